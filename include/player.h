@@ -1,10 +1,51 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
-#include <melody_factory.h>
+#include <Arduino.h>
 
 #include "pitches.h"
+#include "rtttl.h"
 
-Melody getTrackPath(String type, const char track[]);
+#define MELODY_CACHE_SLOTS 12
+#define MELODY_CACHE_RAM_BUDGET 1024 // bytes of packed notes kept in RAM (2 bytes per note)
+#define MELODY_NAME_MAX_LENGTH 15
+#define MELODY_FALLBACK "entertainer" // played when a custom ringtone can't be parsed
+
+/*
+  Melodies by name. The melodies of the .rtttl files in data/ are built into the firmware as flash tables (see
+  scripts/embed_melodies.py) and played without any filesystem access.
+  Other names are custom tunes uploaded to SPIFFS as "/<name>.rtttl", they are parsed on first use (or by preload())
+  into packed notes (see rtttl.h) and cached. When the budget is exceeded the least recently used custom tune is dropped
+  and parsed again on its next use.
+*/
+class MelodyCache {
+  private:
+    struct Entry {
+      char name[MELODY_NAME_MAX_LENGTH + 1];
+      const char *rtttl;   // inline RTTTL string, nullptr for files in SPIFFS
+      RtttlNote *notes;    // nullptr when evicted or invalid
+      uint16_t count;
+      uint16_t bpm;
+      uint32_t lastUsed;
+    };
+    Entry entries[MELODY_CACHE_SLOTS] = {};
+    int entryCount = 0;
+    size_t usedBytes = 0;
+    uint32_t useCounter = 0;
+
+    Entry* find(const char *name);
+    bool load(Entry &entry);
+    void unload(Entry &entry);
+    void evictFor(size_t bytes, const Entry *keep);
+
+  public:
+    static const RtttlMelody* findEmbedded(const char *name);
+
+    // registers a custom tune from "/<name>.rtttl" or from an inline RTTTL string and parses it
+    bool preload(const char *name, const char *rtttl = nullptr);
+    // the notes of custom tunes stay valid until the next call, count is 0 if there is nothing to play
+    RtttlMelody get(const char *name);
+    size_t getUsedBytes();
+};
 
 #endif
@@ -0,0 +1,277 @@
+#ifndef RTTTL_H
+#define RTTTL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pitches.h"
+
+/*
+  Streaming RTTTL parser without heap allocation. It reads from any source with peek()/read() (a const char* or a
+  file stream) and emits packed 2 byte notes. Everything is constexpr, so built-in tunes can be parsed at compile time
+  into flash tables (see rtttlParseTable()).
+
+  Packed note: bits 0..6 index into rtttlPitchTable (0 = pause), bit 7 dotted, bits 8..13 duration - 1 (the note is
+  1/duration of a whole note). Besides the usual 1, 2, 4 ... 32 any duration up to RTTTL_MAX_DURATION is accepted,
+  some tunes use e.g. 3 for a third of a whole note.
+*/
+
+#define RTTTL_PITCH_COUNT 90 // NOTE_SILENT, NOTE_B0 .. NOTE_DS8 from pitches.h
+#define RTTTL_MAX_DURATION 64
+
+constexpr uint16_t rtttlPitchTable[RTTTL_PITCH_COUNT] = {
+  NOTE_SILENT, NOTE_B0, NOTE_C1, NOTE_CS1, NOTE_D1, NOTE_DS1, NOTE_E1, NOTE_F1,
+  NOTE_FS1, NOTE_G1, NOTE_GS1, NOTE_A1, NOTE_AS1, NOTE_B1, NOTE_C2, NOTE_CS2,
+  NOTE_D2, NOTE_DS2, NOTE_E2, NOTE_F2, NOTE_FS2, NOTE_G2, NOTE_GS2, NOTE_A2,
+  NOTE_AS2, NOTE_B2, NOTE_C3, NOTE_CS3, NOTE_D3, NOTE_DS3, NOTE_E3, NOTE_F3,
+  NOTE_FS3, NOTE_G3, NOTE_GS3, NOTE_A3, NOTE_AS3, NOTE_B3, NOTE_C4, NOTE_CS4,
+  NOTE_D4, NOTE_DS4, NOTE_E4, NOTE_F4, NOTE_FS4, NOTE_G4, NOTE_GS4, NOTE_A4,
+  NOTE_AS4, NOTE_B4, NOTE_C5, NOTE_CS5, NOTE_D5, NOTE_DS5, NOTE_E5, NOTE_F5,
+  NOTE_FS5, NOTE_G5, NOTE_GS5, NOTE_A5, NOTE_AS5, NOTE_B5, NOTE_C6, NOTE_CS6,
+  NOTE_D6, NOTE_DS6, NOTE_E6, NOTE_F6, NOTE_FS6, NOTE_G6, NOTE_GS6, NOTE_A6,
+  NOTE_AS6, NOTE_B6, NOTE_C7, NOTE_CS7, NOTE_D7, NOTE_DS7, NOTE_E7, NOTE_F7,
+  NOTE_FS7, NOTE_G7, NOTE_GS7, NOTE_A7, NOTE_AS7, NOTE_B7, NOTE_C8, NOTE_CS8,
+  NOTE_D8, NOTE_DS8,
+};
+
+struct RtttlNote {
+  uint16_t bits;
+
+  // duration 1..RTTTL_MAX_DURATION
+  static constexpr RtttlNote make(uint8_t pitchIndex, uint8_t duration, bool dotted) {
+    return RtttlNote{ (uint16_t)((pitchIndex & 0x7F) | (dotted ? 0x80 : 0) | (((duration - 1) & 0x3F) << 8)) };
+  }
+  constexpr uint8_t pitchIndex() const { return bits & 0x7F; }
+  constexpr uint8_t duration() const { return ((bits >> 8) & 0x3F) + 1; }
+  constexpr bool dotted() const { return (bits & 0x80) != 0; }
+  constexpr bool isPause() const { return pitchIndex() == 0; }
+  constexpr uint16_t frequency() const { return rtttlPitchTable[pitchIndex()]; }
+  // length of the note for the given length of a whole note
+  constexpr uint32_t durationMicros(uint32_t wholeNoteMicros) const {
+    return dotted() ? (wholeNoteMicros / duration()) * 3 / 2 : wholeNoteMicros / duration();
+  }
+  constexpr uint32_t durationMs(uint16_t bpm) const {
+    return durationMicros(240000000ul / bpm) / 1000; // a beat is a quarter note
+  }
+};
+
+// source for RTTTL text in memory (or flash)
+struct RtttlStringSource {
+  const char *text;
+  size_t pos;
+
+  constexpr explicit RtttlStringSource(const char *rtttl) : text(rtttl), pos(0) {}
+  constexpr int peek() const { return text[pos] != 0 ? (unsigned char)text[pos] : -1; }
+  constexpr int read() {
+    int c = peek();
+    if (c >= 0)
+      pos++;
+    return c;
+  }
+};
+
+template<typename Source>
+class RtttlParser {
+  private:
+    Source source;
+    uint8_t defaultDuration = 4; // quarter note
+    uint8_t defaultOctave = 6;
+    uint16_t bpm = 63;
+    bool error = false;
+
+    constexpr void skipSpaces() {
+      while (source.peek() == ' ' || source.peek() == '\r' || source.peek() == '\n' || source.peek() == '\t')
+        source.read();
+    }
+
+    constexpr bool isDigit(int c) const { return c >= '0' && c <= '9'; }
+
+    constexpr uint16_t readNumber() {
+      uint16_t number = 0;
+      while (isDigit(source.peek()))
+        number = number * 10 + (source.read() - '0');
+      return number;
+    }
+
+    static constexpr bool isValidDuration(uint16_t duration) {
+      return duration >= 1 && duration <= RTTTL_MAX_DURATION;
+    }
+
+  public:
+    constexpr explicit RtttlParser(Source rtttlSource) : source(rtttlSource) {}
+
+    // skips the name and reads the defaults section "d=4,o=5,b=140:", the name is copied to name if given
+    constexpr bool parseHeader(char *name = nullptr, size_t nameSize = 0) {
+      size_t nameLength = 0;
+      while (source.peek() >= 0 && source.peek() != ':') {
+        int c = source.read();
+        if (name != nullptr && nameLength + 1 < nameSize)
+          name[nameLength++] = (char)c;
+      }
+      if (name != nullptr && nameSize > 0)
+        name[nameLength] = 0;
+      if (source.read() != ':')
+        return !(error = true);
+
+      for (;;) {
+        skipSpaces();
+        int key = source.read();
+        skipSpaces();
+        if (key == ':')
+          return true; // empty defaults section
+        if (source.read() != '=')
+          return !(error = true);
+        skipSpaces();
+        uint16_t value = readNumber();
+        switch (key) {
+          case 'd':
+            if (!isValidDuration(value))
+              return !(error = true);
+            defaultDuration = value;
+            break;
+          case 'o':
+            if (value < 1 || value > 8)
+              return !(error = true);
+            defaultOctave = value;
+            break;
+          case 'b':
+            if (value == 0)
+              return !(error = true);
+            bpm = value;
+            break;
+          default:
+            return !(error = true);
+        }
+        skipSpaces();
+        int separator = source.read();
+        if (separator == ':')
+          return true;
+        if (separator != ',')
+          return !(error = true);
+      }
+    }
+
+    // reads the next note, returns false at the end of the melody or on a syntax error (see hasError())
+    constexpr bool next(RtttlNote &note) {
+      skipSpaces();
+      if (source.peek() < 0 || error)
+        return false;
+
+      uint8_t duration = defaultDuration;
+      if (isDigit(source.peek())) {
+        uint16_t value = readNumber();
+        if (!isValidDuration(value))
+          return !(error = true);
+        duration = value;
+      }
+
+      int semitone = -1;
+      switch (source.read()) {
+        case 'c': case 'C': semitone = 0; break;
+        case 'd': case 'D': semitone = 2; break;
+        case 'e': case 'E': semitone = 4; break;
+        case 'f': case 'F': semitone = 5; break;
+        case 'g': case 'G': semitone = 7; break;
+        case 'a': case 'A': semitone = 9; break;
+        case 'b': case 'B': semitone = 11; break;
+        case 'h': case 'H': semitone = 11; break; // german notation
+        case 'p': case 'P': semitone = -2; break; // pause
+        default:
+          return !(error = true);
+      }
+      if (source.peek() == '#' || source.peek() == '_') { // '_' is used by some RTTTL files for sharp
+        source.read();
+        semitone++;
+      }
+
+      // the dot is allowed before and after the octave
+      bool dotted = false;
+      if (source.peek() == '.') {
+        source.read();
+        dotted = true;
+      }
+      uint8_t octave = defaultOctave;
+      if (isDigit(source.peek()))
+        octave = source.read() - '0';
+      if (source.peek() == '.') {
+        source.read();
+        dotted = true;
+      }
+
+      uint8_t pitchIndex = 0;
+      if (semitone != -2) {
+        int index = octave * 12 + semitone - 10; // NOTE_B0 is index 1
+        if (index < 1 || index >= RTTTL_PITCH_COUNT)
+          return !(error = true);
+        pitchIndex = index;
+      }
+
+      skipSpaces();
+      if (source.peek() == ',')
+        source.read();
+      else if (source.peek() >= 0)
+        return !(error = true);
+
+      note = RtttlNote::make(pitchIndex, duration, dotted);
+      return true;
+    }
+
+    constexpr bool hasError() const { return error; }
+    constexpr uint16_t getBpm() const { return bpm; }
+};
+
+// number of notes of a melody, 0 on syntax errors
+constexpr size_t rtttlCountNotes(const char *rtttl) {
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{rtttl});
+  if (!parser.parseHeader())
+    return 0;
+  RtttlNote note{};
+  size_t count = 0;
+  while (parser.next(note))
+    count++;
+  return parser.hasError() ? 0 : count;
+}
+
+template<size_t N>
+struct RtttlTable {
+  RtttlNote notes[N];
+  uint16_t count;
+  uint16_t bpm;
+  bool ok;
+};
+
+// parses a melody at compile time: constexpr auto table = rtttlParseTable<rtttlCountNotes(text)>(text);
+template<size_t N>
+constexpr RtttlTable<N> rtttlParseTable(const char *rtttl) {
+  RtttlTable<N> table{};
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{rtttl});
+  table.ok = parser.parseHeader();
+  table.bpm = parser.getBpm();
+  RtttlNote note{};
+  while (table.ok && table.count < N && parser.next(note))
+    table.notes[table.count++] = note;
+  table.ok = table.ok && !parser.hasError() && table.count == N && !parser.next(note);
+  return table;
+}
+
+// compares a parsed table with the packed notes expected for it, used by the static_asserts of embedded_melodies.h
+template<size_t N>
+constexpr bool rtttlTableMatches(const RtttlTable<N> &table, const uint16_t (&expected)[N], uint16_t bpm) {
+  if (!table.ok || table.count != N || table.bpm != bpm)
+    return false;
+  for (size_t i = 0; i < N; i++) {
+    if (table.notes[i].bits != expected[i])
+      return false;
+  }
+  return true;
+}
+
+// a melody stored in flash, see scripts/embed_melodies.py
+struct RtttlMelody {
+  const char *name;
+  const RtttlNote *notes;
+  uint16_t count;
+  uint16_t bpm;
+};
+
+#endif
@@ -0,0 +1,154 @@
+# Converts data/*.rtttl into constexpr note tables (embedded_melodies.h) that are linked into flash, so the built-in
+# melodies are played without reading SPIFFS.
+#
+# The tables are parsed at compile time by the parser in include/rtttl.h. This script parses the files a second time
+# on its own and writes the expected packed notes next to them, the generated static_asserts fail the build when both
+# disagree.
+#
+# Used as a PlatformIO pre script (extra_scripts in platformio.ini), or standalone:
+#   python scripts/embed_melodies.py <output dir>
+
+import os
+import re
+import sys
+
+HEADER_NAME = "embedded_melodies.h"
+MAX_DURATION = 64  # RTTTL_MAX_DURATION
+SEMITONES = {"c": 0, "d": 2, "e": 4, "f": 5, "g": 7, "a": 9, "b": 11, "h": 11}
+PITCH_COUNT = 90  # RTTTL_PITCH_COUNT
+NOTE_PATTERN = re.compile(r"^(\d*)([a-hp])([#_]?)(\.?)(\d?)(\.?)$")
+
+
+class RtttlError(Exception):
+    pass
+
+
+def parse_rtttl(text):
+    """Returns (bpm, packed notes) using the packed note layout of rtttl.h."""
+    parts = text.strip().split(":")
+    if len(parts) != 3:
+        raise RtttlError("expected name:defaults:notes")
+
+    default_duration, octave, bpm = 4, 6, 63
+    for setting in filter(None, (s.strip() for s in parts[1].split(","))):
+        key, _, value = (s.strip() for s in setting.partition("="))
+        if not value.isdigit():
+            raise RtttlError("bad default '%s'" % setting)
+        value = int(value)
+        if key == "d" and 1 <= value <= MAX_DURATION:
+            default_duration = value
+        elif key == "o" and 1 <= value <= 8:
+            octave = value
+        elif key == "b" and value > 0:
+            bpm = value
+        else:
+            raise RtttlError("bad default '%s'" % setting)
+
+    notes = []
+    body = re.sub(r"\s", "", parts[2])
+    for token in body.split(",") if body else []:
+        match = NOTE_PATTERN.match(token.lower())
+        if not match:
+            raise RtttlError("bad note '%s'" % token)
+        duration, letter, sharp, dot1, note_octave, dot2 = match.groups()
+
+        note_duration = int(duration) if duration else default_duration
+        if not 1 <= note_duration <= MAX_DURATION:
+            raise RtttlError("bad duration in '%s'" % token)
+
+        pitch = 0
+        if letter != "p":
+            index = int(note_octave or octave) * 12 + SEMITONES[letter] + (1 if sharp else 0) - 10
+            if not 1 <= index < PITCH_COUNT:
+                raise RtttlError("pitch out of range in '%s'" % token)
+            pitch = index
+
+        dotted = bool(dot1 or dot2)
+        notes.append(pitch | (0x80 if dotted else 0) | ((note_duration - 1) << 8))
+    return bpm, notes
+
+
+def identifier(name):
+    words = re.split(r"[^0-9a-zA-Z]+", name)
+    result = words[0] + "".join(w[:1].upper() + w[1:] for w in words[1:])
+    return result if not result[:1].isdigit() else "melody" + result
+
+
+def cpp_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def generate(data_dir):
+    melodies = []
+    for file_name in sorted(os.listdir(data_dir)):
+        if not file_name.endswith(".rtttl"):
+            continue
+        name = file_name[:-len(".rtttl")]
+        with open(os.path.join(data_dir, file_name)) as f:
+            text = f.read().strip()
+        try:
+            bpm, notes = parse_rtttl(text)
+        except RtttlError as e:
+            raise RtttlError("%s: %s" % (file_name, e))
+        melodies.append((name, identifier(name), text, bpm, notes))
+
+    lines = [
+        "// Generated by scripts/embed_melodies.py from data/*.rtttl, do not edit.",
+        "#ifndef EMBEDDED_MELODIES_H",
+        "#define EMBEDDED_MELODIES_H",
+        "",
+        '#include "rtttl.h"',
+        "",
+        "namespace embedded {",
+    ]
+    for name, ident, text, bpm, notes in melodies:
+        expected = ", ".join("0x%04x" % n for n in notes)
+        lines += [
+            "",
+            "constexpr char %sText[] = %s;" % (ident, cpp_string(text)),
+            "constexpr auto %s = rtttlParseTable<%d>(%sText);" % (ident, len(notes), ident),
+            "constexpr uint16_t %sExpected[] = {%s};" % (ident, expected),
+            'static_assert(rtttlTableMatches(%s, %sExpected, %d), "data/%s.rtttl: parsed table doesn\'t match the source");'
+            % (ident, ident, bpm, name),
+        ]
+    lines += [
+        "",
+        "} // namespace embedded",
+        "",
+        "#define EMBEDDED_MELODY_COUNT %d" % len(melodies),
+        "",
+        "constexpr RtttlMelody embeddedMelodies[EMBEDDED_MELODY_COUNT] = {",
+    ]
+    for name, ident, _, _, _ in melodies:
+        lines.append('  {"%s", embedded::%s.notes, embedded::%s.count, embedded::%s.bpm},' % (name, ident, ident, ident))
+    lines += ["};", "", "#endif", ""]
+    return "\n".join(lines)
+
+
+def write_header(data_dir, output_dir):
+    content = generate(data_dir)
+    path = os.path.join(output_dir, HEADER_NAME)
+    if os.path.isfile(path):
+        with open(path) as f:
+            if f.read() == content:
+                return path  # unchanged, don't trigger a rebuild
+    if not os.path.isdir(output_dir):
+        os.makedirs(output_dir)
+    with open(path, "w") as f:
+        f.write(content)
+    return path
+
+
+if __name__ == "__main__":
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    print(write_header(os.path.join(project_dir, "data"), sys.argv[1] if len(sys.argv) > 1 else "."))
+else:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+
+    output_dir = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    try:
+        write_header(env.subst("$PROJECT_DATA_DIR"), output_dir)  # noqa: F821
+    except RtttlError as e:
+        sys.stderr.write("Error: %s\n" % e)
+        env.Exit(1)  # noqa: F821
+    env.Append(CPPPATH=[output_dir])  # noqa: F821
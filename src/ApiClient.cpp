@@ -0,0 +1,228 @@
+#include "ApiClient.h"
+#include <ArduinoJson.h>
+
+bool ApiClient::begin(const String &apiBaseUrl, EventJournal *eventJournal) {
+  baseUrl = apiBaseUrl;
+  journal = eventJournal;
+  http.setReuse(true); // keep-alive, the connection stays open between requests to the same host
+
+  requestQueue = xQueueCreate(API_REQUEST_QUEUE_LENGTH, sizeof(ApiRequest));
+  responseQueue = xQueueCreate(API_RESPONSE_QUEUE_LENGTH, sizeof(ApiResponse));
+  if (requestQueue == nullptr || responseQueue == nullptr) {
+    Serial.println("API client: could not create queues");
+    return false;
+  }
+
+  if (xTaskCreatePinnedToCore(taskMain, "api", API_TASK_STACK_SIZE, this, API_TASK_PRIORITY, &taskHandle, API_TASK_CORE) != pdPASS) {
+    Serial.println("API client: could not create task");
+    taskHandle = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void ApiClient::taskMain(void *parameter) {
+  static_cast<ApiClient*>(parameter)->run();
+}
+
+void ApiClient::run() {
+  for (;;) {
+    ApiRequest request;
+    if (xQueueReceive(requestQueue, &request, pdMS_TO_TICKS(API_JOURNAL_FLUSH_INTERVAL_MS)) != pdTRUE) {
+      busy = true;
+      flushJournal();
+      busy = false;
+      continue;
+    }
+    busy = true;
+
+    ApiResponse response;
+    response.type = request.type;
+    response.fingerId = request.fingerId;
+    response.callback = request.callback;
+    execute(request, response);
+    response.latencyMillis = millis() - request.submittedMillis;
+
+    if (response.callback != nullptr && xQueueSend(responseQueue, &response, pdMS_TO_TICKS(100)) != pdTRUE)
+      Serial.println("API client: response queue full, response dropped");
+    busy = false;
+  }
+}
+
+void ApiClient::execute(const ApiRequest &request, ApiResponse &response) {
+  if (WiFi.status() != WL_CONNECTED) {
+    response.httpCode = HTTPC_ERROR_NOT_CONNECTED;
+    response.result = UserLookupResult::failed;
+    return;
+  }
+
+  http.setConnectTimeout(request.timeoutMs);
+  http.setTimeout(request.timeoutMs);
+
+  switch (request.type) {
+    case ApiRequestType::getUser:
+      http.begin(client, baseUrl + "/users/fingerprint/" + String(request.fingerId));
+      http.addHeader("Content-Type", "application/json");
+      response.httpCode = http.GET();
+      break;
+  }
+
+  if (response.httpCode > 0) {
+    String body = http.getString(); // always consume the body, otherwise the connection can't be reused
+    Serial.print("API response "); Serial.print(response.httpCode); Serial.print(" for finger #"); Serial.println(request.fingerId);
+    response.result = parseUserLookup(response.httpCode, body);
+  } else {
+    Serial.print("Error on sending API request: "); Serial.println(http.errorToString(response.httpCode));
+    response.result = UserLookupResult::failed;
+  }
+
+  http.end(); // keeps the tcp connection open when it can be reused
+}
+
+// a 2xx answer only says the user exists, users are created with isAuthorized false (see uploadCreateUser())
+UserLookupResult ApiClient::parseUserLookup(int httpCode, const String &body) {
+  if (httpCode < 200 || httpCode >= 300)
+    return httpCode > 0 ? UserLookupResult::unknown : UserLookupResult::failed;
+
+  // the user object or a list with the user as first element, everything but isAuthorized is filtered out
+  bool isList = body.length() > 0 && body[0] == '[';
+  StaticJsonDocument<JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(1)> filter;
+  if (isList)
+    filter[0]["isAuthorized"] = true;
+  else
+    filter["isAuthorized"] = true;
+  StaticJsonDocument<JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(1)> doc;
+  if (deserializeJson(doc, body, DeserializationOption::Filter(filter)) != DeserializationError::Ok)
+    return UserLookupResult::failed;
+
+  JsonVariant user = isList ? doc[0] : doc.as<JsonVariant>();
+  if (user.isNull())
+    return isList ? UserLookupResult::unknown : UserLookupResult::failed; // an empty list: no user for this finger
+  return user["isAuthorized"] == true ? UserLookupResult::authorized : UserLookupResult::denied;
+}
+
+bool ApiClient::submit(const ApiRequest &request) {
+  if (requestQueue == nullptr)
+    return false;
+  return xQueueSend(requestQueue, &request, 0) == pdTRUE;
+}
+
+bool ApiClient::lookupUser(uint16_t fingerId, ApiCallback callback, uint16_t timeoutMs) {
+  ApiRequest request;
+  request.type = ApiRequestType::getUser;
+  request.fingerId = fingerId;
+  request.timeoutMs = timeoutMs;
+  request.submittedMillis = millis();
+  request.callback = callback;
+  return submit(request);
+}
+
+// uploads pending journal records in order until the journal is empty or the backend fails
+void ApiClient::flushJournal() {
+  if (journal == nullptr || WiFi.status() != WL_CONNECTED)
+    return;
+
+  JournalRecord records[API_JOURNAL_BATCH_SIZE];
+  size_t count;
+  while ((count = journal->readPending(records, API_JOURNAL_BATCH_SIZE)) > 0) {
+    if (records[0].type == (uint8_t)JournalRecordType::createUser) {
+      if (records[0].sequence > createdAheadSequence && !uploadCreateUser(records[0]))
+        return;
+      journal->commit(1);
+      continue;
+    }
+
+    // consecutive access events are sent as one batch
+    size_t batchSize = 0;
+    while (batchSize < count && records[batchSize].type == (uint8_t)JournalRecordType::accessEvent)
+      batchSize++;
+    if (!uploadAccessEvents(records, batchSize)) {
+      uploadCreateUsersAhead(&records[batchSize], count - batchSize);
+      return;
+    }
+    journal->commit(batchSize);
+
+    // new lookups have priority over the upload
+    if (uxQueueMessagesWaiting(requestQueue) > 0)
+      return;
+  }
+}
+
+// a new user is not kept waiting by access events the backend doesn't take right now: the user records read behind them
+// are sent once, and skipped when the journal reaches them
+void ApiClient::uploadCreateUsersAhead(const JournalRecord *records, size_t count) {
+  for (size_t i=0; i<count; i++) {
+    if (records[i].type != (uint8_t)JournalRecordType::createUser || records[i].sequence <= createdAheadSequence)
+      continue;
+    if (!uploadCreateUser(records[i]))
+      return;
+    createdAheadSequence = records[i].sequence;
+  }
+}
+
+bool ApiClient::uploadCreateUser(const JournalRecord &record) {
+  http.setConnectTimeout(API_DEFAULT_TIMEOUT_MS);
+  http.setTimeout(API_DEFAULT_TIMEOUT_MS);
+  http.begin(client, baseUrl + "/users");
+  http.addHeader("Content-Type", "application/json");
+  int httpCode = http.POST("{ \"fingerprint\": " + String(record.fingerId) + ", \"lastname\": \"azert\", \"firstname\": \"azert\", \"isAuthorized\": false }");
+  if (httpCode > 0)
+    http.getString();
+  http.end();
+
+  Serial.print("Create user for finger #"); Serial.print(record.fingerId); Serial.print(": "); Serial.println(httpCode);
+  // a 4xx answer will not change on retry (e.g. user already exists), so only transport and server errors keep the record
+  return httpCode > 0 && httpCode < 500;
+}
+
+bool ApiClient::uploadAccessEvents(const JournalRecord *records, size_t count) {
+  String body;
+  body.reserve(40 + count * 110);
+  body = "{ \"events\": [";
+  for (size_t i=0; i<count; i++) {
+    if (i > 0)
+      body += ",";
+    body += "{ \"sequence\": " + String(records[i].sequence);
+    body += ", \"fingerprint\": " + String(records[i].fingerId);
+    body += ", \"granted\": " + String(records[i].granted ? "true" : "false");
+    body += ", \"source\": " + String(records[i].source);
+    body += ", \"timestamp\": " + String(records[i].timestamp);
+    body += ", \"uptime\": " + String(records[i].uptimeMillis) + " }";
+  }
+  body += "] }";
+
+  http.setConnectTimeout(API_DEFAULT_TIMEOUT_MS);
+  http.setTimeout(API_DEFAULT_TIMEOUT_MS);
+  http.begin(client, baseUrl + "/events/batch");
+  http.addHeader("Content-Type", "application/json");
+  int httpCode = http.POST(body);
+  if (httpCode > 0)
+    http.getString();
+  http.end();
+
+  Serial.print("Uploaded "); Serial.print(count); Serial.print(" access events: "); Serial.println(httpCode);
+  // like a user creation, a 4xx answer (e.g. no batch endpoint) will not change on retry and would block the journal
+  if (httpCode >= 400 && httpCode < 500) {
+    Serial.print("Access events #"); Serial.print(records[0].sequence); Serial.print("-"); Serial.print(records[count - 1].sequence);
+    Serial.println(" rejected by the backend, dropped");
+    return true;
+  }
+  return httpCode >= 200 && httpCode < 300;
+}
+
+bool ApiClient::isIdle() {
+  if (requestQueue == nullptr)
+    return true;
+  return !busy && uxQueueMessagesWaiting(requestQueue) == 0 && uxQueueMessagesWaiting(responseQueue) == 0;
+}
+
+void ApiClient::poll() {
+  if (responseQueue == nullptr)
+    return;
+
+  ApiResponse response;
+  while (xQueueReceive(responseQueue, &response, 0) == pdTRUE) {
+    if (response.callback != nullptr)
+      response.callback(response);
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef APICLIENT_H
+#define APICLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include "EventJournal.h"
+
+#define API_TASK_CORE 1
+#define API_TASK_PRIORITY 1
+#define API_TASK_STACK_SIZE 8192
+#define API_REQUEST_QUEUE_LENGTH 8
+#define API_RESPONSE_QUEUE_LENGTH 8
+#define API_DEFAULT_TIMEOUT_MS 2000
+#define API_JOURNAL_FLUSH_INTERVAL_MS 5000 // upload pending journal records when idle for this time
+#define API_JOURNAL_BATCH_SIZE 16
+
+/*
+  Background worker for the user API. Requests are queued and executed one after another on a kept-alive connection,
+  responses are handed back to loop() by poll() which invokes the callback of the request.
+  When idle, the worker uploads the pending records of the event journal in batches.
+*/
+
+enum class ApiRequestType { getUser };
+// authorized only if the backend says so (isAuthorized == true), denied for a known user without access, unknown for
+// a finger without user (4xx), failed if the backend couldn't be asked or the answer was unreadable
+enum class UserLookupResult { authorized, denied, unknown, failed };
+
+struct ApiResponse;
+typedef void (*ApiCallback)(const ApiResponse &response);
+
+struct ApiRequest {
+  ApiRequestType type;
+  uint16_t fingerId = 0;
+  uint16_t timeoutMs = API_DEFAULT_TIMEOUT_MS;
+  unsigned long submittedMillis = 0;
+  ApiCallback callback = nullptr;
+};
+
+struct ApiResponse {
+  ApiRequestType type;
+  uint16_t fingerId = 0;
+  int httpCode = 0;
+  UserLookupResult result = UserLookupResult::failed;
+  unsigned long latencyMillis = 0; // from submit until the response was received
+  ApiCallback callback = nullptr;
+};
+
+class ApiClient {
+  private:
+    String baseUrl;
+    WiFiClient client;
+    HTTPClient http;
+    QueueHandle_t requestQueue = nullptr;
+    QueueHandle_t responseQueue = nullptr;
+    TaskHandle_t taskHandle = nullptr;
+    EventJournal *journal = nullptr;
+    volatile bool busy = false;
+    uint32_t createdAheadSequence = 0; // user creations up to this journal sequence were sent ahead of access events
+
+    static void taskMain(void *parameter);
+    void run();
+    void execute(const ApiRequest &request, ApiResponse &response);
+    bool submit(const ApiRequest &request);
+    void flushJournal();
+    bool uploadCreateUser(const JournalRecord &record);
+    void uploadCreateUsersAhead(const JournalRecord *records, size_t count);
+    bool uploadAccessEvents(const JournalRecord *records, size_t count);
+
+  public:
+    bool begin(const String &apiBaseUrl, EventJournal *eventJournal);
+
+    // non-blocking, returns false if the request queue is full
+    bool lookupUser(uint16_t fingerId, ApiCallback callback, uint16_t timeoutMs = API_DEFAULT_TIMEOUT_MS);
+
+    // called by loop(), invokes the callbacks of finished requests
+    void poll();
+    bool isIdle(); // no request queued or in progress
+
+    static UserLookupResult parseUserLookup(int httpCode, const String &body);
+};
+
+#endif
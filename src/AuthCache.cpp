@@ -0,0 +1,174 @@
+#include "AuthCache.h"
+#include "TimeService.h"
+#include <Preferences.h>
+
+/*
+  The age of an entry must survive a reboot, otherwise an entry loaded from NVS could be used forever. Two sources are
+  persisted: the age in seconds (saved hourly, so the time since the last save is counted as one full interval) and
+  the wall clock time of the answer. The persisted age doesn't include the time the device was off, the wall clock
+  does once SNTP has synced, the larger of both is used.
+*/
+uint32_t AuthCache::getAgeSeconds(const Entry &entry) {
+  uint32_t age = (millis() - entry.fetchedMillis) / 1000ul;
+  if (entry.loadedFromPrefs)
+    age += entry.restoredAgeSeconds;
+  uint32_t now = timeService.now();
+  if (entry.fetchedUnix != 0 && now != 0)
+    age = max(age, now >= entry.fetchedUnix ? now - entry.fetchedUnix : UINT32_MAX); // clock went backwards: unknown
+  return age;
+}
+
+AuthLookup AuthCache::lookup(uint16_t fingerId, AuthState &state) {
+  state = AuthState::none;
+  if (fingerId == 0 || fingerId >= AUTH_CACHE_SIZE) {
+    stats.misses++;
+    return AuthLookup::miss;
+  }
+
+  Entry &entry = entries[fingerId];
+  if (entry.state == AuthState::none) {
+    stats.misses++;
+    return AuthLookup::miss;
+  }
+
+  uint32_t age = getAgeSeconds(entry);
+  unsigned long ttl = (entry.state == AuthState::authorized) ? AUTH_CACHE_TTL_MS : AUTH_CACHE_NEGATIVE_TTL_MS;
+  state = entry.state;
+
+  if (!entry.loadedFromPrefs && (millis() - entry.fetchedMillis) < ttl) {
+    stats.hits++;
+    return AuthLookup::fresh;
+  }
+  if (age < AUTH_CACHE_MAX_STALE_MS / 1000ul) {
+    stats.staleHits++;
+    return AuthLookup::stale;
+  }
+
+  // too old to be trusted anymore
+  entry.state = AuthState::none;
+  state = AuthState::none;
+  stats.misses++;
+  return AuthLookup::miss;
+}
+
+void AuthCache::store(uint16_t fingerId, UserLookupResult result) {
+  if (fingerId == 0 || fingerId >= AUTH_CACHE_SIZE)
+    return;
+
+  Entry &entry = entries[fingerId];
+  entry.refreshPending = false;
+  if (result == UserLookupResult::failed)
+    return; // keep what we have, the API was not reachable
+
+  AuthState newState = (result == UserLookupResult::authorized) ? AuthState::authorized : AuthState::denied;
+  if (newState != entry.state) {
+    if (!dirty)
+      dirtySinceMillis = millis();
+    dirty = true;
+  }
+  entry.state = newState;
+  entry.loadedFromPrefs = false;
+  entry.fetchedMillis = millis();
+  entry.restoredAgeSeconds = 0;
+  entry.fetchedUnix = timeService.now();
+}
+
+bool AuthCache::beginRefresh(uint16_t fingerId) {
+  if (fingerId == 0 || fingerId >= AUTH_CACHE_SIZE)
+    return false;
+  if (entries[fingerId].refreshPending)
+    return false;
+  entries[fingerId].refreshPending = true;
+  stats.refreshes++;
+  return true;
+}
+
+void AuthCache::invalidate(uint16_t fingerId) {
+  if (fingerId == 0 || fingerId >= AUTH_CACHE_SIZE)
+    return;
+  if (entries[fingerId].state != AuthState::none) {
+    if (!dirty)
+      dirtySinceMillis = millis();
+    dirty = true;
+  }
+  entries[fingerId] = Entry();
+}
+
+void AuthCache::clear() {
+  for (int i=0; i<AUTH_CACHE_SIZE; i++)
+    entries[i] = Entry();
+  dirty = true;
+  dirtySinceMillis = millis();
+}
+
+AuthCacheStats AuthCache::getStats() {
+  return stats;
+}
+
+bool AuthCache::loadFromPrefs() {
+  static uint8_t states[AUTH_CACHE_SIZE];
+  static uint32_t ages[AUTH_CACHE_SIZE];
+  static uint32_t fetched[AUTH_CACHE_SIZE];
+  Preferences preferences;
+  if (!preferences.begin("authCache", true))
+    return false;
+  size_t len = preferences.getBytes("states", states, sizeof(states));
+  // entries saved without their age are dropped, their age is unknown
+  bool agesValid = preferences.getBytes("ages", ages, sizeof(ages)) == sizeof(ages) &&
+                   preferences.getBytes("fetched", fetched, sizeof(fetched)) == sizeof(fetched);
+  preferences.end();
+  if (len != sizeof(states) || !agesValid)
+    return false;
+
+  int counter = 0;
+  for (int i=1; i<AUTH_CACHE_SIZE; i++) {
+    if (states[i] == (uint8_t)AuthState::authorized || states[i] == (uint8_t)AuthState::denied) {
+      entries[i].state = (AuthState)states[i];
+      entries[i].loadedFromPrefs = true;
+      entries[i].fetchedMillis = millis();
+      // saturates at the max. stale age, older entries are expired anyway
+      entries[i].restoredAgeSeconds = min(ages[i], (uint32_t)(AUTH_CACHE_MAX_STALE_MS / 1000ul)) + AUTH_CACHE_AGE_SAVE_INTERVAL_MS / 1000ul;
+      entries[i].fetchedUnix = fetched[i];
+      counter++;
+    }
+  }
+  Serial.println(String(counter) + " authorizations loaded from preferences.");
+  return true;
+}
+
+void AuthCache::save() {
+  static uint8_t states[AUTH_CACHE_SIZE];
+  static uint32_t ages[AUTH_CACHE_SIZE];
+  static uint32_t fetched[AUTH_CACHE_SIZE];
+  for (int i=0; i<AUTH_CACHE_SIZE; i++) {
+    states[i] = (uint8_t)entries[i].state;
+    ages[i] = entries[i].state != AuthState::none ? getAgeSeconds(entries[i]) : 0;
+    fetched[i] = entries[i].fetchedUnix;
+  }
+
+  Preferences preferences;
+  if (preferences.begin("authCache", false)) {
+    preferences.putBytes("states", states, sizeof(states));
+    preferences.putBytes("ages", ages, sizeof(ages));
+    preferences.putBytes("fetched", fetched, sizeof(fetched));
+    preferences.end();
+  }
+  lastSaveMillis = millis();
+  dirty = false;
+}
+
+void AuthCache::process() {
+  if (dirty && (millis() - dirtySinceMillis) >= AUTH_CACHE_SAVE_DELAY_MS) {
+    save();
+    return;
+  }
+  if ((millis() - lastSaveMillis) < AUTH_CACHE_AGE_SAVE_INTERVAL_MS)
+    return;
+  for (int i=1; i<AUTH_CACHE_SIZE; i++) {
+    if (entries[i].state != AuthState::none) {
+      save();
+      return;
+    }
+  }
+  lastSaveMillis = millis();
+}
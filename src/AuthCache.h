@@ -0,0 +1,57 @@
+#ifndef AUTHCACHE_H
+#define AUTHCACHE_H
+
+#include <Arduino.h>
+#include "ApiClient.h"
+
+#define AUTH_CACHE_SIZE 201 // finger ids 1..200, like the finger list
+#define AUTH_CACHE_TTL_MS (10ul * 60ul * 1000ul)        // authorized entries are fresh for 10 minutes
+#define AUTH_CACHE_NEGATIVE_TTL_MS (60ul * 1000ul)      // unknown users are asked again after 1 minute
+#define AUTH_CACHE_MAX_STALE_MS (24ul * 3600ul * 1000ul) // stale entries are still used (and refreshed in background) for 24 hours
+#define AUTH_CACHE_SAVE_DELAY_MS 10000                   // coalesce writes to NVS
+#define AUTH_CACHE_AGE_SAVE_INTERVAL_MS (3600ul * 1000ul) // the ages of the entries are persisted hourly
+
+enum class AuthState : uint8_t { none, authorized, denied };
+enum class AuthLookup { miss, fresh, stale };
+
+struct AuthCacheStats {
+  uint32_t hits = 0;
+  uint32_t staleHits = 0;
+  uint32_t misses = 0;
+  uint32_t refreshes = 0;
+};
+
+class AuthCache {
+  private:
+    struct Entry {
+      AuthState state;
+      bool refreshPending;
+      bool loadedFromPrefs; // such entries are stale from the beginning, their age continues from the persisted one
+      unsigned long fetchedMillis; // loaded entries: time of the load
+      uint32_t restoredAgeSeconds; // loaded entries: age when they were saved plus one save interval (worst case)
+      uint32_t fetchedUnix;        // wall clock time of the API answer, 0 if the time was not synced yet
+    };
+    Entry entries[AUTH_CACHE_SIZE] = {};
+    AuthCacheStats stats;
+    bool dirty = false;
+    unsigned long dirtySinceMillis = 0;
+    unsigned long lastSaveMillis = 0;
+
+    uint32_t getAgeSeconds(const Entry &entry);
+    void save();
+
+  public:
+    // returns if and how fresh the cached state for the finger is, the state is written to state
+    AuthLookup lookup(uint16_t fingerId, AuthState &state);
+    void store(uint16_t fingerId, UserLookupResult result);
+    bool beginRefresh(uint16_t fingerId); // false if a refresh is already pending
+    void invalidate(uint16_t fingerId);
+    void clear();
+
+    AuthCacheStats getStats();
+
+    bool loadFromPrefs();
+    void process(); // called by loop(), writes changes to NVS delayed and the ages hourly
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "BootTimeline.h"
+
+BootTimeline bootTimeline;
+
+void BootTimeline::mark(BootStage stage) {
+  if (stageMillis[(int)stage] == 0)
+    stageMillis[(int)stage] = max(millis(), 1ul);
+}
+
+uint32_t BootTimeline::get(BootStage stage) {
+  return stageMillis[(int)stage];
+}
+
+bool BootTimeline::isComplete() {
+  return get(BootStage::doorReady) != 0 && get(BootStage::wifiConnected) != 0;
+}
+
+const char* BootTimeline::getStageName(BootStage stage) {
+  switch (stage) {
+    case BootStage::settingsLoaded:   return "settingsLoaded";
+    case BootStage::wifiStarted:      return "wifiStarted";
+    case BootStage::journalReady:     return "journalReady";
+    case BootStage::servicesStarted:  return "servicesStarted";
+    case BootStage::sensorFound:      return "sensorFound";
+    case BootStage::fingerListLoaded: return "fingerListLoaded";
+    case BootStage::doorReady:        return "doorReady";
+    case BootStage::wifiConnected:    return "wifiConnected";
+    default:                          return "?";
+  }
+}
+
+void BootTimeline::printTo(Print &out) {
+  out.println(F("Boot timeline (ms since reset):"));
+  for (int i=0; i<(int)BootStage::count; i++) {
+    out.print(F("  "));
+    out.print(getStageName((BootStage)i));
+    out.print(F(": "));
+    uint32_t ms = stageMillis[i];
+    if (ms == 0)
+      out.println(F("-"));
+    else
+      out.println(ms);
+  }
+}
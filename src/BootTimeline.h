@@ -0,0 +1,40 @@
+#ifndef BOOTTIMELINE_H
+#define BOOTTIMELINE_H
+
+#include <Arduino.h>
+
+/*
+  Milestones of the boot sequence in ms since reset. setup() only starts the sensor task, WiFi and the network
+  services, they come up concurrently:
+    loop task:   settings -> WiFi started -> journal -> services -> (WiFi connected)
+    sensor task: handshake with retries -> finger list -> door ready
+  Every stage is marked once by one task, later marks of the same stage are ignored.
+*/
+
+enum class BootStage : uint8_t {
+  settingsLoaded,   // WiFi and app settings read from NVS
+  wifiStarted,      // WiFi association started in background
+  journalReady,     // SPIFFS mounted, offline journal loaded
+  servicesStarted,  // web API, event stream and MQTT started
+  sensorFound,      // sensor handshake succeeded
+  fingerListLoaded, // finger names loaded from NVS
+  doorReady,        // sensor task scans, local matches work from now on
+  wifiConnected,    // first WiFi connection
+  count
+};
+
+class BootTimeline {
+  private:
+    volatile uint32_t stageMillis[(int)BootStage::count] = {}; // 0 = not reached yet
+
+  public:
+    void mark(BootStage stage);
+    uint32_t get(BootStage stage);
+    bool isComplete(); // door ready and WiFi connected
+    static const char* getStageName(BootStage stage);
+    void printTo(Print &out);
+};
+
+extern BootTimeline bootTimeline;
+
+#endif
@@ -0,0 +1,108 @@
+#include "Buzzer.h"
+#include "LatencyMetrics.h"
+
+Buzzer::Buzzer(uint8_t buzzerPin) : pin(buzzerPin) {
+}
+
+bool Buzzer::begin() {
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = &Buzzer::onTimer;
+  timerArgs.arg = this;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "buzzer";
+  if (esp_timer_create(&timerArgs, &timer) != ESP_OK)
+    return false;
+
+  ledcSetup(BUZZER_LEDC_CHANNEL, 2000, BUZZER_LEDC_RESOLUTION);
+  ledcAttachPin(pin, BUZZER_LEDC_CHANNEL);
+  ledcWriteTone(BUZZER_LEDC_CHANNEL, 0);
+  return true;
+}
+
+void Buzzer::onTimer(void *arg) {
+  static_cast<Buzzer*>(arg)->step();
+}
+
+// runs in the esp_timer task. play() may have restarted the melody meanwhile, so a step only advances when its deadline
+// is due and otherwise just waits for it.
+void Buzzer::step() {
+  int64_t now = esp_timer_get_time();
+  uint16_t frequency = 0;
+  bool done = false;
+  int64_t late = 0;
+
+  portENTER_CRITICAL(&mux);
+  if (!playing) {
+    portEXIT_CRITICAL(&mux);
+    return;
+  }
+  if (now + BUZZER_EARLY_TOLERANCE_US < nextDeadline) {
+    int64_t wait = nextDeadline - now;
+    portEXIT_CRITICAL(&mux);
+    esp_timer_start_once(timer, wait);
+    return;
+  }
+
+  late = now - nextDeadline;
+  if (gapMicros > 0) {
+    // silence at the end of the note
+    nextDeadline += gapMicros;
+    gapMicros = 0;
+  } else if (position < count) {
+    RtttlNote note = queue[position++];
+    uint32_t length = note.durationMicros(wholeNoteMicros);
+    gapMicros = note.isPause() ? 0 : length * BUZZER_NOTE_GAP_PERCENT / 100;
+    frequency = note.frequency();
+    nextDeadline += length - gapMicros;
+  } else {
+    playing = false;
+    done = true;
+  }
+  int64_t deadline = nextDeadline;
+  portEXIT_CRITICAL(&mux);
+
+  ledcWriteTone(BUZZER_LEDC_CHANNEL, frequency);
+  if (late > 0)
+    latencyMetrics.record(LatencyStage::buzzerLate, (uint32_t)late);
+  if (!done)
+    esp_timer_start_once(timer, max((int64_t)1, deadline - esp_timer_get_time()));
+}
+
+bool Buzzer::play(const RtttlMelody &melody, BuzzerPriority melodyPriority) {
+  if (timer == nullptr || melody.count == 0 || melody.bpm == 0)
+    return false;
+
+  uint16_t notes = min(melody.count, (uint16_t)BUZZER_QUEUE_SIZE);
+  portENTER_CRITICAL(&mux);
+  if (playing && melodyPriority < priority) {
+    portEXIT_CRITICAL(&mux);
+    return false;
+  }
+  memcpy(queue, melody.notes, notes * sizeof(RtttlNote));
+  count = notes;
+  position = 0;
+  gapMicros = 0;
+  wholeNoteMicros = 240000000ul / melody.bpm; // a beat is a quarter note
+  nextDeadline = esp_timer_get_time();
+  priority = melodyPriority;
+  playing = true;
+  portEXIT_CRITICAL(&mux);
+
+  // a step of the preempted melody running right now either picks up the new melody or waits for its deadline
+  esp_timer_stop(timer);
+  esp_timer_start_once(timer, 1);
+  return true;
+}
+
+void Buzzer::stop() {
+  portENTER_CRITICAL(&mux);
+  playing = false;
+  portEXIT_CRITICAL(&mux);
+  if (timer != nullptr)
+    esp_timer_stop(timer);
+  ledcWriteTone(BUZZER_LEDC_CHANNEL, 0);
+}
+
+bool Buzzer::isPlaying() {
+  return playing;
+}
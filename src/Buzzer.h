@@ -0,0 +1,54 @@
+#ifndef BUZZER_H
+#define BUZZER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "rtttl.h"
+
+#define BUZZER_LEDC_CHANNEL 0
+#define BUZZER_LEDC_RESOLUTION 8
+#define BUZZER_QUEUE_SIZE 128 // notes, longer melodies are cut
+#define BUZZER_NOTE_GAP_PERCENT 10 // silence at the end of each note, so repeated notes are heard separately
+#define BUZZER_EARLY_TOLERANCE_US 100 // a step this early is taken as on time
+
+// a melody only interrupts one with the same or a lower priority
+enum class BuzzerPriority : uint8_t {
+  feedback,  // e.g. no match found
+  access,    // access granted or denied
+  alarm
+};
+
+/*
+  Background melody playback. The tone is generated by LEDC, the notes are stepped by a one-shot esp_timer against an
+  absolute schedule, so the timing doesn't depend on the loop or the scan and doesn't drift.
+  The notes are copied into the engine on play(), the caller's melody may be freed afterwards.
+*/
+class Buzzer {
+  private:
+    uint8_t pin;
+    esp_timer_handle_t timer = nullptr;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    RtttlNote queue[BUZZER_QUEUE_SIZE];
+    uint16_t count = 0;
+    uint16_t position = 0;
+    uint32_t wholeNoteMicros = 0; // length of a whole note at the tempo of the melody
+    uint32_t gapMicros = 0;     // silence still to come for the current note
+    int64_t nextDeadline = 0;   // esp_timer time of the next step
+    BuzzerPriority priority = BuzzerPriority::feedback;
+    volatile bool playing = false;
+
+    static void onTimer(void *arg);
+    void step();
+
+  public:
+    Buzzer(uint8_t buzzerPin);
+    bool begin();
+    // returns false if a melody with a higher priority is playing or the melody is empty
+    bool play(const RtttlMelody &melody, BuzzerPriority melodyPriority);
+    void stop();
+    bool isPlaying();
+};
+
+#endif
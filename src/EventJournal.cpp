@@ -0,0 +1,178 @@
+#include "EventJournal.h"
+#include <FS.h>
+#include <SPIFFS.h>
+
+#include "global.h"
+#include "TimeService.h"
+
+uint16_t EventJournal::crc16(const uint8_t *data, size_t length) {
+  // CRC-16/CCITT-FALSE
+  uint16_t crc = 0xFFFF;
+  for (size_t i=0; i<length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit=0; bit<8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc;
+}
+
+bool EventJournal::isValid(const JournalRecord &record) {
+  if (record.magic != JOURNAL_RECORD_MAGIC)
+    return false;
+  JournalRecord copy = record;
+  copy.crc = 0;
+  return crc16((const uint8_t*)&copy, sizeof(copy)) == record.crc;
+}
+
+bool EventJournal::begin() {
+  mutex = xSemaphoreCreateMutex();
+  if (mutex == nullptr || !mountSpiffs())
+    return false;
+
+  File cursorFile = SPIFFS.open(JOURNAL_CURSOR_FILE, FILE_READ);
+  if (cursorFile) {
+    if (cursorFile.read((uint8_t*)&cursor, sizeof(cursor)) != sizeof(cursor) ||
+        cursorFile.read((uint8_t*)&nextSequence, sizeof(nextSequence)) != sizeof(nextSequence)) {
+      cursor = 0;
+      nextSequence = 1;
+    }
+    cursorFile.close();
+  }
+
+  recover();
+  if (cursor > recordCount)
+    cursor = recordCount;
+
+  Serial.println(String(recordCount - cursor) + " journal records pending for upload.");
+  return true;
+}
+
+// counts the valid records, rewrites the file without the broken ones (e.g. a record torn by a reset while appending)
+void EventJournal::recover() {
+  recordCount = 0;
+  File file = SPIFFS.open(JOURNAL_FILE, FILE_READ);
+  if (!file)
+    return;
+
+  bool broken = (file.size() % sizeof(JournalRecord)) != 0;
+  JournalRecord record;
+  while (file.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+    if (isValid(record)) {
+      recordCount++;
+      if (record.sequence >= nextSequence)
+        nextSequence = record.sequence + 1;
+    } else {
+      broken = true;
+    }
+  }
+  file.close();
+
+  if (!broken)
+    return;
+
+  Serial.println("Journal contains broken records, repairing it.");
+  file = SPIFFS.open(JOURNAL_FILE, FILE_READ);
+  File temp = SPIFFS.open(JOURNAL_TEMP_FILE, FILE_WRITE);
+  while (file.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+    if (isValid(record))
+      temp.write((const uint8_t*)&record, sizeof(record));
+  }
+  file.close();
+  temp.close();
+  SPIFFS.remove(JOURNAL_FILE);
+  SPIFFS.rename(JOURNAL_TEMP_FILE, JOURNAL_FILE);
+}
+
+void EventJournal::saveCursor() {
+  File cursorFile = SPIFFS.open(JOURNAL_CURSOR_FILE, FILE_WRITE);
+  if (cursorFile) {
+    cursorFile.write((const uint8_t*)&cursor, sizeof(cursor));
+    cursorFile.write((const uint8_t*)&nextSequence, sizeof(nextSequence)); // sequence numbers continue after the journal was emptied
+    cursorFile.close();
+  }
+}
+
+bool EventJournal::append(JournalRecordType type, uint16_t fingerId, bool granted, AccessSource source) {
+  if (mutex == nullptr)
+    return false;
+
+  JournalRecord record = {};
+  record.magic = JOURNAL_RECORD_MAGIC;
+  record.type = (uint8_t)type;
+  record.fingerId = fingerId;
+  record.granted = granted ? 1 : 0;
+  record.source = (uint8_t)source;
+  record.timestamp = timeService.now();
+  record.uptimeMillis = millis();
+
+  bool ok = false;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (recordCount < JOURNAL_MAX_RECORDS) {
+    record.sequence = nextSequence;
+    record.crc = crc16((const uint8_t*)&record, sizeof(record));
+    File file = SPIFFS.open(JOURNAL_FILE, FILE_APPEND);
+    if (file) {
+      ok = file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+      file.close(); // close after every record, so it is on flash when the door opens
+    }
+    if (ok) {
+      recordCount++;
+      nextSequence++;
+    }
+  }
+  xSemaphoreGive(mutex);
+
+  if (!ok)
+    Serial.println("Journal full or not writable, event lost.");
+  return ok;
+}
+
+bool EventJournal::logAccess(uint16_t fingerId, bool granted, AccessSource source) {
+  return append(JournalRecordType::accessEvent, fingerId, granted, source);
+}
+
+bool EventJournal::logCreateUser(uint16_t fingerId) {
+  return append(JournalRecordType::createUser, fingerId, false, AccessSource::api);
+}
+
+uint32_t EventJournal::pendingCount() {
+  if (mutex == nullptr)
+    return 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  uint32_t count = recordCount - cursor;
+  xSemaphoreGive(mutex);
+  return count;
+}
+
+size_t EventJournal::readPending(JournalRecord *records, size_t maxCount) {
+  if (mutex == nullptr)
+    return 0;
+
+  size_t count = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  File file = SPIFFS.open(JOURNAL_FILE, FILE_READ);
+  if (file && file.seek(cursor * sizeof(JournalRecord))) {
+    while (count < maxCount && file.read((uint8_t*)&records[count], sizeof(JournalRecord)) == sizeof(JournalRecord))
+      count++;
+  }
+  if (file)
+    file.close();
+  xSemaphoreGive(mutex);
+  return count;
+}
+
+void EventJournal::commit(size_t count) {
+  if (mutex == nullptr)
+    return;
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  cursor += count;
+  if (cursor >= recordCount) {
+    // everything uploaded, start over with an empty journal
+    SPIFFS.remove(JOURNAL_FILE);
+    cursor = 0;
+    recordCount = 0;
+  }
+  saveCursor();
+  xSemaphoreGive(mutex);
+}
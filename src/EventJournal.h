@@ -0,0 +1,59 @@
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <Arduino.h>
+
+#define JOURNAL_FILE "/journal.bin"
+#define JOURNAL_CURSOR_FILE "/journal.pos"
+#define JOURNAL_TEMP_FILE "/journal.tmp"
+#define JOURNAL_MAX_RECORDS 2000 // 40 KB on SPIFFS
+#define JOURNAL_RECORD_MAGIC 0xA5
+
+/*
+  Append-only journal of access events and pending API calls on SPIFFS. Records have a fixed size and a CRC, so a record
+  torn by a reset is detected and dropped on next boot. Records are uploaded in batches by the ApiClient worker and removed
+  once everything was sent (at-least-once, the backend can use the sequence number to detect duplicates).
+*/
+
+enum class JournalRecordType : uint8_t { accessEvent = 1, createUser = 2 };
+enum class AccessSource : uint8_t { api, cache, offline, remote };
+
+struct JournalRecord {
+  uint8_t magic;
+  uint8_t type;          // JournalRecordType
+  uint16_t fingerId;
+  uint8_t granted;       // access events only
+  uint8_t source;        // AccessSource, access events only
+  uint16_t crc;          // CRC16 over the whole record with crc = 0
+  uint32_t sequence;
+  uint32_t timestamp;    // unix time, 0 if time was not synced yet
+  uint32_t uptimeMillis;
+};
+
+class EventJournal {
+  private:
+    SemaphoreHandle_t mutex = nullptr;
+    uint32_t recordCount = 0;  // records in file
+    uint32_t cursor = 0;       // records already uploaded
+    uint32_t nextSequence = 1;
+
+    static uint16_t crc16(const uint8_t *data, size_t length);
+    static bool isValid(const JournalRecord &record);
+    void recover();
+    void saveCursor();
+    bool append(JournalRecordType type, uint16_t fingerId, bool granted, AccessSource source);
+
+  public:
+    bool begin();
+
+    bool logAccess(uint16_t fingerId, bool granted, AccessSource source);
+    bool logCreateUser(uint16_t fingerId);
+
+    uint32_t pendingCount();
+    // reads up to maxCount pending records in order, does not remove them
+    size_t readPending(JournalRecord *records, size_t maxCount);
+    // marks the first count pending records as uploaded
+    void commit(size_t count);
+};
+
+#endif
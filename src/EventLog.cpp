@@ -0,0 +1,133 @@
+#include "EventLog.h"
+#include <esp_attr.h>
+
+#include "TimeService.h"
+
+EventLog eventLog;
+
+struct LogRing {
+  uint32_t magic;
+  uint32_t head; // sequence of the next record
+  LogRecord records[EVENT_LOG_SIZE];
+};
+
+// not initialized on reset, only on power-on the content is random
+RTC_NOINIT_ATTR static LogRing ring;
+
+static const char* const logFormats[(int)LogCode::count] = {
+  "Boot (reset reason %d)",                    // boot
+  "Touched",                                   // touched
+  "Imaging error (Code %d)",                   // imagingError
+  "Image too messy",                           // imageMessy
+  "Could not find fingerprint features (Code %d)", // featureFail
+  "Communication error (scan state %d)",       // communicationError
+  "Unknown error (scan state %d, Code %d)",    // unknownError
+  "Did not find a match. (Scan #%d of %d)",    // noMatchPass
+  "Match Found: %d with confidence of %d",     // matchFound
+  "No Match Found (Code %d)",                  // noMatchFound
+  "ScanResult Error (Code %d)",                // scanError
+  "Access granted for finger #%d (source %d)", // accessGranted
+  "Access denied for finger #%d (source %d)",  // accessDenied
+  "User lookup for finger #%d failed (Code %d), access denied.", // userLookupFailed
+};
+
+uint16_t EventLog::checksum(const LogRecord &record) {
+  uint32_t sum = record.sequence ^ record.timestamp ^ record.uptimeMs ^ record.code;
+  for (int i = 0; i < 3; i++)
+    sum = (sum << 5 | sum >> 27) ^ (uint32_t)record.args[i];
+  return (uint16_t)(sum ^ (sum >> 16) ^ 0xA55A);
+}
+
+void EventLog::begin() {
+  bool valid = ring.magic == EVENT_LOG_MAGIC;
+  if (valid) {
+    // after a soft reset the newest record must be intact, otherwise the memory is not from us
+    uint32_t newest = ring.head - 1;
+    const LogRecord &record = ring.records[newest % EVENT_LOG_SIZE];
+    valid = ring.head == 0 || (record.sequence == newest && record.check == checksum(record));
+  }
+  if (!valid) {
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = EVENT_LOG_MAGIC;
+  }
+  echoCursor = ring.head; // records of the previous run are not echoed again
+  log(LogCode::boot, esp_reset_reason());
+}
+
+void EventLog::log(LogCode code, int32_t arg0, int32_t arg1, int32_t arg2) {
+  LogRecord record;
+  record.timestamp = timeService.now();
+  record.uptimeMs = millis();
+  record.code = (uint16_t)code;
+  record.args[0] = arg0;
+  record.args[1] = arg1;
+  record.args[2] = arg2;
+
+  portENTER_CRITICAL(&mux);
+  record.sequence = ring.head;
+  record.check = checksum(record);
+  ring.records[ring.head % EVENT_LOG_SIZE] = record;
+  ring.head++;
+  portEXIT_CRITICAL(&mux);
+}
+
+bool EventLog::read(uint32_t sequence, LogRecord &record) {
+  portENTER_CRITICAL(&mux);
+  record = ring.records[sequence % EVENT_LOG_SIZE];
+  portEXIT_CRITICAL(&mux);
+  // records torn by a reset during the write are skipped
+  return record.sequence == sequence && record.check == checksum(record) && record.code < (uint16_t)LogCode::count;
+}
+
+uint32_t EventLog::getHead() {
+  portENTER_CRITICAL(&mux);
+  uint32_t head = ring.head;
+  portEXIT_CRITICAL(&mux);
+  return head;
+}
+
+uint32_t EventLog::getOldest() {
+  uint32_t head = getHead();
+  return head > EVENT_LOG_SIZE ? head - EVENT_LOG_SIZE : 0;
+}
+
+size_t EventLog::format(const LogRecord &record, char *buffer, size_t size) {
+  if (size < TIME_TIMESTAMP_LENGTH + 4)
+    return 0;
+  int length;
+  if (record.timestamp != 0) {
+    buffer[0] = '[';
+    length = 1 + timeService.format(record.timestamp, buffer + 1, size - 1);
+    length += snprintf(buffer + length, size - length, "]: ");
+  } else {
+    length = snprintf(buffer, size, "[+%u.%03us]: ", record.uptimeMs / 1000, record.uptimeMs % 1000);
+  }
+  if (length < 0 || (size_t)length >= size)
+    return 0;
+  const char *format = record.code < (uint16_t)LogCode::count ? logFormats[record.code] : "Unknown log code";
+  int textLength = snprintf(buffer + length, size - length, format, (int)record.args[0], (int)record.args[1], (int)record.args[2]);
+  return textLength < 0 ? length : min(size - 1, (size_t)(length + textLength));
+}
+
+// called by loop(), the text is built here and not by the task that logged the record
+void EventLog::printNew(Print &out) {
+  uint32_t head = getHead();
+  if (head - echoCursor > EVENT_LOG_SIZE)
+    echoCursor = head - EVENT_LOG_SIZE;
+
+  LogRecord record;
+  char text[EVENT_LOG_TEXT_LENGTH];
+  for (int n = 0; n < EVENT_LOG_ECHO_BURST && echoCursor != head; n++, echoCursor++) {
+    if (read(echoCursor, record) && format(record, text, sizeof(text)) > 0)
+      out.println(text);
+  }
+}
+
+void EventLog::printAll(Print &out) {
+  LogRecord record;
+  char text[EVENT_LOG_TEXT_LENGTH];
+  for (uint32_t sequence = getOldest(); sequence != getHead(); sequence++) {
+    if (read(sequence, record) && format(record, text, sizeof(text)) > 0)
+      out.println(text);
+  }
+}
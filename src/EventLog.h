@@ -0,0 +1,69 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <Arduino.h>
+
+#define EVENT_LOG_SIZE 64           // records, 28 bytes each in RTC slow memory
+#define EVENT_LOG_MAGIC 0x4C4F4731  // "LOG1"
+#define EVENT_LOG_TEXT_LENGTH 96    // max. length of a formatted record
+#define EVENT_LOG_ECHO_BURST 4      // max. records printed to Serial per printNew() call
+
+// the arguments of each code are listed in logFormats (EventLog.cpp)
+enum class LogCode : uint16_t {
+  boot,               // reset reason
+  touched,
+  imagingError,       // return code
+  imageMessy,
+  featureFail,        // return code
+  communicationError, // scan state
+  unknownError,       // scan state, return code
+  noMatchPass,        // scan pass, max. passes
+  matchFound,         // finger id, confidence
+  noMatchFound,       // return code
+  scanError,          // return code
+  accessGranted,      // finger id, AccessSource
+  accessDenied,       // finger id, AccessSource
+  userLookupFailed,   // finger id, http code
+  count
+};
+
+struct LogRecord {
+  uint32_t sequence;
+  uint32_t timestamp;  // unix time, 0 when the time was not synced yet
+  uint32_t uptimeMs;
+  uint16_t code;       // LogCode
+  uint16_t check;      // detects records torn by a reset and garbage after power-on
+  int32_t args[3];
+};
+
+/*
+  Structured log of the hot paths. log() writes a fixed-size binary record (code and up to 3 integer arguments) into a
+  ring in RTC memory, no Strings, no heap, no formatting. The ring survives soft reboots (crash, watchdog, OTA), so the
+  last records before a reset can still be read afterwards.
+  Text is only built when a consumer reads the log: printNew() echoes new records to Serial from loop(), format()
+  is used for /api/logs and the serial monitor.
+*/
+class EventLog {
+  private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t echoCursor = 0;
+
+    static uint16_t checksum(const LogRecord &record);
+
+  public:
+    void begin(); // keeps the records of the previous run if the RTC memory is intact
+    void log(LogCode code, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0);
+
+    // copies the record with the given sequence, false if it is not (or no longer) in the ring
+    bool read(uint32_t sequence, LogRecord &record);
+    uint32_t getHead();   // sequence of the next record
+    uint32_t getOldest(); // sequence of the oldest record in the ring
+
+    static size_t format(const LogRecord &record, char *buffer, size_t size);
+    void printNew(Print &out);
+    void printAll(Print &out);
+};
+
+extern EventLog eventLog;
+
+#endif
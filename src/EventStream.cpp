@@ -0,0 +1,162 @@
+#include "EventStream.h"
+#include <ArduinoJson.h>
+
+#include "TimeService.h"
+
+EventStream eventStream;
+
+EventStream::EventStream() {
+  for (int i = 0; i < EVENT_STREAM_SIZE; i++)
+    slots[i].version.store(0, std::memory_order_relaxed);
+}
+
+void EventStream::begin(AsyncWebServer &server, const char *username, const char *password) {
+  webSocket.setAuthentication(username, password); // checked by the handshake request
+  webSocket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    onWebSocketEvent(client, type);
+  });
+  server.addHandler(&webSocket);
+}
+
+void EventStream::publish(StreamEventType type, uint16_t id, uint16_t value, const char *text) {
+  uint32_t now = timeService.now();
+  uint32_t sequence = head.fetch_add(1, std::memory_order_relaxed);
+  Slot &slot = slots[sequence % EVENT_STREAM_SIZE];
+
+  slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.event.sequence = sequence;
+  slot.event.timestamp = now;
+  slot.event.type = type;
+  slot.event.id = id;
+  slot.event.value = value;
+  strlcpy(slot.event.text, text != nullptr ? text : "", sizeof(slot.event.text));
+  slot.version.store(2 * sequence + 2, std::memory_order_release);
+}
+
+StreamRead EventStream::read(uint32_t sequence, StreamEvent &event) {
+  const Slot &slot = slots[sequence % EVENT_STREAM_SIZE];
+  uint32_t expected = 2 * sequence + 2;
+  uint32_t version = slot.version.load(std::memory_order_acquire);
+  if (version != expected) {
+    // older version: the writer of this sequence has not finished yet, newer version: a later event took the slot
+    return (int32_t)(version - expected) < 0 ? StreamRead::pending : StreamRead::overwritten;
+  }
+  event = slot.event;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  // a version change during the copy can only come from the writer of a newer event
+  return slot.version.load(std::memory_order_relaxed) == version ? StreamRead::ok : StreamRead::overwritten;
+}
+
+uint32_t EventStream::getHead() {
+  return head.load(std::memory_order_acquire);
+}
+
+uint32_t EventStream::getDroppedTotal() {
+  return droppedTotal.load(std::memory_order_relaxed);
+}
+
+void EventStream::onWebSocketEvent(AsyncWebSocketClient *client, AwsEventType type) {
+  if (type != WS_EVT_CONNECT && type != WS_EVT_DISCONNECT)
+    return; // incoming messages are ignored
+
+  bool registered = false;
+  portENTER_CRITICAL(&clientMux);
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+    if (type == WS_EVT_CONNECT && !registered && clients[i].clientId == 0) {
+      // new clients get the recent events first
+      uint32_t currentHead = head.load(std::memory_order_acquire);
+      clients[i].clientId = client->id();
+      clients[i].cursor = currentHead - min(currentHead, (uint32_t)EVENT_STREAM_SIZE);
+      registered = true;
+    } else if (type == WS_EVT_DISCONNECT && clients[i].clientId == client->id()) {
+      clients[i].clientId = 0;
+    }
+  }
+  portEXIT_CRITICAL(&clientMux);
+
+  if (type == WS_EVT_CONNECT && !registered)
+    client->close(1013, "Too many clients");
+}
+
+void EventStream::sendEvent(AsyncWebSocketClient *client, const StreamEvent &event) {
+  StaticJsonDocument<JSON_OBJECT_SIZE(6)> doc;
+  doc["s"] = event.sequence;
+  if (event.timestamp != 0)
+    doc["ts"] = event.timestamp;
+  doc["t"] = getTypeName(event.type);
+  if (event.id != 0)
+    doc["id"] = event.id;
+  if (event.type != StreamEventType::log)
+    doc["v"] = event.value;
+  if (event.text[0] != 0)
+    doc["m"] = (const char*)event.text;
+
+  char buffer[EVENT_STREAM_TEXT_LENGTH * 2 + 64]; // room for escaped text
+  size_t length = serializeJson(doc, buffer, sizeof(buffer));
+  client->text(buffer, length);
+}
+
+void EventStream::sendDropped(AsyncWebSocketClient *client, uint32_t count) {
+  char buffer[40];
+  size_t length = snprintf(buffer, sizeof(buffer), "{\"t\":\"dropped\",\"n\":%u}", count);
+  client->text(buffer, length);
+}
+
+void EventStream::pump() {
+  uint32_t currentHead = head.load(std::memory_order_acquire);
+
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++) {
+    portENTER_CRITICAL(&clientMux);
+    Client entry = clients[i];
+    portEXIT_CRITICAL(&clientMux);
+    if (entry.clientId == 0 || entry.cursor == currentHead)
+      continue;
+
+    AsyncWebSocketClient *client = webSocket.client(entry.clientId);
+    if (client == nullptr || client->status() != WS_CONNECTED)
+      continue;
+
+    // drop-oldest: a client too far behind continues with the oldest event still in the ring
+    uint32_t cursor = entry.cursor;
+    if (currentHead - cursor > EVENT_STREAM_SIZE) {
+      uint32_t dropped = currentHead - cursor - EVENT_STREAM_SIZE;
+      if (client->queueIsFull())
+        continue;
+      sendDropped(client, dropped);
+      droppedTotal.fetch_add(dropped, std::memory_order_relaxed);
+      cursor = currentHead - EVENT_STREAM_SIZE;
+    }
+
+    StreamEvent event;
+    for (int n = 0; n < EVENT_STREAM_SEND_BURST && cursor != currentHead && !client->queueIsFull(); n++) {
+      StreamRead result = read(cursor, event);
+      if (result == StreamRead::pending)
+        break; // still being written, sent with the next pump()
+      if (result == StreamRead::ok)
+        sendEvent(client, event);
+      else
+        droppedTotal.fetch_add(1, std::memory_order_relaxed); // overwritten meanwhile
+      cursor++;
+    }
+
+    portENTER_CRITICAL(&clientMux);
+    if (clients[i].clientId == entry.clientId)
+      clients[i].cursor = cursor;
+    portEXIT_CRITICAL(&clientMux);
+  }
+
+  webSocket.cleanupClients(EVENT_STREAM_MAX_CLIENTS);
+}
+
+const char* EventStream::getTypeName(StreamEventType type) {
+  switch (type) {
+    case StreamEventType::log:            return "log";
+    case StreamEventType::match:          return "match";
+    case StreamEventType::noMatch:        return "noMatch";
+    case StreamEventType::enrollProgress: return "enrollProgress";
+    case StreamEventType::enrollDone:     return "enrollDone";
+    case StreamEventType::error:          return "error";
+    default:                              return "unknown";
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <ESPAsyncWebServer.h>
+
+#define EVENT_STREAM_SIZE 32          // events kept in the ring, older ones are overwritten
+#define EVENT_STREAM_TEXT_LENGTH 95
+#define EVENT_STREAM_MAX_CLIENTS 4
+#define EVENT_STREAM_SEND_BURST 4     // max. events sent to one client per pump() call
+#define EVENT_STREAM_PATH "/ws"
+
+enum class StreamEventType : uint8_t {
+  log,             // text of notifyClients()
+  match,           // id = finger id, value = confidence, text = finger name
+  noMatch,         // value = return code
+  enrollProgress,  // id = finger id, value = take number
+  enrollDone,      // id = finger id, value = 1 on success
+  error            // value = return code
+};
+
+enum class StreamRead { ok, pending, overwritten };
+
+struct StreamEvent {
+  uint32_t sequence;
+  uint32_t timestamp;  // unix time, 0 when the time is not synced yet
+  StreamEventType type;
+  uint16_t id;
+  uint16_t value;
+  char text[EVENT_STREAM_TEXT_LENGTH + 1];
+};
+
+/*
+  Live events for WebSocket clients. publish() is lock-free and can be called from any task: a writer claims a sequence
+  number and writes the slot between two version stores, readers copy a slot and check the version before and after
+  (seqlock). Writers never wait for readers.
+
+  Every client has its own cursor. pump() (called by loop()) sends at most EVENT_STREAM_SEND_BURST events per client
+  and skips clients whose send queue is full. A client falling more than EVENT_STREAM_SIZE events behind loses the oldest
+  ones and gets a "dropped" message instead, so a slow browser never stalls the scan. An event whose sequence is claimed
+  but not completely written yet stops the client until the next pump(), it is only skipped once it was overwritten.
+  Events are sent as compact JSON: {"s":12,"ts":1690000000,"t":"match","id":3,"v":87,"m":"Alice"}
+*/
+class EventStream {
+  private:
+    struct Slot {
+      std::atomic<uint32_t> version; // 2*sequence+1 while written, 2*sequence+2 when complete
+      StreamEvent event;
+    };
+    struct Client {
+      uint32_t clientId;  // 0 = unused
+      uint32_t cursor;    // next sequence to send
+    };
+
+    Slot slots[EVENT_STREAM_SIZE];
+    std::atomic<uint32_t> head{0}; // next sequence to write
+    std::atomic<uint32_t> droppedTotal{0};
+
+    AsyncWebSocket webSocket = AsyncWebSocket(EVENT_STREAM_PATH);
+    Client clients[EVENT_STREAM_MAX_CLIENTS] = {};
+    portMUX_TYPE clientMux = portMUX_INITIALIZER_UNLOCKED; // the client table is changed by async_tcp, read by pump()
+
+    void onWebSocketEvent(AsyncWebSocketClient *client, AwsEventType type);
+    void sendEvent(AsyncWebSocketClient *client, const StreamEvent &event);
+    void sendDropped(AsyncWebSocketClient *client, uint32_t count);
+
+  public:
+    EventStream();
+    // clients need the same credentials as the REST API
+    void begin(AsyncWebServer &server, const char *username, const char *password);
+
+    void publish(StreamEventType type, uint16_t id, uint16_t value, const char *text);
+
+    // copies the event with the given sequence. pending: not (completely) written yet, read it again later.
+    // overwritten: the slot already belongs to a newer event.
+    StreamRead read(uint32_t sequence, StreamEvent &event);
+    uint32_t getHead();
+    uint32_t getDroppedTotal();
+
+    void pump();
+
+    static const char* getTypeName(StreamEventType type);
+};
+
+extern EventStream eventStream;
+
+#endif
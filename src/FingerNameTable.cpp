@@ -0,0 +1,82 @@
+#include "FingerNameTable.h"
+
+FingerNameTable::FingerNameTable() {
+  clear();
+}
+
+void FingerNameTable::clear() {
+  memset(names, 0, sizeof(names));
+  memset(occupied, 0, sizeof(occupied));
+}
+
+bool FingerNameTable::set(uint16_t id, const char *name) {
+  if (id == 0 || id >= FINGER_LIST_SIZE)
+    return false;
+  strlcpy(names[id], name, sizeof(names[id]));
+  occupied[id / 32] |= (1ul << (id % 32));
+  return true;
+}
+
+void FingerNameTable::remove(uint16_t id) {
+  if (id == 0 || id >= FINGER_LIST_SIZE)
+    return;
+  names[id][0] = 0;
+  occupied[id / 32] &= ~(1ul << (id % 32));
+}
+
+bool FingerNameTable::isOccupied(uint16_t id) const {
+  if (id >= FINGER_LIST_SIZE)
+    return false;
+  return (occupied[id / 32] & (1ul << (id % 32))) != 0;
+}
+
+const char* FingerNameTable::get(uint16_t id) const {
+  if (!isOccupied(id))
+    return FINGER_NAME_EMPTY;
+  return names[id];
+}
+
+int FingerNameTable::count() const {
+  int counter = 0;
+  for (size_t i=0; i<sizeof(occupied)/sizeof(occupied[0]); i++)
+    counter += __builtin_popcount(occupied[i]);
+  return counter;
+}
+
+int FingerNameTable::size() const {
+  return FINGER_LIST_SIZE;
+}
+
+size_t FingerNameTable::serialize(uint8_t *buffer, size_t bufferSize) const {
+  size_t pos = 0;
+  for (int id=1; id<FINGER_LIST_SIZE; id++) {
+    if (!isOccupied(id))
+      continue;
+    size_t len = strlen(names[id]);
+    if (pos + 2 + len > bufferSize)
+      break;
+    buffer[pos++] = (uint8_t)id;
+    buffer[pos++] = (uint8_t)len;
+    memcpy(&buffer[pos], names[id], len);
+    pos += len;
+  }
+  return pos;
+}
+
+bool FingerNameTable::deserialize(const uint8_t *buffer, size_t length) {
+  clear();
+  size_t pos = 0;
+  while (pos + 2 <= length) {
+    uint8_t id = buffer[pos++];
+    uint8_t len = buffer[pos++];
+    if (id == 0 || id >= FINGER_LIST_SIZE || len > FINGER_NAME_MAX_LENGTH || pos + len > length) {
+      clear();
+      return false;
+    }
+    memcpy(names[id], &buffer[pos], len);
+    names[id][len] = 0;
+    occupied[id / 32] |= (1ul << (id % 32));
+    pos += len;
+  }
+  return pos == length;
+}
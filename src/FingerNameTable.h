@@ -0,0 +1,37 @@
+#ifndef FINGERNAMETABLE_H
+#define FINGERNAMETABLE_H
+
+#include <Arduino.h>
+
+#define FINGER_LIST_SIZE 201 // slot 0 is unused, finger ids are 1..200
+#define FINGER_NAME_MAX_LENGTH 32
+#define FINGER_NAME_EMPTY "@empty"
+// serialized: (id, name length, name) for each used slot
+#define FINGER_LIST_SERIALIZED_MAX_SIZE ((FINGER_LIST_SIZE - 1) * (2 + FINGER_NAME_MAX_LENGTH))
+
+/*
+  Names of the enrolled fingers in one contiguous block instead of 201 heap allocated Strings.
+  Occupied slots are tracked in a bitmap, names longer than FINGER_NAME_MAX_LENGTH are truncated.
+*/
+class FingerNameTable {
+  private:
+    char names[FINGER_LIST_SIZE][FINGER_NAME_MAX_LENGTH + 1];
+    uint32_t occupied[(FINGER_LIST_SIZE + 31) / 32];
+
+  public:
+    FingerNameTable();
+
+    void clear();
+    bool set(uint16_t id, const char *name);
+    void remove(uint16_t id);
+    bool isOccupied(uint16_t id) const;
+    const char* get(uint16_t id) const; // FINGER_NAME_EMPTY for unused slots
+    int count() const;
+    int size() const;
+
+    // compact binary form used for persistence, returns the number of bytes written
+    size_t serialize(uint8_t *buffer, size_t bufferSize) const;
+    bool deserialize(const uint8_t *buffer, size_t length);
+};
+
+#endif
@@ -2,50 +2,47 @@
 #include "global.h"
 
 #include <Adafruit_Fingerprint.h>
+#include <rom/crc.h>
+#include "LatencyMetrics.h"
+#include "EventStream.h"
+#include "EventLog.h"
+#include "BootTimeline.h"
+#include "TemplateArchive.h"
+#include <SPIFFS.h>
 
 bool FingerprintManager::connect() {
 
-    // initialize input pins
-    pinMode(touchRingPin, INPUT_PULLDOWN);
+    // initialize input pins, touch ring edges are captured by interrupt from now on
+    touchRing.begin(touchRingPin);
 
-    Serial.println("\n\nAdafruit finger detect test");
-
-    // set the data rate for the sensor serial port
-    finger.begin(57600);
-    delay(50);
-    if (finger.verifyPassword()) {
-        Serial.println("Found fingerprint sensor!");
-    } else {
-        delay(5000); // wait a bit longer for sensor to start before 2nd try (usually after a OTA-Update the esp32 is faster with startup than the fingerprint sensor)
-        if (finger.verifyPassword()) {
-          Serial.println("Found fingerprint sensor!");
-        } else {
+    // find the sensor and raise the data rate of the sensor serial port. Usually after an OTA update the esp32 is faster
+    // with startup than the fingerprint sensor, so retry with a short backoff instead of one long wait.
+    uint32_t backoffMs = SENSOR_CONNECT_BACKOFF_MS;
+    for (int attempt=1; !finger.connect(); attempt++) {
+        if (attempt >= SENSOR_CONNECT_ATTEMPTS) {
           Serial.println("Did not find fingerprint sensor :(");
           connected = false;
           return connected;
         }
+        delay(backoffMs);
+        backoffMs *= 2;
     }
-    finger.LEDcontrol(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_BLUE, 0); // sensor connected signal
+    bootTimeline.mark(BootStage::sensorFound);
+    finger.setLed(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_BLUE, 0); // sensor connected signal
+    finger.flushLed();
 
-    Serial.println(F("Reading sensor parameters"));
     finger.getParameters();
-    Serial.print(F("Status: 0x")); Serial.println(finger.status_reg, HEX);
-    Serial.print(F("Sys ID: 0x")); Serial.println(finger.system_id, HEX);
-    Serial.print(F("Capacity: ")); Serial.println(finger.capacity);
-    Serial.print(F("Security level: ")); Serial.println(finger.security_level);
-    Serial.print(F("Device address: ")); Serial.println(finger.device_addr, HEX);
-    Serial.print(F("Packet len: ")); Serial.println(finger.packet_len);
-    Serial.print(F("Baud rate: ")); Serial.println(finger.baud_rate);
-
     finger.getTemplateCount();
-    Serial.print("Sensor contains "); Serial.print(finger.templateCount); Serial.println(" templates");
+    Serial.print(F("Found fingerprint sensor, capacity ")); Serial.print(finger.capacity);
+    Serial.print(F(", security level ")); Serial.print(finger.security_level);
+    Serial.print(F(", packet len ")); Serial.print(finger.packet_len);
+    Serial.print(F(", ")); Serial.print(finger.templateCount); Serial.println(F(" templates"));
 
     loadFingerListFromPrefs();
+    bootTimeline.mark(BootStage::fingerListLoaded);
 
     connected = true;
     return connected;
-
-    //updateTouchState(false);
 }
 
 void FingerprintManager::updateTouchState(bool touched)
@@ -54,7 +51,7 @@ void FingerprintManager::updateTouchState(bool touched)
       // check if sensor or ring is touched
       if (touched) {
         // turn touch indicator on:
-        finger.LEDcontrol(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_RED, 0);
+        finger.setLed(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_RED, 0); // sent together with the next getImage
       } else {
         // turn touch indicator off:
         setLedRingReady();
@@ -66,175 +63,404 @@ void FingerprintManager::updateTouchState(bool touched)
 }
 
 
+Match FingerprintManager::finishScan(Match &match, ScanResult result) {
+  match.scanResult = result;
+  match.scanStartMicros = scanStartMicros;
+  if (result != ScanResult::noFinger)
+    latencyMetrics.record(LatencyStage::scan, micros() - scanStartMicros);
+  scanState = ScanState::idle;
+  return match;
+}
+
+
+/*
+  Resumable scan: each call performs at most one sensor command (getImage, image2Tz or fingerSearch) and returns
+  ScanResult::scanning as long as the scan is not finished yet. This keeps loop() responsive while a finger is on the sensor.
+*/
 Match FingerprintManager::scanFingerprint() {
 
   Match match;
   match.scanResult = ScanResult::error;
 
   if (!connected) {
+      scanState = ScanState::idle;
       return match;
   }
 
+  switch (scanState) {
 
-  // finger detection by capacitive touchRing state (increased sensitivy but error prone due to rain)
-  bool ringTouched = false;
-  if (!ignoreTouchRing) {
-    if (isRingTouched())
-      ringTouched = true;
-    if (ringTouched || lastTouchState) {
-        updateTouchState(true);
-        Serial.println("touched");
-    } else {
-        updateTouchState(false);
-        match.scanResult = ScanResult::noFinger;
-        return match;
-    }
-
-  }
-
+    case ScanState::idle:
+    {
+      // finger detection by capacitive touchRing state (increased sensitivy but error prone due to rain)
+      bool ringTouched = false;
+      uint32_t edgeMicros = micros();
+      if (!ignoreTouchRing) {
+        if (isRingTouched(&edgeMicros))
+          ringTouched = true;
+        if (ringTouched || lastTouchState) {
+            updateTouchState(true);
+            eventLog.log(LogCode::touched);
+        } else {
+            updateTouchState(false);
+            match.scanResult = ScanResult::noFinger;
+            return match;
+        }
+      } else {
+        touchRing.consumeTouch(); // drop edges while the ring is ignored
+      }
 
-  bool doAnotherScan = true;
-  int scanPass = 0;
-  while (doAnotherScan)
-  {
-    doAnotherScan = false;
-    scanPass++;
+      scanRingTouched = ringTouched;
+      scanStartMicros = edgeMicros; // latency is measured from the touch, not from when we noticed it
+      firstImageTaken = false;
+      scanPass = 1;
+      imagingPass = 0;
+      scanState = ScanState::imaging;
+      // no sensor command issued yet, so continue with imaging right away
+    }
+    // fall through
 
     ///////////////////////////////////////////////////////////
     // STEP 1: Get Image from Sensor
     ///////////////////////////////////////////////////////////
-    bool doImaging = true;
-    int imagingPass = 0;
-    while (doImaging)
+    case ScanState::imaging:
     {
-      doImaging = false;
       imagingPass++;
-      Serial.println(String("Get Image try ") + finger.getImage());
-      match.returnCode = finger.getImage();
+      uint32_t startMicros = micros();
+      match.returnCode = finger.getImagePipelined();
+      latencyMetrics.record(LatencyStage::getImage, micros() - startMicros);
       switch (match.returnCode) {
         case FINGERPRINT_OK:
+          if (!firstImageTaken) {
+            latencyMetrics.record(LatencyStage::ringToImage, micros() - scanStartMicros);
+            firstImageTaken = true;
+          }
+          if (wokenByTouch) {
+            latencyMetrics.record(LatencyStage::wakeToImage, micros() - wakeMicros);
+            wokenByTouch = false;
+          }
           // Important: do net set touch state to true yet! Reason:
-          // - if touchRing is NOT ignored, updateTouchState(true) was already called a few lines up, ring is already flashing red
+          // - if touchRing is NOT ignored, updateTouchState(true) was already called when the scan started, ring is already flashing red
           // - if touchRing IS ignored, wait for next step because image still can be "too messy" (=raindrop on sensor), and we don't want to flash red in this case
-          //updateTouchState(true);
-          //Serial.println("Image taken");
-          break;
+          scanState = ScanState::converting;
+          match.scanResult = ScanResult::scanning;
+          return match;
         case FINGERPRINT_NOFINGER:
         case FINGERPRINT_PACKETRECIEVEERR: // occurs from time to time, handle it like a "nofinger detected but touched" situation
-          if (ringTouched) {
+          if (scanRingTouched) {
             // no finger on sensor but ring was touched -> ring event
-            //Serial.println("ring touched");
             updateTouchState(true);
-            if (imagingPass < 15) // up to x image passes in a row are taken after touch ring was touched until noFinger will raise a noMatchFound event
-            {
-              doImaging = true; // scan another image
-              //delay(50);
-              break;
-            } else {
-              //Serial.println("15 times no image after touching ring");
-              match.scanResult = ScanResult::noMatchFound;
+            if (imagingPass < 15) { // up to x image passes in a row are taken after touch ring was touched until noFinger will raise a noMatchFound event
+              match.scanResult = ScanResult::scanning; // scan another image on next call
               return match;
             }
-          } else  {
-            if (ignoreTouchRing && scanPass > 1) {
-              // the scan(s) in last iteration(s) have not found any match, now the finger was released (=no finger) -> return "no match" as result
-              match.scanResult = ScanResult::noMatchFound;
-            } else {
-              match.scanResult = ScanResult::noFinger;
-              updateTouchState(false);
-            }
-            return match;
+            return finishScan(match, ScanResult::noMatchFound);
+          }
+          if (ignoreTouchRing && scanPass > 1) {
+            // the scan(s) in last iteration(s) have not found any match, now the finger was released (=no finger) -> return "no match" as result
+            return finishScan(match, ScanResult::noMatchFound);
           }
+          updateTouchState(false);
+          return finishScan(match, ScanResult::noFinger);
         case FINGERPRINT_IMAGEFAIL:
-          Serial.println("Imaging error");
+          eventLog.log(LogCode::imagingError, match.returnCode);
           updateTouchState(true);
-          return match;
+          return finishScan(match, ScanResult::error);
         default:
-          Serial.println("Unknown error");
-          return match;
+          eventLog.log(LogCode::unknownError, (int)ScanState::imaging, match.returnCode);
+          return finishScan(match, ScanResult::error);
       }
-
     }
 
     ///////////////////////////////////////////////////////////
     // STEP 2: Convert Image to feature map
     ///////////////////////////////////////////////////////////
-    match.returnCode = finger.image2Tz();
-    switch (match.returnCode) {
-      case FINGERPRINT_OK:
-        //Serial.println("Image converted");
-        updateTouchState(true);
-        break;
-      case FINGERPRINT_IMAGEMESS:
-        Serial.println("Image too messy");
-        return match;
-      case FINGERPRINT_PACKETRECIEVEERR:
-        Serial.println("Communication error");
-        return match;
-      case FINGERPRINT_FEATUREFAIL:
-        Serial.println("Could not find fingerprint features");
-        return match;
-      case FINGERPRINT_INVALIDIMAGE:
-        Serial.println("Could not find fingerprint features");
-        return match;
-      default:
-        Serial.println("Unknown error");
-        return match;
+    case ScanState::converting:
+    {
+      uint32_t startMicros = micros();
+      match.returnCode = finger.image2Tz();
+      latencyMetrics.record(LatencyStage::image2Tz, micros() - startMicros);
+      switch (match.returnCode) {
+        case FINGERPRINT_OK:
+          updateTouchState(true);
+          scanState = ScanState::searching;
+          match.scanResult = ScanResult::scanning;
+          return match;
+        case FINGERPRINT_IMAGEMESS:
+          eventLog.log(LogCode::imageMessy);
+          break;
+        case FINGERPRINT_PACKETRECIEVEERR:
+          eventLog.log(LogCode::communicationError, (int)ScanState::converting);
+          break;
+        case FINGERPRINT_FEATUREFAIL:
+        case FINGERPRINT_INVALIDIMAGE:
+          eventLog.log(LogCode::featureFail, match.returnCode);
+          break;
+        default:
+          eventLog.log(LogCode::unknownError, (int)ScanState::converting, match.returnCode);
+          break;
+      }
+      return finishScan(match, ScanResult::error);
     }
 
     ///////////////////////////////////////////////////////////
     // STEP 3: Search DB for matching features
     ///////////////////////////////////////////////////////////
-    match.returnCode = finger.fingerSearch();
-    if (match.returnCode == FINGERPRINT_OK) {
-        // found a match!
-        finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
-
-        match.scanResult = ScanResult::matchFound;
-        match.matchId = finger.fingerID;
-        match.matchConfidence = finger.confidence;
-        match.matchName = fingerList[finger.fingerID];
-
-    } else if (match.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
-        Serial.println("Communication error");
-
-    } else if (match.returnCode == FINGERPRINT_NOTFOUND) {
-        Serial.println(String("Did not find a match. (Scan #") + scanPass + String(" of 5)"));
-        match.scanResult = ScanResult::noMatchFound;
-        if (scanPass < 5) // max 5 Scans until no match found is given back as result
-          doAnotherScan = true;
+    case ScanState::searching:
+    {
+      uint32_t startMicros = micros();
+      match.returnCode = finger.fingerSearch();
+      latencyMetrics.record(LatencyStage::fingerSearch, micros() - startMicros);
+      if (match.returnCode == FINGERPRINT_OK) {
+          // found a match!
+          finger.setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
+          finger.flushLed();
+
+          match.matchId = finger.fingerID;
+          match.matchConfidence = finger.confidence;
+          strlcpy(match.matchName, fingerList.get(finger.fingerID), sizeof(match.matchName));
+          return finishScan(match, ScanResult::matchFound);
+
+      } else if (match.returnCode == FINGERPRINT_NOTFOUND) {
+          eventLog.log(LogCode::noMatchPass, scanPass, 5);
+          if (scanPass < 5) { // max 5 Scans until no match found is given back as result
+            scanPass++;
+            imagingPass = 0;
+            scanState = ScanState::imaging;
+            match.scanResult = ScanResult::scanning;
+            return match;
+          }
+          return finishScan(match, ScanResult::noMatchFound);
 
-    } else {
-        Serial.println("Unknown error");
+      } else if (match.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
+          eventLog.log(LogCode::communicationError, (int)ScanState::searching);
+      } else {
+          eventLog.log(LogCode::unknownError, (int)ScanState::searching, match.returnCode);
+      }
+      return finishScan(match, ScanResult::error);
     }
+  }
 
-  } //while
+  return finishScan(match, ScanResult::error);
 
-  return match;
+}
 
+bool FingerprintManager::isScanInProgress() {
+  return scanState != ScanState::idle;
 }
 
 // Preferences
+/*
+  The finger list is stored as one versioned blob in the "fingerList" namespace: a header (magic, version, length, crc32,
+  generation) followed by the serialized FingerNameTable. Blobs bigger than FINGER_LIST_BLOB_CHUNK_SIZE are split into
+  several keys. A write spanning several keys is not atomic, so there are two slots ("a0", "a1"... and "b0", "b1"...)
+  and a write always goes to the slot not holding the current list. Chunk 0 carries the header and is written last;
+  the crc covers all chunks, so a slot torn by a reset is invalid and the older slot is used. On load the valid slot with
+  the higher generation wins.
+  Version 1 used a single slot ("blob0", "blob1"...), up to version 0.4 every finger had its own key ("1".."200"). Both
+  are migrated on first boot.
+*/
+struct FingerListBlobHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;     // bytes of serialized data following the header
+  uint32_t crc;        // crc32 of the serialized data
+  uint32_t generation; // incremented on every write (not in version 1)
+};
+
+#define FINGER_LIST_BLOB_V1_HEADER_SIZE offsetof(FingerListBlobHeader, generation)
+
+static uint8_t fingerListBlob[sizeof(FingerListBlobHeader) + FINGER_LIST_SERIALIZED_MAX_SIZE];
+
 void FingerprintManager::loadFingerListFromPrefs() {
-  Preferences preferences;
-  preferences.begin("fingerList", true);
-  int counter = 0;
-  for (int i=1; i<=200; i++) {
-    String key = String(i);
-    if (preferences.isKey(key.c_str())) {
-      fingerList[i] = preferences.getString(key.c_str(), String("@empty"));
-      counter++;
+  fingerList.clear();
+  fingerListDirty = false;
+
+  if (!readFingerListBlob()) {
+    uint32_t generation;
+    int migrated = 0;
+    if (readFingerListSlot("blob", 1, generation) &&
+        fingerList.deserialize(&fingerListBlob[sizeof(FingerListBlobHeader)], ((const FingerListBlobHeader*)fingerListBlob)->length)) {
+      migrated = fingerList.count();
+    } else {
+      fingerList.clear();
+      migrated = readFingerListLegacy();
+    }
+    if (migrated > 0) {
+      Serial.println(String("Migrating ") + migrated + " fingers to finger list version " + FINGER_LIST_BLOB_VERSION);
+      if (writeFingerListBlob())
+        removeFingerListLegacy();
     }
-    else
-      fingerList[i] = String("@empty");
   }
+
+  int counter = fingerList.count();
   Serial.println(String(counter) + " fingers loaded from preferences.");
   setFingersRegistred(counter);
   if (counter != finger.templateCount)
     notifyClients(String("Warning: Fingerprint count mismatch! ") + finger.templateCount + " fingerprints stored on sensor, but we are aware of " + counter + " fingerprints.");
+}
+
+bool FingerprintManager::readFingerListBlob() {
+  uint32_t generationA = 0, generationB = 0;
+  bool validB = readFingerListSlot("b", FINGER_LIST_BLOB_VERSION, generationB);
+  bool validA = readFingerListSlot("a", FINGER_LIST_BLOB_VERSION, generationA); // the buffer holds slot a now, if it exists
+  if (!validA && !validB) {
+    fingerListSlot = 0;
+    fingerListGeneration = 0;
+    return false;
+  }
+
+  bool useB = validB && (!validA || (int32_t)(generationB - generationA) > 0);
+  if (useB)
+    readFingerListSlot("b", FINGER_LIST_BLOB_VERSION, generationB); // read slot b again, even an invalid slot a overwrites the buffer
+  fingerListSlot = useB ? 'b' : 'a';
+  fingerListGeneration = useB ? generationB : generationA;
+
+  const FingerListBlobHeader *header = (const FingerListBlobHeader*)fingerListBlob;
+  return fingerList.deserialize(&fingerListBlob[sizeof(FingerListBlobHeader)], header->length);
+}
+
+// reads the chunks <prefix>0, <prefix>1... into fingerListBlob and verifies them, the data starts at
+// sizeof(FingerListBlobHeader) for all versions
+bool FingerprintManager::readFingerListSlot(const char *prefix, uint16_t version, uint32_t &generation) {
+  Preferences preferences;
+  if (!preferences.begin("fingerList", true))
+    return false;
+
+  size_t headerSize = version == 1 ? FINGER_LIST_BLOB_V1_HEADER_SIZE : sizeof(FingerListBlobHeader);
+  size_t offset = sizeof(FingerListBlobHeader) - headerSize; // a version 1 header is placed in front of the data
+  char key[16];
+  snprintf(key, sizeof(key), "%s0", prefix);
+  size_t length = preferences.isKey(key) ? preferences.getBytes(key, &fingerListBlob[offset], min((size_t)FINGER_LIST_BLOB_CHUNK_SIZE, sizeof(fingerListBlob) - offset)) : 0;
+  FingerListBlobHeader header = {};
+  if (length < headerSize) {
+    preferences.end();
+    return false;
+  }
+  memcpy(&header, &fingerListBlob[offset], headerSize);
+
+  size_t total = headerSize + header.length;
+  if (header.magic != FINGER_LIST_BLOB_MAGIC || header.version != version || offset + total > sizeof(fingerListBlob)) {
+    preferences.end();
+    return false;
+  }
+
+  for (int chunk=1; length < total; chunk++) {
+    snprintf(key, sizeof(key), "%s%d", prefix, chunk);
+    size_t chunkLength = preferences.getBytes(key, &fingerListBlob[offset + length], min((size_t)FINGER_LIST_BLOB_CHUNK_SIZE, total - length));
+    if (chunkLength == 0)
+      break;
+    length += chunkLength;
+  }
+  preferences.end();
+
+  if (length != total || crc32_le(0, &fingerListBlob[sizeof(FingerListBlobHeader)], header.length) != header.crc) {
+    Serial.println(String("Finger list slot ") + prefix + " is incomplete or corrupted.");
+    return false;
+  }
+  generation = header.generation;
+  memcpy(fingerListBlob, &header, sizeof(header));
+  return true;
+}
+
+int FingerprintManager::readFingerListLegacy() {
+  Preferences preferences;
+  if (!preferences.begin("fingerList", true))
+    return 0;
+  char key[4];
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  for (int i=1; i<FINGER_LIST_SIZE; i++) {
+    itoa(i, key, 10);
+    if (!preferences.isKey(key))
+      continue;
+    if (preferences.getString(key, name, sizeof(name)) == 0)
+      preferences.getString(key).toCharArray(name, sizeof(name)); // name is longer than a table slot, truncate it
+    fingerList.set(i, name);
+  }
+  preferences.end();
+  return fingerList.count();
+}
+
+// removes the keys of the per finger layout and of version 1
+void FingerprintManager::removeFingerListLegacy() {
+  Preferences preferences;
+  if (!preferences.begin("fingerList", false))
+    return;
+  char key[16];
+  for (int i=1; i<FINGER_LIST_SIZE; i++) {
+    itoa(i, key, 10);
+    if (preferences.isKey(key))
+      preferences.remove(key);
+  }
+  for (int chunk=0; ; chunk++) {
+    snprintf(key, sizeof(key), "blob%d", chunk);
+    if (!preferences.isKey(key))
+      break;
+    preferences.remove(key);
+  }
   preferences.end();
 }
 
+bool FingerprintManager::writeFingerListBlob() {
+  FingerListBlobHeader header;
+  header.magic = FINGER_LIST_BLOB_MAGIC;
+  header.version = FINGER_LIST_BLOB_VERSION;
+  header.length = fingerList.serialize(&fingerListBlob[sizeof(header)], sizeof(fingerListBlob) - sizeof(header));
+  header.crc = crc32_le(0, &fingerListBlob[sizeof(header)], header.length);
+  header.generation = fingerListGeneration + 1;
+  memcpy(fingerListBlob, &header, sizeof(header));
+  size_t total = sizeof(header) + header.length;
+  char slot = (fingerListSlot == 'a') ? 'b' : 'a'; // never overwrite the current list
+
+  Preferences preferences;
+  if (!preferences.begin("fingerList", false))
+    return false;
+
+  // chunk 0 carries the header and is written last, the new slot becomes valid with it
+  bool ok = true;
+  int chunks = (total + FINGER_LIST_BLOB_CHUNK_SIZE - 1) / FINGER_LIST_BLOB_CHUNK_SIZE;
+  char key[8];
+  for (int chunk=chunks-1; chunk>=0 && ok; chunk--) {
+    size_t offset = chunk * FINGER_LIST_BLOB_CHUNK_SIZE;
+    snprintf(key, sizeof(key), "%c%d", slot, chunk);
+    if (preferences.putBytes(key, &fingerListBlob[offset], min((size_t)FINGER_LIST_BLOB_CHUNK_SIZE, total - offset)) == 0)
+      ok = false;
+  }
+  preferences.end();
+
+  if (!ok) {
+    notifyClients("Error: writing finger list to preferences failed.");
+    return false;
+  }
+  fingerListSlot = slot;
+  fingerListGeneration = header.generation;
+  return true;
+}
+
+void FingerprintManager::markFingerListDirty() {
+  if (!fingerListDirty)
+    fingerListDirtyMillis = millis();
+  fingerListDirty = true;
+}
+
+// called periodically by the sensor task
+void FingerprintManager::process() {
+  // LED updates not sent together with a getImage yet
+  if (!isScanInProgress())
+    finger.flushLed();
+
+  if (fingerListDirty && (millis() - fingerListDirtyMillis) >= FINGER_LIST_WRITE_DELAY_MS)
+    flushFingerList();
+}
+
+void FingerprintManager::flushFingerList() {
+  if (!fingerListDirty)
+    return;
+  if (writeFingerListBlob())
+    fingerListDirty = false;
+  else
+    fingerListDirtyMillis = millis(); // try again later
+}
+
 
 int FingerprintManager::countFingerRegistred() {
   return fingersRegistred;
@@ -244,6 +470,25 @@ void FingerprintManager::setFingersRegistred(int n) {
   fingersRegistred = n;
 };
 
+void FingerprintManager::requestEnrollCancel() {
+  enrollCancelRequested = true;
+}
+
+// every wait for the finger is limited, nobody at the sensor must not block the sensor task forever
+bool FingerprintManager::isEnrollAborted(unsigned long waitStartMillis) {
+  return enrollCancelRequested || (millis() - waitStartMillis) >= ENROLL_TAKE_TIMEOUT_MS;
+}
+
+NewFinger FingerprintManager::abortEnroll(NewFinger &newFinger) {
+  Serial.println(enrollCancelRequested ? "cancelled" : "timeout");
+  notifyClients(enrollCancelRequested ? "Enrollment cancelled." : "Enrollment timed out, no finger on the sensor.");
+  enrollCancelRequested = false;
+  newFinger.enrollResult = EnrollResult::error;
+  newFinger.returnCode = FINGERPRINT_TIMEOUT;
+  setLedRingReady();
+  return newFinger;
+}
+
 // Add/Enroll fingerprint
 NewFinger FingerprintManager::enrollFinger(int id, String name) {
 
@@ -251,6 +496,8 @@ NewFinger FingerprintManager::enrollFinger(int id, String name) {
   newFinger.enrollResult = EnrollResult::error;
 
   lastTouchState = true; // after enrollment, scan mode kicks in again. Force update of the ring light back to normal on first iteration of scan mode.
+  scanState = ScanState::idle; // a started scan is discarded, the sensor buffers are overwritten by the enrollment
+  enrollCancelRequested = false;
 
 
   notifyClients(String("Enrollment for id #") + id + " started. We need to scan your finger 5 times until enrollment is completed.");
@@ -260,21 +507,28 @@ NewFinger FingerprintManager::enrollFinger(int id, String name) {
   for (int nTimes=1; nTimes<=5; nTimes++)
   {
       notifyClients(String("Take #" + String(nTimes))+ " (place your finger on the sensor until led ring stops flashing, then remove it).");
+      eventStream.publish(StreamEventType::enrollProgress, id, nTimes, nullptr);
 
       if (nTimes != 1) // not on first run
       {
         //delay(2000);
+        unsigned long waitStartMillis = millis();
         newFinger.returnCode = 0xFF;
         while (newFinger.returnCode != FINGERPRINT_NOFINGER) {
-          newFinger.returnCode = finger.getImage();
+          if (isEnrollAborted(waitStartMillis))
+            return abortEnroll(newFinger);
+          newFinger.returnCode = finger.getImagePipelined();
         }
       }
 
       Serial.print("Taking image sample "); Serial.print(nTimes); Serial.print(": ");
-      finger.LEDcontrol(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_PURPLE, 0);
+      finger.setLed(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_PURPLE, 0);
+      unsigned long waitStartMillis = millis();
       newFinger.returnCode = 0xFF;
       while (newFinger.returnCode != FINGERPRINT_OK) {
-        newFinger.returnCode = finger.getImage();
+        if (isEnrollAborted(waitStartMillis))
+          return abortEnroll(newFinger);
+        newFinger.returnCode = finger.getImagePipelined();
         switch (newFinger.returnCode) {
         case FINGERPRINT_OK:
           Serial.print("taken, ");
@@ -316,7 +570,7 @@ NewFinger FingerprintManager::enrollFinger(int id, String name) {
           Serial.print("Unknown error");
           return newFinger;
       }
-      finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
+      finger.setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
 
   }
 
@@ -346,11 +600,10 @@ NewFinger FingerprintManager::enrollFinger(int id, String name) {
     Serial.println("Stored!");
     newFinger.enrollResult = EnrollResult::ok;
     // save to prefs
-    fingerList[id] = name;
-    Preferences preferences;
-    preferences.begin("fingerList", false);
-    preferences.putString(String(id).c_str(), name);
-    preferences.end();
+    portENTER_CRITICAL(&fingerListMux);
+    fingerList.set(id, name.c_str());
+    portEXIT_CRITICAL(&fingerListMux);
+    markFingerListDirty();
 
   } else if (newFinger.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
     Serial.println("Communication error");
@@ -373,41 +626,99 @@ NewFinger FingerprintManager::enrollFinger(int id, String name) {
 }
 
 
-void FingerprintManager::deleteFinger(int id) {
+uint8_t FingerprintManager::deleteFinger(int id) {
 
   if ((id > 0) && (id <= 200)) {
-    int8_t result = finger.deleteModel(id);
+    uint8_t result = finger.deleteModel(id);
     if (result != FINGERPRINT_OK) {
       notifyClients(String("Delete of finger template #") + id + " from sensor failed with code " + result);
-      return;
+      return result;
 
     } else {
-      fingerList[id] = "@empty";
-      Preferences preferences;
-      preferences.begin("fingerList", false);
-      preferences.remove (String(id).c_str());
-      preferences.end();
+      portENTER_CRITICAL(&fingerListMux);
+      fingerList.remove(id);
+      portEXIT_CRITICAL(&fingerListMux);
+      markFingerListDirty();
       Serial.println(String("Finger template #") + id + " deleted from sensor and prefs.");
-
+      return FINGERPRINT_OK;
     }
   }
-
+  return FINGERPRINT_BADLOCATION;
 }
 
 
 void FingerprintManager::renameFinger(int id, String newName) {
   if ((id > 0) && (id <= 200)) {
-    Preferences preferences;
-    preferences.begin("fingerList", false);
-    preferences.putString(String(id).c_str(), newName);
-    preferences.end();
-    Serial.println(String("Finger template #") + id + " renamed from " + fingerList[id] + " to " + newName);
-    fingerList[id] = newName;
+    Serial.println(String("Finger template #") + id + " renamed from " + fingerList.get(id) + " to " + newName);
+    portENTER_CRITICAL(&fingerListMux);
+    fingerList.set(id, newName.c_str());
+    portEXIT_CRITICAL(&fingerListMux);
+    markFingerListDirty();
+  }
+}
+
+// one DeleteChar command per contiguous range of ids, returns the number of deleted fingers
+int FingerprintManager::deleteFingers(const FingerNameTable &selection) {
+  int deleted = 0;
+  for (int id=1; id<FINGER_LIST_SIZE; id++) {
+    if (!selection.isOccupied(id))
+      continue;
+    int count = 1;
+    while (id + count < FINGER_LIST_SIZE && selection.isOccupied(id + count))
+      count++;
+
+    uint8_t result = finger.deleteTemplates(id, count);
+    if (result == FINGERPRINT_OK) {
+      portENTER_CRITICAL(&fingerListMux);
+      for (int i=id; i<id+count; i++)
+        fingerList.remove(i);
+      portEXIT_CRITICAL(&fingerListMux);
+      deleted += count;
+    } else {
+      notifyClients(String("Delete of finger templates #") + id + "-" + (id + count - 1) + " from sensor failed with code " + result);
+    }
+    id += count - 1;
+  }
+
+  if (deleted > 0) {
+    markFingerListDirty();
+    flushFingerList();
+    setFingersRegistred(fingerList.count());
   }
+  Serial.println(String(deleted) + " finger templates deleted from sensor and prefs.");
+  return deleted;
+}
+
+int FingerprintManager::renameFingers(const FingerNameTable &newNames) {
+  int renamed = 0;
+  portENTER_CRITICAL(&fingerListMux);
+  for (int id=1; id<FINGER_LIST_SIZE; id++) {
+    if (newNames.isOccupied(id) && fingerList.set(id, newNames.get(id)))
+      renamed++;
+  }
+  portEXIT_CRITICAL(&fingerListMux);
+
+  if (renamed > 0) {
+    markFingerListDirty();
+    flushFingerList();
+  }
+  Serial.println(String(renamed) + " fingers renamed.");
+  return renamed;
 }
 
 int FingerprintManager::getFingerListSize() {
-  return sizeof(fingerList) / sizeof(fingerList[0]);
+  return fingerList.size();
+}
+
+bool FingerprintManager::getFingerName(int id, char *name, size_t size) {
+  if (id < 0 || id >= fingerList.size())
+    return false;
+  portENTER_CRITICAL(&fingerListMux);
+  bool occupied = fingerList.isOccupied(id);
+  if (occupied)
+    strlcpy(name, fingerList.get(id), size);
+  portEXIT_CRITICAL(&fingerListMux);
+  return occupied;
 }
 
 void FingerprintManager::setIgnoreTouchRing(bool state) {
@@ -421,11 +732,26 @@ void FingerprintManager::setIgnoreTouchRing(bool state) {
 }
 
 
-bool FingerprintManager::isRingTouched() {
-  if (digitalRead(touchRingPin) == LOW) // LOW = touched. Caution: touchSignal on this pin occour only once (at beginning of touching the ring, not every iteration if you keep your finger on the ring)
-      return true;
-  else
-      return false;
+bool FingerprintManager::isRingTouched(uint32_t *edgeMicros) {
+  // LOW = touched. Caution: touchSignal on this pin occour only once (at beginning of touching the ring, not every iteration
+  // if you keep your finger on the ring), so the edge is captured by interrupt and debounced / rain filtered by touchRing
+  return touchRing.consumeTouch(edgeMicros);
+}
+
+bool FingerprintManager::isIgnoringTouchRing() {
+  return ignoreTouchRing;
+}
+
+// the edge that woke us up from light sleep was not seen by the touch ring interrupt
+void FingerprintManager::onWakeFromSleep(bool touched, uint32_t wakeupMicros) {
+  wokenByTouch = touched;
+  wakeMicros = wakeupMicros;
+  if (touched)
+    touchRing.addEdge(wakeupMicros);
+}
+
+TouchRingStats FingerprintManager::getTouchRingStats() {
+  return touchRing.getStats();
 }
 
 bool FingerprintManager::isFingerOnSensor() {
@@ -441,18 +767,20 @@ bool FingerprintManager::isFingerOnSensor() {
 }
 
 void FingerprintManager::setLedRingError() {
-  finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_RED);
+  finger.setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_RED);
+  finger.flushLed();
 }
 
 void FingerprintManager::setLedRingWifiConfig() {
-  finger.LEDcontrol(FINGERPRINT_LED_BREATHING, 250, FINGERPRINT_LED_RED);
+  finger.setLed(FINGERPRINT_LED_BREATHING, 250, FINGERPRINT_LED_RED);
+  finger.flushLed();
 }
 
 void FingerprintManager::setLedRingReady() {
   if (!ignoreTouchRing)
-    finger.LEDcontrol(FINGERPRINT_LED_BREATHING, 250, FINGERPRINT_LED_BLUE);
+    finger.setLed(FINGERPRINT_LED_BREATHING, 250, FINGERPRINT_LED_BLUE);
   else
-    finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE); // just an indicator for me to see if touch ring is active or not
+    finger.setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE); // just an indicator for me to see if touch ring is active or not
 }
 
 bool FingerprintManager::deleteAll() {
@@ -465,9 +793,12 @@ bool FingerprintManager::deleteAll() {
         rc = preferences.clear();
     preferences.end();
 
-    for (int i=1; i<=200; i++) {
-        fingerList[i] = String("@empty");
-    };
+    portENTER_CRITICAL(&fingerListMux);
+    fingerList.clear();
+    portEXIT_CRITICAL(&fingerListMux);
+    fingerListDirty = false;
+    fingerListSlot = 0;
+    fingerListGeneration = 0;
 
     return rc;
   }
@@ -478,56 +809,10 @@ bool FingerprintManager::deleteAll() {
 
 
 
-uint8_t FingerprintManager::writeNotepad(uint8_t pageNumber, const char *text, uint8_t length) {
-  uint8_t data[34];
-
-  if (length>32)
-    length = 32;
-
-  data[0] = FINGERPRINT_WRITENOTEPAD;
-  data[1] = pageNumber;
-  for (int i=0; i<length; i++)
-    data[i+2] = text[i];
-
-  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
-  finger.writeStructuredPacket(packet);
-  if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  if (packet.type != FINGERPRINT_ACKPACKET)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  return packet.data[0];
-}
-
-
-uint8_t FingerprintManager::readNotepad(uint8_t pageNumber, char *text, uint8_t length) {
-  uint8_t data[2];
-
-  data[0] = FINGERPRINT_READNOTEPAD;
-  data[1] = pageNumber;
-
-  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
-  finger.writeStructuredPacket(packet);
-  if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  if (packet.type != FINGERPRINT_ACKPACKET)
-    return FINGERPRINT_PACKETRECIEVEERR;
-
-  if (packet.data[0] == FINGERPRINT_OK) {
-    // read data payload
-    for (uint8_t i=0; i<length; i++) {
-      text[i] = packet.data[i+1];
-    }
-  }
-
-  return packet.data[0];
-
-}
-
-
 String FingerprintManager::getPairingCode() {
   char buffer[33];
   buffer[32] = 0; // null termination needed for convertion to string at the end
-  if (readNotepad(0, (char*)buffer, 32) == FINGERPRINT_OK)
+  if (finger.readNotepad(0, (char*)buffer, 32) == FINGERPRINT_OK)
     return String((char*)buffer);
   else
     return "";
@@ -535,19 +820,200 @@ String FingerprintManager::getPairingCode() {
 
 
 bool FingerprintManager::setPairingCode(String pairingCode) {
-  if (writeNotepad(0, pairingCode.c_str(), 32) == FINGERPRINT_OK)
+  if (finger.writeNotepad(0, pairingCode.c_str(), 32) == FINGERPRINT_OK)
     return true;
   else
     return false;
 }
 
 
-// ToDo: support sensor replacement by enable transferring of sensor DB to another sensor
-void FingerprintManager::exportSensorDB() {
-
+void FingerprintManager::reportTransfer(const char *operation, int count, size_t bytes, uint32_t durationMs) {
+  notifyClients(String(operation) + " of " + count + " templates finished, " + bytes + " bytes in " + durationMs + " ms (" +
+                (uint32_t)((uint64_t)bytes * 1000 / (durationMs > 0 ? durationMs : 1)) + " bytes/s).");
 }
 
-void FingerprintManager::importSensorDB() {
+/*
+  Sensor replacement: exportSensorDB() streams every template of the sensor (LoadChar + UpChar) together with its name into
+  TEMPLATE_ARCHIVE_PATH on SPIFFS, importSensorDB() streams the archive into a new sensor (DownChar + Store). Only one data
+  packet is held in RAM at a time. Both return the number of templates or -1 on error.
+*/
+int FingerprintManager::exportSensorDB() {
+  if (!connected || !mountSpiffs())
+    return -1;
+
+  static_assert(FINGER_LIST_SIZE <= 256, "only the first page of the index table is read");
+  uint8_t index[32];
+  if (finger.readIndexTable(0, index) != FINGERPRINT_OK) {
+    notifyClients("Template export failed, the index table could not be read.");
+    return -1;
+  }
+  uint16_t count = 0;
+  for (int id=1; id<FINGER_LIST_SIZE; id++)
+    if (index[id / 8] & (1 << (id % 8)))
+      count++;
+
+  uint32_t startMillis = millis();
+  TemplateArchiveWriter archive;
+  if (!archive.begin(SPIFFS, TEMPLATE_ARCHIVE_TEMP_PATH, count)) {
+    notifyClients("Template export failed, the archive could not be created.");
+    return -1;
+  }
 
+  // a template is received completely into RAM before it is written: a SPIFFS write can stall for longer than the
+  // serial RX buffer of the sensor port takes to overflow
+  static uint8_t templateBuffer[TEMPLATE_EXPORT_BUFFER_SIZE];
+  static uint16_t chunkLengths[TEMPLATE_EXPORT_MAX_CHUNKS];
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  size_t bytes = 0;
+  int exported = 0;
+  uint8_t returnCode = FINGERPRINT_OK;
+  for (int id=1; id<FINGER_LIST_SIZE && returnCode == FINGERPRINT_OK; id++) {
+    if (!(index[id / 8] & (1 << (id % 8))))
+      continue;
+    returnCode = finger.loadModel(id);
+    if (returnCode == FINGERPRINT_OK)
+      returnCode = finger.uploadTemplate();
+    if (returnCode != FINGERPRINT_OK)
+      break;
+
+    size_t size = 0;
+    int chunks = 0;
+    for (bool last = false; !last && returnCode == FINGERPRINT_OK; ) {
+      uint16_t length;
+      if (chunks >= TEMPLATE_EXPORT_MAX_CHUNKS || size + SENSOR_DATA_PACKET_MAX_SIZE > sizeof(templateBuffer)) {
+        returnCode = FINGERPRINT_BADPACKET; // bigger than any template of the R503
+        break;
+      }
+      returnCode = finger.readDataPacket(&templateBuffer[size], SENSOR_DATA_PACKET_MAX_SIZE, length, last);
+      if (returnCode == FINGERPRINT_OK) {
+        chunkLengths[chunks++] = length;
+        size += length;
+      }
+    }
+    if (returnCode != FINGERPRINT_OK)
+      break;
+
+    if (!getFingerName(id, name, sizeof(name)))
+      name[0] = 0; // template without a name in the finger list
+    archive.addRecord(id, name);
+    for (int chunk=0, offset=0; chunk<chunks; offset += chunkLengths[chunk++])
+      archive.addChunk(&templateBuffer[offset], chunkLengths[chunk], chunk == chunks - 1);
+    bytes += size;
+    exported++;
+  }
+
+  bool ok = archive.finish() && returnCode == FINGERPRINT_OK;
+  if (ok) {
+    SPIFFS.remove(TEMPLATE_ARCHIVE_PATH);
+    ok = SPIFFS.rename(TEMPLATE_ARCHIVE_TEMP_PATH, TEMPLATE_ARCHIVE_PATH);
+  } else {
+    finger.discardInput(); // rest of an interrupted upload
+    SPIFFS.remove(TEMPLATE_ARCHIVE_TEMP_PATH);
+  }
+  if (!ok) {
+    notifyClients(String("Template export failed after ") + exported + " templates with code " + returnCode);
+    return -1;
+  }
+  reportTransfer("Export", exported, bytes, millis() - startMillis);
+  return exported;
 }
 
+// flashes the LED ring until a finger is placed on the sensor, false after the timeout
+bool FingerprintManager::waitForFingerConfirmation(unsigned long timeoutMs) {
+  notifyClients(String("Place a finger on the sensor within ") + (timeoutMs / 1000) + " s to confirm the template import.");
+  finger.setLed(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_BLUE, 0);
+  finger.flushLed();
+  bool confirmed = false;
+  for (unsigned long startMillis = millis(); !confirmed && (millis() - startMillis) < timeoutMs; ) {
+    confirmed = isFingerOnSensor();
+    if (!confirmed)
+      delay(50);
+  }
+  setLedRingReady();
+  return confirmed;
+}
+
+int FingerprintManager::importSensorDB() {
+  if (!connected || !mountSpiffs())
+    return -1;
+
+  uint32_t startMillis = millis();
+  TemplateArchiveReader archive;
+  if (!archive.begin(SPIFFS, TEMPLATE_ARCHIVE_PATH)) {
+    notifyClients("Template import failed, the archive is missing or corrupted.");
+    return -1;
+  }
+
+  // an import replaces the templates of the sensor, somebody has to be at the door to confirm it
+  if (!waitForFingerConfirmation(TEMPLATE_IMPORT_CONFIRM_TIMEOUT_MS)) {
+    archive.end();
+    notifyClients("Template import cancelled, it was not confirmed at the sensor.");
+    return -1;
+  }
+
+  // the archive holds the packets of the old sensor, they are cut to the packet length of this one
+  uint16_t packetLength = min((uint16_t)finger.packet_len, (uint16_t)SENSOR_DATA_PACKET_MAX_SIZE);
+  uint8_t packet[SENSOR_DATA_PACKET_MAX_SIZE];
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  uint16_t id;
+  size_t bytes = 0;
+  int imported = 0;
+  int failed = 0;
+  uint8_t returnCode = FINGERPRINT_OK;
+  while (returnCode == FINGERPRINT_OK && archive.nextRecord(id, name, sizeof(name))) {
+    if (id < 1 || id >= FINGER_LIST_SIZE)
+      continue;
+    returnCode = finger.downloadTemplate();
+    if (returnCode != FINGERPRINT_OK)
+      break;
+
+    uint8_t writeCode = FINGERPRINT_OK;
+    for (bool last = false; !last && writeCode == FINGERPRINT_OK; ) {
+      size_t length = archive.readData(packet, packetLength);
+      last = archive.isRecordEnd();
+      if (archive.hasFailed())
+        break;
+      writeCode = finger.writeDataPacket(packet, length, last);
+      if (writeCode == FINGERPRINT_OK)
+        bytes += length;
+    }
+    if (archive.hasFailed()) {
+      returnCode = FINGERPRINT_BADPACKET;
+      break;
+    }
+    if (writeCode != FINGERPRINT_OK) {
+      // the template is incomplete, it is not stored; the next DownChar starts a new one (the rest of the record is skipped)
+      finger.discardInput();
+      notifyClients(String("Import of finger template #") + id + " failed with code " + writeCode + ", it was skipped.");
+      failed++;
+      continue;
+    }
+    returnCode = finger.storeModel(id);
+    if (returnCode != FINGERPRINT_OK)
+      break;
+
+    if (name[0] != 0) {
+      portENTER_CRITICAL(&fingerListMux);
+      fingerList.set(id, name);
+      portEXIT_CRITICAL(&fingerListMux);
+    }
+    imported++;
+  }
+  bool ok = (returnCode == FINGERPRINT_OK && !archive.hasFailed());
+  archive.end();
+
+  if (imported > 0) {
+    markFingerListDirty();
+    flushFingerList();
+    setFingersRegistred(fingerList.count());
+  }
+  if (!ok) {
+    finger.discardInput();
+    notifyClients(String("Template import failed after ") + imported + " templates with code " + returnCode);
+    return -1;
+  }
+  reportTransfer("Import", imported, bytes, millis() - startMillis);
+  if (failed > 0)
+    notifyClients(String(failed) + " templates of the archive were not imported.");
+  return imported;
+}
@@ -1,14 +1,25 @@
 #ifndef FINGERPRINTMANAGER_H
 #define FINGERPRINTMANAGER_H
 
-#include <Adafruit_Fingerprint.h>
 #include <Preferences.h>
+#include <atomic>
 #include "global.h"
+#include "FingerNameTable.h"
+#include "SensorTransport.h"
+#include "TouchRing.h"
 
 #define mySerial Serial2
 
-#define FINGERPRINT_WRITENOTEPAD 0x18 // Write Notepad on sensor
-#define FINGERPRINT_READNOTEPAD 0x19 // Read Notepad from sensor
+#define FINGER_LIST_BLOB_MAGIC 0x464C5354 // "FLST"
+#define FINGER_LIST_BLOB_VERSION 2          // 1: single "blob" slot, 2: A/B slots with a generation counter
+#define FINGER_LIST_BLOB_CHUNK_SIZE 1900  // NVS limits the size of a single entry, big lists are split over several keys
+#define FINGER_LIST_WRITE_DELAY_MS 2000   // changes of the finger list are coalesced and written to NVS after this delay
+#define ENROLL_TAKE_TIMEOUT_MS 20000      // max. wait for the finger to be placed or removed during enrollment
+#define TEMPLATE_EXPORT_BUFFER_SIZE 4096  // one template while it is exported, the R503 sends 1536 bytes
+#define TEMPLATE_EXPORT_MAX_CHUNKS 128     // data packets of one template, at least 32 bytes each
+#define TEMPLATE_IMPORT_CONFIRM_TIMEOUT_MS 30000 // a finger on the sensor confirms an import
+#define SENSOR_CONNECT_ATTEMPTS 6         // handshake attempts at boot
+#define SENSOR_CONNECT_BACKOFF_MS 100     // wait after the first failed attempt, doubled after each further one
 
 
 /*
@@ -17,15 +28,17 @@
 */
 const int touchRingPin = 21;     // touch/wakeup pin connected to fingerprint sensor
 
-enum class ScanResult { noFinger, matchFound, noMatchFound, error };
+enum class ScanResult { noFinger, scanning, matchFound, noMatchFound, error };
+enum class ScanState { idle, imaging, converting, searching };
 enum class EnrollResult { ok, error };
 
 struct Match {
   ScanResult scanResult = ScanResult::noFinger;
   uint16_t matchId = 0;
-  String matchName = "unknown";
+  char matchName[FINGER_NAME_MAX_LENGTH + 1] = "unknown"; // plain char array, a Match is passed through FreeRTOS queues
   uint16_t matchConfidence = 0;
   uint8_t returnCode = 0;
+  uint32_t scanStartMicros = 0; // touch ring edge / start of the scan, for end-to-end latency
 };
 
 struct NewFinger {
@@ -35,21 +48,48 @@ struct NewFinger {
 
 class FingerprintManager {
   private:
-    Adafruit_Fingerprint finger = Adafruit_Fingerprint(&mySerial);
+    SensorTransport finger = SensorTransport(&mySerial);
+    TouchRing touchRing;
     bool lastTouchState = false;
-    String fingerList[201];
+    FingerNameTable fingerList;
+    portMUX_TYPE fingerListMux = portMUX_INITIALIZER_UNLOCKED; // written by the sensor task, read by the web server
     int fingerCountOnSensor = 0;
     bool ignoreTouchRing = false; // set to true when the sensor is usually exposed to rain to avoid false ring events. Can also be set conditional by a rain sensor over MQTT
     bool lastIgnoreTouchRing = false;
 
     int fingersRegistred = 0;
 
+    bool fingerListDirty = false;
+    unsigned long fingerListDirtyMillis = 0;
+    char fingerListSlot = 0;             // 'a' or 'b', slot of the last valid blob, 0 if there is none
+    uint32_t fingerListGeneration = 0;   // generation of that blob
+
+    // state of the resumable scan, every call of scanFingerprint() advances it by at most one sensor command
+    ScanState scanState = ScanState::idle;
+    bool scanRingTouched = false;
+    int scanPass = 0;
+    int imagingPass = 0;
+    uint32_t scanStartMicros = 0;
+    bool firstImageTaken = false;
+    bool wokenByTouch = false;
+    std::atomic<bool> enrollCancelRequested{false}; // set by other tasks while enrollFinger() runs
+    uint32_t wakeMicros = 0;
+
     void updateTouchState(bool touched);
-    bool isRingTouched();
+    bool isRingTouched(uint32_t *edgeMicros = nullptr);
     void loadFingerListFromPrefs();
+    bool readFingerListBlob();
+    bool readFingerListSlot(const char *prefix, uint16_t version, uint32_t &generation);
+    int readFingerListLegacy();
+    void removeFingerListLegacy();
+    bool writeFingerListBlob();
+    void markFingerListDirty();
+    bool isEnrollAborted(unsigned long waitStartMillis);
+    NewFinger abortEnroll(NewFinger &newFinger);
     void disconnect();
-    uint8_t writeNotepad(uint8_t pageNumber, const char *text, uint8_t length);
-    uint8_t readNotepad(uint8_t pageNumber, char *text, uint8_t length);
+    Match finishScan(Match &match, ScanResult result);
+    bool waitForFingerConfirmation(unsigned long timeoutMs);
+    void reportTransfer(const char *operation, int count, size_t bytes, uint32_t durationMs);
 
 
 
@@ -57,11 +97,22 @@ class FingerprintManager {
     bool connected;
     bool connect();
     Match scanFingerprint();
-    NewFinger enrollFinger(int id, String name);
-    void deleteFinger(int id);
+    bool isScanInProgress();
+    void process();
+    void flushFingerList();
+    NewFinger enrollFinger(int id, String name); // error with FINGERPRINT_TIMEOUT on timeout or cancel
+    void requestEnrollCancel(); // thread safe, ends a running enrollFinger()
+    uint8_t deleteFinger(int id); // FINGERPRINT_OK or the error code of the sensor
     void renameFinger(int id, String newName);
+    // bulk operations for the ids occupied in the given table, the finger list is written to NVS once
+    int deleteFingers(const FingerNameTable &selection);
+    int renameFingers(const FingerNameTable &newNames);
     int getFingerListSize();
+    bool getFingerName(int id, char *name, size_t size); // thread safe, false for unused slots
     void setIgnoreTouchRing(bool state);
+    bool isIgnoringTouchRing();
+    void onWakeFromSleep(bool touched, uint32_t wakeupMicros);
+    TouchRingStats getTouchRingStats();
     bool isFingerOnSensor();
     void setLedRingError();
     void setLedRingWifiConfig();
@@ -74,9 +125,10 @@ class FingerprintManager {
     int countFingerRegistred();
     void setFingersRegistred(int n);
 
-    // functions for sensor replacement
-    void exportSensorDB();
-    void importSensorDB();
+    // functions for sensor replacement, the archive is TEMPLATE_ARCHIVE_PATH on SPIFFS. The import starts only after
+    // a finger was placed on the sensor (TEMPLATE_IMPORT_CONFIRM_TIMEOUT_MS).
+    int exportSensorDB();
+    int importSensorDB();
 
 };
 
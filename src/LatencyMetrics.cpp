@@ -0,0 +1,94 @@
+#include "LatencyMetrics.h"
+
+LatencyMetrics latencyMetrics;
+
+void LatencyMetrics::record(LatencyStage stage, uint32_t micros) {
+  // bucket i holds values in [2^(i-1), 2^i), bucket 0 holds 0
+  int bucket = (micros == 0) ? 0 : 32 - __builtin_clz(micros);
+  if (bucket >= LATENCY_BUCKET_COUNT)
+    bucket = LATENCY_BUCKET_COUNT - 1;
+
+  Histogram &histogram = histograms[(int)stage];
+  portENTER_CRITICAL(&mux);
+  histogram.buckets[bucket]++;
+  if (histogram.count == 0 || micros < histogram.min)
+    histogram.min = micros;
+  if (micros > histogram.max)
+    histogram.max = micros;
+  histogram.count++;
+  portEXIT_CRITICAL(&mux);
+}
+
+uint32_t LatencyMetrics::percentile(const Histogram &histogram, uint32_t permille) {
+  if (histogram.count == 0)
+    return 0;
+  uint32_t rank = ((uint64_t)histogram.count * permille + 999) / 1000;
+  uint32_t cumulated = 0;
+  for (int i=0; i<LATENCY_BUCKET_COUNT; i++) {
+    cumulated += histogram.buckets[i];
+    if (cumulated >= rank) {
+      uint32_t upperBound = (i == 0) ? 0 : (1ul << i) - 1;
+      return min(upperBound, histogram.max);
+    }
+  }
+  return histogram.max;
+}
+
+LatencySummary LatencyMetrics::getSummary(LatencyStage stage) {
+  Histogram histogram;
+  portENTER_CRITICAL(&mux);
+  histogram = histograms[(int)stage];
+  portEXIT_CRITICAL(&mux);
+
+  LatencySummary summary;
+  summary.count = histogram.count;
+  summary.min = histogram.min;
+  summary.max = histogram.max;
+  summary.p50 = percentile(histogram, 500);
+  summary.p99 = percentile(histogram, 990);
+  return summary;
+}
+
+int LatencyMetrics::getBuckets(LatencyStage stage, uint32_t (&buckets)[LATENCY_BUCKET_COUNT]) {
+  portENTER_CRITICAL(&mux);
+  memcpy(buckets, histograms[(int)stage].buckets, sizeof(buckets));
+  portEXIT_CRITICAL(&mux);
+  int used = LATENCY_BUCKET_COUNT;
+  while (used > 0 && buckets[used - 1] == 0)
+    used--;
+  return used;
+}
+
+const char* LatencyMetrics::getStageName(LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::ringToImage:  return "ringToImage";
+    case LatencyStage::getImage:     return "getImage";
+    case LatencyStage::image2Tz:     return "image2Tz";
+    case LatencyStage::fingerSearch: return "fingerSearch";
+    case LatencyStage::scan:         return "scan";
+    case LatencyStage::apiLookup:    return "apiLookup";
+    case LatencyStage::touchToDoor:  return "touchToDoor";
+    case LatencyStage::wakeToImage:  return "wakeToImage";
+    case LatencyStage::buzzerLate:   return "buzzerLate";
+    case LatencyStage::wifiConnect:  return "wifiConnect";
+    default:                         return "unknown";
+  }
+}
+
+void LatencyMetrics::reset() {
+  portENTER_CRITICAL(&mux);
+  memset(histograms, 0, sizeof(histograms));
+  portEXIT_CRITICAL(&mux);
+}
+
+// formatting happens here only, when somebody asks for the metrics
+void LatencyMetrics::printTo(Print &out) {
+  out.println(F("stage          count    min[us]    p50[us]    p99[us]    max[us]"));
+  char line[80];
+  for (int i=0; i<(int)LatencyStage::count; i++) {
+    LatencySummary summary = getSummary((LatencyStage)i);
+    snprintf(line, sizeof(line), "%-12s %7u %10u %10u %10u %10u", getStageName((LatencyStage)i),
+      summary.count, summary.min, summary.p50, summary.p99, summary.max);
+    out.println(line);
+  }
+}
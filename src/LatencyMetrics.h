@@ -0,0 +1,60 @@
+#ifndef LATENCYMETRICS_H
+#define LATENCYMETRICS_H
+
+#include <Arduino.h>
+
+#define LATENCY_BUCKET_COUNT 25 // log2 buckets of microseconds, the last one collects everything >= 2^24 us (~16.8 s)
+
+/*
+  Always-on latency instrumentation of the scan pipeline. Recording is a few integer operations in a critical
+  section, no heap and no String formatting. Every stage is recorded by one task only.
+*/
+
+enum class LatencyStage : uint8_t {
+  ringToImage,   // scan start (touch ring edge) until the first image was taken
+  getImage,      // single getImage command
+  image2Tz,      // single image2Tz command
+  fingerSearch,  // single fingerSearch command
+  scan,          // scan start until the scan result
+  apiLookup,     // user lookup submitted until answered
+  touchToDoor,   // scan start until the melody for the access decision is started
+  wakeToImage,   // wakeup from idle light sleep by the touch ring until the first image was taken
+  buzzerLate,    // delay of a buzzer note change against its schedule
+  wifiConnect,   // start of a WiFi connect attempt until connected
+  count
+};
+
+struct LatencySummary {
+  uint32_t count;
+  uint32_t min;  // all values in microseconds
+  uint32_t max;
+  uint32_t p50;  // estimated from the buckets (upper bound of the bucket)
+  uint32_t p99;
+};
+
+class LatencyMetrics {
+  private:
+    struct Histogram {
+      uint32_t buckets[LATENCY_BUCKET_COUNT];
+      uint32_t count;
+      uint32_t min;
+      uint32_t max;
+    };
+    Histogram histograms[(int)LatencyStage::count] = {};
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    static uint32_t percentile(const Histogram &histogram, uint32_t permille);
+
+  public:
+    void record(LatencyStage stage, uint32_t micros);
+    LatencySummary getSummary(LatencyStage stage);
+    // bucket i counts values in [2^(i-1), 2^i) us, bucket 0 the value 0. Returns the number of buckets up to the last used one.
+    int getBuckets(LatencyStage stage, uint32_t (&buckets)[LATENCY_BUCKET_COUNT]);
+    static const char* getStageName(LatencyStage stage);
+    void reset();
+    void printTo(Print &out);
+};
+
+extern LatencyMetrics latencyMetrics;
+
+#endif
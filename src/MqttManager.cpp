@@ -0,0 +1,197 @@
+#include "MqttManager.h"
+#include "EventStream.h"
+#include "LatencyMetrics.h"
+
+MqttManager::MqttManager() : client(wifiClient) {
+}
+
+bool MqttManager::begin(const AppSettings &settings, SensorTask *task) {
+  if (settings.mqttServer.isEmpty())
+    return false;
+
+  sensorTask = task;
+  server = settings.mqttServer;
+  username = settings.mqttUsername;
+  password = settings.mqttPassword;
+  rootTopic = settings.mqttRootTopic;
+  clientId = "fingerprintDoorbell-" + String((uint32_t)ESP.getEfuseMac(), HEX);
+  cursor = eventStream.getHead(); // only new events
+
+  client.setServer(server.c_str(), MQTT_PORT);
+  client.setBufferSize(MQTT_BUFFER_SIZE);
+  client.setCallback([this](char *topic, uint8_t *data, unsigned int length) { onMessage(topic, data, length); });
+
+  if (xTaskCreatePinnedToCore(taskMain, "mqtt", MQTT_TASK_STACK_SIZE, this, MQTT_TASK_PRIORITY, &taskHandle, MQTT_TASK_CORE) != pdPASS) {
+    Serial.println("MQTT: could not create task");
+    taskHandle = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void MqttManager::taskMain(void *parameter) {
+  static_cast<MqttManager*>(parameter)->run();
+}
+
+void MqttManager::run() {
+  for (;;) {
+    if (WiFi.status() != WL_CONNECTED) {
+      connected = false;
+      vTaskDelay(pdMS_TO_TICKS(500));
+      continue;
+    }
+
+    if (!client.connected()) {
+      connected = false;
+      if (millis() - lastConnectAttemptMillis >= reconnectDelayMs) {
+        lastConnectAttemptMillis = millis();
+        if (connect()) {
+          reconnectDelayMs = MQTT_RECONNECT_MIN_MS;
+        } else {
+          reconnectDelayMs = min(reconnectDelayMs * 2, (unsigned long)MQTT_RECONNECT_MAX_MS);
+          Serial.println(String("MQTT: connect failed (state ") + client.state() + "), next try in " + reconnectDelayMs + " ms");
+        }
+      }
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    connected = true;
+    client.loop();
+
+    if (millis() - lastBatchMillis >= MQTT_BATCH_INTERVAL_MS) {
+      lastBatchMillis = millis();
+      publishEvents();
+    }
+    if (millis() - lastMetricsMillis >= MQTT_METRICS_INTERVAL_MS) {
+      lastMetricsMillis = millis();
+      publishMetrics();
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+bool MqttManager::connect() {
+  String statusTopic = topic("status");
+  bool ok;
+  if (username.isEmpty())
+    ok = client.connect(clientId.c_str(), statusTopic.c_str(), 1, true, "offline");
+  else
+    ok = client.connect(clientId.c_str(), username.c_str(), password.c_str(), statusTopic.c_str(), 1, true, "offline");
+  if (!ok)
+    return false;
+
+  reconnectCount++;
+  client.publish(statusTopic.c_str(), "online", true);
+  client.subscribe(topic("ignoreTouchRing").c_str(), 1);
+  client.subscribe(topic("led").c_str(), 1);
+  client.subscribe(topic("openDoor").c_str(), 1);
+  Serial.println("MQTT: connected to " + server);
+  return true;
+}
+
+// called by client.loop() in the mqtt task
+void MqttManager::onMessage(char *topic, uint8_t *data, unsigned int length) {
+  char value[16];
+  size_t valueLength = min((size_t)length, sizeof(value) - 1);
+  memcpy(value, data, valueLength);
+  value[valueLength] = 0;
+
+  if (strncmp(topic, rootTopic.c_str(), rootTopic.length()) != 0 || topic[rootTopic.length()] != '/')
+    return;
+  const char *name = topic + rootTopic.length() + 1; // topic without "<root>/"
+  if (strcmp(name, "ignoreTouchRing") == 0) {
+    SensorCommand cmd;
+    cmd.type = SensorCommandType::setIgnoreTouchRing;
+    cmd.value = (strcmp(value, "on") == 0) ? 1 : 0;
+    sensorTask->post(cmd);
+  } else if (strcmp(name, "led") == 0) {
+    if (strcmp(value, "ready") == 0)
+      sensorTask->postLed(LedMode::ready);
+    else if (strcmp(value, "error") == 0)
+      sensorTask->postLed(LedMode::error);
+    else if (strcmp(value, "wifiConfig") == 0)
+      sensorTask->postLed(LedMode::wifiConfig);
+  } else if (strcmp(name, "openDoor") == 0) {
+    portENTER_CRITICAL(&mux);
+    pendingRequests |= MQTT_REQUEST_OPEN_DOOR;
+    portEXIT_CRITICAL(&mux);
+  }
+}
+
+void MqttManager::publishEvents() {
+  uint32_t head = eventStream.getHead();
+  if (head - cursor > EVENT_STREAM_SIZE) {
+    droppedEvents += head - cursor - EVENT_STREAM_SIZE;
+    cursor = head - EVENT_STREAM_SIZE;
+  }
+
+  String eventsTopic = topic("events");
+  StreamEvent event;
+  bool pending = false; // an event still being written ends the batch, it is published with the next call
+  while (cursor != head && !pending) {
+    JsonArray events = doc.to<JsonArray>();
+    while (cursor != head && events.size() < MQTT_BATCH_MAX_EVENTS) {
+      StreamRead result = eventStream.read(cursor, event);
+      if (result == StreamRead::pending) {
+        pending = true;
+        break;
+      }
+      if (result == StreamRead::overwritten)
+        droppedEvents++;
+      else if (event.type != StreamEventType::log) {
+        JsonObject entry = events.createNestedObject();
+        entry["s"] = event.sequence;
+        if (event.timestamp != 0)
+          entry["ts"] = event.timestamp;
+        entry["t"] = EventStream::getTypeName(event.type);
+        entry["id"] = event.id;
+        entry["v"] = event.value;
+        if (event.text[0] != 0)
+          entry["m"] = event.text;
+      }
+      cursor++;
+    }
+    if (events.size() == 0)
+      continue;
+    size_t length = serializeJson(doc, payload, sizeof(payload));
+    client.publish(eventsTopic.c_str(), (const uint8_t*)payload, length, false);
+  }
+}
+
+void MqttManager::publishMetrics() {
+  doc.clear();
+  doc["uptime"] = millis() / 1000;
+  doc["freeHeap"] = ESP.getFreeHeap();
+  doc["reconnects"] = reconnectCount;
+  doc["droppedEvents"] = droppedEvents;
+  JsonObject latency = doc.createNestedObject("latency");
+  for (int i = 0; i < (int)LatencyStage::count; i++) {
+    LatencySummary summary = latencyMetrics.getSummary((LatencyStage)i);
+    if (summary.count == 0)
+      continue;
+    JsonObject stage = latency.createNestedObject(LatencyMetrics::getStageName((LatencyStage)i));
+    stage["n"] = summary.count;
+    stage["p50"] = summary.p50;
+    stage["p99"] = summary.p99;
+    stage["max"] = summary.max;
+  }
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+  client.publish(topic("metrics").c_str(), (const uint8_t*)payload, length, false);
+}
+
+String MqttManager::topic(const char *name) {
+  return rootTopic + "/" + name;
+}
+
+bool MqttManager::isConnected() {
+  return connected;
+}
+
+uint8_t MqttManager::takeRequests() {
+  portENTER_CRITICAL(&mux);
+  uint8_t requests = pendingRequests;
+  pendingRequests = 0;
+  portEXIT_CRITICAL(&mux);
+  return requests;
+}
@@ -0,0 +1,85 @@
+#ifndef MQTTMANAGER_H
+#define MQTTMANAGER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+
+#include "SensorTask.h"
+#include "SettingsManager.h"
+
+#define MQTT_TASK_CORE 1
+#define MQTT_TASK_PRIORITY 1
+#define MQTT_TASK_STACK_SIZE 6144
+#define MQTT_PORT 1883
+#define MQTT_BUFFER_SIZE 1536
+#define MQTT_BATCH_INTERVAL_MS 250      // events of a burst are collected and published as one message
+#define MQTT_BATCH_MAX_EVENTS 8
+#define MQTT_METRICS_INTERVAL_MS 60000
+#define MQTT_RECONNECT_MIN_MS 1000      // reconnect backoff, doubled after each failed attempt
+#define MQTT_RECONNECT_MAX_MS 60000
+
+// work for loop(), collected by takeRequests()
+enum MqttRequest : uint8_t {
+  MQTT_REQUEST_OPEN_DOOR = 0x01
+};
+
+/*
+  MQTT client running in its own task, so connecting and reconnecting (with exponential backoff) never blocks loop().
+  Disabled when no MQTT server is configured.
+
+  Published (below the configured root topic):
+    status            "online" / "offline" (retained, last will)
+    events            JSON array of the events of the event stream since the last publish (no log messages), at most
+                      one message per MQTT_BATCH_INTERVAL_MS. A noMatch event is a ring of the door bell.
+    metrics           JSON with latency percentiles and counters, every MQTT_METRICS_INTERVAL_MS
+  Subscribed (QoS 1):
+    ignoreTouchRing   "on" / "off", e.g. from a rain sensor
+    led               "ready" / "error" / "wifiConfig"
+    openDoor          any payload
+  PubSubClient publishes with QoS 0 only, events are not resent after a lost connection.
+*/
+class MqttManager {
+  private:
+    WiFiClient wifiClient;
+    PubSubClient client;
+    SensorTask *sensorTask = nullptr;
+    String server;
+    String username;
+    String password;
+    String rootTopic;
+    String clientId;
+    TaskHandle_t taskHandle = nullptr;
+
+    uint32_t cursor = 0; // next sequence of the event stream to publish
+    unsigned long lastConnectAttemptMillis = 0;
+    unsigned long reconnectDelayMs = MQTT_RECONNECT_MIN_MS;
+    unsigned long lastBatchMillis = 0;
+    unsigned long lastMetricsMillis = 0;
+    uint32_t reconnectCount = 0;
+    uint32_t droppedEvents = 0;
+    volatile bool connected = false;
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint8_t pendingRequests = 0;
+
+    StaticJsonDocument<MQTT_BUFFER_SIZE> doc;
+    char payload[MQTT_BUFFER_SIZE];
+
+    static void taskMain(void *parameter);
+    void run();
+    bool connect();
+    void onMessage(char *topic, uint8_t *data, unsigned int length);
+    void publishEvents();
+    void publishMetrics();
+    String topic(const char *name);
+
+  public:
+    MqttManager();
+    bool begin(const AppSettings &settings, SensorTask *task);
+    bool isConnected();
+    uint8_t takeRequests(); // MqttRequest flags set since the last call
+};
+
+#endif
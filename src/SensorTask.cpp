@@ -0,0 +1,345 @@
+#include "SensorTask.h"
+#include "global.h"
+#include "BootTimeline.h"
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+
+bool SensorTask::begin(FingerprintManager *manager) {
+  fingerManager = manager;
+  commandQueue = xQueueCreate(SENSOR_COMMAND_QUEUE_LENGTH, sizeof(SensorCommand));
+  eventQueue = xQueueCreate(SENSOR_EVENT_QUEUE_LENGTH, sizeof(SensorEvent));
+  if (commandQueue == nullptr || eventQueue == nullptr) {
+    Serial.println("Sensor task: could not create queues");
+    return false;
+  }
+
+  if (xTaskCreatePinnedToCore(taskMain, "sensor", SENSOR_TASK_STACK_SIZE, this, SENSOR_TASK_PRIORITY, &taskHandle, SENSOR_TASK_CORE) != pdPASS) {
+    Serial.println("Sensor task: could not create task");
+    taskHandle = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool SensorTask::isRunning() {
+  return taskHandle != nullptr;
+}
+
+void SensorTask::taskMain(void *parameter) {
+  static_cast<SensorTask*>(parameter)->run();
+}
+
+void SensorTask::bootSensor() {
+  SensorEvent event;
+  event.type = SensorEventType::ready;
+  event.ok = fingerManager->connect();
+  if (event.ok) {
+    event.fingerOnSensor = fingerManager->isFingerOnSensor();
+    if (!event.fingerOnSensor)
+      fingerManager->setLedRingReady(); // don't wait for loop(), setup() may still be busy with the journal
+    bootTimeline.mark(BootStage::doorReady);
+  }
+  lastActivityMillis = millis();
+  reconnectStartMillis = millis();
+  reconnectBackoffMillis = SENSOR_RECONNECT_BACKOFF_MS;
+  postEvent(event);
+}
+
+// while the sensor is missing there is nothing to scan, the handshake is retried with a growing backoff instead
+void SensorTask::reconnectSensor() {
+  if ((millis() - reconnectStartMillis) < reconnectBackoffMillis)
+    return;
+  reconnectStartMillis = millis();
+  if (!fingerManager->connect()) {
+    reconnectBackoffMillis = min(reconnectBackoffMillis * 2, (unsigned long)SENSOR_RECONNECT_BACKOFF_MAX_MS);
+    return;
+  }
+  reconnectBackoffMillis = SENSOR_RECONNECT_BACKOFF_MS;
+  fingerManager->setLedRingReady();
+  bootTimeline.mark(BootStage::doorReady);
+  lastActivityMillis = millis();
+
+  SensorEvent event;
+  event.type = SensorEventType::ready;
+  event.ok = true; // fingerOnSensor only selects the WiFi config mode at boot
+  postEvent(event);
+}
+
+void SensorTask::run() {
+  bootSensor();
+  for (;;) {
+    fingerManager->process();
+
+    // commands are executed between scans only, a started scan owns the sensor buffers until it is finished.
+    // One command per iteration, a steady stream of commands must not keep a touch from being scanned.
+    bool scanInProgress = fingerManager->isScanInProgress();
+    if (!scanInProgress) {
+      SensorCommand cmd;
+      if (xQueueReceive(commandQueue, &cmd, pdMS_TO_TICKS(SENSOR_IDLE_POLL_MS)) == pdTRUE) {
+        lastActivityMillis = millis();
+        execute(cmd);
+      }
+    } else {
+      lastActivityMillis = millis();
+    }
+
+    if (!fingerManager->connected) {
+      reconnectSensor();
+      continue;
+    }
+
+    if ((millis() - scanHoldStartMillis) >= scanHoldDurationMillis)
+      scan();
+
+    if (shouldSleep())
+      enterIdleSleep();
+  }
+}
+
+void SensorTask::setIdleSleep(bool enabled, SleepCheckCallback canSleep, SleepCallback beforeSleep, SleepCallback afterWake) {
+  canSleepCallback = canSleep;
+  beforeSleepCallback = beforeSleep;
+  afterWakeCallback = afterWake;
+  lastActivityMillis = millis();
+  idleSleepEnabled = enabled;
+}
+
+bool SensorTask::shouldSleep() {
+  if (!idleSleepEnabled || !fingerManager->connected)
+    return false;
+  // without the touch ring there is no wakeup source for a finger on the sensor
+  if (fingerManager->isIgnoringTouchRing() || fingerManager->isScanInProgress())
+    return false;
+  if ((millis() - lastActivityMillis) < IDLE_SLEEP_AFTER_MS || (millis() - scanHoldStartMillis) < scanHoldDurationMillis)
+    return false;
+  if (uxQueueMessagesWaiting(commandQueue) > 0 || uxQueueMessagesWaiting(eventQueue) > 0)
+    return false;
+  return canSleepCallback == nullptr || canSleepCallback();
+}
+
+void SensorTask::enterIdleSleep() {
+  fingerManager->flushFingerList();
+  fingerManager->process(); // pending LED update
+  if (beforeSleepCallback != nullptr)
+    beforeSleepCallback();
+
+  gpio_num_t pin = (gpio_num_t)touchRingPin;
+  // the wakeup level shares the interrupt type of the pin: with the edge interrupt still enabled a LOW level would
+  // fire the touch ring ISR over and over while the ring is touched
+  gpio_intr_disable(pin);
+  gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL); // LOW = touched
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(IDLE_SLEEP_TIMER_WAKEUP_US);
+  Serial.flush();
+
+  esp_light_sleep_start();
+
+  uint32_t wakeupMicros = micros();
+  // back to the edge interrupt of the touch ring
+  gpio_wakeup_disable(pin);
+  gpio_set_intr_type(pin, GPIO_INTR_NEGEDGE);
+  gpio_intr_enable(pin);
+
+  bool touched = (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO);
+  fingerManager->onWakeFromSleep(touched, wakeupMicros);
+  lastActivityMillis = millis();
+
+  if (afterWakeCallback != nullptr)
+    afterWakeCallback();
+}
+
+void SensorTask::scan() {
+  Match match = fingerManager->scanFingerprint();
+  if (match.scanResult == ScanResult::noFinger || match.scanResult == ScanResult::scanning)
+    return;
+  lastActivityMillis = millis();
+
+  SensorEvent event;
+  event.type = SensorEventType::scan;
+  event.match = match;
+  if (match.scanResult == ScanResult::matchFound) {
+    // read the pairing code right away, so loop() can verify the sensor was not replaced without another sensor access
+    fingerManager->getPairingCode().toCharArray(event.text, sizeof(event.text));
+    scanHoldStartMillis = millis();
+    scanHoldDurationMillis = 3000;
+  } else if (match.scanResult == ScanResult::noMatchFound) {
+    scanHoldStartMillis = millis();
+    scanHoldDurationMillis = 1000;
+  }
+  postEvent(event);
+}
+
+void SensorTask::execute(const SensorCommand &cmd) {
+  SensorEvent event;
+  event.id = cmd.id;
+
+  switch (cmd.type) {
+    case SensorCommandType::enroll:
+      event.type = SensorEventType::enrollDone;
+      event.newFinger = fingerManager->enrollFinger(cmd.id, String(cmd.text));
+      event.ok = (event.newFinger.enrollResult == EnrollResult::ok);
+      if (event.ok)
+        fingerManager->setFingersRegistred(cmd.id);
+      break;
+    case SensorCommandType::deleteFinger:
+      event.type = SensorEventType::deleteDone;
+      event.ok = (fingerManager->deleteFinger(cmd.id) == FINGERPRINT_OK);
+      break;
+    case SensorCommandType::renameFinger:
+      event.type = SensorEventType::renameDone;
+      fingerManager->renameFinger(cmd.id, String(cmd.text));
+      event.ok = true;
+      break;
+    case SensorCommandType::deleteAll:
+      event.type = SensorEventType::deleteAllDone;
+      event.ok = fingerManager->deleteAll();
+      break;
+    case SensorCommandType::setLed:
+      switch ((LedMode)cmd.value) {
+        case LedMode::ready:      fingerManager->setLedRingReady(); break;
+        case LedMode::error:      fingerManager->setLedRingError(); break;
+        case LedMode::wifiConfig: fingerManager->setLedRingWifiConfig(); break;
+      }
+      return; // no result event
+    case SensorCommandType::setIgnoreTouchRing:
+      fingerManager->setIgnoreTouchRing(cmd.value != 0);
+      return; // no result event
+    case SensorCommandType::flush:
+      fingerManager->flushFingerList();
+      return; // no result event
+    case SensorCommandType::readNotepad:
+      event.type = SensorEventType::notepadRead;
+      fingerManager->getPairingCode().toCharArray(event.text, sizeof(event.text));
+      event.ok = (event.text[0] != 0);
+      break;
+    case SensorCommandType::writeNotepad:
+      event.type = SensorEventType::notepadWritten;
+      event.ok = fingerManager->setPairingCode(String(cmd.text));
+      strlcpy(event.text, cmd.text, sizeof(event.text));
+      break;
+    case SensorCommandType::exportTemplates:
+    case SensorCommandType::importTemplates:
+    {
+      event.type = (cmd.type == SensorCommandType::exportTemplates) ? SensorEventType::exportDone : SensorEventType::importDone;
+      int count = (cmd.type == SensorCommandType::exportTemplates) ? fingerManager->exportSensorDB() : fingerManager->importSensorDB();
+      event.ok = (count >= 0);
+      event.id = event.ok ? count : 0;
+      break;
+    }
+    case SensorCommandType::deleteBatch:
+      event.type = SensorEventType::deleteBatchDone;
+      event.id = fingerManager->deleteFingers(batch);
+      event.ok = (event.id == batch.count());
+      releaseBatch();
+      break;
+    case SensorCommandType::renameBatch:
+      event.type = SensorEventType::renameBatchDone;
+      event.id = fingerManager->renameFingers(batch);
+      event.ok = true;
+      releaseBatch();
+      break;
+  }
+  postEvent(event);
+}
+
+void SensorTask::postEvent(const SensorEvent &event) {
+  if (xQueueSend(eventQueue, &event, pdMS_TO_TICKS(100)) != pdTRUE)
+    Serial.println("Sensor task: event queue full, result dropped");
+}
+
+bool SensorTask::post(const SensorCommand &cmd) {
+  if (commandQueue == nullptr)
+    return false;
+  return xQueueSend(commandQueue, &cmd, 0) == pdTRUE;
+}
+
+bool SensorTask::postEnroll(uint16_t id, const String &name) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::enroll;
+  cmd.id = id;
+  name.toCharArray(cmd.text, sizeof(cmd.text));
+  return post(cmd);
+}
+
+void SensorTask::cancelEnroll() {
+  fingerManager->requestEnrollCancel();
+}
+
+bool SensorTask::postDelete(uint16_t id) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::deleteFinger;
+  cmd.id = id;
+  return post(cmd);
+}
+
+bool SensorTask::postRename(uint16_t id, const String &newName) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::renameFinger;
+  cmd.id = id;
+  newName.toCharArray(cmd.text, sizeof(cmd.text));
+  return post(cmd);
+}
+
+bool SensorTask::postLed(LedMode mode) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::setLed;
+  cmd.value = (uint8_t)mode;
+  return post(cmd);
+}
+
+bool SensorTask::postReadPairingCode() {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::readNotepad;
+  return post(cmd);
+}
+
+bool SensorTask::postWritePairingCode(const String &pairingCode) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::writeNotepad;
+  pairingCode.toCharArray(cmd.text, sizeof(cmd.text));
+  return post(cmd);
+}
+
+bool SensorTask::postFlush() {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::flush;
+  return post(cmd);
+}
+
+bool SensorTask::postExportTemplates() {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::exportTemplates;
+  return post(cmd);
+}
+
+bool SensorTask::postImportTemplates() {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::importTemplates;
+  return post(cmd);
+}
+
+FingerNameTable* SensorTask::acquireBatch() {
+  if (batchInUse.exchange(true))
+    return nullptr;
+  batch.clear();
+  return &batch;
+}
+
+void SensorTask::releaseBatch() {
+  batchInUse = false;
+}
+
+bool SensorTask::postBatch(SensorCommandType type) {
+  SensorCommand cmd;
+  cmd.type = type;
+  if (post(cmd))
+    return true;
+  releaseBatch();
+  return false;
+}
+
+bool SensorTask::pollEvent(SensorEvent &event) {
+  if (eventQueue == nullptr)
+    return false;
+  return xQueueReceive(eventQueue, &event, 0) == pdTRUE;
+}
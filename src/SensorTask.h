@@ -0,0 +1,120 @@
+#ifndef SENSORTASK_H
+#define SENSORTASK_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "FingerprintManager.h"
+
+#define SENSOR_TASK_CORE 0 // loop() and the HTTP side run on core 1
+#define SENSOR_TASK_PRIORITY 2
+#define SENSOR_TASK_STACK_SIZE 8192
+#define SENSOR_COMMAND_QUEUE_LENGTH 16
+#define SENSOR_EVENT_QUEUE_LENGTH 8
+#define SENSOR_IDLE_POLL_MS 10 // max. wait for a command while no scan is in progress
+#define SENSOR_RECONNECT_BACKOFF_MS 10000      // first retry of a failed sensor handshake, doubled on every failure
+#define SENSOR_RECONNECT_BACKOFF_MAX_MS 300000
+#define IDLE_SLEEP_AFTER_MS 30000                       // enter light sleep after this time without any sensor activity
+#define IDLE_SLEEP_TIMER_WAKEUP_US (300ull * 1000000ull) // wake up every 5 minutes for housekeeping (journal upload etc.)
+
+/*
+  The sensor task is the only owner of the R503 (Serial2). It starts with the sensor handshake and the finger list load,
+  while setup() goes on with WiFi and the network services, and reports the outcome with a ready event. Every other task talks to the sensor by posting
+  commands into a queue, results come back as events which are drained by loop(). Scanning continues between commands.
+  Without a sensor nothing is scanned, the handshake is retried with backoff and another ready event reports success.
+
+  With idle sleep enabled the task puts the ESP32 into light sleep when nothing happened for IDLE_SLEEP_AFTER_MS.
+  The touch ring pin and a timer wake it up again. WiFi can't be kept alive during light sleep, it is handled by the
+  beforeSleep/afterWake callbacks.
+
+  Bulk operations don't fit into a command, their ids and names are passed in one preallocated batch table: acquireBatch(),
+  fill it, postBatch(). The table belongs to the sensor task until the command is executed.
+*/
+
+enum class SensorCommandType { enroll, deleteFinger, renameFinger, deleteAll, setLed, readNotepad, writeNotepad, setIgnoreTouchRing, flush, exportTemplates, importTemplates, deleteBatch, renameBatch };
+enum class LedMode { ready, error, wifiConfig };
+
+struct SensorCommand {
+  SensorCommandType type;
+  uint16_t id = 0;      // finger id or notepad page
+  uint8_t value = 0;    // LedMode, ignoreTouchRing state
+  char text[FINGER_NAME_MAX_LENGTH + 1] = ""; // finger name or notepad content
+};
+
+enum class SensorEventType { ready, scan, enrollDone, deleteDone, renameDone, deleteAllDone, notepadRead, notepadWritten, exportDone, importDone, deleteBatchDone, renameBatchDone };
+
+struct SensorEvent {
+  SensorEventType type;
+  Match match;          // scan result (type scan only)
+  NewFinger newFinger;  // enroll result (type enrollDone only)
+  uint16_t id = 0;      // finger id, number of fingers/templates for the bulk operations
+  bool ok = false;      // ready: sensor found
+  bool fingerOnSensor = false; // ready: a finger was on the sensor at boot (WiFi config mode)
+  char text[FINGER_NAME_MAX_LENGTH + 1] = ""; // pairing code read from sensor after a match, notepad content
+};
+
+typedef bool (*SleepCheckCallback)();
+typedef void (*SleepCallback)();
+
+class SensorTask {
+  private:
+    FingerprintManager *fingerManager = nullptr;
+    QueueHandle_t commandQueue = nullptr;
+    QueueHandle_t eventQueue = nullptr;
+    TaskHandle_t taskHandle = nullptr;
+
+    unsigned long scanHoldStartMillis = 0;
+    unsigned long scanHoldDurationMillis = 0; // feedback hold after a scan result to let the LED show the result
+
+    unsigned long reconnectStartMillis = 0;
+    unsigned long reconnectBackoffMillis = SENSOR_RECONNECT_BACKOFF_MS;
+
+    volatile bool idleSleepEnabled = false;
+    unsigned long lastActivityMillis = 0;
+    SleepCheckCallback canSleepCallback = nullptr;
+    SleepCallback beforeSleepCallback = nullptr;
+    SleepCallback afterWakeCallback = nullptr;
+
+    FingerNameTable batch;
+    std::atomic<bool> batchInUse{false};
+
+    static void taskMain(void *parameter);
+    void run();
+    void bootSensor();
+    void reconnectSensor();
+    void execute(const SensorCommand &cmd);
+    void scan();
+    void postEvent(const SensorEvent &event);
+    bool shouldSleep();
+    void enterIdleSleep();
+
+  public:
+    bool begin(FingerprintManager *manager);
+    bool isRunning();
+
+    // callbacks are invoked from the sensor task
+    void setIdleSleep(bool enabled, SleepCheckCallback canSleep = nullptr, SleepCallback beforeSleep = nullptr, SleepCallback afterWake = nullptr);
+
+    // non-blocking, returns false if the queue is full
+    bool post(const SensorCommand &cmd);
+    bool postEnroll(uint16_t id, const String &name);
+    void cancelEnroll(); // takes effect right away, a running enrollment doesn't read the queue
+    bool postDelete(uint16_t id);
+    bool postRename(uint16_t id, const String &newName);
+    bool postLed(LedMode mode);
+    bool postReadPairingCode();
+    bool postWritePairingCode(const String &pairingCode);
+    bool postFlush(); // write pending finger list changes now, e.g. before a reboot
+    bool postExportTemplates(); // sensor DB into the template archive on SPIFFS
+    bool postImportTemplates(); // template archive into the (new) sensor
+
+    // nullptr while the previous batch is still pending
+    FingerNameTable* acquireBatch();
+    void releaseBatch(); // not posted after all
+    // deleteBatch: fingers occupied in the batch, renameBatch: names in the batch. The batch is released if the queue is full.
+    bool postBatch(SensorCommandType type);
+
+    // called by loop() to get the results
+    bool pollEvent(SensorEvent &event);
+};
+
+#endif
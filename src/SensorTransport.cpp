@@ -0,0 +1,202 @@
+#include "SensorTransport.h"
+
+uint8_t SensorTransport::sendCommand(const uint8_t *data, uint16_t length, Adafruit_Fingerprint_Packet &reply) {
+  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, length, const_cast<uint8_t*>(data));
+  writeStructuredPacket(packet);
+  if (getStructuredPacket(&reply) != FINGERPRINT_OK)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  if (reply.type != FINGERPRINT_ACKPACKET)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  return reply.data[0];
+}
+
+uint8_t SensorTransport::writeNotepad(uint8_t pageNumber, const char *text, uint8_t length) {
+  uint8_t data[34];
+
+  if (length>32)
+    length = 32;
+
+  data[0] = FINGERPRINT_WRITENOTEPAD;
+  data[1] = pageNumber;
+  for (int i=0; i<length; i++)
+    data[i+2] = text[i];
+
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  return sendCommand(data, sizeof(data), reply);
+}
+
+uint8_t SensorTransport::readNotepad(uint8_t pageNumber, char *text, uint8_t length) {
+  uint8_t data[2];
+
+  data[0] = FINGERPRINT_READNOTEPAD;
+  data[1] = pageNumber;
+
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  uint8_t returnCode = sendCommand(data, sizeof(data), reply);
+
+  if (returnCode == FINGERPRINT_OK) {
+    // read data payload
+    for (uint8_t i=0; i<length; i++) {
+      text[i] = reply.data[i+1];
+    }
+  }
+
+  return returnCode;
+}
+
+uint8_t SensorTransport::deleteTemplates(uint16_t startId, uint16_t count) {
+  uint8_t data[5] = { FINGERPRINT_DELETE, (uint8_t)(startId >> 8), (uint8_t)(startId & 0xFF), (uint8_t)(count >> 8), (uint8_t)(count & 0xFF) };
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  return sendCommand(data, sizeof(data), reply);
+}
+
+uint8_t SensorTransport::readIndexTable(uint8_t page, uint8_t *bitmap) {
+  uint8_t data[2] = { FINGERPRINT_READINDEXTABLE, page };
+
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  uint8_t returnCode = sendCommand(data, sizeof(data), reply);
+  if (returnCode == FINGERPRINT_OK)
+    memcpy(bitmap, &reply.data[1], 32);
+  return returnCode;
+}
+
+uint8_t SensorTransport::uploadTemplate() {
+  uint8_t data[2] = { FINGERPRINT_UPCHAR, 0x01 };
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  return sendCommand(data, sizeof(data), reply);
+}
+
+uint8_t SensorTransport::downloadTemplate() {
+  uint8_t data[2] = { FINGERPRINT_DOWNCHAR, 0x01 };
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(data), data); // overwritten by the answer
+  return sendCommand(data, sizeof(data), reply);
+}
+
+uint8_t SensorTransport::readDataPacket(uint8_t *data, uint16_t maxLength, uint16_t &length, bool &last) {
+  // start code, address, packet id, length (payload + checksum)
+  uint8_t header[9];
+  if (serial->readBytes(header, sizeof(header)) != sizeof(header))
+    return FINGERPRINT_TIMEOUT;
+  uint8_t type = header[6];
+  uint16_t packetLength = ((uint16_t)header[7] << 8) | header[8];
+  if (header[0] != (FINGERPRINT_STARTCODE >> 8) || header[1] != (FINGERPRINT_STARTCODE & 0xFF) ||
+      (type != FINGERPRINT_DATAPACKET && type != FINGERPRINT_ENDDATAPACKET) || packetLength < 2 || packetLength - 2 > maxLength)
+    return FINGERPRINT_BADPACKET;
+
+  length = packetLength - 2;
+  uint8_t checksum[2];
+  if (serial->readBytes(data, length) != length || serial->readBytes(checksum, sizeof(checksum)) != sizeof(checksum))
+    return FINGERPRINT_TIMEOUT;
+  uint16_t sum = type + header[7] + header[8];
+  for (uint16_t i=0; i<length; i++)
+    sum += data[i];
+  if (sum != (((uint16_t)checksum[0] << 8) | checksum[1]))
+    return FINGERPRINT_BADPACKET;
+
+  last = (type == FINGERPRINT_ENDDATAPACKET);
+  return FINGERPRINT_OK;
+}
+
+// data packets are not acknowledged, the sensor answers the next command only
+uint8_t SensorTransport::writeDataPacket(const uint8_t *data, uint16_t length, bool last) {
+  if (length > SENSOR_DATA_PACKET_MAX_SIZE)
+    return FINGERPRINT_BADPACKET;
+  uint8_t type = last ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET;
+  uint16_t packetLength = length + 2;
+  // header, data and checksum go out in one write, a failed write sends no part of the packet
+  uint8_t packet[9 + SENSOR_DATA_PACKET_MAX_SIZE + 2] = { FINGERPRINT_STARTCODE >> 8, FINGERPRINT_STARTCODE & 0xFF,
+                                                          0xFF, 0xFF, 0xFF, 0xFF, // default address
+                                                          type, (uint8_t)(packetLength >> 8), (uint8_t)(packetLength & 0xFF) };
+  memcpy(&packet[9], data, length);
+  uint16_t sum = type + packet[7] + packet[8];
+  for (uint16_t i=0; i<length; i++)
+    sum += data[i];
+  packet[9 + length] = sum >> 8;
+  packet[10 + length] = sum & 0xFF;
+
+  size_t size = 11 + length;
+  return serial->write(packet, size) == size ? FINGERPRINT_OK : FINGERPRINT_PACKETRECIEVEERR;
+}
+
+void SensorTransport::discardInput() {
+  delay(100); // let the sensor finish what it is sending
+  while (serial->available() > 0)
+    serial->read();
+}
+
+bool SensorTransport::connect() {
+  begin(SENSOR_BAUD_RATE);
+  delay(50);
+  if (verifyPassword()) {
+    baudRate = SENSOR_BAUD_RATE;
+    return true;
+  }
+
+  // the sensor keeps its baud rate over power cycles, so this is usually a new sensor
+  begin(SENSOR_DEFAULT_BAUD_RATE);
+  delay(50);
+  if (!verifyPassword())
+    return false;
+  baudRate = SENSOR_DEFAULT_BAUD_RATE;
+
+  uint8_t baudSetting = SENSOR_BAUD_RATE / 9600; // register value is a multiple of 9600
+  if (setBaudRate(baudSetting) == FINGERPRINT_OK) {
+    begin(SENSOR_BAUD_RATE);
+    delay(50);
+    if (verifyPassword()) {
+      Serial.print("Sensor baud rate switched to "); Serial.println(SENSOR_BAUD_RATE);
+      baudRate = SENSOR_BAUD_RATE;
+      return true;
+    }
+    begin(SENSOR_DEFAULT_BAUD_RATE);
+    delay(50);
+  }
+  Serial.println("Could not switch sensor baud rate, staying at default.");
+  return true;
+}
+
+uint32_t SensorTransport::getBaudRate() {
+  return baudRate;
+}
+
+void SensorTransport::setLed(uint8_t control, uint8_t speed, uint8_t color, uint8_t count) {
+  LedState state = { control, speed, color, count };
+  if (!ledIsPending && ledShownValid && memcmp(&state, &ledShown, sizeof(state)) == 0)
+    return; // already shown, save the round trip
+  ledPending = state;
+  ledIsPending = true;
+}
+
+uint8_t SensorTransport::flushLed() {
+  if (!ledIsPending)
+    return FINGERPRINT_OK;
+  ledIsPending = false;
+  uint8_t returnCode = LEDcontrol(ledPending.control, ledPending.speed, ledPending.color, ledPending.count);
+  ledShown = ledPending;
+  ledShownValid = (returnCode == FINGERPRINT_OK);
+  return returnCode;
+}
+
+uint8_t SensorTransport::getImagePipelined() {
+  if (!ledIsPending)
+    return getImage();
+
+  uint8_t ledData[5] = { FINGERPRINT_AURALEDCONFIG, ledPending.control, ledPending.speed, ledPending.color, ledPending.count };
+  uint8_t imageData[1] = { FINGERPRINT_GETIMAGE };
+  Adafruit_Fingerprint_Packet ledPacket(FINGERPRINT_COMMANDPACKET, sizeof(ledData), ledData);
+  Adafruit_Fingerprint_Packet imagePacket(FINGERPRINT_COMMANDPACKET, sizeof(imageData), imageData);
+
+  // the sensor handles the commands one after another, so both acks arrive in order
+  writeStructuredPacket(ledPacket);
+  writeStructuredPacket(imagePacket);
+  ledIsPending = false;
+  ledShown = ledPending;
+
+  Adafruit_Fingerprint_Packet reply(FINGERPRINT_ACKPACKET, sizeof(imageData), imageData); // overwritten by the answer
+  ledShownValid = (getStructuredPacket(&reply) == FINGERPRINT_OK && reply.type == FINGERPRINT_ACKPACKET && reply.data[0] == FINGERPRINT_OK);
+  if (getStructuredPacket(&reply) != FINGERPRINT_OK)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  if (reply.type != FINGERPRINT_ACKPACKET)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  return reply.data[0];
+}
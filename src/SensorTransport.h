@@ -0,0 +1,68 @@
+#ifndef SENSORTRANSPORT_H
+#define SENSORTRANSPORT_H
+
+#include <Adafruit_Fingerprint.h>
+
+#define FINGERPRINT_WRITENOTEPAD 0x18 // Write Notepad on sensor
+#define FINGERPRINT_READNOTEPAD 0x19 // Read Notepad from sensor
+#define FINGERPRINT_UPCHAR 0x08 // upload the template in a char buffer to the host
+#define FINGERPRINT_DOWNCHAR 0x09 // download a template from the host into a char buffer
+#define FINGERPRINT_READINDEXTABLE 0x1F // occupied template slots, 32 bytes per page of 256 ids
+
+#define SENSOR_DEFAULT_BAUD_RATE 57600 // factory setting of the R503
+#define SENSOR_BAUD_RATE 115200        // baud rate the sensor is switched to on connect
+#define SENSOR_DATA_PACKET_MAX_SIZE 256 // largest packet length setting of the R503
+
+/*
+  All packet level communication with the R503 goes through this class. Commands the Adafruit library does not
+  support are sent as raw command packets with sendCommand().
+
+  LED updates are deferred: setLed() only remembers the new state (and drops it if it is already shown), the command is
+  sent together with the next getImage (both packets are written back-to-back, then both acks are read) or by flushLed().
+
+  Template transfers use data packets of up to SENSOR_DATA_PACKET_MAX_SIZE bytes. The Adafruit packet struct only holds
+  64 bytes, so they are read and written directly on the serial port.
+*/
+class SensorTransport : public Adafruit_Fingerprint {
+  private:
+    struct LedState {
+      uint8_t control;
+      uint8_t speed;
+      uint8_t color;
+      uint8_t count;
+    };
+    LedState ledShown = {};
+    LedState ledPending = {};
+    bool ledShownValid = false;
+    bool ledIsPending = false;
+    uint32_t baudRate = SENSOR_DEFAULT_BAUD_RATE;
+    HardwareSerial *serial;
+
+  public:
+    SensorTransport(HardwareSerial *serial) : Adafruit_Fingerprint(serial), serial(serial) {}
+
+    // finds the sensor at the fast or the default baud rate and switches it to SENSOR_BAUD_RATE
+    bool connect();
+    uint32_t getBaudRate();
+
+    void setLed(uint8_t control, uint8_t speed, uint8_t color, uint8_t count = 0);
+    uint8_t flushLed();
+    uint8_t getImagePipelined();
+
+    // sends a command packet and waits for the acknowledge, returns the confirmation code of the sensor
+    uint8_t sendCommand(const uint8_t *data, uint16_t length, Adafruit_Fingerprint_Packet &reply);
+
+    uint8_t writeNotepad(uint8_t pageNumber, const char *text, uint8_t length);
+    uint8_t readNotepad(uint8_t pageNumber, char *text, uint8_t length);
+    uint8_t deleteTemplates(uint16_t startId, uint16_t count); // one DeleteChar command for a range of ids
+    uint8_t readIndexTable(uint8_t page, uint8_t *bitmap); // bitmap of 32 bytes, bit n = id page * 256 + n
+
+    // template transfer of char buffer 1: uploadTemplate()/downloadTemplate() start it, then the data follows in packets
+    uint8_t uploadTemplate();
+    uint8_t readDataPacket(uint8_t *data, uint16_t maxLength, uint16_t &length, bool &last);
+    uint8_t downloadTemplate();
+    uint8_t writeDataPacket(const uint8_t *data, uint16_t length, bool last); // FINGERPRINT_PACKETRECIEVEERR if not written
+    void discardInput(); // after an interrupted transfer
+};
+
+#endif
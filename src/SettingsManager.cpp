@@ -1,11 +1,24 @@
 #include "SettingsManager.h"
 #include <Crypto.h>
+#include "TimeService.h"
+
+SettingsManager::SettingsManager() {
+    mutex = xSemaphoreCreateMutex();
+}
 
 bool SettingsManager::loadWifiSettings() {
     Preferences preferences;
     if (preferences.begin("wifiSettings", true)) {
         wifiSettings.ssid = preferences.getString("ssid", String(""));
         wifiSettings.password = preferences.getString("password", String(""));
+        if (preferences.getBytes("bssid", wifiSettings.bssid, sizeof(wifiSettings.bssid)) == sizeof(wifiSettings.bssid))
+            wifiSettings.channel = preferences.getUChar("channel", 0);
+        wifiSettings.ip = preferences.getUInt("ip", 0);
+        wifiSettings.gateway = preferences.getUInt("gateway", 0);
+        wifiSettings.subnet = preferences.getUInt("subnet", 0);
+        wifiSettings.dns = preferences.getUInt("dns", 0);
+        wifiSettings.leaseSeconds = preferences.getUInt("leaseSecs", 0);
+        wifiSettings.leaseStart = preferences.getUInt("leaseStart", 0);
         preferences.end();
         return true;
     } else {
@@ -18,16 +31,29 @@ void SettingsManager::saveWifiSettings() {
     preferences.begin("wifiSettings", false);
     preferences.putString("ssid", wifiSettings.ssid);
     preferences.putString("password", wifiSettings.password);
+    preferences.putBytes("bssid", wifiSettings.bssid, sizeof(wifiSettings.bssid));
+    preferences.putUChar("channel", wifiSettings.channel);
+    preferences.putUInt("ip", wifiSettings.ip);
+    preferences.putUInt("gateway", wifiSettings.gateway);
+    preferences.putUInt("subnet", wifiSettings.subnet);
+    preferences.putUInt("dns", wifiSettings.dns);
+    preferences.putUInt("leaseSecs", wifiSettings.leaseSeconds);
+    preferences.putUInt("leaseStart", wifiSettings.leaseStart);
     preferences.end();
 }
 
 WifiSettings SettingsManager::getWifiSettings() {
-    return wifiSettings;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    WifiSettings settings = wifiSettings;
+    xSemaphoreGive(mutex);
+    return settings;
 }
 
 void SettingsManager::saveWifiSettings(WifiSettings newSettings) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
     wifiSettings = newSettings;
     saveWifiSettings();
+    xSemaphoreGive(mutex);
 }
 
 bool SettingsManager::isWifiConfigured() {
@@ -43,6 +69,13 @@ bool SettingsManager::loadAppSettings() {
         appSettings.sensorPin = preferences.getString("sensorPin", "00000000");
         appSettings.sensorPairingCode = preferences.getString("pairingCode", "");
         appSettings.sensorPairingValid = preferences.getBool("pairingValid", false);
+        appSettings.apiUrl = preferences.getString("apiUrl", appSettings.apiUrl);
+        appSettings.idleSleep = preferences.getBool("idleSleep", false);
+        appSettings.mqttServer = preferences.getString("mqttServer", "");
+        appSettings.mqttUsername = preferences.getString("mqttUsername", "");
+        appSettings.mqttPassword = preferences.getString("mqttPassword", "");
+        appSettings.mqttRootTopic = preferences.getString("mqttRootTopic", appSettings.mqttRootTopic);
+        appSettings.webPassword = preferences.getString("webPassword", "");
         preferences.end();
         return true;
     } else {
@@ -56,16 +89,28 @@ void SettingsManager::saveAppSettings() {
     preferences.putString("sensorPin", appSettings.sensorPin);
     preferences.putString("pairingCode", appSettings.sensorPairingCode);
     preferences.putBool("pairingValid", appSettings.sensorPairingValid);
+    preferences.putString("apiUrl", appSettings.apiUrl);
+    preferences.putBool("idleSleep", appSettings.idleSleep);
+    preferences.putString("mqttServer", appSettings.mqttServer);
+    preferences.putString("mqttUsername", appSettings.mqttUsername);
+    preferences.putString("mqttPassword", appSettings.mqttPassword);
+    preferences.putString("mqttRootTopic", appSettings.mqttRootTopic);
+    preferences.putString("webPassword", appSettings.webPassword);
     preferences.end();
 }
 
 AppSettings SettingsManager::getAppSettings() {
-    return appSettings;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    AppSettings settings = appSettings;
+    xSemaphoreGive(mutex);
+    return settings;
 }
 
 void SettingsManager::saveAppSettings(AppSettings newSettings) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
     appSettings = newSettings;
     saveAppSettings();
+    xSemaphoreGive(mutex);
 }
 
 bool SettingsManager::deleteAppSettings() {
@@ -86,7 +131,9 @@ String SettingsManager::generateNewPairingCode() {
     /* Put some unique values as input in our new hash */
     hasher.doUpdate( String(esp_random()).c_str() ); // random number
     hasher.doUpdate( String(millis()).c_str() ); // time since boot
-    hasher.doUpdate(getTimestampString().c_str()); // current time (if NTP is available)
+    char timestamp[TIME_TIMESTAMP_LENGTH];
+    timeService.formatNow(timestamp, sizeof(timestamp));
+    hasher.doUpdate(timestamp); // current time (if NTP is available)
     hasher.doUpdate(wifiSettings.ssid.c_str());
     hasher.doUpdate(wifiSettings.password.c_str());
 
@@ -7,23 +7,43 @@
 struct WifiSettings {
     String ssid = "Xiaomi mi 9T";
     String password = "cherchepas";
+    // last connection, used for a fast connect without scan and DHCP (see WifiManager)
+    uint8_t bssid[6] = {};
+    uint8_t channel = 0; // 0 = nothing cached
+    uint32_t ip = 0;
+    uint32_t gateway = 0;
+    uint32_t subnet = 0;
+    uint32_t dns = 0;
+    uint32_t leaseSeconds = 0; // DHCP lease time of ip, 0 = unknown
+    uint32_t leaseStart = 0;   // unix time the lease was obtained, 0 if the clock was not set
 };
 
 struct AppSettings {
     String sensorPin = "00000000";
     String sensorPairingCode = "";
     bool   sensorPairingValid = false;
+    String apiUrl = "http://192.168.43.28:8000"; // base url of the user authorization API
+    bool   idleSleep = false; // light sleep while nobody is at the door (battery powered units)
+    String mqttServer = ""; // MQTT is disabled without a server
+    String mqttUsername = "";
+    String mqttPassword = "";
+    String mqttRootTopic = "fingerprintDoorbell";
+    String webPassword = ""; // REST API and event stream, generated on first boot (see WebApi)
 };
 
+// getters and setters are thread safe, the settings are read and changed by loop() and the web server
 class SettingsManager {
   private:
     AppSettings appSettings;
     WifiSettings wifiSettings;
+    SemaphoreHandle_t mutex;
 
     void saveAppSettings();
     void saveWifiSettings();
 
   public:
+    SettingsManager();
+
     bool loadAppSettings();
     bool loadWifiSettings();
 
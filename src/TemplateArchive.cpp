@@ -0,0 +1,156 @@
+#include "TemplateArchive.h"
+#include <rom/crc.h>
+
+bool TemplateArchiveWriter::begin(fs::FS &fs, const char *path, uint16_t count) {
+  crc = 0;
+  size = 0;
+  failed = false;
+  file = fs.open(path, FILE_WRITE);
+  if (!file)
+    return false;
+  TemplateArchiveHeader header = { TEMPLATE_ARCHIVE_MAGIC, TEMPLATE_ARCHIVE_VERSION, count };
+  write(&header, sizeof(header));
+  return !failed;
+}
+
+void TemplateArchiveWriter::write(const void *data, size_t length) {
+  if (failed)
+    return;
+  if (file.write((const uint8_t*)data, length) != length) {
+    failed = true;
+    return;
+  }
+  crc = crc32_le(crc, (const uint8_t*)data, length);
+  size += length;
+}
+
+void TemplateArchiveWriter::addRecord(uint16_t id, const char *name) {
+  uint8_t nameLength = strnlen(name, UINT8_MAX);
+  write(&id, sizeof(id));
+  write(&nameLength, sizeof(nameLength));
+  write(name, nameLength);
+}
+
+void TemplateArchiveWriter::addChunk(const uint8_t *data, uint16_t length, bool last) {
+  uint16_t chunkHeader = length | (last ? TEMPLATE_ARCHIVE_LAST_CHUNK : 0);
+  write(&chunkHeader, sizeof(chunkHeader));
+  write(data, length);
+}
+
+bool TemplateArchiveWriter::finish() {
+  uint32_t trailer = crc;
+  write(&trailer, sizeof(trailer));
+  file.close();
+  return !failed;
+}
+
+size_t TemplateArchiveWriter::getSize() {
+  return size;
+}
+
+
+bool TemplateArchiveReader::begin(fs::FS &fs, const char *path) {
+  failed = false;
+  recordsLeft = 0;
+  file = fs.open(path, FILE_READ);
+  if (!file)
+    return false;
+
+  // the whole archive is checked first, so a corrupted upload doesn't leave a half imported sensor
+  TemplateArchiveHeader header;
+  size_t dataSize = file.size() - sizeof(uint32_t);
+  if (file.size() < sizeof(header) + sizeof(uint32_t) || !read(&header, sizeof(header)) ||
+      header.magic != TEMPLATE_ARCHIVE_MAGIC || header.version != TEMPLATE_ARCHIVE_VERSION) {
+    end();
+    return false;
+  }
+  uint32_t crc = crc32_le(0, (const uint8_t*)&header, sizeof(header));
+  uint8_t buffer[256];
+  for (size_t offset = sizeof(header); offset < dataSize; ) {
+    size_t length = min(sizeof(buffer), dataSize - offset);
+    if (!read(buffer, length)) {
+      end();
+      return false;
+    }
+    crc = crc32_le(crc, buffer, length);
+    offset += length;
+  }
+  uint32_t trailer;
+  if (!read(&trailer, sizeof(trailer)) || trailer != crc || !file.seek(sizeof(header))) {
+    end();
+    return false;
+  }
+
+  count = header.count;
+  recordsLeft = count;
+  chunkLeft = 0;
+  lastChunk = true;
+  return true;
+}
+
+void TemplateArchiveReader::end() {
+  recordsLeft = 0;
+  if (file)
+    file.close();
+}
+
+bool TemplateArchiveReader::read(void *data, size_t length) {
+  if (failed || file.read((uint8_t*)data, length) != length)
+    failed = true;
+  return !failed;
+}
+
+uint16_t TemplateArchiveReader::getCount() {
+  return count;
+}
+
+bool TemplateArchiveReader::nextRecord(uint16_t &id, char *name, size_t nameSize) {
+  // skip what is left of the previous record
+  uint8_t buffer[64];
+  while (readData(buffer, sizeof(buffer)) > 0);
+
+  if (recordsLeft == 0 || failed)
+    return false;
+  recordsLeft--;
+
+  uint8_t nameLength;
+  if (!read(&id, sizeof(id)) || !read(&nameLength, sizeof(nameLength)))
+    return false;
+  size_t stored = min((size_t)nameLength, nameSize - 1);
+  if (!read(name, stored) || !file.seek(nameLength - stored, SeekCur)) {
+    failed = true;
+    return false;
+  }
+  name[stored] = 0;
+
+  chunkLeft = 0;
+  lastChunk = false;
+  return true;
+}
+
+size_t TemplateArchiveReader::readData(uint8_t *buffer, size_t size) {
+  size_t total = 0;
+  while (total < size && !isRecordEnd() && !failed) {
+    size_t length = min(size - total, (size_t)chunkLeft);
+    if (!read(&buffer[total], length))
+      break;
+    total += length;
+    chunkLeft -= length;
+  }
+  return total;
+}
+
+bool TemplateArchiveReader::isRecordEnd() {
+  while (chunkLeft == 0 && !lastChunk && !failed) {
+    uint16_t chunkHeader;
+    if (!read(&chunkHeader, sizeof(chunkHeader)))
+      break;
+    lastChunk = (chunkHeader & TEMPLATE_ARCHIVE_LAST_CHUNK) != 0;
+    chunkLeft = chunkHeader & ~TEMPLATE_ARCHIVE_LAST_CHUNK;
+  }
+  return chunkLeft == 0 && (lastChunk || failed);
+}
+
+bool TemplateArchiveReader::hasFailed() {
+  return failed;
+}
@@ -0,0 +1,71 @@
+#ifndef TEMPLATEARCHIVE_H
+#define TEMPLATEARCHIVE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define TEMPLATE_ARCHIVE_PATH "/templates.bin"      // last export or uploaded archive, served by GET /api/templates
+#define TEMPLATE_ARCHIVE_TEMP_PATH "/templates.tmp" // written first, renamed when complete
+#define TEMPLATE_ARCHIVE_MAGIC 0x4C505446           // "FTPL"
+#define TEMPLATE_ARCHIVE_VERSION 1
+#define TEMPLATE_ARCHIVE_LAST_CHUNK 0x8000          // flag in the chunk length
+
+/*
+  Archive of all sensor templates with their finger names, used to move the fingers to a replacement sensor.
+  It is written and read as a stream, at most one template at a time, the whole DB never is in RAM.
+
+  Layout (little endian):
+    header   magic u32, version u16, template count u16
+    record   id u16, name length u8, name, template data as chunks: length u16 (TEMPLATE_ARCHIVE_LAST_CHUNK marks the
+             last chunk of the record), data. Chunks are the data packets of the exporting sensor.
+    trailer  crc32 of everything before
+*/
+
+struct TemplateArchiveHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+};
+
+class TemplateArchiveWriter {
+  private:
+    File file;
+    uint32_t crc = 0;
+    size_t size = 0;
+    bool failed = false;
+
+    void write(const void *data, size_t length);
+
+  public:
+    bool begin(fs::FS &fs, const char *path, uint16_t count);
+    void addRecord(uint16_t id, const char *name);
+    void addChunk(const uint8_t *data, uint16_t length, bool last);
+    bool finish(); // writes the trailer, false if anything failed
+    size_t getSize();
+};
+
+class TemplateArchiveReader {
+  private:
+    File file;
+    uint16_t count = 0;
+    uint16_t recordsLeft = 0;
+    uint16_t chunkLeft = 0;  // data bytes of the current chunk not read yet
+    bool lastChunk = true;   // the current chunk is the last of the record
+    bool failed = false;
+
+    bool read(void *data, size_t length);
+
+  public:
+    bool begin(fs::FS &fs, const char *path); // checks header and crc before anything is returned
+    void end();
+    uint16_t getCount();
+
+    // name is truncated to nameSize
+    bool nextRecord(uint16_t &id, char *name, size_t nameSize);
+    // template data of the current record, returns 0 at the end of the record
+    size_t readData(uint8_t *buffer, size_t size);
+    bool isRecordEnd();
+    bool hasFailed();
+};
+
+#endif
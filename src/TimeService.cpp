@@ -0,0 +1,88 @@
+#include "TimeService.h"
+#include <sys/time.h>
+#include <time.h>
+#include <esp_timer.h>
+
+TimeService timeService;
+
+void TimeService::begin() {
+  configTime(0, 0, TIME_NTP_SERVER); // UTC, SNTP runs in background and retries on its own
+}
+
+bool TimeService::updateOffset() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  int64_t uptimeUs = esp_timer_get_time();
+  if ((uint32_t)tv.tv_sec < TIME_VALID_AFTER)
+    return false;
+
+  int64_t offsetUs = (int64_t)tv.tv_sec * 1000000ll + tv.tv_usec - uptimeUs;
+  portENTER_CRITICAL(&mux);
+  if (!synced || offsetUs > epochOffsetUs)
+    epochOffsetUs = offsetUs; // never backwards
+  lastSyncCheckUs = uptimeUs;
+  synced = true;
+  portEXIT_CRITICAL(&mux);
+  return true;
+}
+
+bool TimeService::isSynced() {
+  if (!synced)
+    return updateOffset();
+  return true;
+}
+
+uint32_t TimeService::now() {
+  int64_t uptimeUs = esp_timer_get_time();
+  if (!synced || uptimeUs - lastSyncCheckUs > TIME_RESYNC_INTERVAL_US) {
+    if (!updateOffset() && !synced)
+      return 0;
+  }
+  portENTER_CRITICAL(&mux);
+  int64_t offsetUs = epochOffsetUs;
+  portEXIT_CRITICAL(&mux);
+  return (uint32_t)((offsetUs + uptimeUs) / 1000000ll);
+}
+
+size_t TimeService::format(uint32_t unixTime, char *buffer, size_t size) {
+  if (size < TIME_TIMESTAMP_LENGTH) {
+    if (size > 0)
+      buffer[0] = 0;
+    return 0;
+  }
+
+  uint32_t minute = unixTime / 60;
+  portENTER_CRITICAL(&mux);
+  bool cached = (minute == cachedMinute && cachedPrefix[0] != 0);
+  if (cached)
+    memcpy(buffer, cachedPrefix, TIME_TIMESTAMP_LENGTH - 3);
+  portEXIT_CRITICAL(&mux);
+
+  if (!cached) {
+    time_t minuteTime = (time_t)minute * 60;
+    struct tm timeinfo;
+    gmtime_r(&minuteTime, &timeinfo);
+    strftime(buffer, size, "%Y-%m-%d %H:%M:", &timeinfo);
+    portENTER_CRITICAL(&mux);
+    memcpy(cachedPrefix, buffer, TIME_TIMESTAMP_LENGTH - 3);
+    cachedPrefix[TIME_TIMESTAMP_LENGTH - 3] = 0;
+    cachedMinute = minute;
+    portEXIT_CRITICAL(&mux);
+  }
+
+  uint32_t second = unixTime % 60;
+  buffer[TIME_TIMESTAMP_LENGTH - 3] = '0' + second / 10;
+  buffer[TIME_TIMESTAMP_LENGTH - 2] = '0' + second % 10;
+  buffer[TIME_TIMESTAMP_LENGTH - 1] = 0;
+  return TIME_TIMESTAMP_LENGTH - 1;
+}
+
+size_t TimeService::formatNow(char *buffer, size_t size) {
+  uint32_t unixTime = now();
+  if (unixTime != 0)
+    return format(unixTime, buffer, size);
+
+  uint32_t uptimeMs = millis();
+  int length = snprintf(buffer, size, "+%u.%03us", uptimeMs / 1000, uptimeMs % 1000);
+  return length < 0 ? 0 : min((size_t)length, size - 1);
+}
@@ -0,0 +1,44 @@
+#ifndef TIMESERVICE_H
+#define TIMESERVICE_H
+
+#include <Arduino.h>
+
+#define TIME_NTP_SERVER "pool.ntp.org"
+#define TIME_VALID_AFTER 1600000000ul     // the clock starts at 1970 until SNTP has set it
+#define TIME_RESYNC_INTERVAL_US (3600ll * 1000000ll)
+#define TIME_TIMESTAMP_LENGTH 20          // "YYYY-MM-DD HH:MM:SS" plus terminator
+
+/*
+  Wall clock for log and event timestamps. SNTP is started once, the sync is detected without waiting (unlike
+  getLocalTime(), which blocks while the time is not set). After the sync the unix time is derived from the monotonic
+  esp_timer plus an epoch offset, so timestamps never go backwards when SNTP corrects the clock. The offset is refreshed
+  every hour and only moves forward.
+  Timestamps are written into caller-provided buffers, the "YYYY-MM-DD HH:MM:" part is cached and only rebuilt once
+  per minute. All methods can be called from any task and never block.
+*/
+class TimeService {
+  private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    volatile bool synced = false;
+    int64_t epochOffsetUs = 0;    // unix time in us - esp_timer_get_time()
+    int64_t lastSyncCheckUs = 0;
+
+    uint32_t cachedMinute = 0;    // unix time / 60 of cachedPrefix
+    char cachedPrefix[TIME_TIMESTAMP_LENGTH] = "";
+
+    bool updateOffset();
+
+  public:
+    void begin(); // call once the network is up
+    bool isSynced();
+    uint32_t now(); // unix time in seconds, 0 while not synced
+
+    // "YYYY-MM-DD HH:MM:SS" (UTC), returns the length
+    size_t format(uint32_t unixTime, char *buffer, size_t size);
+    // the current time, "+<uptime>s" while not synced
+    size_t formatNow(char *buffer, size_t size);
+};
+
+extern TimeService timeService;
+
+#endif
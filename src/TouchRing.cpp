@@ -0,0 +1,94 @@
+#include "TouchRing.h"
+
+void TouchRing::begin(uint8_t touchPin) {
+  pin = touchPin;
+  pinMode(pin, INPUT_PULLDOWN);
+  attachInterruptArg(digitalPinToInterrupt(pin), onEdge, this, FALLING); // LOW = touched
+}
+
+void IRAM_ATTR TouchRing::onEdge(void *arg) {
+  TouchRing *ring = static_cast<TouchRing*>(arg);
+  uint32_t head = ring->head;
+  if (head - ring->tail >= TOUCH_EDGE_BUFFER_SIZE) {
+    ring->overflows++;
+    return;
+  }
+  ring->edgeMicros[head % TOUCH_EDGE_BUFFER_SIZE] = micros();
+  // the ISR is attached from the sensor task and runs on its core like the consumer, the barrier still keeps the
+  // compiler from moving the head update before the entry. consumeTouch() has the matching barrier.
+  __sync_synchronize();
+  ring->head = head + 1;
+}
+
+void TouchRing::setFilterConfig(const TouchFilterConfig &newConfig) {
+  config = newConfig;
+}
+
+// all times in microseconds, differences are safe over the wrap around of micros()
+bool TouchRing::filter(uint32_t edge) {
+  stats.edges++;
+
+  if (stats.accepted > 0 && (edge - lastAcceptedMicros) < config.debounceMs * 1000ul) {
+    stats.bounces++;
+    return false;
+  }
+
+  // rain ends when the ring was quiet for a while
+  if (raining && (edge - lastEdgeMicros) >= config.rainHoldoffMs * 1000ul)
+    raining = false;
+  lastEdgeMicros = edge;
+
+  if (burstEdges == 0 || (edge - burstStartMicros) >= config.burstWindowMs * 1000ul) {
+    burstStartMicros = edge;
+    burstEdges = 0;
+  }
+  burstEdges++;
+  if (burstEdges >= config.burstThreshold)
+    raining = true;
+
+  if (raining) {
+    stats.rainRejected++;
+    return false;
+  }
+
+  lastAcceptedMicros = edge;
+  stats.accepted++;
+  return true;
+}
+
+bool TouchRing::consumeTouch(uint32_t *edgeMicros) {
+  uint32_t currentHead = head;
+  __sync_synchronize(); // entries up to currentHead were written before the head
+  while (tail != currentHead) {
+    uint32_t micros = this->edgeMicros[tail % TOUCH_EDGE_BUFFER_SIZE];
+    tail++;
+    if (filter(micros)) {
+      touchPending = true;
+      touchPendingMicros = micros;
+    }
+  }
+
+  if (!touchPending)
+    return false;
+  touchPending = false;
+  if (edgeMicros != nullptr)
+    *edgeMicros = touchPendingMicros;
+  return true;
+}
+
+void TouchRing::addEdge(uint32_t edgeMicros) {
+  if (filter(edgeMicros)) {
+    touchPending = true;
+    touchPendingMicros = edgeMicros;
+  }
+}
+
+bool TouchRing::isRaining() {
+  return raining;
+}
+
+TouchRingStats TouchRing::getStats() {
+  TouchRingStats result = stats;
+  result.overflows = overflows;
+  return result;
+}
@@ -0,0 +1,66 @@
+#ifndef TOUCHRING_H
+#define TOUCHRING_H
+
+#include <Arduino.h>
+
+#define TOUCH_EDGE_BUFFER_SIZE 32 // power of two
+
+/*
+  Edges of the touch ring signal are captured by a GPIO interrupt into a lock-free single producer / single consumer
+  ring buffer, so a touch is never missed by a busy loop (the LOW signal occurs only once at the beginning of a touch).
+  The consumer filters them:
+  - edges closer than debounceMs to the last accepted edge are bounces
+  - burstThreshold or more edges within burstWindowMs are typical for rain drops on the ring. The first
+    burstThreshold - 1 edges of such a burst are accepted (we can't know yet), the edge reaching the threshold and all
+    following ones are rejected until no edge occurred for rainHoldoffMs.
+*/
+
+struct TouchFilterConfig {
+  uint16_t debounceMs = 50;
+  uint16_t burstWindowMs = 2000;
+  uint8_t burstThreshold = 3;
+  uint16_t rainHoldoffMs = 10000;
+};
+
+struct TouchRingStats {
+  uint32_t edges = 0;
+  uint32_t accepted = 0;
+  uint32_t bounces = 0;
+  uint32_t rainRejected = 0;
+  uint32_t overflows = 0;
+};
+
+class TouchRing {
+  private:
+    uint8_t pin = 0;
+    volatile uint32_t edgeMicros[TOUCH_EDGE_BUFFER_SIZE];
+    volatile uint32_t head = 0; // written by the ISR only
+    uint32_t tail = 0;          // written by the consumer only
+    volatile uint32_t overflows = 0;
+
+    TouchFilterConfig config;
+    TouchRingStats stats;
+    uint32_t lastEdgeMicros = 0;
+    uint32_t lastAcceptedMicros = 0;
+    uint32_t burstStartMicros = 0;
+    uint8_t burstEdges = 0;
+    bool raining = false;
+    bool touchPending = false;
+    uint32_t touchPendingMicros = 0;
+
+    static void IRAM_ATTR onEdge(void *arg);
+    bool filter(uint32_t edge);
+
+  public:
+    void begin(uint8_t touchPin);
+    void setFilterConfig(const TouchFilterConfig &newConfig);
+
+    // processes captured edges, returns true (once) if a real touch was detected. edgeMicros is the time of the edge.
+    bool consumeTouch(uint32_t *edgeMicros = nullptr);
+    // edge seen by another source than the interrupt, e.g. the wakeup from light sleep. Consumer side only.
+    void addEdge(uint32_t edgeMicros);
+    bool isRaining();
+    TouchRingStats getStats();
+};
+
+#endif
@@ -0,0 +1,396 @@
+#include "WebApi.h"
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+
+#include "global.h"
+#include "TemplateArchive.h"
+#include "LatencyMetrics.h"
+
+void WebApi::begin(SensorTask *task, FingerprintManager *manager, SettingsManager *settings) {
+  sensorTask = task;
+  fingerManager = manager;
+  settingsManager = settings;
+
+  // the password is needed for every route, a missing one is generated
+  AppSettings appSettings = settingsManager->getAppSettings();
+  if (appSettings.webPassword.isEmpty()) {
+    char generated[17];
+    snprintf(generated, sizeof(generated), "%08x%08x", esp_random(), esp_random());
+    appSettings.webPassword = generated;
+    settingsManager->saveAppSettings(appSettings);
+    // printed only now, a serial log of a later boot doesn't give it away
+    Serial.println(String("Web API user: " WEB_API_USER ", generated password: ") + generated);
+  }
+  password = appSettings.webPassword;
+
+  on("/api/fingers", HTTP_GET, &WebApi::handleGetFingers);
+  on("/api/fingers/enroll/cancel", HTTP_POST, &WebApi::handleCancelEnroll); // before enroll, a route also matches its subpaths
+  on("/api/fingers/enroll", HTTP_POST, &WebApi::handleEnroll);
+  on("/api/fingers/delete", HTTP_POST, &WebApi::handleDelete);
+  on("/api/fingers/rename", HTTP_POST, &WebApi::handleRename);
+  on("/api/fingers/deleteAll", HTTP_POST, &WebApi::handleDeleteAll);
+  on("/api/fingers/deleteBatch", HTTP_POST, &WebApi::handleDeleteBatch);
+  on("/api/fingers/renameBatch", HTTP_POST, &WebApi::handleRenameBatch);
+  on("/api/pairing", HTTP_POST, &WebApi::handlePairing);
+  on("/api/settings", HTTP_GET, &WebApi::handleGetSettings);
+  on("/api/settings", HTTP_POST, &WebApi::handlePostSettings);
+  on("/api/logs", HTTP_GET, &WebApi::handleGetLogs);
+  on("/api/status", HTTP_GET, &WebApi::handleGetStatus);
+  on("/api/reboot", HTTP_POST, &WebApi::handleReboot);
+  on("/api/templates", HTTP_GET, &WebApi::handleGetTemplates);
+  on("/api/templates/export", HTTP_POST, &WebApi::handleExportTemplates);
+  server.on("/api/templates/import", HTTP_POST, [this](AsyncWebServerRequest *request) {
+      if (!isAuthenticated(request))
+        return request->requestAuthentication(WEB_API_REALM);
+      handleImportTemplates(request);
+    },
+    [this](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final) {
+      handleTemplateUpload(request, index, data, length, final);
+    });
+  server.onNotFound([this](AsyncWebServerRequest *request) { sendResult(request, 404, "Not found"); });
+  server.begin();
+}
+
+// registers a route behind the authentication, the one guard for all handlers
+void WebApi::on(const char *uri, WebRequestMethodComposite method, Handler handler) {
+  server.on(uri, method, [this, handler](AsyncWebServerRequest *request) {
+    if (!isAuthenticated(request))
+      return request->requestAuthentication(WEB_API_REALM);
+    (this->*handler)(request);
+  });
+}
+
+bool WebApi::isAuthenticated(AsyncWebServerRequest *request) {
+  return !password.isEmpty() && request->authenticate(WEB_API_USER, password.c_str(), WEB_API_REALM);
+}
+
+AsyncWebServer& WebApi::getServer() {
+  return server;
+}
+
+uint8_t WebApi::takeRequests() {
+  portENTER_CRITICAL(&mux);
+  uint8_t requests = pendingRequests;
+  pendingRequests = 0;
+  portEXIT_CRITICAL(&mux);
+  return requests;
+}
+
+void WebApi::addRequest(uint8_t request) {
+  portENTER_CRITICAL(&mux);
+  pendingRequests |= request;
+  portEXIT_CRITICAL(&mux);
+}
+
+void WebApi::sendJson(AsyncWebServerRequest *request, int code, const JsonDocument &doc) {
+  serializeJson(doc, jsonBuffer, sizeof(jsonBuffer));
+  request->send(code, "application/json", jsonBuffer);
+}
+
+void WebApi::sendResult(AsyncWebServerRequest *request, int code, const char *message) {
+  StaticJsonDocument<128> doc;
+  doc["ok"] = code < 300;
+  doc["message"] = message;
+  sendJson(request, code, doc);
+}
+
+bool WebApi::getIdParam(AsyncWebServerRequest *request, uint16_t &id) {
+  if (!request->hasParam("id", true))
+    return false;
+  long value = request->getParam("id", true)->value().toInt();
+  if (value < 1 || value >= fingerManager->getFingerListSize())
+    return false;
+  id = value;
+  return true;
+}
+
+bool WebApi::getNameParam(AsyncWebServerRequest *request, String &name) {
+  if (!request->hasParam("name", true))
+    return false;
+  name = request->getParam("name", true)->value();
+  return isValidName(name);
+}
+
+bool WebApi::isValidName(String &name) {
+  name.trim();
+  return !name.isEmpty() && name.length() <= FINGER_NAME_MAX_LENGTH;
+}
+
+// comma separated ids and ranges, e.g. "3,7,10-25"
+bool WebApi::parseIdList(const String &text, FingerNameTable &selection) {
+  int start = 0;
+  while (start < (int)text.length()) {
+    int end = text.indexOf(',', start);
+    if (end < 0)
+      end = text.length();
+    String item = text.substring(start, end);
+    item.trim();
+    int dash = item.indexOf('-');
+    long first = item.substring(0, dash < 0 ? item.length() : dash).toInt();
+    long last = (dash < 0) ? first : item.substring(dash + 1).toInt();
+    if (first < 1 || last < first || last >= fingerManager->getFingerListSize())
+      return false;
+    for (long id = first; id <= last; id++)
+      selection.set(id, "");
+    start = end + 1;
+  }
+  return selection.count() > 0;
+}
+
+// one "id,name" per line
+bool WebApi::parseNameList(const String &text, FingerNameTable &names) {
+  int start = 0;
+  while (start < (int)text.length()) {
+    int end = text.indexOf('\n', start);
+    if (end < 0)
+      end = text.length();
+    String line = text.substring(start, end);
+    start = end + 1;
+    line.trim();
+    if (line.isEmpty())
+      continue;
+    int comma = line.indexOf(',');
+    long id = (comma < 0) ? 0 : line.substring(0, comma).toInt();
+    String name = line.substring(comma + 1);
+    if (id < 1 || id >= fingerManager->getFingerListSize() || !isValidName(name))
+      return false;
+    names.set(id, name.c_str());
+  }
+  return names.count() > 0;
+}
+
+void WebApi::handleGetFingers(AsyncWebServerRequest *request) {
+  // written entry by entry, a document holding all 200 names would need more RAM than the output
+  size_t length = strlcpy(jsonBuffer, "{\"fingers\":[", sizeof(jsonBuffer));
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  int count = 0;
+  for (int id = 1; id < fingerManager->getFingerListSize(); id++) {
+    if (!fingerManager->getFingerName(id, name, sizeof(name)))
+      continue;
+    StaticJsonDocument<JSON_OBJECT_SIZE(2)> entry;
+    entry["id"] = id;
+    entry["name"] = (const char*)name; // not copied, the entry is serialized right away
+    if (count > 0 && length < sizeof(jsonBuffer) - 1)
+      jsonBuffer[length++] = ',';
+    length += serializeJson(entry, jsonBuffer + length, sizeof(jsonBuffer) - length);
+    count++;
+  }
+  snprintf(jsonBuffer + length, sizeof(jsonBuffer) - length, "],\"count\":%d}", count);
+  request->send(200, "application/json", jsonBuffer);
+}
+
+void WebApi::handleEnroll(AsyncWebServerRequest *request) {
+  uint16_t id;
+  String name;
+  if (!getIdParam(request, id) || !getNameParam(request, name))
+    return sendResult(request, 400, "Invalid id or name");
+  if (!sensorTask->postEnroll(id, name))
+    return sendResult(request, 503, "Sensor is busy");
+  notifyClients(String("Enrollment of finger #") + id + " started, place your finger on the sensor.");
+  sendResult(request, 202, "Enrollment started");
+}
+
+void WebApi::handleCancelEnroll(AsyncWebServerRequest *request) {
+  sensorTask->cancelEnroll();
+  sendResult(request, 202, "Enrollment cancel requested");
+}
+
+void WebApi::handleDelete(AsyncWebServerRequest *request) {
+  uint16_t id;
+  if (!getIdParam(request, id))
+    return sendResult(request, 400, "Invalid id");
+  if (!sensorTask->postDelete(id))
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Delete queued");
+}
+
+void WebApi::handleRename(AsyncWebServerRequest *request) {
+  uint16_t id;
+  String name;
+  if (!getIdParam(request, id) || !getNameParam(request, name))
+    return sendResult(request, 400, "Invalid id or name");
+  if (!sensorTask->postRename(id, name))
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Rename queued");
+}
+
+void WebApi::handleDeleteAll(AsyncWebServerRequest *request) {
+  SensorCommand cmd;
+  cmd.type = SensorCommandType::deleteAll;
+  if (!sensorTask->post(cmd))
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Delete of all fingers queued");
+}
+
+void WebApi::handleDeleteBatch(AsyncWebServerRequest *request) {
+  FingerNameTable *selection = sensorTask->acquireBatch();
+  if (selection == nullptr)
+    return sendResult(request, 503, "Sensor is busy");
+  if (!request->hasParam("ids", true) || !parseIdList(request->getParam("ids", true)->value(), *selection)) {
+    sensorTask->releaseBatch();
+    return sendResult(request, 400, "Invalid ids");
+  }
+  if (!sensorTask->postBatch(SensorCommandType::deleteBatch))
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Delete queued");
+}
+
+void WebApi::handleRenameBatch(AsyncWebServerRequest *request) {
+  FingerNameTable *names = sensorTask->acquireBatch();
+  if (names == nullptr)
+    return sendResult(request, 503, "Sensor is busy");
+  if (!request->hasParam("names", true) || !parseNameList(request->getParam("names", true)->value(), *names)) {
+    sensorTask->releaseBatch();
+    return sendResult(request, 400, "Invalid names, expected one \"id,name\" per line");
+  }
+  if (!sensorTask->postBatch(SensorCommandType::renameBatch))
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Rename queued");
+}
+
+void WebApi::handlePairing(AsyncWebServerRequest *request) {
+  addRequest(WEB_API_REQUEST_PAIRING);
+  sendResult(request, 202, "Pairing started");
+}
+
+void WebApi::handleGetSettings(AsyncWebServerRequest *request) {
+  AppSettings settings = settingsManager->getAppSettings();
+  StaticJsonDocument<256> doc;
+  doc["apiUrl"] = settings.apiUrl.c_str();
+  doc["idleSleep"] = settings.idleSleep;
+  doc["sensorPairingValid"] = settings.sensorPairingValid;
+  doc["mqttServer"] = settings.mqttServer.c_str();
+  doc["mqttUsername"] = settings.mqttUsername.c_str();
+  doc["mqttRootTopic"] = settings.mqttRootTopic.c_str(); // the passwords are never sent back
+  sendJson(request, 200, doc);
+}
+
+void WebApi::handlePostSettings(AsyncWebServerRequest *request) {
+  AppSettings settings = settingsManager->getAppSettings();
+  if (request->hasParam("apiUrl", true)) {
+    String apiUrl = request->getParam("apiUrl", true)->value();
+    if (!apiUrl.startsWith("http://") && !apiUrl.startsWith("https://"))
+      return sendResult(request, 400, "Invalid apiUrl");
+    settings.apiUrl = apiUrl;
+  }
+  if (request->hasParam("idleSleep", true))
+    settings.idleSleep = request->getParam("idleSleep", true)->value() == "true";
+  if (request->hasParam("mqttServer", true))
+    settings.mqttServer = request->getParam("mqttServer", true)->value();
+  if (request->hasParam("mqttUsername", true))
+    settings.mqttUsername = request->getParam("mqttUsername", true)->value();
+  if (request->hasParam("mqttPassword", true))
+    settings.mqttPassword = request->getParam("mqttPassword", true)->value();
+  if (request->hasParam("webPassword", true)) {
+    String webPassword = request->getParam("webPassword", true)->value();
+    if (webPassword.length() < WEB_API_PASSWORD_MIN_LENGTH)
+      return sendResult(request, 400, "webPassword is too short");
+    settings.webPassword = webPassword;
+  }
+  if (request->hasParam("mqttRootTopic", true)) {
+    String rootTopic = request->getParam("mqttRootTopic", true)->value();
+    if (rootTopic.isEmpty() || rootTopic.endsWith("/") || rootTopic.indexOf('#') >= 0 || rootTopic.indexOf('+') >= 0)
+      return sendResult(request, 400, "Invalid mqttRootTopic");
+    settings.mqttRootTopic = rootTopic;
+  }
+
+  settingsManager->saveAppSettings(settings);
+  addRequest(WEB_API_REQUEST_SETTINGS_CHANGED);
+  sendResult(request, 200, "Settings saved");
+}
+
+void WebApi::handleGetLogs(AsyncWebServerRequest *request) {
+  String messages[WEB_API_LOG_MESSAGES];
+  int count = copyLogMessages(messages, WEB_API_LOG_MESSAGES);
+
+  StaticJsonDocument<JSON_ARRAY_SIZE(WEB_API_LOG_MESSAGES) + JSON_OBJECT_SIZE(1)> doc;
+  JsonArray logs = doc.createNestedArray("logs");
+  for (int i = 0; i < count; i++)
+    logs.add(messages[i].c_str()); // not copied, serialized before messages go out of scope
+  sendJson(request, 200, doc);
+}
+
+void WebApi::handleGetStatus(AsyncWebServerRequest *request) {
+  // written stage by stage like the finger list, one document with all histograms would not fit on the stack
+  size_t length = snprintf(jsonBuffer, sizeof(jsonBuffer), "{\"uptime\":%lu,\"freeHeap\":%u,\"latency\":{",
+    millis() / 1000, ESP.getFreeHeap());
+  uint32_t buckets[LATENCY_BUCKET_COUNT];
+  int stages = 0;
+  for (int i = 0; i < (int)LatencyStage::count && length < sizeof(jsonBuffer); i++) {
+    LatencySummary summary = latencyMetrics.getSummary((LatencyStage)i);
+    if (summary.count == 0)
+      continue;
+    int used = latencyMetrics.getBuckets((LatencyStage)i, buckets);
+    StaticJsonDocument<JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(LATENCY_BUCKET_COUNT)> stage;
+    stage["n"] = summary.count;
+    stage["min"] = summary.min;
+    stage["p50"] = summary.p50;
+    stage["p99"] = summary.p99;
+    stage["max"] = summary.max;
+    JsonArray histogram = stage.createNestedArray("buckets"); // log2 buckets of microseconds, see LatencyMetrics
+    for (int bucket = 0; bucket < used; bucket++)
+      histogram.add(buckets[bucket]);
+    length += snprintf(jsonBuffer + length, sizeof(jsonBuffer) - length, "%s\"%s\":", stages > 0 ? "," : "",
+      LatencyMetrics::getStageName((LatencyStage)i));
+    if (length < sizeof(jsonBuffer))
+      length += serializeJson(stage, jsonBuffer + length, sizeof(jsonBuffer) - length);
+    stages++;
+  }
+  if (length < sizeof(jsonBuffer))
+    snprintf(jsonBuffer + length, sizeof(jsonBuffer) - length, "}}");
+  request->send(200, "application/json", jsonBuffer);
+}
+
+void WebApi::handleReboot(AsyncWebServerRequest *request) {
+  addRequest(WEB_API_REQUEST_REBOOT);
+  sendResult(request, 202, "Rebooting");
+}
+
+void WebApi::handleGetTemplates(AsyncWebServerRequest *request) {
+  if (!mountSpiffs() || !SPIFFS.exists(TEMPLATE_ARCHIVE_PATH))
+    return sendResult(request, 404, "No template archive, export the templates first");
+  request->send(SPIFFS, TEMPLATE_ARCHIVE_PATH, "application/octet-stream", true); // streamed from flash
+}
+
+void WebApi::handleExportTemplates(AsyncWebServerRequest *request) {
+  if (!sensorTask->postExportTemplates())
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Template export queued");
+}
+
+// the upload is written to flash chunk by chunk as it arrives
+void WebApi::handleTemplateUpload(AsyncWebServerRequest *request, size_t index, uint8_t *data, size_t length, bool final) {
+  if (!isAuthenticated(request))
+    return; // the body arrives before the request handler answers with 401, nothing is stored
+  if (index == 0) {
+    uploadReceived = true;
+    uploadFailed = !mountSpiffs();
+    if (!uploadFailed)
+      uploadFile = SPIFFS.open(WEB_API_TEMPLATE_UPLOAD_PATH, FILE_WRITE);
+    uploadFailed = uploadFailed || !uploadFile;
+  }
+  if (!uploadFailed && uploadFile.write(data, length) != length)
+    uploadFailed = true;
+  if (final && uploadFile)
+    uploadFile.close();
+}
+
+void WebApi::handleImportTemplates(AsyncWebServerRequest *request) {
+  if (uploadReceived) {
+    uploadReceived = false;
+    if (uploadFile)
+      uploadFile.close(); // upload aborted without a final chunk
+    if (uploadFailed) {
+      SPIFFS.remove(WEB_API_TEMPLATE_UPLOAD_PATH);
+      return sendResult(request, 500, "Storing the uploaded archive failed");
+    }
+    SPIFFS.remove(TEMPLATE_ARCHIVE_PATH);
+    if (!SPIFFS.rename(WEB_API_TEMPLATE_UPLOAD_PATH, TEMPLATE_ARCHIVE_PATH))
+      return sendResult(request, 500, "Storing the uploaded archive failed");
+  }
+  if (!mountSpiffs() || !SPIFFS.exists(TEMPLATE_ARCHIVE_PATH))
+    return sendResult(request, 404, "No template archive, upload one first");
+  if (!sensorTask->postImportTemplates())
+    return sendResult(request, 503, "Sensor is busy");
+  sendResult(request, 202, "Template import queued, place a finger on the sensor to confirm it. The sensor is paired again afterwards.");
+}
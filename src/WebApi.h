@@ -0,0 +1,111 @@
+#ifndef WEBAPI_H
+#define WEBAPI_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+
+#include "FingerprintManager.h"
+#include "SensorTask.h"
+#include "SettingsManager.h"
+
+#define WEB_API_PORT 80
+#define WEB_API_JSON_BUFFER_SIZE 12288 // the finger list with 200 names of full length
+#define WEB_API_LOG_MESSAGES 5
+#define WEB_API_USER "admin"
+#define WEB_API_REALM "FingerprintDoorbell"
+#define WEB_API_PASSWORD_MIN_LENGTH 8
+#define WEB_API_TEMPLATE_UPLOAD_PATH "/templates.up" // upload in progress, renamed to TEMPLATE_ARCHIVE_PATH when complete
+
+// work for loop(), collected by takeRequests()
+enum WebApiRequest : uint8_t {
+  WEB_API_REQUEST_PAIRING = 0x01,
+  WEB_API_REQUEST_REBOOT = 0x02,
+  WEB_API_REQUEST_SETTINGS_CHANGED = 0x04
+};
+
+/*
+  REST API on the async web server. Handlers run in the async_tcp task and never touch the sensor: finger commands are
+  posted to the sensor task and answered with 202, the results show up in the logs. Work that belongs to loop() (pairing,
+  reboot, applying changed settings) is handed over as request flags.
+  JSON is built with ArduinoJson into one preallocated buffer, requests are handled one after the other by async_tcp.
+
+  Every route is registered by on() and requires HTTP authentication (digest or basic) as WEB_API_USER with the
+  webPassword of the app settings. A random password is generated on first boot, it is printed on the serial console
+  once right then and can be changed by POST /api/settings (used after the next reboot).
+
+    GET  /api/fingers                   list of enrolled fingers
+    POST /api/fingers/enroll   id, name
+    POST /api/fingers/enroll/cancel     ends a running enrollment (it times out after ENROLL_TAKE_TIMEOUT_MS without finger)
+    POST /api/fingers/delete   id
+    POST /api/fingers/rename   id, name
+    POST /api/fingers/deleteAll
+    POST /api/fingers/deleteBatch  ids     e.g. "3,7,10-25", one sensor command per contiguous range
+    POST /api/fingers/renameBatch  names   one "id,name" per line, also for importing a list of names
+    POST /api/pairing                   new pairing with the sensor
+    GET  /api/settings
+    POST /api/settings         apiUrl, idleSleep, mqttServer, mqttUsername, mqttPassword, mqttRootTopic, webPassword
+                               (apiUrl, MQTT settings and webPassword are used after the next reboot)
+    GET  /api/logs
+    GET  /api/status                    uptime, free heap and the latency histograms of the scan pipeline
+    POST /api/reboot
+    GET  /api/templates                 template archive of the last export (for a sensor replacement)
+    POST /api/templates/export          write all sensor templates and names into the archive
+    POST /api/templates/import [file]   load the archive into the sensor and re-pair, an uploaded file replaces the archive.
+                                        The import waits for a finger on the sensor as confirmation.
+*/
+class WebApi {
+  private:
+    AsyncWebServer server = AsyncWebServer(WEB_API_PORT);
+    SensorTask *sensorTask = nullptr;
+    FingerprintManager *fingerManager = nullptr;
+    SettingsManager *settingsManager = nullptr;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint8_t pendingRequests = 0;
+    String password; // set once by begin(), only read by async_tcp afterwards
+
+    char jsonBuffer[WEB_API_JSON_BUFFER_SIZE];
+
+    File uploadFile;
+    bool uploadReceived = false; // a file was uploaded with the current import request
+    bool uploadFailed = false;
+
+    typedef void (WebApi::*Handler)(AsyncWebServerRequest *request);
+    void on(const char *uri, WebRequestMethodComposite method, Handler handler);
+    bool isAuthenticated(AsyncWebServerRequest *request);
+    void addRequest(uint8_t request);
+    void sendJson(AsyncWebServerRequest *request, int code, const JsonDocument &doc);
+    void sendResult(AsyncWebServerRequest *request, int code, const char *message);
+    bool getIdParam(AsyncWebServerRequest *request, uint16_t &id);
+    bool getNameParam(AsyncWebServerRequest *request, String &name);
+    bool isValidName(String &name);
+    bool parseIdList(const String &text, FingerNameTable &selection);
+    bool parseNameList(const String &text, FingerNameTable &names);
+
+    void handleGetFingers(AsyncWebServerRequest *request);
+    void handleEnroll(AsyncWebServerRequest *request);
+    void handleCancelEnroll(AsyncWebServerRequest *request);
+    void handleDelete(AsyncWebServerRequest *request);
+    void handleRename(AsyncWebServerRequest *request);
+    void handleDeleteAll(AsyncWebServerRequest *request);
+    void handleDeleteBatch(AsyncWebServerRequest *request);
+    void handleRenameBatch(AsyncWebServerRequest *request);
+    void handlePairing(AsyncWebServerRequest *request);
+    void handleGetSettings(AsyncWebServerRequest *request);
+    void handlePostSettings(AsyncWebServerRequest *request);
+    void handleGetLogs(AsyncWebServerRequest *request);
+    void handleGetStatus(AsyncWebServerRequest *request);
+    void handleReboot(AsyncWebServerRequest *request);
+    void handleGetTemplates(AsyncWebServerRequest *request);
+    void handleExportTemplates(AsyncWebServerRequest *request);
+    void handleImportTemplates(AsyncWebServerRequest *request);
+    void handleTemplateUpload(AsyncWebServerRequest *request, size_t index, uint8_t *data, size_t length, bool final);
+
+  public:
+    void begin(SensorTask *task, FingerprintManager *manager, SettingsManager *settings);
+    AsyncWebServer& getServer(); // for additional handlers like the event stream
+    uint8_t takeRequests(); // WebApiRequest flags set since the last call
+};
+
+#endif
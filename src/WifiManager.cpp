@@ -0,0 +1,216 @@
+#include "WifiManager.h"
+#include "LatencyMetrics.h"
+#include "BootTimeline.h"
+#include "TimeService.h"
+#include "global.h"
+#include <time.h>
+#include <tcpip_adapter.h>
+#include <lwip/dhcp.h>
+
+void WifiManager::begin(SettingsManager *manager) {
+  settingsManager = manager;
+  settings = settingsManager->getWifiSettings();
+  mutex = xSemaphoreCreateMutex();
+
+  WiFi.persistent(false); // credentials are kept in our own settings
+  WiFi.setAutoReconnect(false); // reconnects are done by process() with backoff
+  WiFi.mode(WIFI_STA);
+  startAttempt(hasConnectionCache());
+}
+
+bool WifiManager::hasConnectionCache() {
+  return settings.channel != 0;
+}
+
+bool WifiManager::isCachedLeaseUsable() {
+  if (settings.ip == 0 || settings.leaseSeconds == 0)
+    return false;
+  uint32_t elapsed;
+  if (sessionLease) {
+    elapsed = (millis() - leaseStartMillis) / 1000ul;
+  } else {
+    uint32_t now = getWallClock();
+    if (settings.leaseStart == 0 || now == 0 || now < settings.leaseStart)
+      return false; // age of the lease unknown
+    elapsed = now - settings.leaseStart;
+  }
+  return elapsed < settings.leaseSeconds / 2;
+}
+
+// lease time granted by the DHCP server for the current address, 0 if unknown
+uint32_t WifiManager::readLeaseSeconds() {
+  void *netif = nullptr;
+  if (tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, &netif) != ESP_OK || netif == nullptr)
+    return 0;
+  struct dhcp *dhcp = netif_dhcp_data((struct netif*)netif);
+  return dhcp != nullptr ? dhcp->offered_t0_lease : 0;
+}
+
+// the system clock survives a software reset, unlike timeService it doesn't wait for SNTP in this session
+uint32_t WifiManager::getWallClock() {
+  time_t now = time(nullptr);
+  return now >= (time_t)TIME_VALID_AFTER ? (uint32_t)now : 0;
+}
+
+void WifiManager::startAttempt(bool fast) {
+  fastAttempt = fast;
+  attemptStartMillis = millis();
+  state = WifiState::connecting;
+
+  WiFi.disconnect();
+  cachedLeaseUsed = fast && isCachedLeaseUsable();
+  if (cachedLeaseUsed) {
+    // the previous lease is still valid and reused, no DHCP round trip
+    WiFi.config(IPAddress(settings.ip), IPAddress(settings.gateway), IPAddress(settings.subnet), IPAddress(settings.dns));
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  }
+  if (fast) {
+    WiFi.begin(settings.ssid.c_str(), settings.password.c_str(), settings.channel, settings.bssid);
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(settings.ssid.c_str(), settings.password.c_str());
+  }
+}
+
+void WifiManager::onConnected() {
+  uint32_t connectMs = millis() - attemptStartMillis;
+  latencyMetrics.record(LatencyStage::wifiConnect, connectMs * 1000ul);
+  stats.connects++;
+  stats.lastConnectMs = connectMs;
+  if (fastAttempt)
+    stats.fastConnects++;
+  retryDelayMs = WIFI_RETRY_MIN_MS;
+  state = WifiState::connected;
+  bootTimeline.mark(BootStage::wifiConnected);
+  notifyClients("WiFi connected to " + WiFi.SSID() + " in " + String(connectMs) + " ms, IP " + WiFi.localIP().toString());
+
+  // store the access point and lease for the next fast connect, only written when something changed
+  const uint8_t *bssid = WiFi.BSSID();
+  uint32_t ip = WiFi.localIP();
+  uint32_t gateway = WiFi.gatewayIP();
+  uint32_t subnet = WiFi.subnetMask();
+  uint32_t dns = WiFi.dnsIP();
+  uint32_t leaseSeconds = settings.leaseSeconds;
+  uint32_t leaseStart = settings.leaseStart;
+  if (!cachedLeaseUsed) {
+    // a new lease from DHCP
+    leaseSeconds = readLeaseSeconds();
+    leaseStart = getWallClock();
+    sessionLease = true;
+    leaseStartMillis = millis();
+  }
+  if (bssid != nullptr && (memcmp(settings.bssid, bssid, sizeof(settings.bssid)) != 0 || settings.channel != WiFi.channel() ||
+      settings.ip != ip || settings.gateway != gateway || settings.subnet != subnet || settings.dns != dns ||
+      settings.leaseSeconds != leaseSeconds || settings.leaseStart != leaseStart)) {
+    memcpy(settings.bssid, bssid, sizeof(settings.bssid));
+    settings.channel = WiFi.channel();
+    settings.ip = ip;
+    settings.gateway = gateway;
+    settings.subnet = subnet;
+    settings.dns = dns;
+    settings.leaseSeconds = leaseSeconds;
+    settings.leaseStart = leaseStart;
+    WifiSettings stored = settingsManager->getWifiSettings();
+    memcpy(stored.bssid, settings.bssid, sizeof(stored.bssid));
+    stored.channel = settings.channel;
+    stored.ip = ip;
+    stored.gateway = gateway;
+    stored.subnet = subnet;
+    stored.dns = dns;
+    stored.leaseSeconds = leaseSeconds;
+    stored.leaseStart = leaseStart;
+    settingsManager->saveWifiSettings(stored);
+  }
+}
+
+void WifiManager::onAttemptFailed() {
+  stats.failures++;
+  if (fastAttempt) {
+    // access point or lease changed, try again with scan and DHCP right away
+    startAttempt(false);
+    return;
+  }
+  WiFi.disconnect();
+  state = WifiState::waitingRetry;
+  retryStartMillis = millis();
+  notifyClients("WiFi connect failed, next try in " + String(retryDelayMs / 1000) + " s");
+}
+
+void WifiManager::process() {
+  if (mutex == nullptr || xSemaphoreTake(mutex, 0) != pdTRUE)
+    return; // suspend()/resume() in progress
+
+  if (resumeRequested) {
+    resumeRequested = false;
+    WiFi.mode(WIFI_STA);
+    startAttempt(hasConnectionCache());
+  }
+
+  switch (state) {
+    case WifiState::off:
+    case WifiState::suspended:
+      break;
+    case WifiState::connecting:
+      if (WiFi.status() == WL_CONNECTED)
+        onConnected();
+      else if (millis() - attemptStartMillis > (fastAttempt ? WIFI_FAST_CONNECT_TIMEOUT_MS : WIFI_CONNECT_TIMEOUT_MS))
+        onAttemptFailed();
+      break;
+    case WifiState::connected:
+      if (WiFi.status() != WL_CONNECTED) {
+        stats.disconnects++;
+        notifyClients("WiFi connection lost, reconnecting...");
+        startAttempt(hasConnectionCache());
+      } else if (cachedLeaseUsed && !isCachedLeaseUsable()) {
+        // nobody renews the cached lease, get a new one before it may be given to another device
+        notifyClients("WiFi: cached DHCP lease expires, reconnecting with DHCP");
+        startAttempt(false);
+      }
+      break;
+    case WifiState::waitingRetry:
+      if (millis() - retryStartMillis >= retryDelayMs) {
+        retryDelayMs = min(retryDelayMs * 2, (unsigned long)WIFI_RETRY_MAX_MS);
+        startAttempt(hasConnectionCache());
+      }
+      break;
+  }
+  xSemaphoreGive(mutex);
+}
+
+void WifiManager::suspend() {
+  if (mutex == nullptr)
+    return;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  WiFi.mode(WIFI_OFF); // the radio is powered down in light sleep anyway
+  state = WifiState::suspended;
+  resumeRequested = false;
+  xSemaphoreGive(mutex);
+}
+
+void WifiManager::resume() {
+  if (mutex == nullptr)
+    return;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  resumeRequested = true; // reconnected by process(), local matches don't need the network
+  xSemaphoreGive(mutex);
+}
+
+WifiState WifiManager::getState() {
+  return state;
+}
+
+bool WifiManager::isConnected() {
+  return state == WifiState::connected;
+}
+
+WifiStats WifiManager::getStats() {
+  return stats;
+}
+
+void WifiManager::printTo(Print &out) {
+  char line[96];
+  snprintf(line, sizeof(line), "WiFi: %u connects (%u fast), %u failures, %u disconnects, last connect %u ms",
+    stats.connects, stats.fastConnects, stats.failures, stats.disconnects, stats.lastConnectMs);
+  out.println(line);
+}
@@ -0,0 +1,72 @@
+#ifndef WIFIMANAGER_H
+#define WIFIMANAGER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "SettingsManager.h"
+
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000   // with cached BSSID/channel/IP, falls back to a normal connect
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define WIFI_RETRY_MIN_MS 1000              // backoff after a failed connect, doubled after each failure
+#define WIFI_RETRY_MAX_MS 300000
+
+enum class WifiState { off, connecting, connected, waitingRetry, suspended };
+
+struct WifiStats {
+  uint32_t connects;
+  uint32_t fastConnects;    // connects with the cached access point and lease
+  uint32_t failures;        // connect attempts that timed out
+  uint32_t disconnects;     // lost connections
+  uint32_t lastConnectMs;   // duration of the last successful connect
+};
+
+/*
+  Non-blocking WiFi connection, process() is called by loop() and only advances a small state machine, so scanning
+  keeps working while the access point is unreachable. A failed connect is retried with exponential backoff, there is
+  no reboot anymore.
+  BSSID, channel and the IP lease of the last connection are stored in the WifiSettings. The next connect skips the
+  scan with them (fast connect), if that fails a normal connect with scan and DHCP is done. The cached address is only
+  reused without DHCP while less than half of its lease time has passed (the point where DHCP would renew it). The age
+  of the lease is known from the uptime within a session and from the system clock after a reset, after a power cycle
+  the clock is not set and DHCP is used. A link using the cached address switches to DHCP when the half is over.
+  suspend()/resume() are used around idle light sleep and may be called from another task.
+*/
+class WifiManager {
+  private:
+    SettingsManager *settingsManager = nullptr;
+    WifiSettings settings;
+    SemaphoreHandle_t mutex = nullptr; // WiFi calls of process() and suspend()/resume() from different tasks
+
+    WifiState state = WifiState::off;
+    bool fastAttempt = false;
+    bool resumeRequested = false;
+    unsigned long attemptStartMillis = 0;
+    unsigned long retryStartMillis = 0;
+    unsigned long retryDelayMs = WIFI_RETRY_MIN_MS;
+    bool cachedLeaseUsed = false;           // the current attempt/link uses the cached address without DHCP
+    bool sessionLease = false;              // the cached lease was obtained in this session, see leaseStartMillis
+    unsigned long leaseStartMillis = 0;
+    WifiStats stats = {};
+
+    void startAttempt(bool fast);
+    void onConnected();
+    void onAttemptFailed();
+    bool hasConnectionCache();
+    bool isCachedLeaseUsable();
+    static uint32_t readLeaseSeconds();
+    static uint32_t getWallClock();
+
+  public:
+    void begin(SettingsManager *manager);
+    void process();
+    void suspend();
+    void resume();
+
+    WifiState getState();
+    bool isConnected();
+    WifiStats getStats();
+    void printTo(Print &out);
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <WString.h>
 
 extern void notifyClients(String message);
-extern String getTimestampString();
+extern int copyLogMessages(String *messages, int maxCount); // most recent first
+extern bool mountSpiffs();
 
 #endif
\ No newline at end of file
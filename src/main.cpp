@@ -4,16 +4,26 @@
 
 #include <WiFi.h>
 #include <DNSServer.h>
-#include <time.h>
 #include <ESPAsyncWebServer.h>
-#include <HTTPClient.h>
 #include <Arduino_JSON.h>
 #include <FS.h>
 #include <SPIFFS.h>
-#include <melody_player.h>
 
 #include "FingerprintManager.h"
+#include "SensorTask.h"
+#include "Buzzer.h"
+#include "ApiClient.h"
+#include "AuthCache.h"
+#include "EventJournal.h"
+#include "LatencyMetrics.h"
 #include "SettingsManager.h"
+#include "WebApi.h"
+#include "EventStream.h"
+#include "EventLog.h"
+#include "TimeService.h"
+#include "WifiManager.h"
+#include "MqttManager.h"
+#include "BootTimeline.h"
 #include "global.h"
 #include "player.h"
 
@@ -21,212 +31,227 @@
 
 const char* VersionInfo = "0.4";
 
-enum class Mode { scan, enroll, maintenance };
-
-const long  gmtOffset_sec = 0; // UTC Time
-const int   daylightOffset_sec = 0; // UTC Time
-
-const int logMessagesCount = 5;
-String logMessages[logMessagesCount]; // log messages, 0=most recent log message
 bool shouldReboot = false;
-unsigned long wifiReconnectPreviousMillis = 0;
-
-int enrollId;
-String enrollName;
-HTTPClient http;
-Mode currentMode = Mode::scan;
-MelodyPlayer player(BUZZER_PIN, 0, false);
-Melody track;
+bool wifiConfigMode = false;
+bool bootTimelinePrinted = false;
+
+ApiClient apiClient;
+AuthCache authCache;
+EventJournal eventJournal;
+Buzzer buzzer(BUZZER_PIN);
+MelodyCache melodyCache;
 FingerprintManager fingerManager;
+SensorTask sensorTask;
 SettingsManager settingsManager;
-bool needMaintenanceMode = false;
+WebApi webApi;
+MqttManager mqttManager;
+WifiManager wifiManager;
+bool pairingInProgress = false;
 long lastMsg = 0;
 char msg[50];
 int value = 0;
 
 Match lastMatch;
-
-void addLogMessage(const String& message) {
-  // shift all messages in array by 1, oldest message will die
-  for (int i=logMessagesCount-1; i>0; i--)
-    logMessages[i]=logMessages[i-1];
-  logMessages[0]=message;
-}
-
-String getLogMessagesAsHtml() {
-  String html = "";
-  for (int i=logMessagesCount-1; i>=0; i--) {
-    if (logMessages[i]!="")
-      html = html + logMessages[i] + "<br>";
+uint32_t decisionScanStartMicros = 0; // start of the scan the pending access decision belongs to
+
+// the last records of the event log, formatted only now
+int copyLogMessages(String *messages, int maxCount) {
+  int count = 0;
+  uint32_t oldest = eventLog.getOldest();
+  LogRecord record;
+  char text[EVENT_LOG_TEXT_LENGTH];
+  for (uint32_t sequence=eventLog.getHead(); sequence>oldest && count<maxCount; sequence--) {
+    if (eventLog.read(sequence - 1, record) && EventLog::format(record, text, sizeof(text)) > 0)
+      messages[count++] = text;
   }
-  return html;
+  return count;
 }
 
-String getTimestampString(){
-  struct tm timeinfo;
-  if(!getLocalTime(&timeinfo)){
-    Serial.println("Failed to obtain time");
-    return "no time";
-  }
-
-  char buffer[25];
-  strftime(buffer,sizeof(buffer),"%Y-%m-%d %H:%M:%S %Z", &timeinfo);
-  String datetime = String(buffer);
-  return datetime;
-}
-
-/* wait for maintenance mode or timeout 5s */
-bool waitForMaintenanceMode() {
-  needMaintenanceMode = true;
-  unsigned long startMillis = millis();
-  while (currentMode != Mode::maintenance) {
-    if ((millis() - startMillis) >= 5000ul) {
-      needMaintenanceMode = false;
-      return false;
-    }
-    delay(50);
-  }
-  needMaintenanceMode = false;
-  return true;
+// SPIFFS is only needed by the journal and custom tunes, the built-in melodies are in flash
+bool mountSpiffs() {
+  static bool mounted = false;
+  if (!mounted)
+    mounted = SPIFFS.begin(true);
+  return mounted;
 }
 
 // send LastMessage to websocket clients
 void notifyClients(String message) {
-  String messageWithTimestamp = "[" + getTimestampString() + "]: " + message;
-  Serial.println(messageWithTimestamp);
-  addLogMessage(messageWithTimestamp);
+  char timestamp[TIME_TIMESTAMP_LENGTH];
+  timeService.formatNow(timestamp, sizeof(timestamp));
+  Serial.print('['); Serial.print(timestamp); Serial.print("]: "); Serial.println(message);
+  eventStream.publish(StreamEventType::log, 0, 0, message.c_str());
 }
 
-bool doPairing() {
+// the new code is written to the sensor by the sensor task, pairing is completed in onPairingCodeWritten()
+void doPairing() {
+  if (pairingInProgress)
+    return;
+
   String newPairingCode = settingsManager.generateNewPairingCode();
+  if (sensorTask.postWritePairingCode(newPairingCode))
+    pairingInProgress = true;
+  else
+    notifyClients("Pairing failed.");
+}
 
-  if (fingerManager.setPairingCode(newPairingCode)) {
+void onPairingCodeWritten(const SensorEvent &event) {
+  pairingInProgress = false;
+  if (event.ok) {
     AppSettings settings = settingsManager.getAppSettings();
-    settings.sensorPairingCode = newPairingCode;
+    settings.sensorPairingCode = String(event.text);
     settings.sensorPairingValid = true;
     settingsManager.saveAppSettings(settings);
     notifyClients("Pairing successful.");
-    return true;
   } else {
     notifyClients("Pairing failed.");
-    return false;
   }
-
 }
 
-bool checkPairingValid() {
+// only a mismatch of a code actually read from the sensor is a security issue, a failed read or the automatic first
+// pairing just don't allow access for this scan
+enum class PairingCheck { valid, firstPairing, readError, invalidated, mismatch };
+
+PairingCheck checkPairing(const String &actualSensorPairingCode) {
   AppSettings settings = settingsManager.getAppSettings();
 
-   if (!settings.sensorPairingValid) {
-     if (settings.sensorPairingCode.isEmpty()) {
-       // first boot, do pairing automatically so the user does not have to do this manually
-       return doPairing();
-     } else {
-      Serial.println("Pairing has been invalidated previously.");
-      return false;
-     }
-   }
-
-  String actualSensorPairingCode = fingerManager.getPairingCode();
+  if (!settings.sensorPairingValid) {
+    if (settings.sensorPairingCode.isEmpty()) {
+      // first boot, do pairing automatically so the user does not have to do this manually
+      doPairing();
+      return PairingCheck::firstPairing;
+    }
+    Serial.println("Pairing has been invalidated previously.");
+    bool differs = !actualSensorPairingCode.isEmpty() && !actualSensorPairingCode.equals(settings.sensorPairingCode);
+    return differs ? PairingCheck::mismatch : PairingCheck::invalidated;
+  }
+
   //Serial.println("Awaited pairing code: " + settings.sensorPairingCode);
   //Serial.println("Actual pairing code: " + actualSensorPairingCode);
 
-  if (actualSensorPairingCode.equals(settings.sensorPairingCode))
-    return true;
-  else {
-    if (!actualSensorPairingCode.isEmpty()) {
-      // An empty code means there was a communication problem. So we don't have a valid code, but maybe next read will succeed and we get one again.
-      // But here we just got an non-empty pairing code that was different to the awaited one. So don't expect that will change in future until repairing was done.
-      // -> invalidate pairing for security reasons
-      AppSettings settings = settingsManager.getAppSettings();
-      settings.sensorPairingValid = false;
-      settingsManager.saveAppSettings(settings);
-    }
-    return false;
+  if (actualSensorPairingCode.isEmpty()) {
+    // An empty code means there was a communication problem. So we don't have a valid code, but maybe next read will succeed and we get one again.
+    return PairingCheck::readError;
   }
-}
-
-void createUserApi(int fingerID) {
-  http.begin("http://192.168.43.28:8000/users");
-  http.addHeader("Content-Type", "application/json");
+  if (actualSensorPairingCode.equals(settings.sensorPairingCode))
+    return PairingCheck::valid;
 
-  int httpResponseCode = http.POST("{ \"fingerprint\": " + String(fingerID) + ", \"lastname\": \"azert\", \"firstname\": \"azert\", \"isAuthorized\": false }");
+  // Here we just got an non-empty pairing code that was different to the awaited one. So don't expect that will change in future until repairing was done.
+  // -> invalidate pairing for security reasons
+  settings.sensorPairingValid = false;
+  settingsManager.saveAppSettings(settings);
+  return PairingCheck::mismatch;
+}
 
-  if(httpResponseCode>0){
-    String response = http.getString();
+void doAccessDecision(uint16_t fingerId, bool authorized, AccessSource source) {
+  if (authorized) {
+    buzzer.play(melodyCache.get("simpsons"), BuzzerPriority::access);
 
-    Serial.println(httpResponseCode);
-    Serial.println(response);
-  }else{
-    Serial.print("Error on sending POST: ");
-    Serial.println(httpResponseCode);
+    // Ouvre la porte et sonne
+    eventLog.log(LogCode::accessGranted, fingerId, (int)source);
+  } else {
+    buzzer.play(melodyCache.get("reussi"), BuzzerPriority::access);
+    eventLog.log(LogCode::accessDenied, fingerId, (int)source);
   }
+  latencyMetrics.record(LatencyStage::touchToDoor, micros() - decisionScanStartMicros);
 
-  http.end();
+  // written behind, uploaded by the api worker when the backend is reachable
+  eventJournal.logAccess(fingerId, authorized, source);
 }
 
-String getUserApi(int fingerID) {
-  // use the IP adress of your server/pc in the same network
-  http.begin("http://192.168.43.28:8000/users/fingerprint/" + String(fingerID));
-  http.addHeader("Content-Type", "application/json");
-
-  int httpResponseCode = http.GET();
-  String response;
+// door opened over MQTT, not bound to a finger
+void doRemoteOpen() {
+  buzzer.play(melodyCache.get("simpsons"), BuzzerPriority::access);
+  eventLog.log(LogCode::accessGranted, 0, (int)AccessSource::remote);
+  eventJournal.logAccess(0, true, AccessSource::remote);
+}
 
-  if(httpResponseCode>0){
-    response = http.getString();
+// called by apiClient.poll() when the user lookup for a match (cache miss) is done
+void onUserLookup(const ApiResponse &response) {
+  latencyMetrics.record(LatencyStage::apiLookup, response.latencyMillis * 1000ul);
+  authCache.store(response.fingerId, response.result);
+  if (response.result == UserLookupResult::failed) {
+    // backend not reachable and nothing cached for this finger
+    eventLog.log(LogCode::userLookupFailed, response.fingerId, response.httpCode);
+    doAccessDecision(response.fingerId, false, AccessSource::offline);
+  } else {
+    doAccessDecision(response.fingerId, response.result == UserLookupResult::authorized, AccessSource::api);
+  }
+}
 
-    Serial.println(httpResponseCode);
-    Serial.println(response);
-  }else{
-    Serial.print("Error on sending GET: ");
-    Serial.println(httpResponseCode);
+// called by apiClient.poll() when a background refresh of a stale cache entry is done
+void onUserRefresh(const ApiResponse &response) {
+  authCache.store(response.fingerId, response.result);
+}
 
-    response = "nope";
+void lookupUser(uint16_t fingerId) {
+  AuthState state;
+  switch (authCache.lookup(fingerId, state)) {
+    case AuthLookup::fresh:
+      doAccessDecision(fingerId, state == AuthState::authorized, AccessSource::cache);
+      break;
+    case AuthLookup::stale:
+      // decide with what we know and ask the API in background (stale-while-revalidate)
+      doAccessDecision(fingerId, state == AuthState::authorized, AccessSource::cache);
+      if (authCache.beginRefresh(fingerId) && !apiClient.lookupUser(fingerId, onUserRefresh))
+        authCache.store(fingerId, UserLookupResult::failed); // clears the pending refresh
+      break;
+    case AuthLookup::miss:
+      // the door is opened in onUserLookup() as soon as the API has answered
+      if (!apiClient.lookupUser(fingerId, onUserLookup)) {
+        notifyClients(String("User lookup for finger #") + fingerId + " could not be queued.");
+        doAccessDecision(fingerId, false, AccessSource::offline);
+      }
+      break;
   }
+}
 
-  http.end();
+void doEnroll(int id, const String &name) {
+  if (id < 1 || id > 200) {
+    notifyClients("Invalid memory slot id '" + String(id) + "'");
+    return;
+  }
 
-  return response;
+  if (!sensorTask.postEnroll(id, name))
+    notifyClients("Enrollment could not be started, sensor is busy.");
 }
 
-void doScan() {
-  Match match = fingerManager.scanFingerprint();
+void onEnrollDone(const SensorEvent &event) {
+  eventStream.publish(StreamEventType::enrollDone, event.id, event.newFinger.enrollResult == EnrollResult::ok, nullptr);
+  if (event.newFinger.enrollResult == EnrollResult::ok) {
+    eventJournal.logCreateUser(event.id); // the user is created by the api worker, even if the backend is not reachable right now
+
+    notifyClients("Enrollment successfull. You can now use your new finger for scanning.");
+  }  else if (event.newFinger.enrollResult == EnrollResult::error) {
+    notifyClients(String("Enrollment failed. (Code ") + event.newFinger.returnCode + ")");
+  }
+}
 
+void doScan(const Match &match, const String &actualSensorPairingCode) {
   switch(match.scanResult)
   {
     case ScanResult::noFinger:
-      // standard case, occurs every iteration when no finger touchs the sensor
-      // Serial.println("no finger");
-      // if (match.scanResult != lastMatch.scanResult) {
-      //   Serial.println("no finger");
-      // }
+    case ScanResult::scanning:
+      // not reported by the sensor task
       break;
     case ScanResult::matchFound:
-      notifyClients( String("Match Found: ") + match.matchId + " - " + match.matchName  + " with confidence of " + match.matchConfidence );
+      eventLog.log(LogCode::matchFound, match.matchId, match.matchConfidence);
+      eventStream.publish(StreamEventType::match, match.matchId, match.matchConfidence, match.matchName);
       if (match.scanResult != lastMatch.scanResult) {
         if (match.matchId != lastMatch.matchId) {
-          if (checkPairingValid()) {
-            String user = getUserApi(match.matchId);
-
-            if (user == "nope") {
-              track = getTrackPath("string", "reussi:d=4,o=5,b=250:e,8p,8f,8g,8p,3c6");
-            } else {
-              track = getTrackPath("file", "simpsons");
-            }
-
-            // Ouvre la porte et sonne
-            Serial.println("Open the door!");
-
-            if (track) {
-              player.play(track);
-            }
+          PairingCheck pairing = checkPairing(actualSensorPairingCode);
+          if (pairing == PairingCheck::valid) {
+            decisionScanStartMicros = match.scanStartMicros;
+            lookupUser(match.matchId);
+          } else if (pairing == PairingCheck::mismatch) {
+            buzzer.play(melodyCache.get("alarm"), BuzzerPriority::alarm); // cuts off any other melody
+          } else {
+            // no access without a verified sensor, but nothing points to an attack
+            buzzer.play(melodyCache.get("goodbad"), BuzzerPriority::feedback);
           }
         } else {
           // Mode enregistrement
-          enrollId = fingerManager.countFingerRegistred() + 1;
-          enrollName = "newFingerprintName_" + String(fingerManager.countFingerRegistred() + 1);
-          currentMode = Mode::enroll;
+          doEnroll(fingerManager.countFingerRegistred() + 1, "newFingerprintName_" + String(fingerManager.countFingerRegistred() + 1));
         }
       } else {
         Serial.println("Security issue! invalid sensor pairing! This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page.");
@@ -234,113 +259,195 @@ void doScan() {
 
       lastMatch = match;
       lastMatch.scanResult = ScanResult::noFinger;
-      delay(3000); // wait some time before next scan to let the LED blink
       break;
     case ScanResult::noMatchFound:
-      notifyClients(String("No Match Found (Code ") + match.returnCode + ")");
+      eventLog.log(LogCode::noMatchFound, match.returnCode);
+      eventStream.publish(StreamEventType::noMatch, 0, match.returnCode, nullptr);
       if (match.scanResult != lastMatch.scanResult) {
-        track = getTrackPath("file", "goodbad");
-
-        if (track) {
-          player.play(track);
-        }
-        delay(1000);
+        buzzer.play(melodyCache.get("goodbad"), BuzzerPriority::feedback);
       } else {
         Serial.println("Not the same finger.");
-        delay(1000); // wait some time before next scan to let the LED blink
       }
 
       lastMatch = match;
       lastMatch.scanResult = ScanResult::noFinger;
       break;
     case ScanResult::error:
-      notifyClients(String("ScanResult Error (Code ") + match.returnCode + ")");
+      eventLog.log(LogCode::scanError, match.returnCode);
+      eventStream.publish(StreamEventType::error, 0, match.returnCode, nullptr);
       break;
   };
 }
 
-void doEnroll() {
-  int id = enrollId;
-  if (id < 1 || id > 200) {
-    notifyClients("Invalid memory slot id '" + String(enrollId) + "'");
-    return;
-  }
+// idle light sleep, called from the sensor task
+bool canSleep() {
+  return !buzzer.isPlaying() && apiClient.isIdle();
+}
 
-  NewFinger finger = fingerManager.enrollFinger(id, enrollName);
-  if (finger.enrollResult == EnrollResult::ok) {
-    createUserApi(enrollId);
+void beforeSleep() {
+  wifiManager.suspend();
+}
 
-    notifyClients("Enrollment successfull. You can now use your new finger for scanning.");
-    fingerManager.setFingersRegistred(enrollId);
-  }  else if (finger.enrollResult == EnrollResult::error) {
-    notifyClients(String("Enrollment failed. (Code ") + finger.returnCode + ")");
-  }
+void afterWake() {
+  wifiManager.resume();
 }
 
-bool initWifi() {
-  // Connect to Wi-Fi
-  WifiSettings wifiSettings = settingsManager.getWifiSettings();
-  WiFi.mode(WIFI_STA);
-  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-  WiFi.begin(wifiSettings.ssid.c_str(), wifiSettings.password.c_str());
-  int counter = 0;
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.println("Waiting for WiFi connection...");
-    counter++;
-    if (counter > 30)
-      return false;
+// result of the sensor handshake at boot
+void onSensorReady(const SensorEvent &event) {
+  if (!event.ok) {
+    sensorTask.postLed(LedMode::error);
+    return;
   }
-  Serial.println("Connected!");
-
-  // Print ESP32 Local IP Address
-  Serial.println(WiFi.localIP());
+  if (event.fingerOnSensor && !wifiConfigMode) {
+    Serial.println("Started WiFi-Config mode");
+    wifiConfigMode = true;
+    wifiManager.suspend();
+  }
+  if (wifiConfigMode) {
+    sensorTask.postLed(LedMode::wifiConfig);
+    return;
+  }
+  // the LED ring was already set to ready by the sensor task
+  if (settingsManager.getAppSettings().idleSleep)
+    sensorTask.setIdleSleep(true, canSleep, beforeSleep, afterWake);
+}
 
-  return true;
+// results of commands posted to the sensor task
+void handleSensorEvent(const SensorEvent &event) {
+  switch (event.type) {
+    case SensorEventType::ready:
+      onSensorReady(event);
+      break;
+    case SensorEventType::scan:
+      doScan(event.match, String(event.text));
+      break;
+    case SensorEventType::enrollDone:
+      onEnrollDone(event);
+      break;
+    case SensorEventType::notepadRead:
+      if (checkPairing(String(event.text)) == PairingCheck::mismatch)
+        notifyClients("Security issue! Pairing with sensor is invalid. This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page.");
+      break;
+    case SensorEventType::notepadWritten:
+      onPairingCodeWritten(event);
+      break;
+    case SensorEventType::deleteDone:
+      authCache.invalidate(event.id);
+      break;
+    case SensorEventType::renameDone:
+      break;
+    case SensorEventType::exportDone:
+      break;
+    case SensorEventType::importDone:
+      if (event.ok) {
+        // the new sensor gets its own pairing code, cached decisions may belong to other fingers now
+        authCache.clear();
+        doPairing();
+      }
+      break;
+    case SensorEventType::deleteBatchDone:
+      authCache.clear();
+      notifyClients(String(event.id) + " fingerprints deleted" + (event.ok ? "." : ", some deletes failed."));
+      break;
+    case SensorEventType::renameBatchDone:
+      notifyClients(String(event.id) + " fingers renamed.");
+      break;
+    case SensorEventType::deleteAllDone:
+      authCache.clear();
+      notifyClients(event.ok ? "All fingerprints deleted." : "Deleting all fingerprints failed.");
+      break;
+  }
 }
 
 void reboot() {
   notifyClients("System is rebooting now...");
+  sensorTask.postFlush();
   delay(1000);
 
   WiFi.disconnect();
   ESP.restart();
 }
 
+// requests of the web api and MQTT which have to be handled by loop()
+void handleRemoteRequests() {
+  uint8_t requests = webApi.takeRequests();
+  if (requests & WEB_API_REQUEST_PAIRING)
+    doPairing();
+  if (requests & WEB_API_REQUEST_SETTINGS_CHANGED) {
+    if (fingerManager.connected)
+      sensorTask.setIdleSleep(settingsManager.getAppSettings().idleSleep, canSleep, beforeSleep, afterWake);
+  }
+  if (requests & WEB_API_REQUEST_REBOOT)
+    shouldReboot = true;
+
+  if (mqttManager.takeRequests() & MQTT_REQUEST_OPEN_DOOR)
+    doRemoteOpen();
+}
+
+// simple commands on the serial monitor
+void handleSerialCommands() {
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+      case 'm': // print latency metrics
+        latencyMetrics.printTo(Serial);
+        wifiManager.printTo(Serial);
+        break;
+      case 'r': // reset latency metrics
+        latencyMetrics.reset();
+        break;
+      case 'l': // print the event log, including the records from before the last reset
+        eventLog.printAll(Serial);
+        break;
+      case 'b': // print the boot timeline
+        bootTimeline.printTo(Serial);
+        break;
+    }
+  }
+}
+
 void setup() {
   // open serial monitor for debug infos
   Serial.begin(115200);
   while (!Serial);  // For Yun/Leo/Micro/Zero/...
   delay(100);
 
-  SPIFFS.begin(true);
+  eventLog.begin();
+  buzzer.begin();
+
+  // the sensor handshake (with retries) and the finger list load run in the sensor task, the rest of the boot
+  // continues here in parallel and scanning starts as soon as the sensor is ready, without waiting for WiFi
+  if (!sensorTask.begin(&fingerManager)) {
+    fingerManager.setLedRingError();
+    return;
+  }
+  sensorTask.postReadPairingCode(); // executed after the handshake, pairing is checked in handleSensorEvent()
 
   settingsManager.loadWifiSettings();
   settingsManager.loadAppSettings();
-  fingerManager.connect();
-
-  if (!checkPairingValid()) {
-    notifyClients("Security issue! Pairing with sensor is invalid. This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page.");
-  }
+  bootTimeline.mark(BootStage::settingsLoaded);
 
-  if (fingerManager.isFingerOnSensor() || !settingsManager.isWifiConfigured()) {
+  // a finger on the sensor at boot selects WiFi config mode too, that is known only after the handshake (see onSensorReady())
+  wifiConfigMode = !settingsManager.isWifiConfigured();
+  if (wifiConfigMode) {
     Serial.println("Started WiFi-Config mode");
-    fingerManager.setLedRingWifiConfig();
-
   } else {
     Serial.println("Started normal operating mode");
-    currentMode = Mode::scan;
+    // WiFi connects in background, scanning works offline in the meantime
+    wifiManager.begin(&settingsManager);
+    bootTimeline.mark(BootStage::wifiStarted);
+  }
 
-    if (initWifi()) {
-      if (fingerManager.connected) {
-        fingerManager.setLedRingReady();
-      } else {
-        fingerManager.setLedRingError();
-      }
-    } else {
-      fingerManager.setLedRingError();
-      shouldReboot = true;
-    }
+  eventJournal.begin();
+  apiClient.begin(settingsManager.getAppSettings().apiUrl, &eventJournal);
+  authCache.loadFromPrefs();
+  bootTimeline.mark(BootStage::journalReady);
+
+  if (!wifiConfigMode) {
+    timeService.begin();
+    webApi.begin(&sensorTask, &fingerManager, &settingsManager);
+    eventStream.begin(webApi.getServer(), WEB_API_USER, settingsManager.getAppSettings().webPassword.c_str());
+    mqttManager.begin(settingsManager.getAppSettings(), &sensorTask);
+    bootTimeline.mark(BootStage::servicesStarted);
   }
 
 }
@@ -351,30 +458,26 @@ void loop() {
     reboot();
   }
 
-  // do the actual loop work
-  switch (currentMode) {
-  case Mode::scan:
-    if (fingerManager.connected)
-      doScan();
-    break;
+  // handle results of the sensor task (scans, enrollments, pairing...)
+  SensorEvent event;
+  while (sensorTask.pollEvent(event))
+    handleSensorEvent(event);
 
-  case Mode::enroll:
-    Serial.println("Mode Enroll");
-    doEnroll();
-    currentMode = Mode::scan; // switch back to scan mode after enrollment is done
+  wifiManager.process();
 
-    Serial.println("Enter in mode Scan");
-    break;
+  // callbacks of finished API requests
+  apiClient.poll();
+  authCache.process();
+  handleRemoteRequests();
+  eventStream.pump();
+  eventLog.printNew(Serial);
 
-  case Mode::maintenance:
-    // do nothing, give webserver exclusive access to sensor (not thread-safe for concurrent calls)
-    Serial.println("Mode Maintenance");
-    break;
+  if (!bootTimelinePrinted && bootTimeline.isComplete()) {
+    bootTimelinePrinted = true;
+    bootTimeline.printTo(Serial);
   }
 
-  // enter maintenance mode (no continous scanning) if requested
-  if (needMaintenanceMode) {
-    currentMode = Mode::maintenance;
-  }
-}
+  handleSerialCommands();
 
+  delay(1);
+}
@@ -1,29 +1,161 @@
 #include <Arduino.h>
-#include <iostream>
-#include <sstream>
-#include <string>
+#include <FS.h>
+#include <SPIFFS.h>
 
 #include "player.h"
+#include "embedded_melodies.h"
+#include "global.h"
 
-Melody getTrackPath(String type, const char track[]) {
-    Melody melody;
+// source for RTTTL files, the parser reads through the file without copying it
+struct RtttlFileSource {
+    File *file;
 
-    if (type.equals("file")) {
-        String path = "/" + String(track) + ".rtttl";
+    int peek() const { return file->peek(); }
+    int read() { return file->read(); }
+};
 
-        melody = MelodyFactory.loadRtttlFile(path);
+template<typename Source>
+static uint16_t parseNotes(Source source, RtttlNote *notes, uint16_t maxCount, uint16_t &bpm) {
+    RtttlParser<Source> parser(source);
+    if (!parser.parseHeader())
+        return 0;
+    bpm = parser.getBpm();
 
-        if (!melody) {
+    RtttlNote note = {};
+    uint16_t count = 0;
+    while (parser.next(note)) {
+        if (notes != nullptr && count < maxCount)
+            notes[count] = note;
+        count++;
+    }
+    return parser.hasError() ? 0 : count;
+}
+
+MelodyCache::Entry* MelodyCache::find(const char *name) {
+    for (int i=0; i<entryCount; i++) {
+        if (strcmp(entries[i].name, name) == 0)
+            return &entries[i];
+    }
+    return nullptr;
+}
+
+bool MelodyCache::load(Entry &entry) {
+    unload(entry);
+
+    // first pass counts the notes, second pass parses them into the allocated array
+    uint16_t bpm = 0;
+    uint16_t count = 0;
+    File file;
+    if (entry.rtttl != nullptr) {
+        count = parseNotes(RtttlStringSource(entry.rtttl), nullptr, 0, bpm);
+    } else {
+        String path = "/" + String(entry.name) + ".rtttl";
+        if (mountSpiffs())
+            file = SPIFFS.open(path, FILE_READ);
+        if (!file) {
             Serial.println(path + " not found, try to load another one...");
+            return false;
         }
+        count = parseNotes(RtttlFileSource{&file}, nullptr, 0, bpm);
+    }
+
+    if (count == 0) {
+        Serial.println(String("Melody ") + entry.name + " can't be parsed.");
+        if (file)
+            file.close();
+        return false;
+    }
+
+    size_t bytes = count * sizeof(RtttlNote);
+    evictFor(bytes, &entry);
+    entry.notes = (RtttlNote*)malloc(bytes);
+    if (entry.notes == nullptr) {
+        if (file)
+            file.close();
+        return false;
+    }
+
+    if (entry.rtttl != nullptr) {
+        parseNotes(RtttlStringSource(entry.rtttl), entry.notes, count, bpm);
     } else {
-       melody =  MelodyFactory.loadRtttlString(track);
+        file.seek(0);
+        parseNotes(RtttlFileSource{&file}, entry.notes, count, bpm);
+        file.close();
+    }
+    entry.count = count;
+    entry.bpm = bpm;
+    usedBytes += bytes;
+    return true;
+}
 
-        if (!melody) {
-            Serial.println("Your custom ringtone dosen't work, loading entertainer ringtone...");
-            melody = MelodyFactory.loadRtttlFile("/entertainer.rtttl");
+void MelodyCache::unload(Entry &entry) {
+    if (entry.notes == nullptr)
+        return;
+    free(entry.notes);
+    entry.notes = nullptr;
+    usedBytes -= entry.count * sizeof(RtttlNote);
+    entry.count = 0;
+}
+
+void MelodyCache::evictFor(size_t bytes, const Entry *keep) {
+    while (usedBytes + bytes > MELODY_CACHE_RAM_BUDGET) {
+        Entry *oldest = nullptr;
+        for (int i=0; i<entryCount; i++) {
+            if (&entries[i] != keep && entries[i].notes != nullptr && (oldest == nullptr || entries[i].lastUsed < oldest->lastUsed))
+                oldest = &entries[i];
         }
+        if (oldest == nullptr)
+            return; // nothing left to evict, keep the melody anyway
+        unload(*oldest);
+    }
+}
+
+const RtttlMelody* MelodyCache::findEmbedded(const char *name) {
+    for (const RtttlMelody &melody : embeddedMelodies) {
+        if (strcmp(melody.name, name) == 0)
+            return &melody;
+    }
+    return nullptr;
+}
+
+bool MelodyCache::preload(const char *name, const char *rtttl) {
+    Entry *entry = find(name);
+    if (entry == nullptr) {
+        if (entryCount >= MELODY_CACHE_SLOTS)
+            return false;
+        entry = &entries[entryCount++];
+        strlcpy(entry->name, name, sizeof(entry->name));
+    }
+    entry->rtttl = rtttl;
+    entry->lastUsed = ++useCounter;
+    return load(*entry);
+}
+
+RtttlMelody MelodyCache::get(const char *name) {
+    const RtttlMelody *embedded = findEmbedded(name);
+    if (embedded != nullptr)
+        return *embedded;
+
+    Entry *entry = find(name);
+    if (entry == nullptr) {
+        // not registered yet, e.g. a custom tune uploaded to SPIFFS
+        preload(name);
+        entry = find(name);
+    }
+
+    if (entry != nullptr) {
+        entry->lastUsed = ++useCounter;
+        if (entry->notes != nullptr || load(*entry))
+            return RtttlMelody{entry->name, entry->notes, entry->count, entry->bpm};
+    }
+
+    if (strcmp(name, MELODY_FALLBACK) != 0) {
+        Serial.println("Your custom ringtone dosen't work, loading " MELODY_FALLBACK " ringtone...");
+        return get(MELODY_FALLBACK);
     }
+    return RtttlMelody{name, nullptr, 0, 0};
+}
 
-    return melody;
+size_t MelodyCache::getUsedBytes() {
+    return usedBytes;
 }
@@ -0,0 +1,712 @@
+#include "Arduino.h"
+#include "esp_timer.h"
+#include <stdarg.h>
+#include <sys/time.h>
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+
+const IPAddress INADDR_NONE(0);
+
+// String
+
+std::string String::fromInteger(long long number, unsigned char base) {
+  if (number < 0)
+    return "-" + fromUnsigned(-(unsigned long long)number, base);
+  return fromUnsigned(number, base);
+}
+
+std::string String::fromUnsigned(unsigned long long number, unsigned char base) {
+  if (base < 2 || base > 36)
+    base = 10;
+  std::string digits;
+  do {
+    int digit = number % base;
+    digits.insert(digits.begin(), (char)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+    number /= base;
+  } while (number > 0);
+  return digits;
+}
+
+std::string String::fromDouble(double number, unsigned int decimalPlaces) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", (int)decimalPlaces, number);
+  return buffer;
+}
+
+bool String::equalsIgnoreCase(const String &other) const {
+  if (value.length() != other.value.length())
+    return false;
+  for (size_t i = 0; i < value.length(); i++) {
+    if (tolower((unsigned char)value[i]) != tolower((unsigned char)other.value[i]))
+      return false;
+  }
+  return true;
+}
+
+bool String::endsWith(const String &suffix) const {
+  return value.length() >= suffix.value.length() &&
+         value.compare(value.length() - suffix.value.length(), suffix.value.length(), suffix.value) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t index = value.find(c, from);
+  return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::indexOf(const String &text, unsigned int from) const {
+  size_t index = value.find(text.value, from);
+  return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::lastIndexOf(char c) const {
+  size_t index = value.rfind(c);
+  return index == std::string::npos ? -1 : (int)index;
+}
+
+String String::substring(unsigned int from) const {
+  return from < value.length() ? String(value.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to)
+    std::swap(from, to);
+  if (from >= value.length())
+    return String();
+  return String(value.substr(from, std::min((size_t)to, value.length()) - from));
+}
+
+void String::replace(const String &find, const String &replacement) {
+  if (find.value.empty())
+    return;
+  for (size_t index = value.find(find.value); index != std::string::npos; index = value.find(find.value, index + replacement.value.length()))
+    value.replace(index, find.value.length(), replacement.value);
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if (index < value.length())
+    value.erase(index, count);
+}
+
+void String::toLowerCase() {
+  for (char &c : value)
+    c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+  for (char &c : value)
+    c = toupper((unsigned char)c);
+}
+
+void String::trim() {
+  size_t first = value.find_first_not_of(" \t\r\n\f\v");
+  if (first == std::string::npos) {
+    value.clear();
+    return;
+  }
+  size_t last = value.find_last_not_of(" \t\r\n\f\v");
+  value = value.substr(first, last - first + 1);
+}
+
+long String::toInt() const {
+  return atol(value.c_str());
+}
+
+float String::toFloat() const {
+  return atof(value.c_str());
+}
+
+void String::getBytes(unsigned char *buffer, unsigned int size, unsigned int index) const {
+  if (buffer == nullptr || size == 0)
+    return;
+  if (index >= value.length()) {
+    buffer[0] = 0;
+    return;
+  }
+  size_t length = std::min((size_t)size - 1, value.length() - index);
+  memcpy(buffer, value.data() + index, length);
+  buffer[length] = 0;
+}
+
+// libc
+
+size_t nativeStrlcpy(char *destination, const char *source, size_t size) {
+  size_t length = strlen(source);
+  if (size > 0) {
+    size_t copied = std::min(length, size - 1);
+    memcpy(destination, source, copied);
+    destination[copied] = 0;
+  }
+  return length;
+}
+
+char* itoa(int value, char *buffer, int base) {
+  std::string text = String(value, (unsigned char)base).str();
+  memcpy(buffer, text.c_str(), text.length() + 1);
+  return buffer;
+}
+
+// simulated time and esp_timer
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void *arg;
+  bool armed;
+  uint64_t deadline;
+  uint64_t period;
+};
+
+static std::atomic<uint64_t> clockMicros{0};
+static std::recursive_mutex timerMutex;
+static std::vector<esp_timer*> timers;
+static std::function<uint32_t()> dispatchLatency;
+static std::atomic<uint32_t> wallClockBase{0};
+static std::atomic<uint64_t> wallClockSetMicros{0};
+
+static void raiseClock(uint64_t micros) {
+  uint64_t current = clockMicros.load();
+  while (current < micros && !clockMicros.compare_exchange_weak(current, micros));
+}
+
+// moves the clock to target and runs the timers due on the way in the order of their deadlines
+static void advanceClockTo(uint64_t target) {
+  for (;;) {
+    esp_timer_cb_t callback;
+    void *arg;
+    {
+      std::lock_guard<std::recursive_mutex> lock(timerMutex);
+      esp_timer *due = nullptr;
+      for (esp_timer *timer : timers) {
+        if (timer->armed && timer->deadline <= target && (due == nullptr || timer->deadline < due->deadline))
+          due = timer;
+      }
+      if (due == nullptr) {
+        raiseClock(target);
+        return;
+      }
+      uint64_t fireMicros = std::max(due->deadline, clockMicros.load()) + (dispatchLatency ? dispatchLatency() : 0);
+      if (due->period > 0)
+        due->deadline += due->period;
+      else
+        due->armed = false;
+      raiseClock(fireMicros);
+      callback = due->callback;
+      arg = due->arg;
+    }
+    callback(arg);
+  }
+}
+
+uint64_t NativeClock::getMicros() {
+  return clockMicros.load();
+}
+
+void NativeClock::advanceMicros(uint64_t micros) {
+  advanceClockTo(clockMicros.load() + micros);
+}
+
+void NativeClock::blockFor(uint64_t micros) {
+  advanceMicros(micros);
+  if (NativeRtos::getTaskCount() > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(std::max<uint64_t>(micros * NATIVE_REAL_MICROS_PER_TICK / 1000, 1)));
+}
+
+void NativeClock::reset() {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  for (esp_timer *timer : timers)
+    timer->armed = false;
+  clockMicros = 0;
+  wallClockBase = 0;
+  wallClockSetMicros = 0;
+}
+
+void NativeClock::setWallClock(uint32_t unixTime) {
+  wallClockSetMicros = clockMicros.load();
+  wallClockBase = unixTime;
+}
+
+uint32_t NativeClock::getWallClock() {
+  uint32_t base = wallClockBase.load();
+  if (base == 0)
+    return 0;
+  return base + (uint32_t)((clockMicros.load() - wallClockSetMicros.load()) / 1000000ull);
+}
+
+void NativeTimers::setDispatchLatency(std::function<uint32_t()> latencyMicros) {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  dispatchLatency = latencyMicros;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+  if (args == nullptr || args->callback == nullptr || handle == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  *handle = new esp_timer{args->callback, args->arg, false, 0, 0};
+  timers.push_back(*handle);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutMicros) {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  if (timer->armed)
+    return ESP_ERR_INVALID_STATE;
+  timer->deadline = clockMicros.load() + timeoutMicros;
+  timer->period = 0;
+  timer->armed = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodMicros) {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  if (timer->armed)
+    return ESP_ERR_INVALID_STATE;
+  timer->deadline = clockMicros.load() + periodMicros;
+  timer->period = periodMicros;
+  timer->armed = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  if (!timer->armed)
+    return ESP_ERR_INVALID_STATE;
+  timer->armed = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  std::lock_guard<std::recursive_mutex> lock(timerMutex);
+  for (size_t i = 0; i < timers.size(); i++) {
+    if (timers[i] == timer) {
+      timers.erase(timers.begin() + i);
+      delete timer;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+int64_t esp_timer_get_time() {
+  return clockMicros.load();
+}
+
+unsigned long millis() {
+  return clockMicros.load() / 1000ull;
+}
+
+unsigned long micros() {
+  return clockMicros.load();
+}
+
+void delay(uint32_t ms) {
+  NativeClock::blockFor(ms * 1000ull);
+}
+
+void delayMicroseconds(uint32_t us) {
+  NativeClock::advanceMicros(us);
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+// the wall clock of the libc, set by SNTP on the ESP32 and by NativeClock::setWallClock() here
+extern "C" time_t time(time_t *result) __THROW {
+  time_t now = NativeClock::getWallClock();
+  if (result != nullptr)
+    *result = now;
+  return now;
+}
+
+extern "C" int gettimeofday(struct timeval *tv, void *tz) __THROW {
+  uint32_t base = wallClockBase.load();
+  uint64_t elapsed = base != 0 ? clockMicros.load() - wallClockSetMicros.load() : clockMicros.load();
+  tv->tv_sec = base + elapsed / 1000000ull;
+  tv->tv_usec = elapsed % 1000000ull;
+  return 0;
+}
+
+void configTime(long gmtOffsetSeconds, int daylightOffsetSeconds, const char *server1, const char *server2, const char *server3) {
+}
+
+// random numbers, reproducible
+
+static std::mt19937 randomGenerator(12345);
+static std::mutex randomMutex;
+
+long random(long max) {
+  return max > 0 ? random(0, max) : 0;
+}
+
+long random(long min, long max) {
+  if (min >= max)
+    return min;
+  std::lock_guard<std::mutex> lock(randomMutex);
+  return min + (long)(randomGenerator() % (unsigned long)(max - min));
+}
+
+void randomSeed(unsigned long seed) {
+  std::lock_guard<std::mutex> lock(randomMutex);
+  randomGenerator.seed(seed);
+}
+
+uint32_t esp_random() {
+  std::lock_guard<std::mutex> lock(randomMutex);
+  return randomGenerator();
+}
+
+static esp_reset_reason_t resetReason = ESP_RST_POWERON;
+
+esp_reset_reason_t esp_reset_reason() {
+  return resetReason;
+}
+
+void NativeSystem::setResetReason(esp_reset_reason_t reason) {
+  resetReason = reason;
+}
+
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() {
+  return NATIVE_FREE_HEAP;
+}
+
+// GPIO
+
+struct NativePin {
+  int level = HIGH;
+  void (*handler)(void*) = nullptr;
+  void *arg = nullptr;
+  bool interruptEnabled = false;
+};
+
+static std::map<uint8_t, NativePin> pins;
+static std::recursive_mutex pinMutex;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin];
+}
+
+int digitalRead(uint8_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  return pins[pin].level;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin].level = value;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void *arg, int mode) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin].handler = handler;
+  pins[pin].arg = arg;
+  pins[pin].interruptEnabled = true;
+}
+
+void detachInterrupt(uint8_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin].handler = nullptr;
+  pins[pin].interruptEnabled = false;
+}
+
+void NativeGpio::setLevel(uint8_t pin, int level) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin].level = level;
+}
+
+void NativeGpio::setInterruptEnabled(uint8_t pin, bool enabled) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins[pin].interruptEnabled = enabled;
+}
+
+bool NativeGpio::raiseInterrupt(uint8_t pin) {
+  void (*handler)(void*);
+  void *arg;
+  {
+    std::lock_guard<std::recursive_mutex> lock(pinMutex);
+    NativePin &state = pins[pin];
+    if (state.handler == nullptr || !state.interruptEnabled)
+      return false;
+    handler = state.handler;
+    arg = state.arg;
+  }
+  handler(arg);
+  return true;
+}
+
+bool NativeGpio::isInterruptAttached(uint8_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  return pins[pin].handler != nullptr;
+}
+
+void NativeGpio::reset() {
+  std::lock_guard<std::recursive_mutex> lock(pinMutex);
+  pins.clear();
+}
+
+// LEDC
+
+static std::map<uint8_t, std::vector<NativeTone>> tones;
+static std::mutex toneMutex;
+
+uint32_t ledcSetup(uint8_t channel, uint32_t frequency, uint8_t resolution) {
+  return frequency;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {
+}
+
+uint32_t ledcWriteTone(uint8_t channel, uint32_t frequency) {
+  std::lock_guard<std::mutex> lock(toneMutex);
+  tones[channel].push_back(NativeTone{clockMicros.load(), frequency});
+  return frequency;
+}
+
+const std::vector<NativeTone>& NativeLedc::getTones(uint8_t channel) {
+  std::lock_guard<std::mutex> lock(toneMutex);
+  return tones[channel];
+}
+
+void NativeLedc::reset() {
+  std::lock_guard<std::mutex> lock(toneMutex);
+  tones.clear();
+}
+
+// Print and Stream
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t written = 0;
+  while (written < size && write(buffer[written]) == 1)
+    written++;
+  return written;
+}
+
+size_t Print::print(long number, int base) {
+  return print(String(number, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long number, int base) {
+  return print(String(number, (unsigned char)base));
+}
+
+size_t Print::print(double number, int digits) {
+  return print(String(number, (unsigned int)digits));
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0)
+    return 0;
+  return write((const uint8_t*)buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
+
+// polls once per millisecond, HardwareSerial knows when the next byte arrives
+bool Stream::waitForData(unsigned long deadlineMillis) {
+  if (millis() >= deadlineMillis)
+    return false;
+  NativeClock::blockFor(1000);
+  return true;
+}
+
+int Stream::timedRead() {
+  unsigned long deadline = millis() + timeout;
+  do {
+    if (available() > 0)
+      return read();
+  } while (waitForData(deadline));
+  return -1;
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0)
+      break;
+    buffer[count++] = (uint8_t)c;
+  }
+  return count;
+}
+
+String Stream::readString() {
+  String text;
+  for (int c = timedRead(); c >= 0; c = timedRead())
+    text += (char)c;
+  return text;
+}
+
+// HardwareSerial
+
+uint64_t HardwareSerial::getByteMicros(uint32_t baudRate) {
+  return baudRate > 0 ? (10000000ull + baudRate / 2) / baudRate : 0;
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert, unsigned long timeoutMs) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  // the UART driver is installed again, received data is lost
+  lineBaudRate = baud;
+  incoming.clear();
+  rxBuffer.clear();
+}
+
+void HardwareSerial::end() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  lineBaudRate = 0;
+  incoming.clear();
+  rxBuffer.clear();
+}
+
+void HardwareSerial::receivePending() {
+  uint64_t now = clockMicros.load();
+  while (!incoming.empty() && incoming.front().micros <= now) {
+    if (rxBuffer.size() < NATIVE_SERIAL_RX_BUFFER_SIZE)
+      rxBuffer.push_back(incoming.front().value);
+    else
+      overflows++;
+    incoming.pop_front();
+  }
+}
+
+int HardwareSerial::available() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  receivePending();
+  return rxBuffer.size();
+}
+
+int HardwareSerial::read() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  receivePending();
+  if (rxBuffer.empty())
+    return -1;
+  uint8_t value = rxBuffer.front();
+  rxBuffer.pop_front();
+  return value;
+}
+
+int HardwareSerial::peek() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  receivePending();
+  return rxBuffer.empty() ? -1 : rxBuffer.front();
+}
+
+bool HardwareSerial::waitForData(unsigned long deadlineMillis) {
+  uint64_t now, target;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    receivePending();
+    if (!rxBuffer.empty())
+      return true;
+    now = clockMicros.load();
+    target = deadlineMillis * 1000ull;
+    if (now >= target)
+      return false;
+    if (!incoming.empty())
+      target = std::min(target, incoming.front().micros);
+  }
+  NativeClock::blockFor(target - now);
+  return true;
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+  SerialDevice *receiver;
+  uint32_t baud;
+  uint64_t stopBitMicros;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (lostWriteByte >= 0 && bytesWritten + 1 > lostWriteByte) {
+      lostWriteByte = -1;
+      return 0;
+    }
+    bytesWritten++;
+    receiver = device;
+    baud = lineBaudRate;
+    // written into the TX FIFO without waiting, the bytes leave one after another
+    stopBitMicros = std::max(clockMicros.load(), txLineFreeMicros) + getByteMicros(baud);
+    txLineFreeMicros = stopBitMicros;
+  }
+  if (receiver != nullptr)
+    receiver->onReceive(*this, value, baud, stopBitMicros);
+  else if (number == 0 && getenv("NATIVE_SERIAL_ECHO") != nullptr)
+    putchar(value);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (lostWriteByte >= 0 && bytesWritten + size > lostWriteByte) {
+      lostWriteByte = -1;
+      return 0;
+    }
+  }
+  for (size_t i = 0; i < size; i++)
+    write(buffer[i]);
+  return size;
+}
+
+void HardwareSerial::attach(SerialDevice *serialDevice) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  device = serialDevice;
+}
+
+void HardwareSerial::deliver(const uint8_t *data, size_t length, uint32_t deviceBaudRate, uint64_t startMicros) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (deviceBaudRate != lineBaudRate)
+    return; // garbage at this baud rate
+  uint64_t byteMicros = getByteMicros(deviceBaudRate);
+  uint64_t micros = std::max(startMicros, rxLineFreeMicros);
+  for (size_t i = 0; i < length; i++) {
+    micros += byteMicros;
+    incoming.push_back(Arrival{micros, data[i]});
+  }
+  rxLineFreeMicros = micros;
+}
+
+uint32_t HardwareSerial::getOverflowCount() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  receivePending();
+  return overflows;
+}
+
+uint32_t HardwareSerial::getBytesWritten() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return bytesWritten;
+}
+
+void HardwareSerial::loseWriteAfter(uint32_t bytes) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  lostWriteByte = (int64_t)bytesWritten + bytes;
+}
+
+void HardwareSerial::reset() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  device = nullptr;
+  lineBaudRate = 0;
+  txLineFreeMicros = 0;
+  rxLineFreeMicros = 0;
+  incoming.clear();
+  rxBuffer.clear();
+  overflows = 0;
+  bytesWritten = 0;
+  lostWriteByte = -1;
+}
+
+// IPAddress
+
+String IPAddress::toString() const {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buffer);
+}
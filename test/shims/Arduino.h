@@ -0,0 +1,172 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*
+  Arduino core of the ESP32 for the native build (platformio.ini, env:native). Time is simulated: millis()/micros()
+  only move when somebody waits (delay(), a serial read timeout, a queue timeout) or a test advances the NativeClock,
+  so latencies measured by the firmware are those of the simulated hardware and the tests are deterministic.
+*/
+
+#ifndef ARDUINO
+#define ARDUINO 10813
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "WString.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+
+using std::min;
+using std::max;
+using std::abs;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define F(text) (text)
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define DEC 10
+#define HEX 16
+#define digitalPinToInterrupt(pin) (pin)
+
+// not in every libc
+size_t nativeStrlcpy(char *destination, const char *source, size_t size);
+#define strlcpy nativeStrlcpy
+char* itoa(int value, char *buffer, int base);
+
+// simulated time, shared by all threads
+class NativeClock {
+  public:
+    static uint64_t getMicros();
+    // moves the time forward, runs the esp_timers that become due on the way
+    static void advanceMicros(uint64_t micros);
+    static void advanceMillis(uint64_t millis) { advanceMicros(millis * 1000ull); }
+    // advances the clock for a thread that blocks, e.g. in delay(). While tasks are running it also sleeps
+    // NATIVE_REAL_MICROS_PER_TICK of real time per simulated millisecond, so the other threads get their share.
+    static void blockFor(uint64_t micros);
+    // back to power-on: time 0, no timers, wall clock not set
+    static void reset();
+    // unix time returned by time()/gettimeofday(), 0 = not set like after a power cycle
+    static void setWallClock(uint32_t unixTime);
+    static uint32_t getWallClock();
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// GPIO, interrupts are raised by the tests
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+class NativeGpio {
+  public:
+    static void setLevel(uint8_t pin, int level);
+    static void setInterruptEnabled(uint8_t pin, bool enabled); // gpio_intr_enable()/gpio_intr_disable()
+    // calls the interrupt handler of the pin like the GPIO ISR would, false if none is attached or it is disabled
+    static bool raiseInterrupt(uint8_t pin);
+    static bool isInterruptAttached(uint8_t pin);
+    static void reset();
+};
+
+// LEDC, the tone changes are recorded with their time
+struct NativeTone {
+  uint64_t micros;
+  uint32_t frequency;
+};
+
+uint32_t ledcSetup(uint8_t channel, uint32_t frequency, uint8_t resolution);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+uint32_t ledcWriteTone(uint8_t channel, uint32_t frequency);
+
+class NativeLedc {
+  public:
+    static const std::vector<NativeTone>& getTones(uint8_t channel);
+    static void reset();
+};
+
+void configTime(long gmtOffsetSeconds, int daylightOffsetSeconds, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *text) { return text != nullptr ? write((const uint8_t*)text, strlen(text)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+    size_t print(const char *text) { return write(text); }
+    size_t print(const String &text) { return write(text.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char number, int base = DEC) { return print((unsigned long)number, base); }
+    size_t print(int number, int base = DEC) { return print((long)number, base); }
+    size_t print(unsigned int number, int base = DEC) { return print((unsigned long)number, base); }
+    size_t print(long number, int base = DEC);
+    size_t print(unsigned long number, int base = DEC);
+    size_t print(long long number, int base = DEC) { return print((long)number, base); }
+    size_t print(unsigned long long number, int base = DEC) { return print((unsigned long)number, base); }
+    size_t print(double number, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template<typename T>
+    size_t println(const T &value) { size_t n = print(value); return n + println(); }
+    template<typename T>
+    size_t println(const T &value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+  protected:
+    unsigned long timeout = 1000;
+
+    int timedRead();
+    // waits (in simulated time) until data may be there, false when the deadline has passed
+    virtual bool waitForData(unsigned long deadlineMillis);
+
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeoutMs) { timeout = timeoutMs; }
+    size_t readBytes(uint8_t *buffer, size_t length);
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+    String readString();
+};
+
+#include "Esp.h"
+#include "HardwareSerial.h"
+#include "IPAddress.h"
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_SIZE 32
+
+// SHA256 of the intrbiz Crypto library
+class SHA256 {
+  private:
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t blockLength;
+    uint64_t totalLength;
+
+    void processBlock();
+
+  public:
+    SHA256();
+    void doUpdate(const uint8_t *data, size_t length);
+    void doUpdate(const char *text);
+    void doFinal(uint8_t *digest);
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "ESPAsyncWebServer.h"
+#include <algorithm>
+
+// function statics: global AsyncWebSockets (the event stream) register before the statics of this file are initialized
+static std::mutex& getRegistryMutex() {
+  static std::mutex registryMutex;
+  return registryMutex;
+}
+
+static std::vector<AsyncWebSocket*>& getRegistry() {
+  static std::vector<AsyncWebSocket*> registry;
+  return registry;
+}
+static std::mutex asyncTcp; // one request at a time
+
+AwsClientStatus AsyncWebSocketClient::status() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return clientStatus;
+}
+
+bool AsyncWebSocketClient::queueIsFull() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return queue.size() >= WS_MAX_QUEUED_MESSAGES || clientStatus != WS_CONNECTED;
+}
+
+void AsyncWebSocketClient::text(const char *message, size_t length) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (clientStatus != WS_CONNECTED)
+    return;
+  if (queue.size() >= WS_MAX_QUEUED_MESSAGES) {
+    dropped++; // "ERROR: Too many messages queued"
+    return;
+  }
+  queue.emplace_back(message, length);
+}
+
+void AsyncWebSocketClient::close(uint16_t code, const char *message) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (clientStatus != WS_CONNECTED)
+    return;
+  clientStatus = WS_DISCONNECTING;
+  closeCode = code;
+}
+
+std::vector<std::string> AsyncWebSocketClient::receive(size_t maxCount) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  std::vector<std::string> messages;
+  while (!queue.empty() && messages.size() < maxCount) {
+    messages.push_back(queue.front());
+    queue.pop_front();
+  }
+  return messages;
+}
+
+size_t AsyncWebSocketClient::getQueued() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return queue.size();
+}
+
+uint32_t AsyncWebSocketClient::getDroppedCount() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return dropped;
+}
+
+uint16_t AsyncWebSocketClient::getCloseCode() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return closeCode;
+}
+
+AsyncWebSocket::AsyncWebSocket(const String &newUrl) : url(newUrl.c_str()) {
+  std::lock_guard<std::mutex> lock(getRegistryMutex());
+  getRegistry().push_back(this);
+}
+
+AsyncWebSocket::AsyncWebSocket(const AsyncWebSocket &other) : url(other.url), username(other.username), password(other.password), handler(other.handler) {
+  std::lock_guard<std::mutex> lock(getRegistryMutex());
+  getRegistry().push_back(this);
+}
+
+AsyncWebSocket::~AsyncWebSocket() {
+  std::lock_guard<std::mutex> lock(getRegistryMutex());
+  std::vector<AsyncWebSocket*> &registry = getRegistry();
+  registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+void AsyncWebSocket::setAuthentication(const char *newUsername, const char *newPassword) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  username = newUsername != nullptr ? newUsername : "";
+  password = newPassword != nullptr ? newPassword : "";
+}
+
+void AsyncWebSocket::onEvent(AwsEventHandler newHandler) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  handler = newHandler;
+}
+
+AsyncWebSocketClient* AsyncWebSocket::client(uint32_t id) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  for (auto &entry : clients) {
+    if (entry->clientId == id)
+      return entry.get();
+  }
+  return nullptr;
+}
+
+size_t AsyncWebSocket::count() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return std::count_if(clients.begin(), clients.end(), [](const std::unique_ptr<AsyncWebSocketClient> &entry) {
+    return entry->clientStatus == WS_CONNECTED;
+  });
+}
+
+void AsyncWebSocket::cleanupClients(uint16_t maxClients) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (count() > maxClients)
+    clients.front()->close();
+  clients.remove_if([](const std::unique_ptr<AsyncWebSocketClient> &entry) { return entry->clientStatus == WS_DISCONNECTED; });
+}
+
+AsyncWebSocketClient* AsyncWebSocket::connect(const char *user, const char *pass) {
+  AsyncWebSocketClient *newClient;
+  AwsEventHandler eventHandler;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!username.empty() && (username != user || password != pass))
+      return nullptr; // 401 on the handshake request
+    clients.emplace_back(new AsyncWebSocketClient(nextId++, mutex));
+    newClient = clients.back().get();
+    eventHandler = handler;
+  }
+  if (eventHandler)
+    eventHandler(this, newClient, WS_EVT_CONNECT, nullptr, nullptr, 0);
+  return newClient;
+}
+
+void AsyncWebSocket::disconnect(AsyncWebSocketClient *oldClient) {
+  AwsEventHandler eventHandler;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (oldClient->clientStatus == WS_DISCONNECTED)
+      return;
+    oldClient->clientStatus = WS_DISCONNECTED;
+    eventHandler = handler;
+  }
+  if (eventHandler)
+    eventHandler(this, oldClient, WS_EVT_DISCONNECT, nullptr, nullptr, 0);
+}
+
+AsyncWebSocket* NativeWebSockets::find(const char *url) {
+  std::lock_guard<std::mutex> lock(getRegistryMutex());
+  for (AsyncWebSocket *webSocket : getRegistry()) {
+    if (strcmp(webSocket->getUrl(), url) == 0)
+      return webSocket;
+  }
+  return nullptr;
+}
+
+bool AsyncWebServerRequest::hasParam(const String &name, bool post, bool file) const {
+  for (const AsyncWebParameter &param : parameters) {
+    if (param.name() == name && param.isPost() == post && param.isFile() == file)
+      return true;
+  }
+  return false;
+}
+
+AsyncWebParameter* AsyncWebServerRequest::getParam(const String &name, bool post, bool file) {
+  for (AsyncWebParameter &param : parameters) {
+    if (param.name() == name && param.isPost() == post && param.isFile() == file)
+      return &param;
+  }
+  return nullptr;
+}
+
+bool AsyncWebServerRequest::authenticate(const char *username, const char *password, const char *realm, bool passwordIsHash) {
+  return !authUser.isEmpty() && authUser == username && authPassword == password;
+}
+
+void AsyncWebServerRequest::requestAuthentication(const char *realm, bool isDigest) {
+  send(401);
+}
+
+void AsyncWebServerRequest::send(int code, const String &contentType, const String &content) {
+  if (response.code != 0)
+    return; // the library sends one response per request
+  response.code = code;
+  response.contentType = contentType;
+  response.body = content.c_str();
+}
+
+void AsyncWebServerRequest::send(FS &fs, const String &path, const String &contentType, bool download) {
+  File file = fs.open(path, FILE_READ);
+  if (!file)
+    return send(404);
+  std::string body(file.size(), '\0');
+  body.resize(file.read((uint8_t*)&body[0], body.size()));
+  file.close();
+  send(200, contentType);
+  response.body = body;
+  response.download = download;
+}
+
+bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) {
+  if (!requestHandler || !(method & request->method()))
+    return false;
+  return uri == request->url() || request->url().startsWith(uri + "/");
+}
+
+void AsyncCallbackWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  if (requestHandler)
+    requestHandler(request);
+}
+
+void AsyncCallbackWebHandler::handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if (uploadHandler)
+    uploadHandler(request, filename, index, data, len, final);
+}
+
+AsyncCallbackWebHandler& AsyncWebServer::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest) {
+  return on(uri, method, onRequest, nullptr);
+}
+
+AsyncCallbackWebHandler& AsyncWebServer::on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload) {
+  AsyncCallbackWebHandler *handler = new AsyncCallbackWebHandler();
+  handler->setUri(uri);
+  handler->setMethod(method);
+  handler->onRequest(onRequest);
+  handler->onUpload(onUpload);
+  callbackHandlers.emplace_back(handler);
+  addHandler(handler);
+  return *handler;
+}
+
+NativeWebResponse AsyncWebServer::request(WebRequestMethodComposite method, const char *url, const std::vector<std::pair<String, String>> &params,
+                                           const char *user, const char *pass, const std::string *upload) {
+  std::lock_guard<std::mutex> lock(asyncTcp);
+  AsyncWebServerRequest request(method, url);
+  for (const std::pair<String, String> &param : params)
+    request.parameters.emplace_back(param.first, param.second, method == HTTP_POST);
+  if (user != nullptr) {
+    request.authUser = user;
+    request.authPassword = pass != nullptr ? pass : "";
+  }
+
+  AsyncWebHandler *handler = nullptr;
+  for (AsyncWebHandler *candidate : handlers) {
+    if (candidate->canHandle(&request)) {
+      handler = candidate;
+      break;
+    }
+  }
+  if (handler == nullptr) {
+    if (notFoundHandler)
+      notFoundHandler(&request);
+    else
+      request.send(404);
+    return request.response;
+  }
+  if (upload != nullptr) {
+    std::vector<uint8_t> chunk;
+    size_t index = 0;
+    do {
+      size_t length = std::min((size_t)NATIVE_HTTP_UPLOAD_CHUNK, upload->size() - index);
+      chunk.assign(upload->begin() + index, upload->begin() + index + length);
+      handler->handleUpload(&request, "upload.bin", index, chunk.data(), length, index + length == upload->size());
+      index += length;
+    } while (index < upload->size());
+  }
+  handler->handleRequest(&request);
+  return request.response;
+}
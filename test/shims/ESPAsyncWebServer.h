@@ -0,0 +1,202 @@
+#ifndef ESPASYNCWEBSERVER_H
+#define ESPASYNCWEBSERVER_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define WS_MAX_QUEUED_MESSAGES 32 // per client, like the ESP32 build of the library
+#define NATIVE_HTTP_UPLOAD_CHUNK 1436 // upload data arrives in TCP segments
+
+/*
+  ESPAsyncWebServer for the native build. The browser side is driven by the tests:
+  - WebSocket: connect() does the (authenticated) handshake and raises WS_EVT_CONNECT, receive() takes the messages the
+    browser has read from the send queue. A client whose queue is full drops further messages like the library does.
+  - HTTP: AsyncWebServer::request() sends one request and returns the response. Requests are handled one after the
+    other like in the single async_tcp task, in the thread of the caller. Routes match like in the library: the same
+    uri or a subpath of it, the first registered handler wins. An upload is passed to the upload handler in chunks
+    before the request handler runs.
+*/
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebParameter {
+  private:
+    String paramName;
+    String paramValue;
+    bool post;
+
+  public:
+    AsyncWebParameter(const String &name, const String &value, bool isPost) : paramName(name), paramValue(value), post(isPost) {}
+    const String& name() const { return paramName; }
+    const String& value() const { return paramValue; }
+    bool isPost() const { return post; }
+    bool isFile() const { return false; }
+};
+
+// what the browser got back
+struct NativeWebResponse {
+  int code = 0; // 0: the handler sent nothing
+  String contentType;
+  std::string body;
+  bool download = false; // sent as attachment
+};
+
+class AsyncWebServerRequest {
+  private:
+    WebRequestMethodComposite requestMethod;
+    String requestUrl;
+    std::vector<AsyncWebParameter> parameters;
+    String authUser;
+    String authPassword;
+    NativeWebResponse response;
+
+    friend class AsyncWebServer;
+    AsyncWebServerRequest(WebRequestMethodComposite method, const String &url) : requestMethod(method), requestUrl(url) {}
+
+  public:
+    WebRequestMethodComposite method() const { return requestMethod; }
+    const String& url() const { return requestUrl; }
+    size_t params() const { return parameters.size(); }
+    bool hasParam(const String &name, bool post = false, bool file = false) const;
+    AsyncWebParameter* getParam(const String &name, bool post = false, bool file = false);
+
+    bool authenticate(const char *username, const char *password, const char *realm = nullptr, bool passwordIsHash = false);
+    void requestAuthentication(const char *realm = nullptr, bool isDigest = true);
+
+    void send(int code, const String &contentType = String(), const String &content = String());
+    void send(FS &fs, const String &path, const String &contentType = String(), bool download = false);
+};
+
+typedef enum { WS_DISCONNECTED, WS_CONNECTED, WS_DISCONNECTING } AwsClientStatus;
+typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
+
+class AsyncWebSocket;
+
+class AsyncWebSocketClient {
+  private:
+    uint32_t clientId;
+    AwsClientStatus clientStatus = WS_CONNECTED;
+    std::deque<std::string> queue; // sent by the server, not read by the browser yet
+    uint32_t dropped = 0;
+    uint16_t closeCode = 0;
+    std::recursive_mutex &mutex;
+
+    friend class AsyncWebSocket;
+    AsyncWebSocketClient(uint32_t id, std::recursive_mutex &socketMutex) : clientId(id), mutex(socketMutex) {}
+
+  public:
+    uint32_t id() { return clientId; }
+    AwsClientStatus status();
+    bool queueIsFull();
+    void text(const char *message, size_t length);
+    void text(const char *message) { text(message, strlen(message)); }
+    void text(const String &message) { text(message.c_str(), message.length()); }
+    void close(uint16_t code = 0, const char *message = nullptr);
+
+    // browser side
+    std::vector<std::string> receive(size_t maxCount = SIZE_MAX);
+    size_t getQueued();
+    uint32_t getDroppedCount(); // messages lost because the queue was full
+    uint16_t getCloseCode();    // 0 while not closed by the server
+};
+
+typedef std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)> AwsEventHandler;
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final)> ArUploadHandlerFunction;
+
+class AsyncWebHandler {
+  public:
+    virtual ~AsyncWebHandler() {}
+    virtual bool canHandle(AsyncWebServerRequest *request) { return false; }
+    virtual void handleRequest(AsyncWebServerRequest *request) {}
+    virtual void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {}
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler {
+  private:
+    String uri;
+    WebRequestMethodComposite method = HTTP_ANY;
+    ArRequestHandlerFunction requestHandler;
+    ArUploadHandlerFunction uploadHandler;
+
+  public:
+    void setUri(const String &newUri) { uri = newUri; }
+    void setMethod(WebRequestMethodComposite newMethod) { method = newMethod; }
+    void onRequest(ArRequestHandlerFunction fn) { requestHandler = fn; }
+    void onUpload(ArUploadHandlerFunction fn) { uploadHandler = fn; }
+    bool canHandle(AsyncWebServerRequest *request) override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+    void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) override;
+};
+
+class AsyncWebSocket : public AsyncWebHandler {
+  private:
+    std::string url;
+    std::string username;
+    std::string password;
+    AwsEventHandler handler;
+    std::list<std::unique_ptr<AsyncWebSocketClient>> clients;
+    uint32_t nextId = 1;
+    std::recursive_mutex mutex;
+
+  public:
+    explicit AsyncWebSocket(const String &url);
+    AsyncWebSocket(const AsyncWebSocket &other);
+    ~AsyncWebSocket();
+
+    const char* getUrl() const { return url.c_str(); }
+    void setAuthentication(const char *newUsername, const char *newPassword);
+    void onEvent(AwsEventHandler newHandler);
+    AsyncWebSocketClient* client(uint32_t id); // nullptr if there is no such client (any more)
+    size_t count();
+    void cleanupClients(uint16_t maxClients = 8); // frees disconnected clients, closes the oldest above maxClients
+
+    // browser side, connect() returns nullptr if the credentials are rejected
+    AsyncWebSocketClient* connect(const char *user = "", const char *pass = "");
+    void disconnect(AsyncWebSocketClient *client); // the browser went away or finished the close handshake
+};
+
+class AsyncWebServer {
+  private:
+    std::vector<AsyncWebHandler*> handlers;
+    std::vector<std::unique_ptr<AsyncCallbackWebHandler>> callbackHandlers;
+    ArRequestHandlerFunction notFoundHandler;
+
+  public:
+    explicit AsyncWebServer(uint16_t port) {}
+    AsyncWebHandler& addHandler(AsyncWebHandler *handler) { handlers.push_back(handler); return *handler; }
+    AsyncCallbackWebHandler& on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest);
+    AsyncCallbackWebHandler& on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload);
+    void onNotFound(ArRequestHandlerFunction fn) { notFoundHandler = fn; }
+    void begin() {}
+
+    // browser side: params are form fields of a POST or the query of other methods, basic authentication if user is set
+    NativeWebResponse request(WebRequestMethodComposite method, const char *url,
+                               const std::vector<std::pair<String, String>> &params = {},
+                               const char *user = nullptr, const char *pass = nullptr, const std::string *upload = nullptr);
+};
+
+class NativeWebSockets {
+  public:
+    static AsyncWebSocket* find(const char *url); // every AsyncWebSocket registers itself, nullptr if none has the url
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef ESP_H
+#define ESP_H
+
+#include <stdint.h>
+
+#define NATIVE_FREE_HEAP 180000 // what a running firmware has left with WiFi, web server and MQTT up
+#define NATIVE_EFUSE_MAC 0x5634120ac424ull // 24:0a:c4:12:34:56, the lowest byte first
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap();
+    uint64_t getEfuseMac() { return NATIVE_EFUSE_MAC; }
+};
+
+extern EspClass ESP;
+
+#endif
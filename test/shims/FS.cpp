@@ -0,0 +1,260 @@
+#include "FS.h"
+#include "SPIFFS.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define NATIVE_FS_SIZE 1378241 // usable bytes of the default 1.5 MB SPIFFS partition
+
+fs::SPIFFSFS SPIFFS;
+
+typedef std::shared_ptr<std::vector<uint8_t>> FileData;
+
+static std::map<std::string, FileData> files;
+static std::recursive_mutex filesMutex;
+static bool mounted = false;
+static long bytesUntilFailure = -1;
+static uint32_t microsPerWrite = 0;
+static uint32_t microsPerByte = 0;
+static uint32_t writeCount = 0;
+static uint32_t writtenBytes = 0;
+
+namespace fs {
+
+struct FileImpl {
+  std::string path;
+  FileData data;
+  size_t position;
+  bool writable;
+  bool append;
+  bool open;
+};
+
+size_t File::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+  if (!impl || !impl->open || !impl->writable)
+    return 0;
+  uint64_t latency;
+  {
+    std::lock_guard<std::recursive_mutex> lock(filesMutex);
+    writeCount++;
+    if (bytesUntilFailure >= 0 && (long)size > bytesUntilFailure)
+      size = bytesUntilFailure; // the rest is lost
+    if (bytesUntilFailure > 0)
+      bytesUntilFailure -= size;
+    if (impl->append)
+      impl->position = impl->data->size();
+    if (impl->position + size > impl->data->size())
+      impl->data->resize(impl->position + size);
+    memcpy(impl->data->data() + impl->position, buffer, size);
+    impl->position += size;
+    writtenBytes += size;
+    latency = microsPerWrite + (uint64_t)microsPerByte * size;
+  }
+  if (latency > 0)
+    NativeClock::blockFor(latency);
+  return size;
+}
+
+int File::available() {
+  if (!impl || !impl->open)
+    return 0;
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return impl->position < impl->data->size() ? impl->data->size() - impl->position : 0;
+}
+
+int File::read() {
+  uint8_t value;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int File::peek() {
+  if (!impl || !impl->open)
+    return -1;
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return impl->position < impl->data->size() ? (*impl->data)[impl->position] : -1;
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+  if (!impl || !impl->open)
+    return 0;
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  size_t length = impl->position < impl->data->size() ? std::min(size, impl->data->size() - impl->position) : 0;
+  memcpy(buffer, impl->data->data() + impl->position, length);
+  impl->position += length;
+  return length;
+}
+
+bool File::seek(uint32_t position, SeekMode mode) {
+  if (!impl || !impl->open)
+    return false;
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  long target = position;
+  if (mode == SeekCur)
+    target += impl->position;
+  else if (mode == SeekEnd)
+    target = impl->data->size() - position;
+  if (target < 0 || (size_t)target > impl->data->size())
+    return false;
+  impl->position = target;
+  return true;
+}
+
+size_t File::position() const {
+  return impl ? impl->position : 0;
+}
+
+size_t File::size() const {
+  if (!impl)
+    return 0;
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return impl->data->size();
+}
+
+void File::close() {
+  if (impl)
+    impl->open = false;
+}
+
+File::operator bool() const {
+  return impl && impl->open;
+}
+
+const char* File::name() const {
+  return impl ? impl->path.c_str() : "";
+}
+
+File FS::open(const char *path, const char *mode) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  if (!mounted || path == nullptr || path[0] != '/')
+    return File();
+  auto entry = files.find(path);
+  bool reading = strcmp(mode, FILE_READ) == 0;
+  if (entry == files.end()) {
+    if (reading)
+      return File();
+    entry = files.emplace(path, std::make_shared<std::vector<uint8_t>>()).first;
+  } else if (strcmp(mode, FILE_WRITE) == 0) {
+    // truncated, handles still open on the old content keep it
+    entry->second = std::make_shared<std::vector<uint8_t>>();
+  }
+  bool append = strcmp(mode, FILE_APPEND) == 0;
+  return File(std::make_shared<FileImpl>(FileImpl{path, entry->second, append ? entry->second->size() : 0, !reading, append, true}));
+}
+
+bool FS::exists(const char *path) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return mounted && files.find(path) != files.end();
+}
+
+bool FS::remove(const char *path) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return mounted && files.erase(path) > 0;
+}
+
+bool FS::rename(const char *pathFrom, const char *pathTo) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  auto entry = files.find(pathFrom);
+  if (!mounted || entry == files.end() || files.find(pathTo) != files.end())
+    return false;
+  FileData data = entry->second;
+  files.erase(entry);
+  files[pathTo] = data;
+  return true;
+}
+
+bool SPIFFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  mounted = true;
+  return true;
+}
+
+void SPIFFSFS::end() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  mounted = false;
+}
+
+bool SPIFFSFS::format() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  files.clear();
+  return true;
+}
+
+size_t SPIFFSFS::totalBytes() {
+  return NATIVE_FS_SIZE;
+}
+
+size_t SPIFFSFS::usedBytes() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  size_t used = 0;
+  for (const auto &entry : files)
+    used += entry.second->size();
+  return used;
+}
+
+} // namespace fs
+
+void NativeFs::reset() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  files.clear();
+  mounted = false;
+  bytesUntilFailure = -1;
+  microsPerWrite = 0;
+  microsPerByte = 0;
+  writeCount = 0;
+  writtenBytes = 0;
+}
+
+void NativeFs::setMounted(bool isMounted) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  mounted = isMounted;
+}
+
+bool NativeFs::isMounted() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return mounted;
+}
+
+void NativeFs::failWritesAfter(long count) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  bytesUntilFailure = count;
+}
+
+void NativeFs::setWriteLatency(uint32_t perWrite, uint32_t perByte) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  microsPerWrite = perWrite;
+  microsPerByte = perByte;
+}
+
+uint32_t NativeFs::getWriteCount() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return writeCount;
+}
+
+uint32_t NativeFs::getWrittenBytes() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  return writtenBytes;
+}
+
+void NativeFs::resetCounters() {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  writeCount = 0;
+  writtenBytes = 0;
+}
+
+void NativeFs::writeFile(const char *path, const std::string &content) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  files[path] = std::make_shared<std::vector<uint8_t>>(content.begin(), content.end());
+}
+
+std::string NativeFs::readFile(const char *path) {
+  std::lock_guard<std::recursive_mutex> lock(filesMutex);
+  auto entry = files.find(path);
+  if (entry == files.end())
+    return std::string();
+  return std::string(entry->second->begin(), entry->second->end());
+}
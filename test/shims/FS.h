@@ -0,0 +1,87 @@
+#ifndef FS_H
+#define FS_H
+
+#include "Arduino.h"
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+/*
+  File system API of the ESP32 core on in-memory files. Writes are visible right away. NativeFs can make writes slow
+  (SPIFFS stalls while it erases a block) or make them fail after a number of bytes, like a reset while writing.
+*/
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FileImpl;
+
+class File : public Stream {
+  private:
+    std::shared_ptr<FileImpl> impl;
+
+  public:
+    File() {}
+    File(std::shared_ptr<FileImpl> fileImpl) : impl(fileImpl) {}
+
+    using Print::write;
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override {}
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readBytes(char *buffer, size_t length) { return read((uint8_t*)buffer, length); }
+    bool seek(uint32_t position, SeekMode mode);
+    bool seek(uint32_t position) { return seek(position, SeekSet); }
+    size_t position() const;
+    size_t size() const;
+    void close();
+    operator bool() const;
+    const char* name() const;
+    bool isDirectory() { return false; }
+};
+
+class FS {
+  public:
+    virtual ~FS() {}
+    File open(const char *path, const char *mode = FILE_READ);
+    File open(const String &path, const char *mode = FILE_READ) { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *pathFrom, const char *pathTo);
+    bool rename(const String &pathFrom, const String &pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+class NativeFs {
+  public:
+    static void reset(); // unmounted, no files, no faults
+    static void setMounted(bool mounted);
+    static bool isMounted();
+    // the next count bytes are written, everything after fails until failWritesAfter(-1)
+    static void failWritesAfter(long count);
+    // simulated duration of every write call and of every byte written
+    static void setWriteLatency(uint32_t microsPerWrite, uint32_t microsPerByte);
+    static uint32_t getWriteCount();
+    static uint32_t getWrittenBytes();
+    static void resetCounters();
+
+    static void writeFile(const char *path, const std::string &content);
+    static std::string readFile(const char *path);
+};
+
+#endif
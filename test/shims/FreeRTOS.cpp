@@ -0,0 +1,141 @@
+#include "Arduino.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct NativeQueue {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t length;
+  size_t itemSize;
+  bool isMutex;
+};
+
+struct NativeTask {
+  TaskFunction_t function;
+  void *parameter;
+};
+
+static std::atomic<int> taskCount{0};
+
+// waits until ready() or the timeout, the simulated clock advances by the time the caller was blocked
+template<typename Predicate>
+static bool waitFor(NativeQueue *queue, std::unique_lock<std::mutex> &lock, TickType_t ticksToWait, Predicate ready) {
+  if (ready())
+    return true;
+  if (ticksToWait == 0)
+    return false;
+  if (ticksToWait == portMAX_DELAY) {
+    queue->changed.wait(lock, ready);
+    return true;
+  }
+  uint64_t startMicros = NativeClock::getMicros();
+  bool ok = queue->changed.wait_for(lock, std::chrono::microseconds((uint64_t)ticksToWait * NATIVE_REAL_MICROS_PER_TICK), ready);
+  if (ok)
+    return true;
+  // nobody came, the task was blocked for the whole timeout (minus what other threads advanced meanwhile)
+  lock.unlock();
+  uint64_t elapsed = NativeClock::getMicros() - startMicros;
+  uint64_t timeout = (uint64_t)ticksToWait * 1000ull;
+  if (elapsed < timeout)
+    NativeClock::advanceMicros(timeout - elapsed);
+  lock.lock();
+  return ready();
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  if (length == 0)
+    return nullptr;
+  NativeQueue *queue = new NativeQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  queue->isMutex = false;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(queue, lock, ticksToWait, [queue] { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  const uint8_t *bytes = static_cast<const uint8_t*>(item);
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(queue, lock, ticksToWait, [queue] { return !queue->items.empty(); }))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->items.size();
+}
+
+// a mutex is a queue of length 1 which holds an item while the mutex is free
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  NativeQueue *queue = new NativeQueue();
+  queue->length = 1;
+  queue->itemSize = 0;
+  queue->isMutex = true;
+  queue->items.emplace_back();
+  return queue;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  if (!waitFor(semaphore, lock, ticksToWait, [semaphore] { return !semaphore->items.empty(); }))
+    return pdFALSE;
+  semaphore->items.pop_front();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+  if (!semaphore->items.empty())
+    return pdFALSE;
+  semaphore->items.emplace_back();
+  semaphore->changed.notify_all();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete semaphore;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t coreId) {
+  NativeTask *task = new NativeTask{function, parameter};
+  taskCount++;
+  // tasks run until the test process exits
+  std::thread([task] { task->function(task->parameter); }).detach();
+  if (handle != nullptr)
+    *handle = task;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  NativeClock::blockFor((uint64_t)ticks * 1000ull);
+}
+
+TickType_t xTaskGetTickCount() {
+  return millis();
+}
+
+int NativeRtos::getTaskCount() {
+  return taskCount.load();
+}
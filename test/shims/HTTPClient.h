@@ -0,0 +1,79 @@
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+struct NativeHttpRequest {
+  String method;
+  String url;
+  String body;
+};
+
+struct NativeHttpResponse {
+  int code = 200;
+  String body;
+  uint32_t latencyMillis = 20; // server time until the answer, on top of the connect
+  bool keepAlive = true;       // false: the server closes the connection after the answer
+};
+
+/*
+  HTTPClient of the ESP32 core against a backend function of the test. Every request takes the connect time (if the
+  kept-alive connection can't be reused) plus the latency of the answer in simulated time, a read timeout cuts it off.
+*/
+class HTTPClient {
+  private:
+    String url;
+    String host;
+    bool reuse = true;
+    bool connected = false; // kept-alive connection to host
+    uint16_t connectTimeout = 5000;
+    uint16_t timeout = 5000;
+    String responseBody;
+
+    int request(const char *method, const String &body);
+
+  public:
+    ~HTTPClient();
+
+    bool begin(WiFiClient &client, const String &url);
+    bool begin(const String &url);
+    void end();
+    void setReuse(bool reuse) { this->reuse = reuse; }
+    void setConnectTimeout(int32_t connectTimeout) { this->connectTimeout = connectTimeout; }
+    void setTimeout(uint16_t timeout) { this->timeout = timeout; }
+    void addHeader(const String &name, const String &value) {}
+
+    int GET();
+    int POST(const String &body);
+    int POST(const char *body) { return POST(String(body)); }
+    String getString();
+    static String errorToString(int error);
+};
+
+class NativeHttp {
+  public:
+    typedef std::function<NativeHttpResponse(const NativeHttpRequest&)> Backend;
+
+    static void reset(); // no backend (connection refused), default timings, counters cleared
+    static void setBackend(Backend backend);
+    static void setConnectMillis(uint32_t millis); // TCP handshake
+    static void setReachable(bool reachable);      // unreachable: every connect runs into the connect timeout
+    static uint32_t getConnectCount();
+    static uint32_t getRequestCount();
+    static std::vector<NativeHttpRequest> getRequests();
+};
+
+#endif
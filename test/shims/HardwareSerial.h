@@ -0,0 +1,82 @@
+#ifndef HARDWARESERIAL_H
+#define HARDWARESERIAL_H
+
+#include <deque>
+#include <mutex>
+
+#define SERIAL_8N1 0x800001c
+#define NATIVE_SERIAL_RX_BUFFER_SIZE 256 // UART driver buffer of the ESP32 core
+
+class HardwareSerial;
+
+// the other end of a serial line, e.g. the R503 simulator on Serial2
+class SerialDevice {
+  public:
+    virtual ~SerialDevice() {}
+    // a byte sent by the ESP32, micros is the simulated time its stop bit was received. Called from the writing thread,
+    // the device answers with HardwareSerial::deliver().
+    virtual void onReceive(HardwareSerial &serial, uint8_t value, uint32_t baudRate, uint64_t micros) = 0;
+};
+
+/*
+  UART with simulated timing: every byte occupies the line for 10 bit times at the baud rate. Bytes sent by the device
+  arrive one after another in the RX buffer, which holds NATIVE_SERIAL_RX_BUFFER_SIZE bytes like the UART driver, bytes
+  arriving while it is full are lost. Bytes sent at another baud rate than the one set by begin() are garbage and
+  dropped. Without a device the output is discarded (printed when the environment variable NATIVE_SERIAL_ECHO is set).
+*/
+class HardwareSerial : public Stream {
+  private:
+    struct Arrival {
+      uint64_t micros;
+      uint8_t value;
+    };
+
+    int number;
+    std::recursive_mutex mutex;
+    SerialDevice *device = nullptr;
+    uint32_t lineBaudRate = 0;
+    uint64_t txLineFreeMicros = 0;
+    uint64_t rxLineFreeMicros = 0;
+    std::deque<Arrival> incoming;  // on the wire, not in the RX buffer yet
+    std::deque<uint8_t> rxBuffer;
+    uint32_t overflows = 0;
+    uint32_t bytesWritten = 0;
+    int64_t lostWriteByte = -1; // a write() reaching this byte count is lost
+
+    void receivePending(); // moves the bytes arrived until now into the RX buffer
+    static uint64_t getByteMicros(uint32_t baudRate);
+
+  protected:
+    bool waitForData(unsigned long deadlineMillis) override;
+
+  public:
+    explicit HardwareSerial(int uartNumber) : number(uartNumber) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1, bool invert = false, unsigned long timeoutMs = 20000ul);
+    void end();
+    uint32_t baudRate() { return lineBaudRate; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    using Print::write;
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush() override {}
+
+    // simulation side
+    void attach(SerialDevice *serialDevice);
+    // the device sends data at its baud rate, starting not before startMicros
+    void deliver(const uint8_t *data, size_t length, uint32_t deviceBaudRate, uint64_t startMicros);
+    uint32_t getOverflowCount();  // bytes lost because the RX buffer was full
+    uint32_t getBytesWritten();
+    // the write() call that reaches the given number of bytes from now returns 0 and sends nothing, later calls work
+    void loseWriteAfter(uint32_t bytes);
+    void reset(); // detaches the device, clears buffers and counters
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <stdint.h>
+
+// IPv4 address, the uint32_t form has the first octet in the lowest byte like lwIP
+class IPAddress {
+  private:
+    uint32_t address;
+
+  public:
+    IPAddress() : address(0) {}
+    IPAddress(uint32_t value) : address(value) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+    operator uint32_t() const { return address; }
+    uint8_t operator[](int index) const { return (address >> (index * 8)) & 0xFF; }
+    bool operator==(const IPAddress &other) const { return address == other.address; }
+    bool operator==(uint32_t other) const { return address == other; }
+    bool operator!=(const IPAddress &other) const { return address != other.address; }
+    String toString() const;
+};
+
+extern const IPAddress INADDR_NONE;
+
+#endif
@@ -0,0 +1,320 @@
+#include "WiFi.h"
+#include "HTTPClient.h"
+#include "tcpip_adapter.h"
+#include "lwip/dhcp.h"
+#include <mutex>
+
+WiFiClass WiFi;
+
+static std::recursive_mutex networkMutex;
+
+// WiFi
+
+static NativeAccessPoint accessPoint;
+static bool inRange = true;
+static wifi_mode_t wifiMode = WIFI_OFF;
+static IPAddress staticIp, staticGateway, staticSubnet, staticDns;
+static bool connecting = false;
+static bool connected = false;
+static uint64_t connectDoneMicros = 0;
+static bool usedDhcp = false;
+static uint32_t beginCount = 0;
+static uint32_t dhcpCount = 0;
+static uint32_t scanCount = 0;
+static struct dhcp dhcpData;
+static struct netif stationNetif;
+
+bool WiFiClass::mode(wifi_mode_t mode) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  wifiMode = mode;
+  if (mode == WIFI_OFF)
+    disconnect();
+  return true;
+}
+
+wifi_mode_t WiFiClass::getMode() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return wifiMode;
+}
+
+bool WiFiClass::config(IPAddress localIp, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  staticIp = localIp;
+  staticGateway = gateway;
+  staticSubnet = subnet;
+  staticDns = dns1;
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  beginCount++;
+  if (wifiMode == WIFI_OFF)
+    wifiMode = WIFI_STA;
+  connected = false;
+  connecting = true;
+
+  bool known = accessPoint.ssid == ssid && accessPoint.password == (passphrase != nullptr ? passphrase : "");
+  bool fast = channel != 0 && bssid != nullptr;
+  if (!known || (fast && (channel != accessPoint.channel || memcmp(bssid, accessPoint.bssid, sizeof(accessPoint.bssid)) != 0))) {
+    connectDoneMicros = UINT64_MAX; // wrong credentials or the access point is not where it was: never connects
+    return WL_DISCONNECTED;
+  }
+
+  uint64_t millis = accessPoint.associateMillis;
+  if (!fast) {
+    millis += accessPoint.scanMillis;
+    scanCount++;
+  }
+  usedDhcp = (staticIp == (uint32_t)0);
+  if (usedDhcp) {
+    millis += accessPoint.dhcpMillis;
+    dhcpCount++;
+  }
+  connectDoneMicros = NativeClock::getMicros() + millis * 1000ull;
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifiOff) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  connecting = false;
+  connected = false;
+  if (wifiOff)
+    wifiMode = WIFI_OFF;
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (!inRange)
+    connected = false;
+  else if (connecting && NativeClock::getMicros() >= connectDoneMicros) {
+    connecting = false;
+    connected = true;
+  }
+  return connected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+String WiFiClass::SSID() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return status() == WL_CONNECTED ? accessPoint.ssid : String();
+}
+
+const uint8_t* WiFiClass::BSSID() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return status() == WL_CONNECTED ? accessPoint.bssid : nullptr;
+}
+
+int32_t WiFiClass::channel() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return status() == WL_CONNECTED ? accessPoint.channel : 0;
+}
+
+IPAddress WiFiClass::localIP() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (status() != WL_CONNECTED)
+    return IPAddress();
+  return usedDhcp ? accessPoint.ip : staticIp;
+}
+
+IPAddress WiFiClass::gatewayIP() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (status() != WL_CONNECTED)
+    return IPAddress();
+  return usedDhcp ? accessPoint.gateway : staticGateway;
+}
+
+IPAddress WiFiClass::subnetMask() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (status() != WL_CONNECTED)
+    return IPAddress();
+  return usedDhcp ? accessPoint.subnet : staticSubnet;
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t index) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (status() != WL_CONNECTED || index != 0)
+    return IPAddress();
+  return usedDhcp ? accessPoint.dns : staticDns;
+}
+
+esp_err_t tcpip_adapter_get_netif(tcpip_adapter_if_t interface, void **netif) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  if (interface != TCPIP_ADAPTER_IF_STA || wifiMode == WIFI_OFF)
+    return ESP_ERR_INVALID_ARG;
+  dhcpData.offered_t0_lease = accessPoint.leaseSeconds;
+  stationNetif.dhcp = usedDhcp ? &dhcpData : nullptr;
+  *netif = &stationNetif;
+  return ESP_OK;
+}
+
+void NativeWiFi::reset() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  accessPoint = NativeAccessPoint();
+  inRange = true;
+  wifiMode = WIFI_OFF;
+  staticIp = staticGateway = staticSubnet = staticDns = IPAddress();
+  connecting = false;
+  connected = false;
+  usedDhcp = false;
+  beginCount = 0;
+  dhcpCount = 0;
+  scanCount = 0;
+}
+
+void NativeWiFi::setAccessPoint(const NativeAccessPoint &newAccessPoint) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  accessPoint = newAccessPoint;
+}
+
+void NativeWiFi::setInRange(bool isInRange) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  inRange = isInRange;
+}
+
+uint32_t NativeWiFi::getBeginCount() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return beginCount;
+}
+
+uint32_t NativeWiFi::getDhcpCount() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return dhcpCount;
+}
+
+uint32_t NativeWiFi::getScanCount() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return scanCount;
+}
+
+// HTTPClient
+
+static NativeHttp::Backend backend;
+static uint32_t connectMillis = 30;
+static bool reachable = true;
+static uint32_t connectCount = 0;
+static std::vector<NativeHttpRequest> requests;
+
+HTTPClient::~HTTPClient() {
+  connected = false;
+}
+
+bool HTTPClient::begin(WiFiClient &client, const String &newUrl) {
+  return begin(newUrl);
+}
+
+bool HTTPClient::begin(const String &newUrl) {
+  int hostStart = newUrl.indexOf("://");
+  hostStart = hostStart < 0 ? 0 : hostStart + 3;
+  int hostEnd = newUrl.indexOf('/', hostStart);
+  String newHost = hostEnd < 0 ? newUrl.substring(hostStart) : newUrl.substring(hostStart, hostEnd);
+  if (newHost != host)
+    connected = false; // another server
+  host = newHost;
+  url = newUrl;
+  responseBody = String();
+  return true;
+}
+
+void HTTPClient::end() {
+  if (!reuse)
+    connected = false;
+}
+
+int HTTPClient::request(const char *method, const String &body) {
+  NativeHttp::Backend handler;
+  uint32_t connectTime;
+  bool canConnect;
+  {
+    std::lock_guard<std::recursive_mutex> lock(networkMutex);
+    requests.push_back(NativeHttpRequest{method, url, body});
+    handler = backend;
+    connectTime = connectMillis;
+    canConnect = reachable && backend;
+  }
+
+  if (!connected || !reuse) {
+    if (!canConnect) {
+      NativeClock::blockFor((uint64_t)(reachable ? connectTime : connectTimeout) * 1000ull);
+      connected = false;
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    NativeClock::blockFor((uint64_t)connectTime * 1000ull);
+    std::lock_guard<std::recursive_mutex> lock(networkMutex);
+    connectCount++;
+    connected = true;
+  }
+
+  NativeHttpResponse response = handler(NativeHttpRequest{method, url, body});
+  if (response.latencyMillis > timeout) {
+    NativeClock::blockFor((uint64_t)timeout * 1000ull);
+    connected = false;
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+  NativeClock::blockFor((uint64_t)response.latencyMillis * 1000ull);
+  responseBody = response.body;
+  if (!response.keepAlive)
+    connected = false;
+  return response.code;
+}
+
+int HTTPClient::GET() {
+  return request("GET", String());
+}
+
+int HTTPClient::POST(const String &body) {
+  return request("POST", body);
+}
+
+String HTTPClient::getString() {
+  return responseBody;
+}
+
+String HTTPClient::errorToString(int error) {
+  switch (error) {
+    case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+    case HTTPC_ERROR_NOT_CONNECTED:      return "not connected";
+    case HTTPC_ERROR_CONNECTION_LOST:    return "connection lost";
+    case HTTPC_ERROR_READ_TIMEOUT:       return "read Timeout";
+    default:                             return String();
+  }
+}
+
+void NativeHttp::reset() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  backend = nullptr;
+  connectMillis = 30;
+  reachable = true;
+  connectCount = 0;
+  requests.clear();
+}
+
+void NativeHttp::setBackend(Backend newBackend) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  backend = newBackend;
+}
+
+void NativeHttp::setConnectMillis(uint32_t millis) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  connectMillis = millis;
+}
+
+void NativeHttp::setReachable(bool isReachable) {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  reachable = isReachable;
+}
+
+uint32_t NativeHttp::getConnectCount() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return connectCount;
+}
+
+uint32_t NativeHttp::getRequestCount() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return requests.size();
+}
+
+std::vector<NativeHttpRequest> NativeHttp::getRequests() {
+  std::lock_guard<std::recursive_mutex> lock(networkMutex);
+  return requests;
+}
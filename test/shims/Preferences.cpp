@@ -0,0 +1,268 @@
+#include "Preferences.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define NVS_KEY_MAX_LENGTH 15
+#define NVS_ENTRIES 630 // 3 pages of 126 entries each minus the reserved page, like the default nvs partition
+
+struct NvsEntry {
+  NativeNvsType type;
+  std::vector<uint8_t> data;
+};
+
+static std::map<std::string, std::map<std::string, NvsEntry>> storage;
+static std::mutex storageMutex;
+static uint32_t writeCount = 0;
+static uint32_t readCount = 0;
+static uint32_t writtenBytes = 0;
+static int writesUntilFailure = -1;
+
+// takes one write from the budget, false if it fails
+static bool consumeWrite() {
+  writeCount++;
+  if (writesUntilFailure == 0)
+    return false;
+  if (writesUntilFailure > 0)
+    writesUntilFailure--;
+  return true;
+}
+
+static bool isValidKey(const char *key) {
+  return key != nullptr && key[0] != 0 && strlen(key) <= NVS_KEY_MAX_LENGTH;
+}
+
+bool Preferences::begin(const char *namespaceName, bool readOnlyMode) {
+  if (started || !isValidKey(namespaceName))
+    return false;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  // a namespace is created when it is opened for writing, it can't be opened read-only before
+  if (readOnlyMode && storage.find(namespaceName) == storage.end())
+    return false;
+  storage[namespaceName];
+  name = namespaceName;
+  readOnly = readOnlyMode;
+  started = true;
+  return true;
+}
+
+void Preferences::end() {
+  started = false;
+}
+
+bool Preferences::clear() {
+  if (!started || readOnly)
+    return false;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  if (!consumeWrite())
+    return false;
+  storage[name.c_str()].clear();
+  return true;
+}
+
+bool Preferences::remove(const char *key) {
+  if (!started || readOnly || !isValidKey(key))
+    return false;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  if (entries.find(key) == entries.end())
+    return false;
+  if (!consumeWrite())
+    return false;
+  entries.erase(key);
+  return true;
+}
+
+bool Preferences::isKey(const char *key) {
+  if (!started || !isValidKey(key))
+    return false;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  return entries.find(key) != entries.end();
+}
+
+size_t Preferences::freeEntries() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  size_t used = 0;
+  for (const auto &space : storage) {
+    for (const auto &entry : space.second)
+      used += 1 + (entry.second.data.size() + 31) / 32; // header entry plus 32 byte data entries
+  }
+  return used < NVS_ENTRIES ? NVS_ENTRIES - used : 0;
+}
+
+size_t Preferences::put(const char *key, NativeNvsType type, const void *value, size_t length) {
+  if (!started || readOnly || !isValidKey(key) || value == nullptr)
+    return 0;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  if (!consumeWrite())
+    return 0;
+  const uint8_t *bytes = static_cast<const uint8_t*>(value);
+  storage[name.c_str()][key] = NvsEntry{type, std::vector<uint8_t>(bytes, bytes + length)};
+  writtenBytes += length;
+  return length;
+}
+
+bool Preferences::get(const char *key, NativeNvsType type, void *value, size_t length) {
+  if (!started || !isValidKey(key))
+    return false;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  auto entry = entries.find(key);
+  if (entry == entries.end() || entry->second.type != type || entry->second.data.size() != length)
+    return false;
+  memcpy(value, entry->second.data.data(), length);
+  return true;
+}
+
+size_t Preferences::putChar(const char *key, int8_t value) { return put(key, NativeNvsType::i8, &value, sizeof(value)); }
+size_t Preferences::putUChar(const char *key, uint8_t value) { return put(key, NativeNvsType::u8, &value, sizeof(value)); }
+size_t Preferences::putShort(const char *key, int16_t value) { return put(key, NativeNvsType::i16, &value, sizeof(value)); }
+size_t Preferences::putUShort(const char *key, uint16_t value) { return put(key, NativeNvsType::u16, &value, sizeof(value)); }
+size_t Preferences::putInt(const char *key, int32_t value) { return put(key, NativeNvsType::i32, &value, sizeof(value)); }
+size_t Preferences::putUInt(const char *key, uint32_t value) { return put(key, NativeNvsType::u32, &value, sizeof(value)); }
+
+size_t Preferences::putString(const char *key, const char *value) {
+  if (value == nullptr)
+    return 0;
+  // stored with the terminator, the length returned is without it
+  size_t length = put(key, NativeNvsType::str, value, strlen(value) + 1);
+  return length > 0 ? length - 1 : 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+  if (length == 0)
+    return 0;
+  return put(key, NativeNvsType::blob, value, length);
+}
+
+int8_t Preferences::getChar(const char *key, int8_t defaultValue) {
+  int8_t value = defaultValue;
+  return get(key, NativeNvsType::i8, &value, sizeof(value)) ? value : defaultValue;
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+  uint8_t value = defaultValue;
+  return get(key, NativeNvsType::u8, &value, sizeof(value)) ? value : defaultValue;
+}
+
+int16_t Preferences::getShort(const char *key, int16_t defaultValue) {
+  int16_t value = defaultValue;
+  return get(key, NativeNvsType::i16, &value, sizeof(value)) ? value : defaultValue;
+}
+
+uint16_t Preferences::getUShort(const char *key, uint16_t defaultValue) {
+  uint16_t value = defaultValue;
+  return get(key, NativeNvsType::u16, &value, sizeof(value)) ? value : defaultValue;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t defaultValue) {
+  int32_t value = defaultValue;
+  return get(key, NativeNvsType::i32, &value, sizeof(value)) ? value : defaultValue;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) {
+  uint32_t value = defaultValue;
+  return get(key, NativeNvsType::u32, &value, sizeof(value)) ? value : defaultValue;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLen) {
+  if (!started || !isValidKey(key) || value == nullptr || maxLen == 0)
+    return 0;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  auto entry = entries.find(key);
+  if (entry == entries.end() || entry->second.type != NativeNvsType::str || entry->second.data.size() > maxLen)
+    return 0;
+  memcpy(value, entry->second.data.data(), entry->second.data.size());
+  return entry->second.data.size();
+}
+
+String Preferences::getString(const char *key, const String &defaultValue) {
+  if (!started || !isValidKey(key))
+    return defaultValue;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  auto entry = entries.find(key);
+  if (entry == entries.end() || entry->second.type != NativeNvsType::str)
+    return defaultValue;
+  return String((const char*)entry->second.data.data());
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  if (!started || !isValidKey(key))
+    return 0;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  auto entry = entries.find(key);
+  if (entry == entries.end() || entry->second.type != NativeNvsType::blob)
+    return 0;
+  return entry->second.data.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLen) {
+  if (!started || !isValidKey(key) || buffer == nullptr)
+    return 0;
+  std::lock_guard<std::mutex> lock(storageMutex);
+  readCount++;
+  std::map<std::string, NvsEntry> &entries = storage[name.c_str()];
+  auto entry = entries.find(key);
+  if (entry == entries.end() || entry->second.type != NativeNvsType::blob || entry->second.data.size() > maxLen)
+    return 0;
+  memcpy(buffer, entry->second.data.data(), entry->second.data.size());
+  return entry->second.data.size();
+}
+
+void NativeNvs::reset() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  storage.clear();
+  writeCount = 0;
+  readCount = 0;
+  writtenBytes = 0;
+  writesUntilFailure = -1;
+}
+
+uint32_t NativeNvs::getWriteCount() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  return writeCount;
+}
+
+uint32_t NativeNvs::getReadCount() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  return readCount;
+}
+
+uint32_t NativeNvs::getWrittenBytes() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  return writtenBytes;
+}
+
+void NativeNvs::resetCounters() {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  writeCount = 0;
+  readCount = 0;
+  writtenBytes = 0;
+}
+
+void NativeNvs::failWritesAfter(int count) {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  writesUntilFailure = count;
+}
+
+bool NativeNvs::hasKey(const char *name, const char *key) {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  auto space = storage.find(name);
+  return space != storage.end() && space->second.find(key) != space->second.end();
+}
+
+int NativeNvs::getKeyCount(const char *name) {
+  std::lock_guard<std::mutex> lock(storageMutex);
+  auto space = storage.find(name);
+  return space != storage.end() ? space->second.size() : 0;
+}
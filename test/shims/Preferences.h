@@ -0,0 +1,77 @@
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include "Arduino.h"
+
+/*
+  Preferences of the ESP32 core on an in-memory NVS. Keys are typed like in NVS (a key written as string can't be
+  read as integer), keys and namespaces are limited to 15 characters. NativeNvs counts the operations and can make
+  writes fail from a given point on, like a reset in the middle of a sequence of writes.
+*/
+
+enum class NativeNvsType : uint8_t { u8, i8, u16, i16, u32, i32, u64, i64, str, blob };
+
+class Preferences {
+  private:
+    String name;
+    bool started = false;
+    bool readOnly = false;
+
+    size_t put(const char *key, NativeNvsType type, const void *value, size_t length);
+    bool get(const char *key, NativeNvsType type, void *value, size_t length);
+
+  public:
+    ~Preferences() { end(); }
+
+    bool begin(const char *name, bool readOnly = false);
+    void end();
+
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+    size_t freeEntries();
+
+    size_t putChar(const char *key, int8_t value);
+    size_t putUChar(const char *key, uint8_t value);
+    size_t putShort(const char *key, int16_t value);
+    size_t putUShort(const char *key, uint16_t value);
+    size_t putInt(const char *key, int32_t value);
+    size_t putUInt(const char *key, uint32_t value);
+    size_t putLong(const char *key, int32_t value) { return putInt(key, value); }
+    size_t putULong(const char *key, uint32_t value) { return putUInt(key, value); }
+    size_t putBool(const char *key, bool value) { return putUChar(key, value ? 1 : 0); }
+    size_t putString(const char *key, const char *value);
+    size_t putString(const char *key, const String &value) { return putString(key, value.c_str()); }
+    size_t putBytes(const char *key, const void *value, size_t length);
+
+    int8_t getChar(const char *key, int8_t defaultValue = 0);
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+    int16_t getShort(const char *key, int16_t defaultValue = 0);
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0);
+    int32_t getInt(const char *key, int32_t defaultValue = 0);
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+    int32_t getLong(const char *key, int32_t defaultValue = 0) { return getInt(key, defaultValue); }
+    uint32_t getULong(const char *key, uint32_t defaultValue = 0) { return getUInt(key, defaultValue); }
+    bool getBool(const char *key, bool defaultValue = false) { return getUChar(key, defaultValue ? 1 : 0) == 1; }
+    // length including the terminator, 0 if the key is missing or maxLen is too small
+    size_t getString(const char *key, char *value, size_t maxLen);
+    String getString(const char *key, const String &defaultValue = String());
+    size_t getBytesLength(const char *key);
+    // 0 if the key is missing or the blob is longer than maxLen
+    size_t getBytes(const char *key, void *buffer, size_t maxLen);
+};
+
+class NativeNvs {
+  public:
+    static void reset(); // erases everything and the counters
+    static uint32_t getWriteCount(); // put, remove and clear operations
+    static uint32_t getReadCount();
+    static uint32_t getWrittenBytes();
+    static void resetCounters();
+    // the next count writes succeed, all writes after them fail until failWritesAfter(-1)
+    static void failWritesAfter(int count);
+    static bool hasKey(const char *name, const char *key);
+    static int getKeyCount(const char *name);
+};
+
+#endif
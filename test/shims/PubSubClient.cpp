@@ -0,0 +1,284 @@
+#include "PubSubClient.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+struct NativeMqttSession {
+  PubSubClient *client;
+  String willTopic;
+  std::string willMessage;
+  bool willRetain;
+};
+
+static std::recursive_mutex brokerMutex;
+static bool reachable = true;
+static uint32_t connectMillis = 30;
+static String requiredUser;
+static String requiredPass;
+static std::vector<NativeMqttSession> sessions;
+static std::vector<NativeMqttSubscription> subscriptions;
+static std::vector<NativeMqttMessage> messages;
+static std::map<std::string, std::string> retained;
+static std::vector<uint64_t> connectAttempts;
+static uint32_t connectCount = 0;
+
+void NativeMqtt::route(const String &clientId, const String &topic, const std::string &payload, bool retain) {
+  messages.push_back({ clientId, topic, payload, retain, NativeClock::getMicros() });
+  if (retain) {
+    if (payload.empty())
+      retained.erase(topic.c_str());
+    else
+      retained[topic.c_str()] = payload;
+  }
+  for (const NativeMqttSubscription &subscription : subscriptions) {
+    if (subscription.topic != topic)
+      continue;
+    for (NativeMqttSession &session : sessions) {
+      if (session.client->id == subscription.clientId)
+        session.client->inbox.push_back({ clientId, topic, payload, false, NativeClock::getMicros() });
+    }
+  }
+}
+
+void NativeMqtt::loseSession(PubSubClient *client) {
+  auto session = std::find_if(sessions.begin(), sessions.end(), [client](const NativeMqttSession &entry) { return entry.client == client; });
+  if (session == sessions.end())
+    return;
+  NativeMqttSession lost = *session;
+  sessions.erase(session);
+  subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+    [client](const NativeMqttSubscription &entry) { return entry.clientId == client->id; }), subscriptions.end());
+  client->clientState = MQTT_CONNECTION_LOST;
+  client->inbox.clear();
+  if (!lost.willTopic.isEmpty())
+    route(client->id, lost.willTopic, lost.willMessage, lost.willRetain);
+}
+
+PubSubClient::~PubSubClient() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  NativeMqtt::loseSession(this);
+}
+
+PubSubClient& PubSubClient::setServer(const char *domain, uint16_t newPort) {
+  host = domain;
+  port = newPort;
+  return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(std::function<void(char*, uint8_t*, unsigned int)> newCallback) {
+  callback = newCallback;
+  return *this;
+}
+
+bool PubSubClient::setBufferSize(uint16_t size) {
+  if (size == 0)
+    return false;
+  bufferSize = size;
+  return true;
+}
+
+bool PubSubClient::connect(const char *clientId) {
+  return connect(clientId, nullptr, nullptr, nullptr, 0, false, nullptr);
+}
+
+bool PubSubClient::connect(const char *clientId, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage) {
+  return connect(clientId, nullptr, nullptr, willTopic, willQos, willRetain, willMessage);
+}
+
+bool PubSubClient::connect(const char *clientId, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage) {
+  if (connected())
+    return true;
+  bool isReachable;
+  uint32_t handshakeMillis;
+  {
+    std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+    connectAttempts.push_back(NativeClock::getMicros());
+    isReachable = reachable && !host.isEmpty();
+    handshakeMillis = connectMillis;
+  }
+  if (WiFi.status() != WL_CONNECTED) {
+    clientState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  NativeClock::blockFor((uint64_t)(isReachable ? handshakeMillis : NATIVE_MQTT_CONNECT_TIMEOUT_MS) * 1000ull);
+
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  if (!isReachable || !reachable) {
+    clientState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  if (!requiredUser.isEmpty() && (user == nullptr || requiredUser != user || pass == nullptr || requiredPass != pass)) {
+    clientState = (user == nullptr) ? MQTT_CONNECT_UNAUTHORIZED : MQTT_CONNECT_BAD_CREDENTIALS;
+    return false;
+  }
+  // a session with the same client id is taken over
+  for (size_t i = 0; i < sessions.size(); i++) {
+    if (sessions[i].client->id == clientId) {
+      NativeMqtt::loseSession(sessions[i].client);
+      break;
+    }
+  }
+  id = clientId;
+  inbox.clear();
+  sessions.push_back({ this, willTopic != nullptr ? willTopic : "", willMessage != nullptr ? willMessage : "", willRetain });
+  clientState = MQTT_CONNECTED;
+  connectCount++;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  if (clientState != MQTT_CONNECTED)
+    return;
+  PubSubClient *self = this;
+  sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [self](const NativeMqttSession &entry) { return entry.client == self; }), sessions.end());
+  subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+    [self](const NativeMqttSubscription &entry) { return entry.clientId == self->id; }), subscriptions.end());
+  clientState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retain) {
+  return publish(topic, (const uint8_t*)payload, payload != nullptr ? strlen(payload) : 0, retain);
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length, bool retain) {
+  if (!connected())
+    return false;
+  if (MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length > bufferSize)
+    return false;
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  NativeMqtt::route(id, topic, std::string((const char*)payload, length), retain);
+  return true;
+}
+
+bool PubSubClient::subscribe(const char *topic, uint8_t qos) {
+  if (!connected() || qos > 1)
+    return false;
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  PubSubClient *self = this;
+  subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+    [self, topic](const NativeMqttSubscription &entry) { return entry.clientId == self->id && entry.topic == topic; }), subscriptions.end());
+  subscriptions.push_back({ id, topic, qos });
+  auto message = retained.find(topic);
+  if (message != retained.end())
+    inbox.push_back({ "", topic, message->second, true, NativeClock::getMicros() });
+  return true;
+}
+
+bool PubSubClient::loop() {
+  if (!connected())
+    return false;
+  for (;;) {
+    NativeMqttMessage message;
+    {
+      std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+      if (inbox.empty())
+        break;
+      message = inbox.front();
+      inbox.pop_front();
+    }
+    if (callback) {
+      std::vector<char> topic(message.topic.c_str(), message.topic.c_str() + message.topic.length() + 1);
+      std::vector<uint8_t> payload(message.payload.begin(), message.payload.end());
+      callback(topic.data(), payload.data(), payload.size());
+    }
+  }
+  return true;
+}
+
+bool PubSubClient::connected() {
+  bool wifiUp = WiFi.status() == WL_CONNECTED;
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  if (clientState == MQTT_CONNECTED && !wifiUp)
+    NativeMqtt::loseSession(this); // the broker notices with the keep alive timeout
+  return clientState == MQTT_CONNECTED;
+}
+
+int PubSubClient::state() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  return clientState;
+}
+
+void NativeMqtt::reset() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  for (NativeMqttSession &session : sessions)
+    session.client->clientState = MQTT_CONNECTION_LOST;
+  reachable = true;
+  connectMillis = 30;
+  requiredUser = "";
+  requiredPass = "";
+  sessions.clear();
+  subscriptions.clear();
+  messages.clear();
+  retained.clear();
+  connectAttempts.clear();
+  connectCount = 0;
+}
+
+void NativeMqtt::setCredentials(const char *user, const char *pass) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  requiredUser = user != nullptr ? user : "";
+  requiredPass = pass != nullptr ? pass : "";
+}
+
+void NativeMqtt::setReachable(bool isReachable) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  reachable = isReachable;
+}
+
+void NativeMqtt::setConnectMillis(uint32_t millis) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  connectMillis = millis;
+}
+
+void NativeMqtt::dropConnections() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  while (!sessions.empty())
+    loseSession(sessions.front().client);
+}
+
+void NativeMqtt::publish(const char *topic, const char *payload, bool retain) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  route("", topic, payload, retain);
+}
+
+std::vector<NativeMqttMessage> NativeMqtt::getMessages(const char *topic) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  std::vector<NativeMqttMessage> result;
+  for (const NativeMqttMessage &message : messages) {
+    if (topic == nullptr || message.topic == topic)
+      result.push_back(message);
+  }
+  return result;
+}
+
+void NativeMqtt::clearMessages() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  messages.clear();
+}
+
+String NativeMqtt::getRetained(const char *topic) {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  auto message = retained.find(topic);
+  return message != retained.end() ? String(message->second.c_str()) : String();
+}
+
+std::vector<NativeMqttSubscription> NativeMqtt::getSubscriptions() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  return subscriptions;
+}
+
+std::vector<uint64_t> NativeMqtt::getConnectAttempts() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  return connectAttempts;
+}
+
+uint32_t NativeMqtt::getConnectCount() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  return connectCount;
+}
+
+size_t NativeMqtt::getSessionCount() {
+  std::lock_guard<std::recursive_mutex> lock(brokerMutex);
+  return sessions.size();
+}
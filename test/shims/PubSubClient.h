@@ -0,0 +1,107 @@
+#ifndef PUBSUBCLIENT_H
+#define PUBSUBCLIENT_H
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <deque>
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_BAD_PROTOCOL    1
+#define MQTT_CONNECT_BAD_CLIENT_ID   2
+#define MQTT_CONNECT_UNAVAILABLE     3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED    5
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_MAX_HEADER_SIZE 5
+#define NATIVE_MQTT_CONNECT_TIMEOUT_MS 3000 // TCP connect timeout of the WiFiClient
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+struct NativeMqttMessage {
+  String clientId; // empty for messages of NativeMqtt::publish()
+  String topic;
+  std::string payload;
+  bool retained;
+  uint64_t micros; // when the broker got it
+};
+
+/*
+  PubSubClient against an in-process broker (NativeMqtt). connect() takes the TCP handshake and the CONNACK in simulated
+  time, or the connect timeout when the broker is unreachable. Messages to a subscribed topic wait in the session of the
+  client until its loop() hands them to the callback. Topics match exactly, there are no wildcards.
+  Like the library, a publish larger than the buffer fails and everything is sent with QoS 0.
+*/
+class PubSubClient {
+  private:
+    String host;
+    uint16_t port = 0;
+    uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+    MQTT_CALLBACK_SIGNATURE;
+    int clientState = MQTT_DISCONNECTED;
+    String id;
+    std::deque<NativeMqttMessage> inbox;
+
+    friend class NativeMqtt;
+
+  public:
+    PubSubClient() {}
+    explicit PubSubClient(WiFiClient &client) {}
+    ~PubSubClient();
+
+    PubSubClient& setServer(const char *domain, uint16_t port);
+    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+    bool setBufferSize(uint16_t size);
+    uint16_t getBufferSize() { return bufferSize; }
+
+    bool connect(const char *id);
+    bool connect(const char *id, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage);
+    bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage);
+    void disconnect();
+
+    bool publish(const char *topic, const char *payload, bool retained = false);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false);
+    bool subscribe(const char *topic, uint8_t qos = 0);
+
+    bool loop();
+    bool connected();
+    int state();
+};
+
+struct NativeMqttSubscription {
+  String clientId;
+  String topic;
+  uint8_t qos;
+};
+
+class NativeMqtt {
+  private:
+    friend class PubSubClient;
+    // with the broker lock held
+    static void route(const String &clientId, const String &topic, const std::string &payload, bool retain);
+    static void loseSession(PubSubClient *client); // gone without DISCONNECT, the last will is sent
+
+  public:
+    static void reset(); // reachable broker without credentials, nothing retained, no sessions, counters cleared
+    static void setCredentials(const char *user, const char *pass); // required from now on, nullptr: anonymous
+    static void setReachable(bool reachable);      // unreachable: every connect runs into the connect timeout
+    static void setConnectMillis(uint32_t millis); // TCP handshake and CONNACK
+    static void dropConnections();                 // broker restart: every client loses its session, last wills are sent
+
+    // as another client
+    static void publish(const char *topic, const char *payload, bool retained = false);
+
+    static std::vector<NativeMqttMessage> getMessages(const char *topic = nullptr); // everything the broker got
+    static void clearMessages();
+    static String getRetained(const char *topic); // empty if nothing is retained
+    static std::vector<NativeMqttSubscription> getSubscriptions();
+    static std::vector<uint64_t> getConnectAttempts(); // simulated micros of every connect()
+    static uint32_t getConnectCount();                 // successful ones
+    static size_t getSessionCount();
+};
+
+#endif
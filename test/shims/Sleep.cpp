@@ -0,0 +1,142 @@
+#include "Arduino.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct ScheduledTouch {
+  uint8_t pin;
+  uint64_t micros;
+};
+
+static std::recursive_mutex sleepMutex;
+static std::vector<ScheduledTouch> touches;
+static std::map<uint8_t, bool> interruptDisabled;
+static std::map<uint8_t, bool> disabledDuringSleep;
+static std::map<uint8_t, bool> wakeupPins;
+static bool gpioWakeup = false;
+static bool timerWakeup = false;
+static uint64_t timerWakeupMicros = 0;
+static uint32_t wakeupMicros = 150;
+static esp_sleep_wakeup_cause_t wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static uint32_t sleepCount = 0;
+static uint64_t sleptMicros = 0;
+
+esp_err_t gpio_intr_enable(gpio_num_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  interruptDisabled[pin] = false;
+  NativeGpio::setInterruptEnabled(pin, true);
+  return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  interruptDisabled[pin] = true;
+  NativeGpio::setInterruptEnabled(pin, false);
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) {
+  if (type != GPIO_INTR_LOW_LEVEL && type != GPIO_INTR_HIGH_LEVEL)
+    return ESP_ERR_INVALID_ARG; // only levels can wake up
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  wakeupPins[pin] = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  wakeupPins[pin] = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup() {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  gpioWakeup = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeMicros) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  timerWakeup = true;
+  timerWakeupMicros = timeMicros;
+  return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start() {
+  uint64_t wakeMicros;
+  {
+    std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+    uint64_t now = NativeClock::getMicros();
+    wakeMicros = timerWakeup ? now + timerWakeupMicros : UINT64_MAX;
+    wakeupCause = ESP_SLEEP_WAKEUP_TIMER;
+    int touchIndex = -1;
+    for (size_t i = 0; gpioWakeup && i < touches.size(); i++) {
+      uint64_t touchMicros = std::max(touches[i].micros, now);
+      if (wakeupPins[touches[i].pin] && touchMicros < wakeMicros) {
+        wakeMicros = touchMicros;
+        touchIndex = i;
+      }
+    }
+    if (touchIndex < 0 && !timerWakeup)
+      return ESP_ERR_INVALID_STATE; // no wakeup source, would never wake up
+    if (touchIndex >= 0) {
+      wakeupCause = ESP_SLEEP_WAKEUP_GPIO;
+      touches.erase(touches.begin() + touchIndex);
+    }
+    disabledDuringSleep = interruptDisabled;
+    sleepCount++;
+    sleptMicros += wakeMicros - now;
+  }
+  NativeClock::advanceMicros(wakeMicros + wakeupMicros - NativeClock::getMicros());
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  return wakeupCause;
+}
+
+void NativeSleep::reset() {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  touches.clear();
+  interruptDisabled.clear();
+  disabledDuringSleep.clear();
+  wakeupPins.clear();
+  gpioWakeup = false;
+  timerWakeup = false;
+  wakeupMicros = 150;
+  wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+  sleepCount = 0;
+  sleptMicros = 0;
+}
+
+void NativeSleep::scheduleTouch(uint8_t pin, uint64_t atMicros) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  touches.push_back(ScheduledTouch{pin, atMicros});
+}
+
+void NativeSleep::setWakeupMicros(uint32_t micros) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  wakeupMicros = micros;
+}
+
+uint32_t NativeSleep::getSleepCount() {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  return sleepCount;
+}
+
+uint64_t NativeSleep::getSleptMicros() {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  return sleptMicros;
+}
+
+bool NativeSleep::wasInterruptDisabledDuringSleep(uint8_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(sleepMutex);
+  return disabledDuringSleep[pin];
+}
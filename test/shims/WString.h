@@ -0,0 +1,98 @@
+#ifndef WSTRING_H
+#define WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+/*
+  Arduino String for the native build, backed by std::string. Only what the firmware uses, with the semantics of the
+  ESP32 core (numbers are explicit constructors, concatenation with + works from either side).
+*/
+class String {
+  private:
+    std::string value;
+
+    static std::string fromInteger(long long number, unsigned char base);
+    static std::string fromUnsigned(unsigned long long number, unsigned char base);
+    static std::string fromDouble(double number, unsigned int decimalPlaces);
+
+  public:
+    String(const char *text = "") : value(text != nullptr ? text : "") {}
+    String(const std::string &text) : value(text) {}
+    String(char c) : value(1, c) {}
+    explicit String(unsigned char number, unsigned char base = 10) : value(fromUnsigned(number, base)) {}
+    explicit String(int number, unsigned char base = 10) : value(fromInteger(number, base)) {}
+    explicit String(unsigned int number, unsigned char base = 10) : value(fromUnsigned(number, base)) {}
+    explicit String(long number, unsigned char base = 10) : value(fromInteger(number, base)) {}
+    explicit String(unsigned long number, unsigned char base = 10) : value(fromUnsigned(number, base)) {}
+    explicit String(long long number, unsigned char base = 10) : value(fromInteger(number, base)) {}
+    explicit String(unsigned long long number, unsigned char base = 10) : value(fromUnsigned(number, base)) {}
+    explicit String(float number, unsigned int decimalPlaces = 2) : value(fromDouble(number, decimalPlaces)) {}
+    explicit String(double number, unsigned int decimalPlaces = 2) : value(fromDouble(number, decimalPlaces)) {}
+
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+    bool isEmpty() const { return value.empty(); }
+    bool reserve(unsigned int size) { value.reserve(size); return true; }
+    const std::string& str() const { return value; }
+
+    char charAt(unsigned int index) const { return index < value.length() ? value[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return value[index]; }
+
+    bool concat(const String &other) { value += other.value; return true; }
+    bool concat(const char *text) { if (text == nullptr) return false; value += text; return true; }
+    bool concat(char c) { value += c; return true; }
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+    bool concat(T number) { return concat(String(number)); }
+
+    template<typename T>
+    String& operator+=(const T &other) { concat(other); return *this; }
+
+    bool equals(const String &other) const { return value == other.value; }
+    bool equals(const char *text) const { return value == (text != nullptr ? text : ""); }
+    bool equalsIgnoreCase(const String &other) const;
+    int compareTo(const String &other) const { return value.compare(other.value); }
+    bool startsWith(const String &prefix) const { return value.compare(0, prefix.value.length(), prefix.value) == 0; }
+    bool endsWith(const String &suffix) const;
+
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String &text, unsigned int from = 0) const;
+    int lastIndexOf(char c) const;
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+
+    void replace(const String &find, const String &replacement);
+    void remove(unsigned int index, unsigned int count = (unsigned int)-1);
+    void toLowerCase();
+    void toUpperCase();
+    void trim();
+
+    long toInt() const;
+    float toFloat() const;
+    void toCharArray(char *buffer, unsigned int size, unsigned int index = 0) const { getBytes((unsigned char*)buffer, size, index); }
+    void getBytes(unsigned char *buffer, unsigned int size, unsigned int index = 0) const;
+
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator==(const char *text) const { return equals(text); }
+    bool operator!=(const String &other) const { return value != other.value; }
+    bool operator!=(const char *text) const { return !equals(text); }
+    bool operator<(const String &other) const { return value < other.value; }
+};
+
+// result type of the concatenation operators in the ESP32 core, ArduinoJson has adapters for it
+class StringSumHelper : public String {
+  public:
+    StringSumHelper(const String &text) : String(text) {}
+};
+
+inline String operator+(const String &lhs, const String &rhs) { String result(lhs); result.concat(rhs); return result; }
+inline String operator+(const String &lhs, const char *rhs) { String result(lhs); result.concat(rhs); return result; }
+inline String operator+(const char *lhs, const String &rhs) { String result(lhs); result.concat(rhs); return result; }
+inline String operator+(const String &lhs, char rhs) { String result(lhs); result.concat(rhs); return result; }
+template<typename T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+inline String operator+(const String &lhs, T rhs) { String result(lhs); result.concat(rhs); return result; }
+
+#endif
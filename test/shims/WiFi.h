@@ -0,0 +1,75 @@
+#ifndef WIFI_H
+#define WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+// TCP connection, only a handle for HTTPClient and PubSubClient here
+class WiFiClient {
+  public:
+    virtual ~WiFiClient() {}
+};
+
+/*
+  Station of the ESP32 core against one scripted access point. A connect takes the scan (skipped when channel and
+  BSSID are given and match), the association and the DHCP round trip (skipped with a static address from config()).
+  status() turns to WL_CONNECTED when that time has passed on the simulated clock.
+*/
+class WiFiClass {
+  public:
+    void persistent(bool persistent) {}
+    bool setAutoReconnect(bool autoReconnect) { return true; }
+    bool mode(wifi_mode_t mode);
+    wifi_mode_t getMode();
+    bool config(IPAddress localIp, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+    wl_status_t begin(const char *ssid, const char *passphrase = nullptr, int32_t channel = 0, const uint8_t *bssid = nullptr, bool connect = true);
+    bool disconnect(bool wifiOff = false);
+    wl_status_t status();
+
+    String SSID();
+    const uint8_t* BSSID();
+    int32_t channel();
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t index = 0);
+};
+
+extern WiFiClass WiFi;
+
+struct NativeAccessPoint {
+  String ssid = "door";
+  String password = "secret";
+  uint8_t bssid[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+  uint8_t channel = 6;
+  uint32_t scanMillis = 2200;     // active scan of all channels
+  uint32_t associateMillis = 150; // authentication and association
+  uint32_t dhcpMillis = 800;
+  uint32_t leaseSeconds = 86400;
+  IPAddress ip = IPAddress(192, 168, 1, 50);
+  IPAddress gateway = IPAddress(192, 168, 1, 1);
+  IPAddress subnet = IPAddress(255, 255, 255, 0);
+  IPAddress dns = IPAddress(192, 168, 1, 1);
+};
+
+class NativeWiFi {
+  public:
+    static void reset(); // the default access point, in range, station off
+    static void setAccessPoint(const NativeAccessPoint &accessPoint);
+    static void setInRange(bool inRange); // out of range: connects never finish, a link is lost
+    static uint32_t getBeginCount();
+    static uint32_t getDhcpCount();   // connects that asked the DHCP server
+    static uint32_t getScanCount();   // connects that scanned
+};
+
+#endif
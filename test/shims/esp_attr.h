@@ -0,0 +1,11 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+// placement attributes of the ESP32 linker script, everything is ordinary memory on the host. RTC_NOINIT_ATTR
+// variables are zero initialized like after a power-on, tests simulate soft resets by keeping them.
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
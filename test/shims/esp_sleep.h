@@ -0,0 +1,40 @@
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+#include <stdint.h>
+#include "esp_system.h"
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED,
+  ESP_SLEEP_WAKEUP_ALL,
+  ESP_SLEEP_WAKEUP_EXT0,
+  ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER,
+  ESP_SLEEP_WAKEUP_TOUCHPAD,
+  ESP_SLEEP_WAKEUP_ULP,
+  ESP_SLEEP_WAKEUP_GPIO,
+  ESP_SLEEP_WAKEUP_UART,
+} esp_sleep_wakeup_cause_t;
+
+esp_err_t esp_sleep_enable_gpio_wakeup();
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeMicros);
+esp_err_t esp_light_sleep_start();
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+
+/*
+  Light sleep on the simulated clock: esp_light_sleep_start() jumps to the first scheduled touch of a GPIO wakeup pin
+  or to the timer wakeup, whichever comes first, plus the wakeup latency. No real time passes while sleeping.
+*/
+class NativeSleep {
+  public:
+    static void reset();
+    // the touch ring pin goes LOW at the given simulated time
+    static void scheduleTouch(uint8_t pin, uint64_t atMicros);
+    static void setWakeupMicros(uint32_t micros); // time from the wakeup source until the code runs again
+    static uint32_t getSleepCount();
+    static uint64_t getSleptMicros();
+    // the edge interrupt of the pin was disabled during the last sleep
+    static bool wasInterruptDisabledDuringSleep(uint8_t pin);
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+#include <functional>
+#include "esp_system.h"
+
+/*
+  esp_timer on the simulated clock: a timer fires while the NativeClock is advanced past its deadline, the callback
+  runs in the advancing thread with the clock set to the deadline plus the dispatch latency of the timer task.
+*/
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+  ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void *arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char *name;
+} esp_timer_create_args_t;
+
+struct esp_timer;
+typedef struct esp_timer* esp_timer_handle_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutMicros);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodMicros);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+int64_t esp_timer_get_time();
+
+class NativeTimers {
+  public:
+    // delay between the deadline and the callback, e.g. the timer task waiting for a higher priority task. Called for
+    // every dispatch, nullptr for none.
+    static void setDispatchLatency(std::function<uint32_t()> latencyMicros);
+};
+
+#endif
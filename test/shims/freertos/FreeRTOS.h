@@ -0,0 +1,75 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/*
+  FreeRTOS API of the ESP32 core for the native build. Tasks are std::threads, queues and mutexes are protected by a
+  std::mutex. A timeout of a blocking call is simulated time: it waits a short real time (NATIVE_REAL_MICROS_PER_TICK
+  per tick) for another thread and then advances the NativeClock by the whole timeout, like the RTOS would when the
+  task was blocked for that long.
+*/
+
+#define NATIVE_REAL_MICROS_PER_TICK 100
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef void (*TaskFunction_t)(void*);
+
+struct NativeQueue;
+struct NativeTask;
+typedef NativeQueue* QueueHandle_t;
+typedef NativeQueue* SemaphoreHandle_t;
+typedef NativeTask* TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t coreId);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+// critical sections are a spin lock, interrupts are not masked on the host
+struct portMUX_TYPE {
+  std::atomic_flag locked = ATOMIC_FLAG_INIT;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+inline void portENTER_CRITICAL(portMUX_TYPE *mux) {
+  while (mux->locked.test_and_set(std::memory_order_acquire));
+}
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) {
+  mux->locked.clear(std::memory_order_release);
+}
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+
+class NativeRtos {
+  public:
+    // tasks created by xTaskCreatePinnedToCore() so far
+    static int getTaskCount();
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef LWIP_DHCP_H
+#define LWIP_DHCP_H
+
+#include <stdint.h>
+
+struct dhcp {
+  uint32_t offered_t0_lease; // lease time in seconds
+};
+
+struct netif {
+  struct dhcp *dhcp; // nullptr while DHCP is not used
+};
+
+#define netif_dhcp_data(netif) ((netif)->dhcp)
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef ROM_CRC_H
+#define ROM_CRC_H
+
+#include <stdint.h>
+
+// CRC-32 of the ESP32 ROM (polynomial 0xEDB88320, the crc is inverted on entry and exit)
+uint32_t crc32_le(uint32_t crc, const uint8_t *buffer, uint32_t length);
+
+#endif
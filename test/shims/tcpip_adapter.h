@@ -0,0 +1,16 @@
+#ifndef TCPIP_ADAPTER_H
+#define TCPIP_ADAPTER_H
+
+#include "esp_system.h"
+
+typedef enum {
+  TCPIP_ADAPTER_IF_STA = 0,
+  TCPIP_ADAPTER_IF_AP,
+  TCPIP_ADAPTER_IF_ETH,
+  TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+// the lwIP netif of the interface, it has DHCP data while the station got its address by DHCP (see WiFi.h)
+esp_err_t tcpip_adapter_get_netif(tcpip_adapter_if_t interface, void **netif);
+
+#endif
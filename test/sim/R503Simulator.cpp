@@ -0,0 +1,528 @@
+#include "R503Simulator.h"
+#include <algorithm>
+
+#define R503_STARTCODE_HIGH 0xEF
+#define R503_STARTCODE_LOW 0x01
+#define R503_PACKET_COMMAND 0x01
+#define R503_PACKET_DATA 0x02
+#define R503_PACKET_ACK 0x07
+#define R503_PACKET_END_DATA 0x08
+#define R503_MAX_PACKET_LENGTH 300
+
+// confirmation codes
+#define R503_OK 0x00
+#define R503_RECEIVE_ERROR 0x01
+#define R503_NO_FINGER 0x02
+#define R503_IMAGE_FAIL 0x03
+#define R503_IMAGE_MESSY 0x06
+#define R503_FEATURE_FAIL 0x07
+#define R503_NOT_FOUND 0x09
+#define R503_ENROLL_MISMATCH 0x0A
+#define R503_BAD_LOCATION 0x0B
+#define R503_DB_READ_FAIL 0x0C
+#define R503_UPLOAD_FAIL 0x0D
+#define R503_DELETE_FAIL 0x10
+#define R503_WRONG_PASSWORD 0x13
+#define R503_INVALID_IMAGE 0x15
+#define R503_INVALID_REGISTER 0x1A
+
+static uint64_t getByteMicros(uint32_t baudRate) {
+  return (10000000ull + baudRate / 2) / baudRate; // start, 8 data and stop bit
+}
+
+void R503Simulator::attach(HardwareSerial &newSerial) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  serial = &newSerial;
+  newSerial.attach(this);
+}
+
+void R503Simulator::onReceive(HardwareSerial &line, uint8_t value, uint32_t lineBaudRate, uint64_t micros) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (!present || micros < readyMicros || lineBaudRate != baudRate) {
+    packet.clear(); // nobody listening or garbage at this baud rate
+    return;
+  }
+
+  packet.push_back(value);
+  if ((packet.size() == 1 && value != R503_STARTCODE_HIGH) || (packet.size() == 2 && value != R503_STARTCODE_LOW)) {
+    packet.clear();
+    if (value == R503_STARTCODE_HIGH)
+      packet.push_back(value);
+    return;
+  }
+  if (packet.size() < 9)
+    return;
+  uint16_t length = ((uint16_t)packet[7] << 8) | packet[8];
+  if (length < 2 || length > R503_MAX_PACKET_LENGTH) {
+    packet.clear();
+    return;
+  }
+  if (packet.size() == 9u + length)
+    handlePacket(micros);
+}
+
+void R503Simulator::handlePacket(uint64_t micros) {
+  std::vector<uint8_t> received;
+  received.swap(packet);
+  uint8_t type = received[6];
+  uint16_t length = (((uint16_t)received[7] << 8) | received[8]) - 2;
+  const uint8_t *data = &received[9];
+
+  uint16_t sum = type + received[7] + received[8];
+  for (uint16_t i = 0; i < length; i++)
+    sum += data[i];
+  bool valid = sum == (((uint16_t)received[9 + length] << 8) | received[10 + length]);
+
+  if (type == R503_PACKET_DATA || type == R503_PACKET_END_DATA) {
+    if (downloading && valid)
+      handleData(data, length, type == R503_PACKET_END_DATA);
+    return; // data packets are never acknowledged
+  }
+  if (type != R503_PACKET_COMMAND || length == 0)
+    return;
+
+  if (!valid) {
+    uint8_t code = R503_RECEIVE_ERROR;
+    std::vector<uint8_t> reply;
+    appendPacket(reply, R503_PACKET_ACK, &code, 1);
+    uint64_t start = std::max(micros, busyUntilMicros) + timing.commandMicros;
+    serial->deliver(reply.data(), reply.size(), baudRate, start);
+    busyUntilMicros = start + reply.size() * getByteMicros(baudRate);
+    return;
+  }
+  handleCommand(data, length, micros);
+}
+
+uint32_t R503Simulator::getCommandMicros(uint8_t code) {
+  switch (code) {
+    case 0x02: return timing.image2TzMicros;
+    case 0x04: return timing.searchMicros + timing.searchPerTemplateMicros * library.size();
+    case 0x05: return timing.createModelMicros;
+    case 0x06: return timing.storeMicros;
+    case 0x07: return timing.loadMicros;
+    case 0x0C: return timing.deleteMicros;
+    case 0x0D: return timing.emptyMicros;
+    case 0x18:
+    case 0x19: return timing.notepadMicros;
+    default:   return timing.commandMicros;
+  }
+}
+
+void R503Simulator::handleCommand(const uint8_t *data, uint16_t length, uint64_t micros) {
+  uint8_t code = data[0];
+  commands.push_back(R503Command{code, micros});
+  uint64_t executeMicros = std::max(micros, busyUntilMicros);
+
+  if (silencedCommands[code] > 0) {
+    silencedCommands[code]--;
+    return;
+  }
+
+  std::vector<uint8_t> dataPackets;
+  std::vector<uint8_t> payload;
+  uint32_t latency;
+  std::vector<uint8_t> &injected = injectedCodes[code];
+  if (!injected.empty()) {
+    payload.assign(1, injected.front());
+    payload.resize(code == 0x04 ? 5 : 1, 0);
+    injected.erase(injected.begin());
+    latency = getCommandMicros(code);
+  } else {
+    payload = execute(data, length, executeMicros, dataPackets);
+    latency = code == 0x01 ? (payload[0] == R503_NO_FINGER ? timing.getImageNoFingerMicros : timing.getImageMicros) : getCommandMicros(code);
+  }
+
+  std::vector<uint8_t> reply;
+  appendPacket(reply, R503_PACKET_ACK, payload.data(), payload.size());
+  reply.insert(reply.end(), dataPackets.begin(), dataPackets.end());
+  uint64_t start = executeMicros + latency;
+  serial->deliver(reply.data(), reply.size(), baudRate, start);
+  busyUntilMicros = start + reply.size() * getByteMicros(baudRate);
+
+  // a new baud rate is used after the acknowledge
+  if (code == 0x0E && payload[0] == R503_OK && data[1] == 4)
+    baudRate = data[2] * 9600;
+}
+
+std::vector<uint8_t> R503Simulator::execute(const uint8_t *data, uint16_t length, uint64_t micros, std::vector<uint8_t> &dataPackets) {
+  std::vector<uint8_t> reply(1, R503_OK);
+  uint8_t code = data[0];
+  uint8_t buffer = length > 1 ? data[1] : 0;
+  bool validBuffer = buffer >= 1 && buffer <= R503_CHAR_BUFFERS;
+
+  switch (code) {
+    case 0x01: { // GenImg
+      R503Image image;
+      int finger = getFingerAt(micros, image);
+      imageFinger = -1;
+      if (finger < 0)
+        reply[0] = R503_NO_FINGER;
+      else if (image == R503Image::fail)
+        reply[0] = R503_IMAGE_FAIL;
+      else {
+        imageFinger = finger;
+        imageQuality = image;
+      }
+      break;
+    }
+
+    case 0x02: // Img2Tz
+      if (!validBuffer)
+        reply[0] = R503_RECEIVE_ERROR;
+      else if (imageFinger < 0)
+        reply[0] = R503_INVALID_IMAGE;
+      else if (imageQuality == R503Image::messy)
+        reply[0] = R503_IMAGE_MESSY;
+      else if (imageQuality == R503Image::noFeatures)
+        reply[0] = R503_FEATURE_FAIL;
+      else
+        charBuffers[buffer] = CharBuffer{imageFinger, false};
+      break;
+
+    case 0x04: { // Search
+      uint16_t startId = ((uint16_t)data[2] << 8) | data[3];
+      uint16_t count = ((uint16_t)data[4] << 8) | data[5];
+      reply.resize(5, 0);
+      reply[0] = R503_NOT_FOUND;
+      int finger = validBuffer ? charBuffers[buffer].finger : -1;
+      for (const auto &entry : library) {
+        if (finger >= 0 && entry.first >= startId && entry.first < startId + count && getFinger(entry.second) == finger) {
+          reply = { R503_OK, (uint8_t)(entry.first >> 8), (uint8_t)(entry.first & 0xFF), 0, R503_MATCH_SCORE };
+          break;
+        }
+      }
+      break;
+    }
+
+    case 0x05: { // RegModel, the features of all filled buffers must be of the same finger
+      int finger = -1;
+      for (int i = 1; i <= R503_CHAR_BUFFERS && reply[0] == R503_OK; i++) {
+        if (charBuffers[i].finger < 0 || charBuffers[i].isTemplate)
+          continue;
+        if (finger >= 0 && charBuffers[i].finger != finger)
+          reply[0] = R503_ENROLL_MISMATCH;
+        finger = charBuffers[i].finger;
+      }
+      if (finger < 0)
+        reply[0] = R503_ENROLL_MISMATCH;
+      if (reply[0] == R503_OK) {
+        for (int i = 1; i <= R503_CHAR_BUFFERS; i++)
+          charBuffers[i] = CharBuffer();
+        charBuffers[1] = CharBuffer{finger, true, makeTemplate(finger)};
+      }
+      break;
+    }
+
+    case 0x06: { // Store
+      uint16_t id = ((uint16_t)data[2] << 8) | data[3];
+      if (!validBuffer || (charBuffers[buffer].finger < 0 && !charBuffers[buffer].isTemplate))
+        reply[0] = R503_RECEIVE_ERROR;
+      else if (id >= R503_CAPACITY)
+        reply[0] = R503_BAD_LOCATION;
+      else
+        library[id] = charBuffers[buffer].isTemplate ? charBuffers[buffer].content : makeTemplate(charBuffers[buffer].finger);
+      break;
+    }
+
+    case 0x07: { // LoadChar
+      uint16_t id = ((uint16_t)data[2] << 8) | data[3];
+      auto entry = library.find(id);
+      if (!validBuffer || entry == library.end())
+        reply[0] = R503_DB_READ_FAIL;
+      else
+        charBuffers[buffer] = CharBuffer{getFinger(entry->second), true, entry->second};
+      break;
+    }
+
+    case 0x08: { // UpChar, the template follows the acknowledge in data packets
+      if (!validBuffer || !charBuffers[buffer].isTemplate) {
+        reply[0] = R503_UPLOAD_FAIL;
+        break;
+      }
+      const std::vector<uint8_t> &content = charBuffers[buffer].content;
+      size_t chunk = 32u << packetSizeSetting;
+      for (size_t offset = 0; offset < content.size(); offset += chunk) {
+        size_t size = std::min(chunk, content.size() - offset);
+        bool last = offset + size >= content.size();
+        appendPacket(dataPackets, last ? R503_PACKET_END_DATA : R503_PACKET_DATA, &content[offset], size);
+      }
+      break;
+    }
+
+    case 0x09: // DownChar, the host sends the data packets next
+      if (!validBuffer) {
+        reply[0] = R503_RECEIVE_ERROR;
+        break;
+      }
+      downloading = true;
+      downloadBuffer = buffer;
+      download.clear();
+      charBuffers[buffer] = CharBuffer();
+      break;
+
+    case 0x0C: { // DeletChar
+      uint16_t id = ((uint16_t)data[1] << 8) | data[2];
+      uint16_t count = ((uint16_t)data[3] << 8) | data[4];
+      if (count == 0 || id + count > R503_CAPACITY)
+        reply[0] = R503_DELETE_FAIL;
+      else
+        for (uint16_t i = id; i < id + count; i++)
+          library.erase(i);
+      break;
+    }
+
+    case 0x0D: // Empty
+      library.clear();
+      break;
+
+    case 0x0E: // WriteReg, the baud rate is switched after the acknowledge
+      if (data[1] == 4 && data[2] >= 1 && data[2] <= 12)
+        break;
+      if (data[1] == 5 && data[2] >= 1 && data[2] <= 5)
+        securityLevel = data[2];
+      else if (data[1] == 6 && data[2] <= 3)
+        packetSizeSetting = data[2];
+      else
+        reply[0] = R503_INVALID_REGISTER;
+      break;
+
+    case 0x0F: { // ReadSysPara
+      uint16_t baudSetting = baudRate / 9600;
+      uint8_t parameters[16] = { 0, 0, 0, 0, 0, R503_CAPACITY, 0, securityLevel, 0xFF, 0xFF, 0xFF, 0xFF,
+                                 0, packetSizeSetting, (uint8_t)(baudSetting >> 8), (uint8_t)(baudSetting & 0xFF) };
+      reply.insert(reply.end(), parameters, parameters + sizeof(parameters));
+      break;
+    }
+
+    case 0x13: { // VfyPwd
+      uint32_t received = length >= 5 ? ((uint32_t)data[1] << 24 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 8 | data[4]) : ~password;
+      if (received != password)
+        reply[0] = R503_WRONG_PASSWORD;
+      break;
+    }
+
+    case 0x18: // WriteNotepad
+      if (length < 34 || data[1] >= R503_NOTEPAD_PAGES)
+        reply[0] = R503_RECEIVE_ERROR;
+      else
+        memcpy(notepad[data[1]], &data[2], 32);
+      break;
+
+    case 0x19: // ReadNotepad
+      if (data[1] >= R503_NOTEPAD_PAGES)
+        reply[0] = R503_RECEIVE_ERROR;
+      else
+        reply.insert(reply.end(), notepad[data[1]], notepad[data[1]] + 32);
+      break;
+
+    case 0x1D: // TempleteNum
+      reply.push_back(library.size() >> 8);
+      reply.push_back(library.size() & 0xFF);
+      break;
+
+    case 0x1F: { // ReadIndexTable
+      uint8_t bitmap[32] = {};
+      for (const auto &entry : library)
+        if (entry.first / 256 == data[1])
+          bitmap[(entry.first % 256) / 8] |= 1 << (entry.first % 8);
+      reply.insert(reply.end(), bitmap, bitmap + sizeof(bitmap));
+      break;
+    }
+
+    case 0x35: // AuraLedConfig
+      leds.push_back(R503Led{data[1], data[2], data[3], data[4], micros});
+      break;
+
+    case 0x50: // LED on/off of older sensors
+    case 0x51:
+      break;
+
+    default:
+      reply[0] = R503_RECEIVE_ERROR;
+      break;
+  }
+  return reply;
+}
+
+void R503Simulator::handleData(const uint8_t *data, uint16_t length, bool last) {
+  download.insert(download.end(), data, data + length);
+  if (!last)
+    return;
+  downloading = false;
+  // the template matches a finger only if it arrived intact
+  charBuffers[downloadBuffer] = CharBuffer{getFinger(download), true, download};
+}
+
+void R503Simulator::appendPacket(std::vector<uint8_t> &out, uint8_t type, const uint8_t *data, uint16_t length) {
+  uint16_t packetLength = length + 2;
+  uint8_t header[9] = { R503_STARTCODE_HIGH, R503_STARTCODE_LOW, 0xFF, 0xFF, 0xFF, 0xFF, type,
+                        (uint8_t)(packetLength >> 8), (uint8_t)(packetLength & 0xFF) };
+  uint16_t sum = type + header[7] + header[8];
+  for (uint16_t i = 0; i < length; i++)
+    sum += data[i];
+  out.insert(out.end(), header, header + sizeof(header));
+  out.insert(out.end(), data, data + length);
+  out.push_back(sum >> 8);
+  out.push_back(sum & 0xFF);
+}
+
+int R503Simulator::getFingerAt(uint64_t micros, R503Image &image) {
+  int finger = -1;
+  for (const R503Touch &touch : touches) {
+    if (micros >= touch.fromMicros && micros < touch.toMicros) {
+      finger = touch.finger;
+      image = touch.image;
+    }
+  }
+  return finger;
+}
+
+void R503Simulator::setTiming(const R503Timing &newTiming) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  timing = newTiming;
+}
+
+void R503Simulator::setPresent(bool isPresent) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  present = isPresent;
+}
+
+void R503Simulator::powerCycle(uint64_t bootMicros) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  readyMicros = NativeClock::getMicros() + bootMicros;
+  busyUntilMicros = 0;
+  packet.clear();
+  imageFinger = -1;
+  for (int i = 1; i <= R503_CHAR_BUFFERS; i++)
+    charBuffers[i] = CharBuffer();
+  downloading = false;
+  download.clear();
+}
+
+void R503Simulator::setBaudRate(uint32_t newBaudRate) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  baudRate = newBaudRate;
+}
+
+uint32_t R503Simulator::getBaudRate() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return baudRate;
+}
+
+void R503Simulator::setPacketSizeSetting(uint8_t setting) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  packetSizeSetting = setting;
+}
+
+void R503Simulator::placeFinger(int finger, uint64_t fromMicros, uint64_t toMicros, R503Image image) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  touches.push_back(R503Touch{fromMicros, toMicros, finger, image});
+}
+
+void R503Simulator::placeFingerNow(int finger, uint32_t durationMillis, R503Image image) {
+  uint64_t now = NativeClock::getMicros();
+  placeFinger(finger, now, now + durationMillis * 1000ull, image);
+}
+
+void R503Simulator::removeFingers() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  uint64_t now = NativeClock::getMicros();
+  for (R503Touch &touch : touches)
+    touch.toMicros = std::min(touch.toMicros, now);
+}
+
+void R503Simulator::clearTouches() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  touches.clear();
+}
+
+std::vector<uint8_t> R503Simulator::makeTemplate(int finger) {
+  std::vector<uint8_t> content(R503_TEMPLATE_SIZE);
+  uint32_t state = 0x9E3779B9u ^ (uint32_t)finger;
+  content[0] = finger >> 8;
+  content[1] = finger & 0xFF;
+  for (size_t i = 2; i < content.size(); i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    content[i] = state & 0xFF;
+  }
+  return content;
+}
+
+int R503Simulator::getFinger(const std::vector<uint8_t> &content) {
+  if (content.size() != R503_TEMPLATE_SIZE)
+    return -1;
+  int finger = ((int)content[0] << 8) | content[1];
+  return content == makeTemplate(finger) ? finger : -1;
+}
+
+void R503Simulator::storeTemplate(uint16_t id, int finger) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  library[id] = makeTemplate(finger);
+}
+
+bool R503Simulator::hasTemplate(uint16_t id) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return library.find(id) != library.end();
+}
+
+int R503Simulator::getTemplateFinger(uint16_t id) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  auto entry = library.find(id);
+  return entry != library.end() ? getFinger(entry->second) : -1;
+}
+
+int R503Simulator::getTemplateCount() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return library.size();
+}
+
+std::vector<uint8_t> R503Simulator::getTemplate(uint16_t id) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  auto entry = library.find(id);
+  return entry != library.end() ? entry->second : std::vector<uint8_t>();
+}
+
+void R503Simulator::setNotepad(uint8_t page, const char *text) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  memset(notepad[page], 0, sizeof(notepad[page]));
+  memcpy(notepad[page], text, std::min(strlen(text), sizeof(notepad[page])));
+}
+
+String R503Simulator::getNotepad(uint8_t page) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return String(std::string(notepad[page], strnlen(notepad[page], sizeof(notepad[page]))));
+}
+
+void R503Simulator::injectReply(uint8_t code, uint8_t confirmationCode, int count) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  for (int i = 0; i < count; i++)
+    injectedCodes[code].push_back(confirmationCode);
+}
+
+void R503Simulator::silence(uint8_t code, int count) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  silencedCommands[code] += count;
+}
+
+std::vector<R503Command> R503Simulator::getCommands() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return commands;
+}
+
+int R503Simulator::countCommands(uint8_t code) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return std::count_if(commands.begin(), commands.end(), [code](const R503Command &command) { return command.code == code; });
+}
+
+void R503Simulator::clearCommands() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  commands.clear();
+  leds.clear();
+}
+
+std::vector<R503Led> R503Simulator::getLeds() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return leds;
+}
@@ -0,0 +1,149 @@
+#ifndef R503SIMULATOR_H
+#define R503SIMULATOR_H
+
+#include <Arduino.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define R503_CAPACITY 200
+#define R503_TEMPLATE_SIZE 1536     // bytes of one template in UpChar/DownChar
+#define R503_CHAR_BUFFERS 6
+#define R503_NOTEPAD_PAGES 16
+#define R503_DEFAULT_PASSWORD 0
+#define R503_MATCH_SCORE 87
+
+// command latencies of the sensor, from the end of the command packet until the acknowledge starts
+struct R503Timing {
+  uint32_t getImageMicros = 130000;       // finger on the sensor
+  uint32_t getImageNoFingerMicros = 60000;
+  uint32_t image2TzMicros = 160000;
+  uint32_t searchMicros = 25000;
+  uint32_t searchPerTemplateMicros = 350;
+  uint32_t createModelMicros = 60000;
+  uint32_t storeMicros = 40000;
+  uint32_t loadMicros = 12000;
+  uint32_t deleteMicros = 15000;
+  uint32_t emptyMicros = 80000;
+  uint32_t notepadMicros = 8000;
+  uint32_t commandMicros = 1500;          // everything else (LED, parameters, index table...)
+};
+
+enum class R503Image { good, messy, noFeatures, fail };
+
+// a finger on the sensor from fromMicros until toMicros (simulated time)
+struct R503Touch {
+  uint64_t fromMicros;
+  uint64_t toMicros;
+  int finger;
+  R503Image image;
+};
+
+struct R503Command {
+  uint8_t code;
+  uint64_t micros; // end of the command packet
+};
+
+struct R503Led {
+  uint8_t control;
+  uint8_t speed;
+  uint8_t color;
+  uint8_t count;
+  uint64_t micros;
+};
+
+/*
+  Scripted R503 on the other end of Serial2. Command packets are parsed byte by byte at the baud rate of the sensor,
+  acknowledges are sent back after the command latency (R503Timing), one command after the other. Bytes sent at another
+  baud rate are garbage to the sensor. The baud rate register survives powerCycle() like on the real sensor.
+
+  Fingers are numbers: a test places a finger on the sensor for a span of simulated time (placeFinger()), getImage
+  takes the finger present when the command is executed. A template is R503_TEMPLATE_SIZE bytes starting with the
+  finger number, so templates exported and imported again still match the same finger.
+*/
+class R503Simulator : public SerialDevice {
+  private:
+    struct CharBuffer {
+      int finger = -1;          // features or template of this finger, -1 = empty or a template of no finger
+      bool isTemplate = false;
+      std::vector<uint8_t> content; // template data
+    };
+
+    std::recursive_mutex mutex;
+    HardwareSerial *serial = nullptr;
+    R503Timing timing;
+
+    // registers and flash, kept over a power cycle
+    uint32_t baudRate = 57600;
+    uint32_t password = R503_DEFAULT_PASSWORD;
+    uint8_t packetSizeSetting = 2; // 0..3: 32, 64, 128, 256 bytes
+    uint8_t securityLevel = 3;
+    std::map<uint16_t, std::vector<uint8_t>> library;
+    char notepad[R503_NOTEPAD_PAGES][32] = {};
+
+    // volatile state
+    bool present = true;
+    uint64_t readyMicros = 0;  // the sensor ignores everything before it finished booting
+    uint64_t busyUntilMicros = 0;
+    std::vector<uint8_t> packet;
+    int imageFinger = -1;      // finger of the last image, -1 = no image
+    R503Image imageQuality = R503Image::good;
+    CharBuffer charBuffers[R503_CHAR_BUFFERS + 1];
+    bool downloading = false;
+    uint8_t downloadBuffer = 1;
+    std::vector<uint8_t> download;
+
+    std::vector<R503Touch> touches;
+    std::map<uint8_t, std::vector<uint8_t>> injectedCodes; // replies replacing the next commands with this code
+    std::map<uint8_t, int> silencedCommands;
+    std::vector<R503Command> commands;
+    std::vector<R503Led> leds;
+
+    uint32_t getCommandMicros(uint8_t code);
+    void handlePacket(uint64_t micros);
+    void handleCommand(const uint8_t *data, uint16_t length, uint64_t micros);
+    void handleData(const uint8_t *data, uint16_t length, bool last);
+    std::vector<uint8_t> execute(const uint8_t *data, uint16_t length, uint64_t micros, std::vector<uint8_t> &dataPackets);
+    void appendPacket(std::vector<uint8_t> &out, uint8_t type, const uint8_t *data, uint16_t length);
+    int getFingerAt(uint64_t micros, R503Image &image);
+
+  public:
+    void attach(HardwareSerial &newSerial);
+    void onReceive(HardwareSerial &line, uint8_t value, uint32_t lineBaudRate, uint64_t micros) override;
+
+    void setTiming(const R503Timing &newTiming);
+    void setPresent(bool isPresent);           // false: no sensor connected, nothing is answered
+    void powerCycle(uint64_t bootMicros = 0);  // loses the volatile state, answers again after bootMicros
+    void setBaudRate(uint32_t newBaudRate);    // as if it was set by a previous run
+    uint32_t getBaudRate();
+    void setPacketSizeSetting(uint8_t setting);
+
+    // fingers
+    void placeFinger(int finger, uint64_t fromMicros, uint64_t toMicros = UINT64_MAX, R503Image image = R503Image::good);
+    void placeFingerNow(int finger, uint32_t durationMillis, R503Image image = R503Image::good);
+    void removeFingers(); // from now on
+    void clearTouches();
+
+    // flash
+    static std::vector<uint8_t> makeTemplate(int finger);
+    static int getFinger(const std::vector<uint8_t> &content); // -1 if it is no intact template
+    void storeTemplate(uint16_t id, int finger);
+    bool hasTemplate(uint16_t id);
+    int getTemplateFinger(uint16_t id); // -1 for an empty slot
+    int getTemplateCount();
+    std::vector<uint8_t> getTemplate(uint16_t id);
+    void setNotepad(uint8_t page, const char *text);
+    String getNotepad(uint8_t page);
+
+    // error injection: the next count commands with this code are answered with the confirmation code / not at all
+    void injectReply(uint8_t code, uint8_t confirmationCode, int count = 1);
+    void silence(uint8_t code, int count = 1);
+
+    // what the sensor saw
+    std::vector<R503Command> getCommands();
+    int countCommands(uint8_t code);
+    void clearCommands();
+    std::vector<R503Led> getLeds();
+};
+
+#endif
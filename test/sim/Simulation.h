@@ -0,0 +1,20 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <Arduino.h>
+#include <vector>
+
+/*
+  Shared setup of the native tests: global.h (notifyClients(), copyLogMessages(), mountSpiffs()) is implemented in
+  global.cpp of this directory instead of main.cpp, the notifications are recorded for the tests.
+*/
+class Simulation {
+  public:
+    // back to a board fresh from the factory: time 0, erased NVS and SPIFFS, no WiFi, no timers, nothing on Serial2
+    static void reset();
+    static std::vector<String> getNotifications();
+    static bool wasNotified(const char *text); // a notification containing the text
+    static void clearNotifications();
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "global.h"
+#include "Simulation.h"
+#include <FS.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <PubSubClient.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <mutex>
+#include "EventLog.h"
+#include "EventStream.h"
+
+static std::recursive_mutex notificationsMutex;
+static std::vector<String> notifications;
+
+// main.cpp is not part of the native build, these are the test versions of its global functions
+
+void notifyClients(String message) {
+  {
+    std::lock_guard<std::recursive_mutex> lock(notificationsMutex);
+    notifications.push_back(message);
+  }
+  eventStream.publish(StreamEventType::log, 0, 0, message.c_str());
+}
+
+int copyLogMessages(String *messages, int maxCount) {
+  int count = 0;
+  uint32_t oldest = eventLog.getOldest();
+  LogRecord record;
+  char text[EVENT_LOG_TEXT_LENGTH];
+  for (uint32_t sequence=eventLog.getHead(); sequence>oldest && count<maxCount; sequence--) {
+    if (eventLog.read(sequence - 1, record) && EventLog::format(record, text, sizeof(text)) > 0)
+      messages[count++] = text;
+  }
+  return count;
+}
+
+// not cached like in main.cpp, a test may unmount SPIFFS
+bool mountSpiffs() {
+  return NativeFs::isMounted() || SPIFFS.begin(true);
+}
+
+void Simulation::reset() {
+  NativeClock::reset();
+  NativeTimers::setDispatchLatency(nullptr);
+  NativeGpio::reset();
+  NativeLedc::reset();
+  NativeSleep::reset();
+  NativeNvs::reset();
+  NativeFs::reset();
+  NativeWiFi::reset();
+  NativeHttp::reset();
+  NativeMqtt::reset();
+  Serial2.reset();
+  clearNotifications();
+}
+
+std::vector<String> Simulation::getNotifications() {
+  std::lock_guard<std::recursive_mutex> lock(notificationsMutex);
+  return notifications;
+}
+
+bool Simulation::wasNotified(const char *text) {
+  std::lock_guard<std::recursive_mutex> lock(notificationsMutex);
+  for (const String &notification : notifications)
+    if (notification.indexOf(text) >= 0)
+      return true;
+  return false;
+}
+
+void Simulation::clearNotifications() {
+  std::lock_guard<std::recursive_mutex> lock(notificationsMutex);
+  notifications.clear();
+}
@@ -0,0 +1,183 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "ApiClient.h"
+#include "Simulation.h"
+
+/*
+  The API worker runs in its own thread against a mock backend (NativeHttp). The test thread plays loop(): it submits
+  lookups and polls for the answers in real time, so the simulated time is advanced by the worker only and the latency
+  of a response is the time the worker needed for it.
+*/
+
+#define LATENCY_SAMPLES 200
+#define LATENCY_TOLERANCE_MS 5  // the response comes back through the queue, the ack polling of loop() is not included
+#define LOOKUP_MAX_REAL_MICROS 2000
+#define WAIT_REAL_MS 20000
+
+static ApiClient apiClient;
+static std::atomic<uint32_t> backendDelayMillis{40};
+static std::atomic<int> backendCode{200};
+static std::vector<ApiResponse> responses;
+
+void setUp() {
+  responses.clear();
+  backendDelayMillis = 40;
+  backendCode = 200;
+}
+
+void tearDown() {
+}
+
+static NativeHttpResponse backend(const NativeHttpRequest &request) {
+  NativeHttpResponse response;
+  response.code = backendCode;
+  response.latencyMillis = backendDelayMillis;
+  int id = request.url.substring(request.url.lastIndexOf('/') + 1).toInt();
+  response.body = String("{\"id\": ") + id + ", \"firstname\": \"A\", \"isAuthorized\": " + (id % 2 == 1 ? "true" : "false") + "}";
+  return response;
+}
+
+static void onResponse(const ApiResponse &response) {
+  responses.push_back(response);
+}
+
+// polls like loop() until count responses arrived
+static bool waitForResponses(size_t count) {
+  for (int i = 0; i < WAIT_REAL_MS * 10; i++) {
+    apiClient.poll();
+    if (responses.size() >= count)
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+static ApiResponse lookup(uint16_t fingerId, uint16_t timeoutMs = API_DEFAULT_TIMEOUT_MS) {
+  size_t count = responses.size();
+  TEST_ASSERT_TRUE(apiClient.lookupUser(fingerId, onResponse, timeoutMs));
+  TEST_ASSERT_TRUE(waitForResponses(count + 1));
+  return responses.back();
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, uint32_t permille) {
+  std::sort(values.begin(), values.end());
+  size_t rank = (values.size() * permille + 999) / 1000; // nearest rank
+  return values[max(rank, (size_t)1) - 1];
+}
+
+void test_lookup_returns_the_authorization() {
+  ApiResponse authorized = lookup(7);
+  ApiResponse denied = lookup(8);
+
+  TEST_ASSERT_EQUAL_UINT16(7, authorized.fingerId);
+  TEST_ASSERT_TRUE(authorized.result == UserLookupResult::authorized);
+  TEST_ASSERT_TRUE(denied.result == UserLookupResult::denied);
+  TEST_ASSERT_EQUAL_INT(200, denied.httpCode);
+}
+
+void test_connection_is_kept_alive() {
+  lookup(1);
+  uint32_t connects = NativeHttp::getConnectCount();
+
+  for (int i = 0; i < 20; i++)
+    lookup(1 + i);
+
+  TEST_ASSERT_EQUAL_UINT32(connects, NativeHttp::getConnectCount());
+}
+
+void test_match_to_decision_percentiles_with_backend_delay() {
+  lookup(1); // connected
+
+  // mostly fast answers, some slow ones and a few very slow ones
+  std::vector<uint32_t> injected, measured;
+  for (int i = 0; i < LATENCY_SAMPLES; i++) {
+    backendDelayMillis = (i % 100 == 99) ? 900 : (i % 10 == 9) ? 150 : 40;
+    injected.push_back(backendDelayMillis);
+    measured.push_back(lookup(1 + i % 200).latencyMillis);
+  }
+
+  uint32_t p50 = percentile(measured, 500), p99 = percentile(measured, 990);
+  char message[80];
+  snprintf(message, sizeof(message), "match to decision: p50 %u ms, p99 %u ms", p50, p99);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_UINT32_WITHIN(LATENCY_TOLERANCE_MS, percentile(injected, 500), p50);
+  TEST_ASSERT_UINT32_WITHIN(LATENCY_TOLERANCE_MS, percentile(injected, 990), p99);
+}
+
+void test_timeout_limits_the_decision() {
+  lookup(1);
+  uint32_t connects = NativeHttp::getConnectCount();
+
+  backendDelayMillis = 5000;
+  ApiResponse response = lookup(3, 500);
+
+  TEST_ASSERT_TRUE(response.result == UserLookupResult::failed);
+  TEST_ASSERT_EQUAL_INT(HTTPC_ERROR_READ_TIMEOUT, response.httpCode);
+  TEST_ASSERT_UINT32_WITHIN(LATENCY_TOLERANCE_MS, 500, response.latencyMillis);
+
+  // the timed out connection is not reused
+  backendDelayMillis = 40;
+  TEST_ASSERT_TRUE(lookup(3).result == UserLookupResult::authorized);
+  TEST_ASSERT_EQUAL_UINT32(connects + 1, NativeHttp::getConnectCount());
+}
+
+void test_lookup_never_blocks_the_caller() {
+  backendDelayMillis = 1000;
+  uint32_t maxMicros = 0;
+  int accepted = 0;
+
+  for (int i = 0; i < API_REQUEST_QUEUE_LENGTH * 2; i++) {
+    auto start = std::chrono::steady_clock::now();
+    if (apiClient.lookupUser(1 + i, onResponse))
+      accepted++;
+    maxMicros = max(maxMicros, (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  TEST_ASSERT_LESS_THAN_UINT32(LOOKUP_MAX_REAL_MICROS, maxMicros);
+  TEST_ASSERT_LESS_THAN_INT(API_REQUEST_QUEUE_LENGTH * 2, accepted); // the queue was full, not waited for
+  TEST_ASSERT_TRUE(waitForResponses(accepted));
+}
+
+void test_unknown_finger_and_server_error() {
+  backendCode = 404;
+  TEST_ASSERT_TRUE(lookup(5).result == UserLookupResult::unknown);
+  backendCode = 500;
+  TEST_ASSERT_TRUE(lookup(5).result == UserLookupResult::unknown);
+}
+
+void test_parse_user_lookup() {
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "{\"isAuthorized\": true}") == UserLookupResult::authorized);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "{\"isAuthorized\": false}") == UserLookupResult::denied);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "{\"isAuthorized\": \"yes\"}") == UserLookupResult::denied);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "{\"id\": 3}") == UserLookupResult::denied);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "[{\"id\": 3, \"isAuthorized\": true}]") == UserLookupResult::authorized);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "[]") == UserLookupResult::unknown);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(200, "not json") == UserLookupResult::failed);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(404, "") == UserLookupResult::unknown);
+  TEST_ASSERT_TRUE(ApiClient::parseUserLookup(HTTPC_ERROR_CONNECTION_REFUSED, "") == UserLookupResult::failed);
+}
+
+int main(int argc, char **argv) {
+  Simulation::reset();
+  WiFi.begin("door", "secret");
+  NativeClock::advanceMillis(5000);
+  NativeHttp::setBackend(backend);
+  apiClient.begin("http://backend:8000", nullptr);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_lookup_returns_the_authorization);
+  RUN_TEST(test_connection_is_kept_alive);
+  RUN_TEST(test_match_to_decision_percentiles_with_backend_delay);
+  RUN_TEST(test_timeout_limits_the_decision);
+  RUN_TEST(test_lookup_never_blocks_the_caller);
+  RUN_TEST(test_unknown_finger_and_server_error);
+  RUN_TEST(test_parse_user_lookup);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the API task never returns
+}
@@ -0,0 +1,239 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <thread>
+#include <Preferences.h>
+#include "ApiClient.h"
+#include "AuthCache.h"
+#include "Simulation.h"
+
+#define BENCHMARK_LOOKUPS 100
+#define BACKEND_DELAY_MS 120
+#define WAIT_REAL_MS 20000
+
+static AuthCache *authCache = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete authCache;
+  authCache = new AuthCache();
+}
+
+void tearDown() {
+}
+
+// power cycle: the time starts again at 0, NVS is kept
+static void reboot() {
+  delete authCache;
+  NativeClock::reset();
+  authCache = new AuthCache();
+}
+
+static AuthLookup lookup(uint16_t fingerId, AuthState &state) {
+  return authCache->lookup(fingerId, state);
+}
+
+void test_authorized_entry_is_fresh_then_stale_then_expired() {
+  AuthState state;
+  authCache->store(7, UserLookupResult::authorized);
+
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::fresh);
+  TEST_ASSERT_TRUE(state == AuthState::authorized);
+
+  NativeClock::advanceMillis(AUTH_CACHE_TTL_MS);
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::stale);
+  TEST_ASSERT_TRUE(state == AuthState::authorized);
+
+  NativeClock::advanceMillis(AUTH_CACHE_MAX_STALE_MS - AUTH_CACHE_TTL_MS);
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::miss);
+  TEST_ASSERT_TRUE(state == AuthState::none);
+}
+
+void test_negative_result_is_asked_again_after_a_minute() {
+  AuthState state;
+  authCache->store(8, UserLookupResult::unknown);
+
+  TEST_ASSERT_TRUE(lookup(8, state) == AuthLookup::fresh);
+  TEST_ASSERT_TRUE(state == AuthState::denied);
+  NativeClock::advanceMillis(AUTH_CACHE_NEGATIVE_TTL_MS);
+  TEST_ASSERT_TRUE(lookup(8, state) == AuthLookup::stale);
+  TEST_ASSERT_TRUE(state == AuthState::denied);
+}
+
+void test_failed_lookup_keeps_the_cached_state() {
+  AuthState state;
+  authCache->store(7, UserLookupResult::authorized);
+  NativeClock::advanceMillis(AUTH_CACHE_TTL_MS);
+
+  authCache->store(7, UserLookupResult::failed);
+
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::stale);
+  TEST_ASSERT_TRUE(state == AuthState::authorized);
+  authCache->store(9, UserLookupResult::failed);
+  TEST_ASSERT_TRUE(lookup(9, state) == AuthLookup::miss);
+}
+
+void test_background_refresh_is_started_once() {
+  authCache->store(7, UserLookupResult::authorized);
+
+  TEST_ASSERT_TRUE(authCache->beginRefresh(7));
+  TEST_ASSERT_FALSE(authCache->beginRefresh(7));
+  authCache->store(7, UserLookupResult::authorized); // refresh done
+  TEST_ASSERT_TRUE(authCache->beginRefresh(7));
+  TEST_ASSERT_EQUAL_UINT32(2, authCache->getStats().refreshes);
+}
+
+void test_counters() {
+  AuthState state;
+  authCache->store(7, UserLookupResult::authorized);
+
+  lookup(7, state);
+  lookup(7, state);
+  lookup(8, state);
+  lookup(0, state);
+  NativeClock::advanceMillis(AUTH_CACHE_TTL_MS);
+  lookup(7, state);
+
+  AuthCacheStats stats = authCache->getStats();
+  TEST_ASSERT_EQUAL_UINT32(2, stats.hits);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.staleHits);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.misses);
+}
+
+void test_changes_are_written_to_nvs_once_after_the_delay() {
+  for (int id = 1; id <= 50; id++) {
+    authCache->store(id, id % 2 ? UserLookupResult::authorized : UserLookupResult::denied);
+    NativeClock::advanceMillis(100);
+    authCache->process();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, NativeNvs::getWriteCount());
+
+  NativeClock::advanceMillis(AUTH_CACHE_SAVE_DELAY_MS);
+  authCache->process();
+  authCache->process();
+
+  TEST_ASSERT_EQUAL_UINT32(3, NativeNvs::getWriteCount()); // states, ages and fetch times
+}
+
+void test_entries_are_stale_after_a_reboot() {
+  AuthState state;
+  authCache->store(7, UserLookupResult::authorized);
+  authCache->store(8, UserLookupResult::denied);
+  NativeClock::advanceMillis(AUTH_CACHE_SAVE_DELAY_MS);
+  authCache->process();
+
+  reboot();
+  TEST_ASSERT_TRUE(authCache->loadFromPrefs());
+
+  // usable without network, but asked again in background
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::stale);
+  TEST_ASSERT_TRUE(state == AuthState::authorized);
+  TEST_ASSERT_TRUE(lookup(8, state) == AuthLookup::stale);
+  TEST_ASSERT_TRUE(state == AuthState::denied);
+  TEST_ASSERT_TRUE(lookup(9, state) == AuthLookup::miss);
+}
+
+void test_restored_entries_keep_aging() {
+  AuthState state;
+  authCache->store(7, UserLookupResult::authorized);
+  // the ages are saved hourly
+  for (int hour = 0; hour < 22; hour++) {
+    NativeClock::advanceMillis(AUTH_CACHE_AGE_SAVE_INTERVAL_MS);
+    authCache->process();
+  }
+
+  reboot();
+  TEST_ASSERT_TRUE(authCache->loadFromPrefs());
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::stale);
+
+  // 22 h saved plus one save interval of uncertainty: expired after less than an hour
+  NativeClock::advanceMillis(AUTH_CACHE_AGE_SAVE_INTERVAL_MS);
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::miss);
+}
+
+void test_cache_without_ages_is_dropped() {
+  uint8_t states[AUTH_CACHE_SIZE] = {};
+  states[7] = (uint8_t)AuthState::authorized;
+  Preferences preferences;
+  preferences.begin("authCache", false);
+  preferences.putBytes("states", states, sizeof(states));
+  preferences.end();
+
+  AuthState state;
+  TEST_ASSERT_FALSE(authCache->loadFromPrefs());
+  TEST_ASSERT_TRUE(lookup(7, state) == AuthLookup::miss);
+}
+
+// the worker thread can't be stopped, so this test runs last
+static ApiClient apiClient;
+static std::vector<ApiResponse> responses;
+
+static void onResponse(const ApiResponse &response) {
+  responses.push_back(response);
+}
+
+static NativeHttpResponse backend(const NativeHttpRequest &request) {
+  NativeHttpResponse response;
+  response.body = "{\"isAuthorized\": true}";
+  response.latencyMillis = BACKEND_DELAY_MS;
+  return response;
+}
+
+// the decision of lookupUser() in main.cpp: from the cache, or after the API answered
+static uint32_t decide(uint16_t fingerId) {
+  uint64_t start = NativeClock::getMicros();
+  AuthState state;
+  if (authCache->lookup(fingerId, state) == AuthLookup::fresh)
+    return NativeClock::getMicros() - start;
+
+  size_t count = responses.size();
+  TEST_ASSERT_TRUE(apiClient.lookupUser(fingerId, onResponse));
+  for (int i = 0; i < WAIT_REAL_MS * 10 && responses.size() == count; i++) {
+    apiClient.poll();
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  TEST_ASSERT_EQUAL_UINT32(count + 1, responses.size());
+  authCache->store(fingerId, responses.back().result);
+  return responses.back().latencyMillis * 1000ul;
+}
+
+void test_benchmark_decision_latency_warm_vs_cold() {
+  WiFi.begin("door", "secret");
+  NativeClock::advanceMillis(5000);
+  NativeHttp::setBackend(backend);
+  apiClient.begin("http://backend:8000", nullptr);
+
+  uint64_t coldMicros = 0, warmMicros = 0;
+  for (int id = 1; id <= BENCHMARK_LOOKUPS; id++)
+    coldMicros += decide(id);
+  auto start = std::chrono::steady_clock::now();
+  for (int id = 1; id <= BENCHMARK_LOOKUPS; id++)
+    warmMicros += decide(id);
+  uint64_t warmRealNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  char message[120];
+  snprintf(message, sizeof(message), "decision latency: cold %u us, warm %u us (%u ns host time per lookup)",
+           (uint32_t)(coldMicros / BENCHMARK_LOOKUPS), (uint32_t)(warmMicros / BENCHMARK_LOOKUPS), (uint32_t)(warmRealNanos / BENCHMARK_LOOKUPS));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(BACKEND_DELAY_MS * 1000ul, coldMicros / BENCHMARK_LOOKUPS);
+  TEST_ASSERT_EQUAL_UINT32(0, warmMicros);
+  TEST_ASSERT_EQUAL_UINT32(BENCHMARK_LOOKUPS, authCache->getStats().hits);
+  TEST_ASSERT_EQUAL_UINT32(BENCHMARK_LOOKUPS, NativeHttp::getRequestCount());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_authorized_entry_is_fresh_then_stale_then_expired);
+  RUN_TEST(test_negative_result_is_asked_again_after_a_minute);
+  RUN_TEST(test_failed_lookup_keeps_the_cached_state);
+  RUN_TEST(test_background_refresh_is_started_once);
+  RUN_TEST(test_counters);
+  RUN_TEST(test_changes_are_written_to_nvs_once_after_the_delay);
+  RUN_TEST(test_entries_are_stale_after_a_reboot);
+  RUN_TEST(test_restored_entries_keep_aging);
+  RUN_TEST(test_cache_without_ages_is_dropped);
+  RUN_TEST(test_benchmark_decision_latency_warm_vs_cold);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the API task never returns
+}
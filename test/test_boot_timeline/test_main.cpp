@@ -0,0 +1,172 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <WiFi.h>
+#include "BootTimeline.h"
+#include "EventJournal.h"
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "SensorTask.h"
+#include "SettingsManager.h"
+#include "WifiManager.h"
+#include "Simulation.h"
+
+/*
+  Boot sequence of setup() (without the network services) on simulated time: the sensor task does the handshake and
+  loads the finger list while the test thread, as the loop task, loads the settings, starts WiFi, mounts the journal and
+  then runs loop(). The sensor boots slower than the ESP32 like after an OTA update and keeps the baud rate of the run
+  before. The boot timeline is global and every stage is marked once, so there is a single boot per run, the failing
+  handshake before it marks nothing.
+*/
+
+#define SENSOR_BOOT_MS 600         // the sensor answers this long after reset
+#define FINGER 42
+#define FINGER_ID 7
+#define LOOP_SLEEP_REAL_MICROS 100 // the loop task yields to the sensor task
+#define OLD_HANDSHAKE_WAIT_MS 5000 // fixed wait before the second handshake of the serial boot
+#define WAIT_REAL_MS 30000
+
+static R503Simulator sensor;
+static FingerprintManager fingerManager;
+static SensorTask sensorTask;
+static SettingsManager settingsManager;
+static WifiManager wifiManager;
+static EventJournal eventJournal;
+static std::vector<SensorEvent> events;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+class TextOutput : public Print {
+  public:
+    std::string text;
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+};
+
+// one pass of loop(), the sensor task drives the simulated clock, a delay() here would advance it a second time
+static void loopOnce() {
+  SensorEvent event;
+  while (sensorTask.pollEvent(event))
+    events.push_back(event);
+  wifiManager.process();
+  std::this_thread::sleep_for(std::chrono::microseconds(LOOP_SLEEP_REAL_MICROS));
+}
+
+template<typename Condition>
+static bool loopUntil(Condition condition) {
+  auto start = std::chrono::steady_clock::now();
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(WAIT_REAL_MS))
+      return false;
+    loopOnce();
+  }
+  return true;
+}
+
+static bool hasEvent(SensorEventType type) {
+  return std::any_of(events.begin(), events.end(), [type](const SensorEvent &event) { return event.type == type; });
+}
+
+void test_missing_sensor_gives_up_after_short_backoffs() {
+  Simulation::reset();
+  R503Simulator missing;
+  missing.attach(Serial2);
+  missing.setPresent(false);
+  FingerprintManager manager;
+
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_FALSE(manager.connect());
+  uint32_t elapsedMs = (uint32_t)((NativeClock::getMicros() - start) / 1000);
+
+  uint32_t backoffMs = 0;
+  for (int attempt = 1; attempt < SENSOR_CONNECT_ATTEMPTS; attempt++)
+    backoffMs += SENSOR_CONNECT_BACKOFF_MS << (attempt - 1);
+  char message[80];
+  snprintf(message, sizeof(message), "no sensor: gave up after %d attempts in %u ms", SENSOR_CONNECT_ATTEMPTS, elapsedMs);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(backoffMs, elapsedMs);
+  TEST_ASSERT_EQUAL_UINT32(0, bootTimeline.get(BootStage::sensorFound));
+}
+
+void test_door_is_ready_before_wifi() {
+  Simulation::reset();
+  WifiSettings wifiSettings;
+  wifiSettings.ssid = "door";
+  wifiSettings.password = "secret";
+  settingsManager.saveWifiSettings(wifiSettings);
+  sensor.attach(Serial2);
+  sensor.storeTemplate(FINGER_ID, FINGER);
+  sensor.setBaudRate(SENSOR_BAUD_RATE); // switched by the run before the update
+  sensor.powerCycle(SENSOR_BOOT_MS * 1000ull);
+
+  // setup()
+  TEST_ASSERT_TRUE(sensorTask.begin(&fingerManager));
+  settingsManager.loadWifiSettings();
+  settingsManager.loadAppSettings();
+  bootTimeline.mark(BootStage::settingsLoaded);
+  wifiManager.begin(&settingsManager);
+  bootTimeline.mark(BootStage::wifiStarted);
+  eventJournal.begin();
+  bootTimeline.mark(BootStage::journalReady);
+
+  // loop(), a user is at the door as soon as the sensor is ready
+  TEST_ASSERT_TRUE(loopUntil([]() { return hasEvent(SensorEventType::ready); }));
+  TEST_ASSERT_TRUE(events.front().ok);
+  TEST_ASSERT_FALSE(wifiManager.isConnected());
+  sensor.placeFingerNow(FINGER, 1000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  TEST_ASSERT_TRUE(loopUntil([]() { return hasEvent(SensorEventType::scan); }));
+  uint32_t matchMs = millis();
+  NativeGpio::setLevel(touchRingPin, HIGH);
+  const SensorEvent &scan = *std::find_if(events.begin(), events.end(), [](const SensorEvent &event) { return event.type == SensorEventType::scan; });
+  TEST_ASSERT_TRUE(scan.match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(FINGER_ID, scan.match.matchId);
+  TEST_ASSERT_TRUE(loopUntil([]() { return bootTimeline.isComplete(); }));
+
+  uint32_t settingsLoaded = bootTimeline.get(BootStage::settingsLoaded);
+  uint32_t journalReady = bootTimeline.get(BootStage::journalReady);
+  uint32_t sensorFound = bootTimeline.get(BootStage::sensorFound);
+  uint32_t fingerListLoaded = bootTimeline.get(BootStage::fingerListLoaded);
+  uint32_t doorReady = bootTimeline.get(BootStage::doorReady);
+  uint32_t wifiConnected = bootTimeline.get(BootStage::wifiConnected);
+
+  // the loop task did not wait for the handshake, the sensor task not for WiFi
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(bootTimeline.get(BootStage::wifiStarted), settingsLoaded);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(journalReady, bootTimeline.get(BootStage::wifiStarted));
+  TEST_ASSERT_LESS_THAN_UINT32(sensorFound, journalReady);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(SENSOR_BOOT_MS, sensorFound);
+  TEST_ASSERT_LESS_THAN_UINT32(OLD_HANDSHAKE_WAIT_MS, sensorFound);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(fingerListLoaded, sensorFound);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(doorReady, fingerListLoaded);
+  TEST_ASSERT_LESS_THAN_UINT32(wifiConnected, matchMs); // matched offline
+  TEST_ASSERT_LESS_THAN_UINT32(wifiConnected / 2, doorReady);
+
+  TextOutput out;
+  bootTimeline.printTo(out);
+  TEST_ASSERT_TRUE(out.text.find("doorReady: " + std::to_string(doorReady) + "\r\n") != std::string::npos);
+  TEST_ASSERT_TRUE(out.text.find("servicesStarted: -\r\n") != std::string::npos);
+
+  // one stage after the other: the handshake, then WiFi
+  uint32_t serialMs = sensorFound + wifiManager.getStats().lastConnectMs;
+  char message[120];
+  snprintf(message, sizeof(message), "door ready after %u ms, first match at %u ms, WiFi after %u ms, one after the other %u ms",
+           doorReady, matchMs, wifiConnected, serialMs);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_missing_sensor_gives_up_after_short_backoffs);
+  RUN_TEST(test_door_is_ready_before_wifi);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the sensor task never returns
+}
@@ -0,0 +1,276 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <esp_timer.h>
+#include "Buzzer.h"
+#include "FingerprintManager.h"
+#include "LatencyMetrics.h"
+#include "R503Simulator.h"
+#include "player.h"
+#include "Simulation.h"
+
+/*
+  Tone timeline of the buzzer engine on the simulated clock. The esp_timer callbacks run while the clock is advanced,
+  by the test or by a blocking call like the UART traffic of a scan. A dispatch latency stands in for the timer task
+  waiting behind higher priority tasks.
+*/
+
+#define BUZZER_PIN 2
+#define MAX_DISPATCH_LATENCY_US 2000
+#define ADVANCE_STEP_MS 10
+
+static Buzzer *buzzer = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  latencyMetrics.reset();
+  delete buzzer;
+  buzzer = new Buzzer(BUZZER_PIN);
+  TEST_ASSERT_TRUE(buzzer->begin());
+}
+
+void tearDown() {
+  NativeTimers::setDispatchLatency(nullptr);
+}
+
+static const RtttlMelody& melody(const char *name) {
+  const RtttlMelody *embedded = MelodyCache::findEmbedded(name);
+  TEST_ASSERT_NOT_NULL(embedded);
+  return *embedded;
+}
+
+static size_t toneCount() {
+  return NativeLedc::getTones(BUZZER_LEDC_CHANNEL).size();
+}
+
+// the tone changes since index first, relative to start
+static std::vector<NativeTone> tonesSince(size_t first, uint64_t start) {
+  const std::vector<NativeTone> &tones = NativeLedc::getTones(BUZZER_LEDC_CHANNEL);
+  std::vector<NativeTone> result(tones.begin() + first, tones.end());
+  for (NativeTone &tone : result)
+    tone.micros -= start;
+  return result;
+}
+
+// the exact schedule: every note starts when the one before ended, a tone goes silent for the last 10 % of its note
+static std::vector<NativeTone> schedule(const RtttlMelody &melody, uint16_t count) {
+  std::vector<NativeTone> tones;
+  uint32_t wholeNoteMicros = 240000000ul / melody.bpm;
+  uint64_t micros = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t length = melody.notes[i].durationMicros(wholeNoteMicros);
+    tones.push_back({ micros, melody.notes[i].frequency() });
+    if (!melody.notes[i].isPause())
+      tones.push_back({ micros + length - length * BUZZER_NOTE_GAP_PERCENT / 100, 0 });
+    micros += length;
+  }
+  tones.push_back({ micros, 0 });
+  return tones;
+}
+
+static void playToEnd() {
+  while (buzzer->isPlaying())
+    NativeClock::advanceMillis(ADVANCE_STEP_MS);
+}
+
+// largest difference of the tone changes to the schedule, the frequencies must be the same
+static uint32_t maxDeviation(const std::vector<NativeTone> &expected, const std::vector<NativeTone> &actual) {
+  TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+  uint32_t deviation = 0;
+  for (size_t i = 0; i < expected.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(expected[i].frequency, actual[i].frequency);
+    uint64_t difference = actual[i].micros > expected[i].micros ? actual[i].micros - expected[i].micros : expected[i].micros - actual[i].micros;
+    deviation = max(deviation, (uint32_t)difference);
+  }
+  return deviation;
+}
+
+void test_tones_follow_the_schedule() {
+  const RtttlMelody &simpsons = melody("simpsons");
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_TRUE(buzzer->play(simpsons, BuzzerPriority::access));
+  TEST_ASSERT_TRUE(buzzer->isPlaying());
+  playToEnd();
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, maxDeviation(schedule(simpsons, simpsons.count), tonesSince(first, start)));
+}
+
+void test_late_dispatches_do_not_add_up() {
+  srand(16);
+  NativeTimers::setDispatchLatency([]() { return (uint32_t)(rand() % MAX_DISPATCH_LATENCY_US); });
+  const RtttlMelody &furelise = melody("furelise");
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_TRUE(buzzer->play(furelise, BuzzerPriority::access));
+  playToEnd();
+
+  std::vector<NativeTone> tones = tonesSince(first, start);
+  std::vector<NativeTone> expected = schedule(furelise, furelise.count);
+  uint32_t deviation = maxDeviation(expected, tones);
+  LatencySummary late = latencyMetrics.getSummary(LatencyStage::buzzerLate);
+  char message[120];
+  snprintf(message, sizeof(message), "%u tone changes, max %u us off the schedule, buzzerLate p50 %u us p99 %u us",
+           (uint32_t)tones.size(), deviation, late.p50, late.p99);
+  TEST_MESSAGE(message);
+  // each change is late by its own dispatch only, the end of a 7 s melody included
+  TEST_ASSERT_LESS_THAN_UINT32(MAX_DISPATCH_LATENCY_US + BUZZER_EARLY_TOLERANCE_US, deviation);
+  TEST_ASSERT_LESS_THAN_UINT64(MAX_DISPATCH_LATENCY_US + BUZZER_EARLY_TOLERANCE_US, tones.back().micros - expected.back().micros);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(tones.size() - 1, late.count);
+  TEST_ASSERT_LESS_THAN_UINT32(MAX_DISPATCH_LATENCY_US + BUZZER_EARLY_TOLERANCE_US, late.max);
+}
+
+// playback like the Melody Player library: the loop writes a tone and delay()s for its length, so every late wakeup
+// shifts the rest of the melody
+static void playBlocking(const RtttlMelody &melody) {
+  uint32_t wholeNoteMicros = 240000000ul / melody.bpm;
+  for (uint16_t i = 0; i < melody.count; i++) {
+    uint32_t length = melody.notes[i].durationMicros(wholeNoteMicros);
+    uint32_t gap = melody.notes[i].isPause() ? 0 : length * BUZZER_NOTE_GAP_PERCENT / 100;
+    ledcWriteTone(BUZZER_LEDC_CHANNEL, melody.notes[i].frequency());
+    delayMicroseconds(length - gap);
+    NativeClock::advanceMicros(rand() % MAX_DISPATCH_LATENCY_US); // the task runs again late
+    if (gap > 0) {
+      ledcWriteTone(BUZZER_LEDC_CHANNEL, 0);
+      delayMicroseconds(gap);
+      NativeClock::advanceMicros(rand() % MAX_DISPATCH_LATENCY_US);
+    }
+  }
+  ledcWriteTone(BUZZER_LEDC_CHANNEL, 0);
+}
+
+void test_benchmark_jitter_against_blocking_playback() {
+  const RtttlMelody &furelise = melody("furelise");
+  std::vector<NativeTone> expected = schedule(furelise, furelise.count);
+
+  srand(16);
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+  playBlocking(furelise);
+  uint32_t blocking = maxDeviation(expected, tonesSince(first, start));
+
+  srand(16);
+  NativeTimers::setDispatchLatency([]() { return (uint32_t)(rand() % MAX_DISPATCH_LATENCY_US); });
+  first = toneCount();
+  start = NativeClock::getMicros();
+  buzzer->play(furelise, BuzzerPriority::access);
+  playToEnd();
+  uint32_t engine = maxDeviation(expected, tonesSince(first, start));
+
+  char message[100];
+  snprintf(message, sizeof(message), "max deviation from the schedule: %u us blocking, %u us timer engine", blocking, engine);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT32(blocking / 10, engine);
+}
+
+void test_melody_plays_on_while_a_scan_runs() {
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.storeTemplate(7, 42);
+  const RtttlMelody &simpsons = melody("simpsons");
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_TRUE(buzzer->play(simpsons, BuzzerPriority::access));
+  // the scan loop only does its UART traffic, the notes are stepped while it blocks
+  int scans = 0;
+  while (buzzer->isPlaying()) {
+    sensor.placeFingerNow(42, 500);
+    NativeGpio::setLevel(touchRingPin, LOW);
+    NativeGpio::raiseInterrupt(touchRingPin);
+    Match match;
+    for (int i = 0; i < 100 && (match = fingerManager.scanFingerprint()).scanResult == ScanResult::scanning; i++);
+    NativeGpio::setLevel(touchRingPin, HIGH);
+    if (match.scanResult == ScanResult::matchFound)
+      scans++;
+    NativeClock::advanceMillis(ADVANCE_STEP_MS);
+  }
+
+  TEST_ASSERT_GREATER_THAN_INT(3, scans);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, maxDeviation(schedule(simpsons, simpsons.count), tonesSince(first, start)));
+}
+
+void test_alarm_cuts_off_a_lower_priority_melody() {
+  TEST_ASSERT_TRUE(buzzer->play(melody("simpsons"), BuzzerPriority::access));
+  NativeClock::advanceMillis(1000);
+
+  TEST_ASSERT_FALSE(buzzer->play(melody("goodbad"), BuzzerPriority::feedback));
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_TRUE(buzzer->play(melody("alarm"), BuzzerPriority::alarm));
+  playToEnd();
+
+  // the alarm starts right away and plays to its end, nothing of the other melody is heard after it
+  const RtttlMelody &alarm = melody("alarm");
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, maxDeviation(schedule(alarm, alarm.count), tonesSince(first, start)));
+}
+
+void test_same_priority_restarts_and_lower_plays_after_the_end() {
+  TEST_ASSERT_TRUE(buzzer->play(melody("simpsons"), BuzzerPriority::access));
+  NativeClock::advanceMillis(500);
+  TEST_ASSERT_TRUE(buzzer->play(melody("reussi"), BuzzerPriority::access));
+  playToEnd();
+
+  TEST_ASSERT_TRUE(buzzer->play(melody("goodbad"), BuzzerPriority::feedback));
+  TEST_ASSERT_TRUE(buzzer->isPlaying());
+}
+
+void test_stop_silences_right_away() {
+  TEST_ASSERT_TRUE(buzzer->play(melody("starwars"), BuzzerPriority::alarm));
+  NativeClock::advanceMillis(300);
+
+  buzzer->stop();
+  size_t stopped = toneCount();
+  NativeClock::advanceMillis(10000);
+
+  TEST_ASSERT_FALSE(buzzer->isPlaying());
+  TEST_ASSERT_EQUAL_UINT32(0, NativeLedc::getTones(BUZZER_LEDC_CHANNEL).back().frequency);
+  TEST_ASSERT_EQUAL_UINT32(stopped, toneCount());
+  TEST_ASSERT_TRUE(buzzer->play(melody("goodbad"), BuzzerPriority::feedback)); // a stopped alarm doesn't block
+}
+
+void test_notes_are_copied_and_long_melodies_cut() {
+  std::vector<RtttlNote> notes;
+  for (int i = 0; i < BUZZER_QUEUE_SIZE + 50; i++)
+    notes.push_back(RtttlNote::make(40 + i % 20, 16, false));
+  std::vector<RtttlNote> original = notes;
+  RtttlMelody tooLong = { "long", notes.data(), (uint16_t)notes.size(), 200 };
+  RtttlMelody expected = { "long", original.data(), (uint16_t)original.size(), 200 };
+  size_t first = toneCount();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_TRUE(buzzer->play(tooLong, BuzzerPriority::access));
+  std::fill(notes.begin(), notes.end(), RtttlNote::make(0, 1, false)); // the caller's buffer is reused
+  playToEnd();
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, maxDeviation(schedule(expected, BUZZER_QUEUE_SIZE), tonesSince(first, start)));
+}
+
+void test_empty_melody_is_not_played() {
+  RtttlMelody empty = { "empty", nullptr, 0, 120 };
+  Buzzer notStarted(BUZZER_PIN);
+
+  TEST_ASSERT_FALSE(buzzer->play(empty, BuzzerPriority::alarm));
+  TEST_ASSERT_FALSE(buzzer->isPlaying());
+  TEST_ASSERT_FALSE(notStarted.play(melody("reussi"), BuzzerPriority::alarm));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_tones_follow_the_schedule);
+  RUN_TEST(test_late_dispatches_do_not_add_up);
+  RUN_TEST(test_benchmark_jitter_against_blocking_playback);
+  RUN_TEST(test_melody_plays_on_while_a_scan_runs);
+  RUN_TEST(test_alarm_cuts_off_a_lower_priority_melody);
+  RUN_TEST(test_same_priority_restarts_and_lower_plays_after_the_end);
+  RUN_TEST(test_stop_silences_right_away);
+  RUN_TEST(test_notes_are_copied_and_long_melodies_cut);
+  RUN_TEST(test_empty_melody_is_not_played);
+  return UNITY_END();
+}
@@ -0,0 +1,189 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <FS.h>
+#include "Buzzer.h"
+#include "embedded_melodies.h"
+#include "pitches.h"
+#include "player.h"
+#include "Simulation.h"
+
+/*
+  The melodies built into the firmware from the .rtttl files in data/. The expected notes are worked out by hand from the
+  RTTTL text of the files (pitch from pitches.h, length in ms at the tempo of the tune), they don't come from a parser.
+*/
+
+#define BUZZER_PIN 2
+#define TONE_TOLERANCE_US 2 // the first step runs 1 us after play()
+
+struct ExpectedNote {
+  uint16_t frequency;
+  uint32_t ms;
+};
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+}
+
+// the tests run in the project directory, the path of this file is the fallback
+static std::vector<std::string> listDataFiles(std::string &directory) {
+  std::string file = __FILE__;
+  std::string directories[] = { "data", file.substr(0, file.rfind("test/")) + "data" };
+  std::vector<std::string> names;
+  for (const std::string &candidate : directories) {
+    DIR *dir = opendir(candidate.c_str());
+    if (dir == nullptr)
+      continue;
+    while (dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 6 && name.compare(name.size() - 6, 6, ".rtttl") == 0)
+        names.push_back(name.substr(0, name.size() - 6));
+    }
+    closedir(dir);
+    directory = candidate;
+    break;
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(0, names.size());
+  return names;
+}
+
+static void assertMelody(const char *name, uint16_t bpm, const ExpectedNote *expected, size_t count) {
+  const RtttlMelody *melody = MelodyCache::findEmbedded(name);
+  TEST_ASSERT_NOT_NULL_MESSAGE(melody, name);
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(bpm, melody->bpm, name);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(count, melody->count, name);
+  for (size_t i = 0; i < count; i++) {
+    char message[40];
+    snprintf(message, sizeof(message), "%s note %u", name, (uint32_t)i + 1);
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected[i].frequency, melody->notes[i].frequency(), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected[i].ms, melody->notes[i].durationMs(melody->bpm), message);
+  }
+}
+
+void test_every_data_file_is_built_in() {
+  std::string directory;
+  std::vector<std::string> names = listDataFiles(directory);
+
+  TEST_ASSERT_EQUAL_UINT32(names.size(), EMBEDDED_MELODY_COUNT);
+  for (const std::string &name : names) {
+    const RtttlMelody *melody = MelodyCache::findEmbedded(name.c_str());
+    TEST_ASSERT_NOT_NULL_MESSAGE(melody, name.c_str());
+    // one note per comma separated field after the second colon
+    std::ifstream stream(directory + "/" + name + ".rtttl");
+    std::stringstream text;
+    text << stream.rdbuf();
+    std::string notes = text.str().substr(text.str().rfind(':') + 1);
+    size_t fields = 1;
+    for (char c : notes)
+      fields += c == ',' ? 1 : 0;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(fields, melody->count, name.c_str());
+  }
+  TEST_ASSERT_NULL(MelodyCache::findEmbedded("unknown"));
+}
+
+void test_alarm_notes() {
+  // alarm:d=8,o=6,b=200 - a whole note is 1200 ms, eighths of 150 ms
+  ExpectedNote expected[12];
+  for (int i = 0; i < 12; i++)
+    expected[i] = { (uint16_t)(i % 2 == 0 ? NOTE_A6 : NOTE_E6), 150 };
+
+  assertMelody("alarm", 200, expected, 12);
+}
+
+void test_reussi_notes() {
+  // reussi:d=4,o=5,b=250 - a whole note is 960 ms, 3c6 is a third of it
+  const ExpectedNote expected[] = {
+    { NOTE_E5, 240 }, { NOTE_SILENT, 120 }, { NOTE_F5, 120 }, { NOTE_G5, 120 }, { NOTE_SILENT, 120 }, { NOTE_C6, 320 },
+  };
+
+  assertMelody("reussi", 250, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_simpsons_notes() {
+  // The Simpsons:d=4,o=5,b=160 - a quarter is 375 ms, dotted 562 ms, an eighth 187 ms, a half 750 ms
+  const ExpectedNote expected[] = {
+    { NOTE_C6, 562 }, { NOTE_E6, 375 }, { NOTE_FS6, 375 }, { NOTE_A6, 187 }, { NOTE_G6, 562 }, { NOTE_E6, 375 },
+    { NOTE_C6, 375 }, { NOTE_A5, 187 }, { NOTE_FS5, 187 }, { NOTE_FS5, 187 }, { NOTE_FS5, 187 }, { NOTE_G5, 750 },
+    { NOTE_SILENT, 187 }, { NOTE_SILENT, 187 }, { NOTE_FS5, 187 }, { NOTE_FS5, 187 }, { NOTE_FS5, 187 }, { NOTE_G5, 187 },
+    { NOTE_AS5, 562 }, { NOTE_C6, 187 }, { NOTE_C6, 187 }, { NOTE_C6, 187 }, { NOTE_C6, 375 },
+  };
+
+  assertMelody("simpsons", 160, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_goodbad_notes() {
+  // GoodBad:d=4,o=5,b=56 - a whole note is 4285.7 ms: 32nd 133 ms, dotted 32nd 200 ms, dotted 16th 401 ms,
+  // dotted eighth 803 ms, quarter 1071 ms
+  const ExpectedNote expected[] = {
+    { NOTE_SILENT, 133 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 }, { NOTE_AS5, 803 },
+    { NOTE_FS5, 401 }, { NOTE_GS5, 401 }, { NOTE_DS5, 1071 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 }, { NOTE_AS5, 133 },
+    { NOTE_DS6, 133 }, { NOTE_AS5, 803 }, { NOTE_FS5, 401 }, { NOTE_GS5, 401 }, { NOTE_CS6, 1071 }, { NOTE_AS5, 133 },
+    { NOTE_DS6, 133 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 }, { NOTE_AS5, 803 }, { NOTE_FS5, 401 }, { NOTE_F5, 200 },
+    { NOTE_DS5, 200 }, { NOTE_CS5, 1071 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 }, { NOTE_AS5, 133 }, { NOTE_DS6, 133 },
+    { NOTE_AS5, 803 }, { NOTE_GS5, 401 }, { NOTE_DS5, 1071 },
+  };
+
+  assertMelody("goodbad", 56, expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_furelise_opening() {
+  // Beethoven:d=4,o=6,b=70 - 16th 214 ms, dotted eighth 642 ms; "d_" is D#
+  const ExpectedNote expected[] = {
+    { NOTE_E6, 214 }, { NOTE_DS6, 214 }, { NOTE_E6, 214 }, { NOTE_DS6, 214 }, { NOTE_E6, 214 }, { NOTE_B5, 214 },
+    { NOTE_D6, 214 }, { NOTE_C6, 214 }, { NOTE_A5, 642 }, { NOTE_C5, 214 }, { NOTE_E5, 214 }, { NOTE_A5, 214 },
+  };
+  const size_t count = sizeof(expected) / sizeof(expected[0]);
+  const RtttlMelody *melody = MelodyCache::findEmbedded("furelise");
+  TEST_ASSERT_NOT_NULL(melody);
+  TEST_ASSERT_GREATER_THAN_UINT32(count, melody->count);
+
+  TEST_ASSERT_EQUAL_UINT16(70, melody->bpm);
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_UINT16(expected[i].frequency, melody->notes[i].frequency());
+    TEST_ASSERT_EQUAL_UINT32(expected[i].ms, melody->notes[i].durationMs(melody->bpm));
+  }
+}
+
+void test_reussi_plays_without_spiffs() {
+  Buzzer buzzer(BUZZER_PIN);
+  TEST_ASSERT_TRUE(buzzer.begin());
+  MelodyCache melodies;
+  size_t first = NativeLedc::getTones(BUZZER_LEDC_CHANNEL).size();
+
+  TEST_ASSERT_TRUE(buzzer.play(melodies.get("reussi"), BuzzerPriority::access));
+  while (buzzer.isPlaying())
+    NativeClock::advanceMillis(10);
+
+  // each tone ends with 10 % of silence, a pause has none: E5 0-216, 240 pause, F5 360-468, G5 480-588, 600 pause,
+  // C6 720-1008, end at 1040 ms
+  const NativeTone expected[] = {
+    { 0, NOTE_E5 }, { 216000, 0 }, { 240000, 0 }, { 360000, NOTE_F5 }, { 468000, 0 }, { 480000, NOTE_G5 }, { 588000, 0 },
+    { 600000, 0 }, { 720000, NOTE_C6 }, { 1008000, 0 }, { 1040000, 0 },
+  };
+  const std::vector<NativeTone> &tones = NativeLedc::getTones(BUZZER_LEDC_CHANNEL);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(expected) / sizeof(expected[0]), tones.size() - first);
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    TEST_ASSERT_EQUAL_UINT32(expected[i].frequency, tones[first + i].frequency);
+    TEST_ASSERT_UINT64_WITHIN(TONE_TOLERANCE_US, expected[i].micros, tones[first + i].micros);
+  }
+  TEST_ASSERT_FALSE(NativeFs::isMounted());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_data_file_is_built_in);
+  RUN_TEST(test_alarm_notes);
+  RUN_TEST(test_reussi_notes);
+  RUN_TEST(test_simpsons_notes);
+  RUN_TEST(test_goodbad_notes);
+  RUN_TEST(test_furelise_opening);
+  RUN_TEST(test_reussi_plays_without_spiffs);
+  return UNITY_END();
+}
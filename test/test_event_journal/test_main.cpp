@@ -0,0 +1,315 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <SPIFFS.h>
+#include "ApiClient.h"
+#include "EventJournal.h"
+#include "Simulation.h"
+
+/*
+  The journal is kept on the simulated SPIFFS across simulated reboots (a new EventJournal on the same files). The last
+  test replays everything that was logged offline through the ApiClient worker against a mock backend.
+*/
+
+#define WAIT_REAL_MS 30000
+
+static EventJournal *journal = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete journal;
+  journal = new EventJournal();
+  TEST_ASSERT_TRUE(journal->begin());
+}
+
+void tearDown() {
+}
+
+// power cycle: RAM state is lost, the files are kept
+static void reboot() {
+  delete journal;
+  NativeClock::reset();
+  journal = new EventJournal();
+  TEST_ASSERT_TRUE(journal->begin());
+}
+
+static std::vector<JournalRecord> readAllPending(EventJournal &eventJournal) {
+  std::vector<JournalRecord> records(eventJournal.pendingCount() + 1);
+  records.resize(eventJournal.readPending(records.data(), records.size()));
+  return records;
+}
+
+void test_records_are_read_back_in_order() {
+  for (int i = 1; i <= 10; i++) {
+    NativeClock::advanceMillis(100);
+    TEST_ASSERT_TRUE(journal->logAccess(i, i % 2 == 1, AccessSource::offline));
+  }
+  TEST_ASSERT_TRUE(journal->logCreateUser(11));
+
+  std::vector<JournalRecord> records = readAllPending(*journal);
+  TEST_ASSERT_EQUAL_UINT32(11, records.size());
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL_UINT32(i + 1, records[i].sequence);
+    TEST_ASSERT_EQUAL_UINT16(i + 1, records[i].fingerId);
+    TEST_ASSERT_EQUAL_UINT8(i % 2 == 0, records[i].granted);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)AccessSource::offline, records[i].source);
+    TEST_ASSERT_EQUAL_UINT32((i + 1) * 100, records[i].uptimeMillis);
+  }
+  TEST_ASSERT_EQUAL_UINT8((uint8_t)JournalRecordType::createUser, records[10].type);
+}
+
+void test_records_survive_reboots() {
+  for (int boot = 0; boot < 3; boot++) {
+    for (int i = 0; i < 5; i++)
+      TEST_ASSERT_TRUE(journal->logAccess(boot * 5 + i + 1, true, AccessSource::cache));
+    reboot();
+  }
+
+  std::vector<JournalRecord> records = readAllPending(*journal);
+  TEST_ASSERT_EQUAL_UINT32(15, records.size());
+  for (int i = 0; i < 15; i++) {
+    TEST_ASSERT_EQUAL_UINT32(i + 1, records[i].sequence);
+    TEST_ASSERT_EQUAL_UINT16(i + 1, records[i].fingerId);
+  }
+}
+
+void test_uploaded_records_are_not_sent_again_after_a_reboot() {
+  for (int i = 1; i <= 8; i++)
+    journal->logAccess(i, true, AccessSource::api);
+  JournalRecord records[3];
+  TEST_ASSERT_EQUAL_UINT32(3, journal->readPending(records, 3));
+  journal->commit(3);
+
+  reboot();
+
+  TEST_ASSERT_EQUAL_UINT32(5, journal->pendingCount());
+  TEST_ASSERT_EQUAL_UINT32(1, journal->readPending(records, 1));
+  TEST_ASSERT_EQUAL_UINT32(4, records[0].sequence);
+}
+
+void test_sequence_continues_after_the_journal_was_emptied() {
+  for (int i = 1; i <= 4; i++)
+    journal->logAccess(i, true, AccessSource::api);
+  journal->commit(4);
+  TEST_ASSERT_FALSE(SPIFFS.exists(JOURNAL_FILE));
+
+  reboot();
+  journal->logAccess(5, true, AccessSource::api);
+
+  JournalRecord record;
+  TEST_ASSERT_EQUAL_UINT32(1, journal->readPending(&record, 1));
+  TEST_ASSERT_EQUAL_UINT32(5, record.sequence);
+}
+
+void test_torn_record_is_dropped_on_next_boot() {
+  for (int i = 1; i <= 3; i++)
+    journal->logAccess(i, true, AccessSource::offline);
+
+  // reset while the fourth record is written
+  NativeFs::failWritesAfter(sizeof(JournalRecord) / 2);
+  TEST_ASSERT_FALSE(journal->logAccess(4, true, AccessSource::offline));
+  NativeFs::failWritesAfter(-1);
+  reboot();
+
+  TEST_ASSERT_EQUAL_UINT32(3, journal->pendingCount());
+  TEST_ASSERT_EQUAL_UINT32(3 * sizeof(JournalRecord), NativeFs::readFile(JOURNAL_FILE).size());
+  TEST_ASSERT_TRUE(journal->logAccess(5, false, AccessSource::offline));
+  std::vector<JournalRecord> records = readAllPending(*journal);
+  TEST_ASSERT_EQUAL_UINT32(4, records.size());
+  TEST_ASSERT_EQUAL_UINT16(5, records[3].fingerId);
+  TEST_ASSERT_EQUAL_UINT32(4, records[3].sequence);
+}
+
+void test_corrupted_record_is_dropped() {
+  for (int i = 1; i <= 3; i++)
+    journal->logAccess(i, true, AccessSource::offline);
+  std::string content = NativeFs::readFile(JOURNAL_FILE);
+  content[sizeof(JournalRecord) + offsetof(JournalRecord, fingerId)] ^= 0x01;
+  NativeFs::writeFile(JOURNAL_FILE, content);
+
+  reboot();
+
+  std::vector<JournalRecord> records = readAllPending(*journal);
+  TEST_ASSERT_EQUAL_UINT32(2, records.size());
+  TEST_ASSERT_EQUAL_UINT32(1, records[0].sequence);
+  TEST_ASSERT_EQUAL_UINT32(3, records[1].sequence);
+}
+
+void test_full_journal_refuses_records() {
+  for (int i = 0; i < JOURNAL_MAX_RECORDS; i++)
+    TEST_ASSERT_TRUE(journal->logAccess(1 + i % 200, true, AccessSource::offline));
+
+  TEST_ASSERT_FALSE(journal->logAccess(1, true, AccessSource::offline));
+  TEST_ASSERT_EQUAL_UINT32(JOURNAL_MAX_RECORDS, journal->pendingCount());
+}
+
+// the mock backend records every sequence number it accepted, the API worker runs until the end of the program
+static ApiClient apiClient;
+static EventJournal uploadJournal;
+static std::mutex backendMutex;
+static std::vector<NativeHttpRequest> accepted;
+static std::atomic<int> failuresLeft{0};
+static std::atomic<int> batchCode{200}; // answer of /events/batch
+
+static NativeHttpResponse backend(const NativeHttpRequest &request) {
+  NativeHttpResponse response;
+  if (failuresLeft > 0) {
+    failuresLeft--;
+    response.code = 503;
+    return response;
+  }
+  if (request.url.endsWith("/events/batch") && batchCode != 200) {
+    response.code = batchCode;
+    return response;
+  }
+  std::lock_guard<std::mutex> lock(backendMutex);
+  accepted.push_back(request);
+  response.code = request.url.endsWith("/users") ? 201 : 200;
+  return response;
+}
+
+static std::vector<uint32_t> getValues(const String &body, const String &key) {
+  std::vector<uint32_t> values;
+  String pattern = "\"" + key + "\": ";
+  for (int index = body.indexOf(pattern); index >= 0; index = body.indexOf(pattern, index + 1))
+    values.push_back(body.substring(index + pattern.length()).toInt());
+  return values;
+}
+
+static bool waitUntil(std::function<bool()> condition) {
+  for (int i = 0; i < WAIT_REAL_MS * 10; i++) {
+    if (condition())
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+// setUp() reset the simulation, the worker of the replay test is still running
+static void reconnect() {
+  WiFi.begin("door", "secret");
+  NativeHttp::setBackend(backend);
+}
+
+static uint32_t countCreatedUsers(uint16_t fingerId) {
+  std::lock_guard<std::mutex> lock(backendMutex);
+  uint32_t count = 0;
+  for (const NativeHttpRequest &request : accepted) {
+    if (request.url.endsWith("/users") && getValues(request.body, "fingerprint") == std::vector<uint32_t>{ fingerId })
+      count++;
+  }
+  return count;
+}
+
+void test_offline_records_are_replayed_in_order_without_loss() {
+  // three boots without network, one of them ends with a torn record
+  uint32_t logged = 0;
+  for (int boot = 0; boot < 3; boot++) {
+    for (int i = 0; i < 40; i++) {
+      NativeClock::advanceMillis(1000);
+      uint16_t fingerId = 1 + (logged % 200);
+      if (i == 20)
+        TEST_ASSERT_TRUE(journal->logCreateUser(fingerId));
+      else
+        TEST_ASSERT_TRUE(journal->logAccess(fingerId, true, AccessSource::offline));
+      logged++;
+    }
+    if (boot == 1) {
+      NativeFs::failWritesAfter(7);
+      journal->logAccess(1, true, AccessSource::offline);
+      NativeFs::failWritesAfter(-1);
+    }
+    reboot();
+  }
+  delete journal;
+  journal = nullptr;
+
+  // the network is back, the first two uploads fail with a server error
+  NativeClock::reset();
+  TEST_ASSERT_TRUE(uploadJournal.begin());
+  TEST_ASSERT_EQUAL_UINT32(logged, uploadJournal.pendingCount());
+  failuresLeft = 2;
+  WiFi.begin("door", "secret");
+  NativeClock::advanceMillis(5000);
+  NativeHttp::setBackend(backend);
+  apiClient.begin("http://backend:8000", &uploadJournal);
+
+  TEST_ASSERT_TRUE(waitUntil([]() { return uploadJournal.pendingCount() == 0; }));
+  TEST_ASSERT_EQUAL_INT(0, failuresLeft);
+
+  // every record arrived exactly once and in order, the access events in batches (record n is for finger n)
+  std::lock_guard<std::mutex> lock(backendMutex);
+  std::vector<uint32_t> fingerIds;
+  uint32_t createUsers = 0, batches = 0;
+  for (const NativeHttpRequest &request : accepted) {
+    std::vector<uint32_t> ids = getValues(request.body, "fingerprint");
+    if (request.url.endsWith("/users")) {
+      createUsers++;
+    } else {
+      batches++;
+      TEST_ASSERT_TRUE(getValues(request.body, "sequence") == ids);
+    }
+    fingerIds.insert(fingerIds.end(), ids.begin(), ids.end());
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, createUsers);
+  TEST_ASSERT_EQUAL_UINT32(logged, fingerIds.size());
+  for (uint32_t i = 0; i < fingerIds.size(); i++)
+    TEST_ASSERT_EQUAL_UINT32(i + 1, fingerIds[i]);
+  char message[64];
+  snprintf(message, sizeof(message), "%u records uploaded with %u requests", logged, batches + createUsers);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT32(logged / 4, batches + createUsers);
+}
+
+// a backend without the batch endpoint: the events are dropped instead of blocking the journal
+void test_rejected_access_events_do_not_block_the_user_creation() {
+  reconnect();
+  batchCode = 404;
+  TEST_ASSERT_TRUE(uploadJournal.logAccess(41, true, AccessSource::api));
+  TEST_ASSERT_TRUE(uploadJournal.logAccess(41, true, AccessSource::api));
+  TEST_ASSERT_TRUE(uploadJournal.logCreateUser(42));
+
+  TEST_ASSERT_TRUE(waitUntil([]() { return uploadJournal.pendingCount() == 0; }));
+  TEST_ASSERT_EQUAL_UINT32(1, countCreatedUsers(42));
+  batchCode = 200;
+}
+
+// the backend fails the events only for now: the user is created ahead of them, and not a second time later
+void test_failing_access_events_do_not_delay_the_user_creation() {
+  reconnect();
+  batchCode = 500;
+  TEST_ASSERT_TRUE(uploadJournal.logAccess(43, true, AccessSource::api));
+  TEST_ASSERT_TRUE(uploadJournal.logCreateUser(44));
+
+  TEST_ASSERT_TRUE(waitUntil([]() { return countCreatedUsers(44) == 1; }));
+  TEST_ASSERT_EQUAL_UINT32(2, uploadJournal.pendingCount());
+
+  batchCode = 200;
+  TEST_ASSERT_TRUE(waitUntil([]() { return uploadJournal.pendingCount() == 0; }));
+  TEST_ASSERT_EQUAL_UINT32(1, countCreatedUsers(44));
+  std::lock_guard<std::mutex> lock(backendMutex);
+  TEST_ASSERT_TRUE(accepted.back().url.endsWith("/events/batch"));
+  TEST_ASSERT_TRUE(getValues(accepted.back().body, "fingerprint") == std::vector<uint32_t>{ 43 });
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_are_read_back_in_order);
+  RUN_TEST(test_records_survive_reboots);
+  RUN_TEST(test_uploaded_records_are_not_sent_again_after_a_reboot);
+  RUN_TEST(test_sequence_continues_after_the_journal_was_emptied);
+  RUN_TEST(test_torn_record_is_dropped_on_next_boot);
+  RUN_TEST(test_corrupted_record_is_dropped);
+  RUN_TEST(test_full_journal_refuses_records);
+  RUN_TEST(test_offline_records_are_replayed_in_order_without_loss);
+  RUN_TEST(test_rejected_access_events_do_not_block_the_user_creation);
+  RUN_TEST(test_failing_access_events_do_not_delay_the_user_creation);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the API task never returns
+}
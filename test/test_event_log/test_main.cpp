@@ -0,0 +1,325 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <esp_system.h>
+#include "EventLog.h"
+#include "TimeService.h"
+#include "Simulation.h"
+
+/*
+  The ring lives in RTC_NOINIT_ATTR memory, which the host keeps for the whole run: the first begin() sees it zeroed
+  like after a power-on, every further EventLog is a soft reset on the same memory. The time service is synced in the
+  last tests only, it can't be unsynced again.
+*/
+
+#define THREADS 4
+#define RECORDS_PER_THREAD 20000
+#define BENCHMARK_EVENTS 20000
+#define LEGACY_LOG_MESSAGES 5 // the array of the old notifyClients()
+
+// counts the heap allocations while enabled
+static bool countAllocations = false;
+static uint32_t allocations = 0;
+
+void* operator new(size_t size) {
+  if (countAllocations)
+    allocations++;
+  void *pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t size) noexcept {
+  free(pointer);
+}
+
+class LineOutput : public Print {
+  public:
+    std::vector<std::string> lines;
+    std::string line;
+    size_t write(uint8_t c) override {
+      if (c == '\n') {
+        lines.push_back(line);
+        line.clear();
+      } else if (c != '\r') {
+        line += (char)c;
+      }
+      return 1;
+    }
+};
+
+// counts the characters without keeping them, for the benchmark
+class NullOutput : public Print {
+  public:
+    size_t count = 0;
+    size_t write(uint8_t c) override { count++; return 1; }
+};
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+  countAllocations = false;
+}
+
+static String formatRecord(uint32_t sequence) {
+  LogRecord record;
+  TEST_ASSERT_TRUE(eventLog.read(sequence, record));
+  char text[EVENT_LOG_TEXT_LENGTH];
+  TEST_ASSERT_GREATER_THAN_UINT32(0, EventLog::format(record, text, sizeof(text)));
+  return String(text);
+}
+
+// the path every log message took before: timestamp String, concatenation, Serial and a shifted String array
+static String legacyMessages[LEGACY_LOG_MESSAGES];
+
+static String legacyTimestamp() {
+  time_t now = time(nullptr);
+  struct tm timeinfo;
+  gmtime_r(&now, &timeinfo);
+  char buffer[25];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S %Z", &timeinfo);
+  String datetime = String(buffer);
+  return datetime;
+}
+
+static void legacyNotify(String message) {
+  String messageWithTimestamp = "[" + legacyTimestamp() + "]: " + message;
+  Serial.println(messageWithTimestamp);
+  for (int i = LEGACY_LOG_MESSAGES - 1; i > 0; i--)
+    legacyMessages[i] = legacyMessages[i - 1];
+  legacyMessages[0] = messageWithTimestamp;
+}
+
+void test_power_on_starts_with_the_boot_record() {
+  NativeSystem::setResetReason(ESP_RST_POWERON);
+  eventLog.begin();
+
+  TEST_ASSERT_EQUAL_UINT32(1, eventLog.getHead());
+  TEST_ASSERT_EQUAL_UINT32(0, eventLog.getOldest());
+  LogRecord record;
+  TEST_ASSERT_TRUE(eventLog.read(0, record));
+  TEST_ASSERT_EQUAL_UINT16((uint16_t)LogCode::boot, record.code);
+  TEST_ASSERT_EQUAL_INT32(ESP_RST_POWERON, record.args[0]);
+  TEST_ASSERT_FALSE(eventLog.read(1, record)); // not written yet
+}
+
+void test_records_are_formatted_with_uptime_before_the_time_is_synced() {
+  NativeClock::advanceMillis(1234);
+  uint32_t sequence = eventLog.getHead();
+  eventLog.log(LogCode::matchFound, 7, 93);
+  eventLog.log(LogCode::unknownError, 2, -1);
+  eventLog.log(LogCode::imageMessy);
+
+  LogRecord record;
+  TEST_ASSERT_TRUE(eventLog.read(sequence, record));
+  TEST_ASSERT_EQUAL_UINT32(0, record.timestamp);
+  TEST_ASSERT_EQUAL_UINT32(1234, record.uptimeMs);
+  TEST_ASSERT_EQUAL_STRING("[+1.234s]: Match Found: 7 with confidence of 93", formatRecord(sequence).c_str());
+  TEST_ASSERT_EQUAL_STRING("[+1.234s]: Unknown error (scan state 2, Code -1)", formatRecord(sequence + 1).c_str());
+  TEST_ASSERT_EQUAL_STRING("[+1.234s]: Image too messy", formatRecord(sequence + 2).c_str());
+}
+
+void test_format_handles_small_buffers_and_unknown_codes() {
+  LogRecord record = {};
+  record.uptimeMs = 5000;
+  record.code = (uint16_t)LogCode::userLookupFailed;
+  record.args[0] = 12;
+  record.args[1] = 404;
+  char text[EVENT_LOG_TEXT_LENGTH];
+
+  TEST_ASSERT_EQUAL_UINT32(0, EventLog::format(record, text, TIME_TIMESTAMP_LENGTH + 3));
+  TEST_ASSERT_EQUAL_UINT32(29, EventLog::format(record, text, 30)); // truncated
+  TEST_ASSERT_EQUAL_STRING("[+5.000s]: User lookup for fi", text);
+  record.code = (uint16_t)LogCode::count;
+  EventLog::format(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("[+5.000s]: Unknown log code", text);
+}
+
+void test_ring_keeps_the_newest_records() {
+  uint32_t first = eventLog.getHead();
+  for (int i = 0; i < 3 * EVENT_LOG_SIZE; i++)
+    eventLog.log(LogCode::noMatchFound, i);
+
+  uint32_t head = eventLog.getHead();
+  TEST_ASSERT_EQUAL_UINT32(first + 3 * EVENT_LOG_SIZE, head);
+  TEST_ASSERT_EQUAL_UINT32(head - EVENT_LOG_SIZE, eventLog.getOldest());
+  LogRecord record;
+  TEST_ASSERT_FALSE(eventLog.read(eventLog.getOldest() - 1, record)); // overwritten
+  for (uint32_t sequence = eventLog.getOldest(); sequence != head; sequence++) {
+    TEST_ASSERT_TRUE(eventLog.read(sequence, record));
+    TEST_ASSERT_EQUAL_UINT32(sequence, record.sequence);
+    TEST_ASSERT_EQUAL_INT32((int32_t)(sequence - first), record.args[0]);
+  }
+}
+
+void test_print_new_echoes_a_burst_per_call() {
+  LineOutput drained;
+  eventLog.printNew(drained);
+  while (!drained.lines.empty()) {
+    drained.lines.clear();
+    eventLog.printNew(drained);
+  }
+
+  for (int i = 0; i < 10; i++)
+    eventLog.log(LogCode::scanError, i);
+  LineOutput out;
+  eventLog.printNew(out);
+  TEST_ASSERT_EQUAL_UINT32(EVENT_LOG_ECHO_BURST, out.lines.size());
+  eventLog.printNew(out);
+  eventLog.printNew(out);
+  TEST_ASSERT_EQUAL_UINT32(10, out.lines.size());
+  eventLog.printNew(out);
+  TEST_ASSERT_EQUAL_UINT32(10, out.lines.size());
+  TEST_ASSERT_EQUAL_STRING("[+0.000s]: ScanResult Error (Code 0)", out.lines[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("[+0.000s]: ScanResult Error (Code 9)", out.lines[9].c_str());
+}
+
+void test_print_new_skips_what_was_overwritten() {
+  uint32_t head = eventLog.getHead();
+  for (int i = 0; i < 2 * EVENT_LOG_SIZE; i++)
+    eventLog.log(LogCode::featureFail, i);
+
+  LineOutput out;
+  eventLog.printNew(out);
+  TEST_ASSERT_EQUAL_UINT32(EVENT_LOG_ECHO_BURST, out.lines.size());
+  TEST_ASSERT_EQUAL_STRING(formatRecord(head + EVENT_LOG_SIZE).c_str(), out.lines[0].c_str());
+}
+
+void test_print_all_lists_the_whole_ring() {
+  LineOutput out;
+  eventLog.printAll(out);
+  TEST_ASSERT_EQUAL_UINT32(EVENT_LOG_SIZE, out.lines.size());
+  TEST_ASSERT_EQUAL_STRING(formatRecord(eventLog.getOldest()).c_str(), out.lines.front().c_str());
+  TEST_ASSERT_EQUAL_STRING(formatRecord(eventLog.getHead() - 1).c_str(), out.lines.back().c_str());
+}
+
+void test_soft_reset_keeps_the_records() {
+  eventLog.log(LogCode::accessDenied, 12, 1);
+  uint32_t head = eventLog.getHead();
+
+  NativeSystem::setResetReason(ESP_RST_TASK_WDT);
+  EventLog rebooted; // same RTC memory
+  rebooted.begin();
+
+  TEST_ASSERT_EQUAL_UINT32(head + 1, rebooted.getHead());
+  LogRecord record;
+  TEST_ASSERT_TRUE(rebooted.read(head - 1, record));
+  TEST_ASSERT_EQUAL_UINT16((uint16_t)LogCode::accessDenied, record.code);
+  TEST_ASSERT_EQUAL_INT32(12, record.args[0]);
+  TEST_ASSERT_TRUE(rebooted.read(head, record));
+  TEST_ASSERT_EQUAL_UINT16((uint16_t)LogCode::boot, record.code);
+  TEST_ASSERT_EQUAL_INT32(ESP_RST_TASK_WDT, record.args[0]);
+
+  // only the boot record is new for the echo, the previous run is listed by printAll()
+  LineOutput out;
+  rebooted.printNew(out);
+  TEST_ASSERT_EQUAL_UINT32(1, out.lines.size());
+  TEST_ASSERT_EQUAL_STRING("[+0.000s]: Boot (reset reason 6)", out.lines[0].c_str());
+  LineOutput all;
+  rebooted.printAll(all);
+  TEST_ASSERT_EQUAL_UINT32(EVENT_LOG_SIZE, all.lines.size());
+}
+
+void test_concurrent_writers_leave_intact_records() {
+  uint32_t head = eventLog.getHead();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < RECORDS_PER_THREAD; i++)
+        eventLog.log(LogCode::noMatchPass, t, i, t * i);
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+
+  TEST_ASSERT_EQUAL_UINT32(head + THREADS * RECORDS_PER_THREAD, eventLog.getHead());
+  LogRecord record;
+  for (uint32_t sequence = eventLog.getOldest(); sequence != eventLog.getHead(); sequence++) {
+    TEST_ASSERT_TRUE(eventLog.read(sequence, record));
+    TEST_ASSERT_EQUAL_INT32(record.args[0] * record.args[1], record.args[2]);
+  }
+}
+
+void test_records_carry_the_time_once_synced() {
+  NativeClock::setWallClock(1700000000);
+  TEST_ASSERT_TRUE(timeService.isSynced());
+  uint32_t sequence = eventLog.getHead();
+  eventLog.log(LogCode::accessGranted, 3, 0);
+
+  LogRecord record;
+  TEST_ASSERT_TRUE(eventLog.read(sequence, record));
+  TEST_ASSERT_EQUAL_UINT32(1700000000, record.timestamp);
+  TEST_ASSERT_EQUAL_STRING("[2023-11-14 22:13:20]: Access granted for finger #3 (source 0)", formatRecord(sequence).c_str());
+}
+
+void test_benchmark_against_string_messages() {
+  NativeClock::setWallClock(1700000000);
+  uint16_t id = 7;
+  uint16_t confidence = 93;
+  String name = "Alice";
+
+  allocations = 0;
+  countAllocations = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_EVENTS; i++)
+    legacyNotify(String("Match Found: ") + id + " - " + name + " with confidence of " + confidence);
+  uint64_t legacyNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t legacyAllocations = allocations;
+
+  allocations = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_EVENTS; i++)
+    eventLog.log(LogCode::matchFound, id, confidence);
+  uint64_t logNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t logAllocations = allocations;
+
+  // the text is built by the consumer, here the echo of loop()
+  NullOutput out;
+  allocations = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_EVENTS; i++)
+    eventLog.printAll(out);
+  uint64_t formatNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t formatAllocations = allocations;
+  countAllocations = false;
+
+  char message[200];
+  snprintf(message, sizeof(message), "per event: String path %u ns, %.1f allocations; log() %u ns, %.1f allocations; formatting on read %u ns, %.1f allocations (host time)",
+           (uint32_t)(legacyNanos / BENCHMARK_EVENTS), (double)legacyAllocations / BENCHMARK_EVENTS,
+           (uint32_t)(logNanos / BENCHMARK_EVENTS), (double)logAllocations / BENCHMARK_EVENTS,
+           (uint32_t)(formatNanos / BENCHMARK_EVENTS / EVENT_LOG_SIZE), (double)formatAllocations / BENCHMARK_EVENTS / EVENT_LOG_SIZE);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(0, logAllocations);
+  TEST_ASSERT_EQUAL_UINT32(0, formatAllocations);
+  TEST_ASSERT_GREATER_THAN_UINT32(BENCHMARK_EVENTS, legacyAllocations);
+  TEST_ASSERT_LESS_THAN_UINT64(legacyNanos, logNanos);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, out.count);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_power_on_starts_with_the_boot_record);
+  RUN_TEST(test_records_are_formatted_with_uptime_before_the_time_is_synced);
+  RUN_TEST(test_format_handles_small_buffers_and_unknown_codes);
+  RUN_TEST(test_ring_keeps_the_newest_records);
+  RUN_TEST(test_print_new_echoes_a_burst_per_call);
+  RUN_TEST(test_print_new_skips_what_was_overwritten);
+  RUN_TEST(test_print_all_lists_the_whole_ring);
+  RUN_TEST(test_soft_reset_keeps_the_records);
+  RUN_TEST(test_concurrent_writers_leave_intact_records);
+  RUN_TEST(test_records_carry_the_time_once_synced);
+  RUN_TEST(test_benchmark_against_string_messages);
+  return UNITY_END();
+}
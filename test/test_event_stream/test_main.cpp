@@ -0,0 +1,298 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include "EventStream.h"
+#include "Simulation.h"
+
+/*
+  WebSocket event stream with the browser side of the native web server. The stream is the global one of the firmware,
+  its sequence numbers go on from test to test. In the backpressure test a publisher thread stands in for the scan loop,
+  pump() runs in its own thread like loop() and several browsers read at different speeds.
+*/
+
+#define USER "admin"
+#define PASSWORD "secret"
+#define SLOW_PUBLISHED_EVENTS 20000
+#define PUBLISH_MAX_REAL_MICROS 2000 // a writer never waits for readers, only for the scheduler
+#define PUMP_MAX_REAL_MICROS 20000 // one burst per client, never waits for a browser
+#define DRAIN_REAL_MS 200 // the fast browser catches up after the last event
+
+static AsyncWebServer server(80);
+static AsyncWebSocket *webSocket = nullptr;
+
+struct ReceivedEvent {
+  uint32_t sequence;
+  std::string type;
+  uint32_t dropped; // type "dropped" only
+};
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static ReceivedEvent parse(const std::string &message) {
+  StaticJsonDocument<512> doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, message.c_str()));
+  ReceivedEvent event;
+  event.type = doc["t"].as<const char*>();
+  event.sequence = doc["s"].as<uint32_t>();
+  event.dropped = doc["n"].as<uint32_t>();
+  return event;
+}
+
+static void publishLogs(int count) {
+  for (int i = 0; i < count; i++)
+    eventStream.publish(StreamEventType::log, 0, 0, "entry");
+}
+
+static void disconnectAll(const std::vector<AsyncWebSocketClient*> &clients) {
+  for (AsyncWebSocketClient *client : clients)
+    webSocket->disconnect(client);
+  eventStream.pump(); // frees them
+}
+
+void test_handshake_needs_the_credentials() {
+  TEST_ASSERT_NULL(webSocket->connect());
+  TEST_ASSERT_NULL(webSocket->connect(USER, "wrong"));
+  AsyncWebSocketClient *client = webSocket->connect(USER, PASSWORD);
+  TEST_ASSERT_NOT_NULL(client);
+  disconnectAll({ client });
+}
+
+void test_events_are_compact_json() {
+  AsyncWebSocketClient *client = webSocket->connect(USER, PASSWORD);
+  eventStream.pump();
+  client->receive(); // history
+  uint32_t sequence = eventStream.getHead();
+
+  eventStream.publish(StreamEventType::match, 3, 87, "Alice \"Al\"");
+  eventStream.publish(StreamEventType::noMatch, 0, 9, nullptr);
+  eventStream.publish(StreamEventType::log, 0, 0, "Enrollment cancelled.");
+  eventStream.pump();
+
+  std::vector<std::string> messages = client->receive();
+  TEST_ASSERT_EQUAL_UINT32(3, messages.size());
+  char expected[120];
+  snprintf(expected, sizeof(expected), "{\"s\":%u,\"t\":\"match\",\"id\":3,\"v\":87,\"m\":\"Alice \\\"Al\\\"\"}", sequence);
+  TEST_ASSERT_EQUAL_STRING(expected, messages[0].c_str());
+  snprintf(expected, sizeof(expected), "{\"s\":%u,\"t\":\"noMatch\",\"v\":9}", sequence + 1);
+  TEST_ASSERT_EQUAL_STRING(expected, messages[1].c_str());
+  snprintf(expected, sizeof(expected), "{\"s\":%u,\"t\":\"log\",\"m\":\"Enrollment cancelled.\"}", sequence + 2);
+  TEST_ASSERT_EQUAL_STRING(expected, messages[2].c_str());
+  disconnectAll({ client });
+}
+
+void test_new_clients_get_the_recent_events_in_bursts() {
+  publishLogs(EVENT_STREAM_SIZE + 10);
+  uint32_t head = eventStream.getHead();
+  AsyncWebSocketClient *client = webSocket->connect(USER, PASSWORD);
+
+  eventStream.pump();
+  std::vector<std::string> messages = client->receive();
+
+  TEST_ASSERT_EQUAL_UINT32(EVENT_STREAM_SEND_BURST, messages.size());
+  TEST_ASSERT_EQUAL_UINT32(head - EVENT_STREAM_SIZE, parse(messages[0]).sequence);
+  for (int i = 1; i < EVENT_STREAM_SIZE / EVENT_STREAM_SEND_BURST; i++) {
+    eventStream.pump();
+    std::vector<std::string> burst = client->receive();
+    messages.insert(messages.end(), burst.begin(), burst.end());
+  }
+  TEST_ASSERT_EQUAL_UINT32(EVENT_STREAM_SIZE, messages.size());
+  TEST_ASSERT_EQUAL_UINT32(head - 1, parse(messages.back()).sequence);
+  eventStream.pump();
+  TEST_ASSERT_EQUAL_UINT32(0, client->getQueued());
+  disconnectAll({ client });
+}
+
+void test_a_client_too_far_behind_loses_the_oldest_events() {
+  AsyncWebSocketClient *client = webSocket->connect(USER, PASSWORD);
+  while (eventStream.pump(), client->getQueued() > 0)
+    client->receive();
+  uint32_t droppedBefore = eventStream.getDroppedTotal();
+  uint32_t first = eventStream.getHead();
+
+  publishLogs(EVENT_STREAM_SIZE + 25);
+  uint32_t head = eventStream.getHead();
+  eventStream.pump();
+
+  std::vector<std::string> messages = client->receive();
+  TEST_ASSERT_EQUAL_UINT32(1 + EVENT_STREAM_SEND_BURST, messages.size());
+  ReceivedEvent dropped = parse(messages[0]);
+  TEST_ASSERT_EQUAL_STRING("dropped", dropped.type.c_str());
+  TEST_ASSERT_EQUAL_UINT32(25, dropped.dropped);
+  TEST_ASSERT_EQUAL_UINT32(first + 25, parse(messages[1]).sequence);
+  TEST_ASSERT_EQUAL_UINT32(head - EVENT_STREAM_SIZE, parse(messages[1]).sequence);
+  TEST_ASSERT_EQUAL_UINT32(droppedBefore + 25, eventStream.getDroppedTotal());
+  disconnectAll({ client });
+}
+
+void test_a_full_send_queue_is_skipped_without_losing_events() {
+  AsyncWebSocketClient *client = webSocket->connect(USER, PASSWORD);
+  while (eventStream.pump(), client->getQueued() > 0)
+    client->receive();
+  uint32_t first = eventStream.getHead();
+
+  // the browser reads nothing until its queue is full
+  publishLogs(EVENT_STREAM_SIZE);
+  for (int i = 0; i < 2 * EVENT_STREAM_SIZE; i++)
+    eventStream.pump();
+  TEST_ASSERT_TRUE(client->queueIsFull());
+  TEST_ASSERT_EQUAL_UINT32(0, client->getDroppedCount()); // nothing was sent into the full queue
+
+  std::vector<std::string> messages = client->receive();
+  eventStream.pump();
+  std::vector<std::string> rest = client->receive();
+  messages.insert(messages.end(), rest.begin(), rest.end());
+  TEST_ASSERT_EQUAL_UINT32(EVENT_STREAM_SIZE, messages.size());
+  for (int i = 0; i < EVENT_STREAM_SIZE; i++)
+    TEST_ASSERT_EQUAL_UINT32(first + i, parse(messages[i]).sequence);
+  disconnectAll({ client });
+}
+
+void test_clients_above_the_limit_are_closed() {
+  std::vector<AsyncWebSocketClient*> clients;
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++)
+    clients.push_back(webSocket->connect(USER, PASSWORD));
+
+  AsyncWebSocketClient *rejected = webSocket->connect(USER, PASSWORD);
+  TEST_ASSERT_NOT_NULL(rejected);
+  TEST_ASSERT_EQUAL_UINT16(1013, rejected->getCloseCode());
+  webSocket->disconnect(rejected);
+
+  // a slot is free again after a disconnect
+  webSocket->disconnect(clients[0]);
+  AsyncWebSocketClient *next = webSocket->connect(USER, PASSWORD);
+  TEST_ASSERT_EQUAL_UINT16(0, next->getCloseCode());
+  clients[0] = next;
+  disconnectAll(clients);
+}
+
+void test_reads_detect_pending_and_overwritten_slots() {
+  uint32_t head = eventStream.getHead();
+  StreamEvent event;
+
+  TEST_ASSERT_TRUE(eventStream.read(head, event) == StreamRead::pending);
+  TEST_ASSERT_TRUE(eventStream.read(head - 1, event) == StreamRead::ok);
+  TEST_ASSERT_EQUAL_UINT32(head - 1, event.sequence);
+  TEST_ASSERT_TRUE(eventStream.read(head - EVENT_STREAM_SIZE - 1, event) == StreamRead::overwritten);
+}
+
+void test_slow_clients_never_stall_the_publisher() {
+  // client 0 reads everything right away, 1 reads a few messages now and then, 2 reads rarely, 3 never reads
+  const int readEveryMicros[EVENT_STREAM_MAX_CLIENTS] = { 0, 200, 5000, 0 };
+  const size_t readCount[EVENT_STREAM_MAX_CLIENTS] = { SIZE_MAX, 2, 8, 0 };
+  std::vector<AsyncWebSocketClient*> clients;
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS; i++)
+    clients.push_back(webSocket->connect(USER, PASSWORD));
+  while (eventStream.pump(), clients[0]->getQueued() > 0 || clients[3]->getQueued() < WS_MAX_QUEUED_MESSAGES)
+    clients[0]->receive(), clients[1]->receive(), clients[2]->receive(); // history read, the queue of 3 is full
+  uint32_t first = eventStream.getHead();
+  uint32_t droppedBefore = eventStream.getDroppedTotal();
+
+  std::atomic<bool> reading{true};
+  std::atomic<bool> pumping{true};
+  std::atomic<uint32_t> maxPumpMicros{0};
+  std::vector<std::vector<std::string>> received(EVENT_STREAM_MAX_CLIENTS);
+
+  std::thread loop([&]() {
+    while (pumping) {
+      auto start = std::chrono::steady_clock::now();
+      eventStream.pump();
+      uint32_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+      maxPumpMicros = std::max(maxPumpMicros.load(), micros);
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  });
+  std::vector<std::thread> browsers;
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS - 1; i++) {
+    browsers.emplace_back([&, i]() {
+      while (reading) {
+        std::vector<std::string> messages = clients[i]->receive(readCount[i]);
+        received[i].insert(received[i].end(), messages.begin(), messages.end());
+        std::this_thread::sleep_for(std::chrono::microseconds(readEveryMicros[i]));
+      }
+    });
+  }
+
+  uint32_t maxPublishMicros = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < SLOW_PUBLISHED_EVENTS; i++) {
+    auto publishStart = std::chrono::steady_clock::now();
+    eventStream.publish(i % 2 == 0 ? StreamEventType::match : StreamEventType::noMatch, i % 200, i % 100, "Alice");
+    uint32_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - publishStart).count();
+    maxPublishMicros = std::max(maxPublishMicros, micros);
+    if (i % 16 == 15)
+      std::this_thread::sleep_for(std::chrono::microseconds(100)); // a scan takes a while
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_REAL_MS));
+  reading = false;
+  for (std::thread &browser : browsers)
+    browser.join();
+  pumping = false;
+  loop.join();
+  uint32_t head = eventStream.getHead();
+
+  // every client sees increasing sequences, a gap is announced by a dropped message unless the slot was overwritten
+  // while it was copied (counted in getDroppedTotal() only)
+  uint32_t notified = 0;
+  uint32_t gaps[EVENT_STREAM_MAX_CLIENTS] = {};
+  uint32_t counts[EVENT_STREAM_MAX_CLIENTS] = {};
+  for (int i = 0; i < EVENT_STREAM_MAX_CLIENTS - 1; i++) {
+    uint32_t expected = first;
+    uint32_t announced = 0;
+    for (const std::string &message : received[i]) {
+      ReceivedEvent event = parse(message);
+      if (event.type == "dropped") {
+        announced += event.dropped;
+        continue;
+      }
+      TEST_ASSERT_GREATER_OR_EQUAL_UINT32(expected, event.sequence);
+      gaps[i] += event.sequence - expected;
+      expected = event.sequence + 1;
+      counts[i]++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(announced + (eventStream.getDroppedTotal() - droppedBefore), gaps[i]);
+    notified += announced;
+  }
+  char message[200];
+  snprintf(message, sizeof(message), "%d events in %.2f s, max publish %u us, max pump %u us, received %u/%u/%u/%u, dropped %u",
+           SLOW_PUBLISHED_EVENTS, seconds, maxPublishMicros, maxPumpMicros.load(), counts[0], counts[1], counts[2],
+           (uint32_t)clients[3]->getQueued(), eventStream.getDroppedTotal() - droppedBefore);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(first + SLOW_PUBLISHED_EVENTS, head);
+  TEST_ASSERT_LESS_THAN_UINT32(PUBLISH_MAX_REAL_MICROS, maxPublishMicros);
+  TEST_ASSERT_LESS_THAN_UINT32(PUMP_MAX_REAL_MICROS, maxPumpMicros.load());
+  TEST_ASSERT_GREATER_THAN_UINT32(counts[2], counts[0]); // the fast client is not held back by the slow ones
+  TEST_ASSERT_EQUAL_UINT32(head, first + gaps[0] + counts[0]);                 // and has seen the last event
+  TEST_ASSERT_GREATER_THAN_UINT32(0, notified);
+  TEST_ASSERT_EQUAL_UINT32(WS_MAX_QUEUED_MESSAGES, clients[3]->getQueued());
+  TEST_ASSERT_EQUAL_UINT32(0, clients[3]->getDroppedCount());
+  disconnectAll(clients);
+}
+
+int main(int argc, char **argv) {
+  Simulation::reset();
+  eventStream.begin(server, USER, PASSWORD);
+  webSocket = NativeWebSockets::find(EVENT_STREAM_PATH);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_handshake_needs_the_credentials);
+  RUN_TEST(test_events_are_compact_json);
+  RUN_TEST(test_new_clients_get_the_recent_events_in_bursts);
+  RUN_TEST(test_a_client_too_far_behind_loses_the_oldest_events);
+  RUN_TEST(test_a_full_send_queue_is_skipped_without_losing_events);
+  RUN_TEST(test_clients_above_the_limit_are_closed);
+  RUN_TEST(test_reads_detect_pending_and_overwritten_slots);
+  RUN_TEST(test_slow_clients_never_stall_the_publisher);
+  return UNITY_END();
+}
@@ -0,0 +1,210 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <Preferences.h>
+#include "FingerNameTable.h"
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "Simulation.h"
+
+/*
+  Batched delete and rename against the per-item calls, as the web API sends them one request after the other. The
+  sensor task calls process() between the requests, so every per-item change is written to NVS once its write delay
+  has passed.
+*/
+
+#define BATCH_FINGERS 199 // ids 1..199, the R503 has the library slots 0..199
+
+static R503Simulator *sensor = nullptr;
+static FingerprintManager *fingerManager = nullptr;
+static uint32_t idleMs = 0;
+
+struct BatchCost {
+  int commands;         // sensor round trips
+  uint32_t nvsWrites;   // put and remove operations
+  uint32_t nvsBytes;
+  uint32_t simulatedMs; // without the idle time between the requests
+  uint64_t hostNanos;
+};
+
+void setUp() {
+  Simulation::reset();
+  delete fingerManager;
+  delete sensor;
+  sensor = new R503Simulator();
+  sensor->attach(Serial2);
+  sensor->setBaudRate(115200);
+  fingerManager = new FingerprintManager();
+}
+
+void tearDown() {
+}
+
+// a sensor with the fingers 1..count, their names are in NVS
+static void enroll(int count) {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  FingerNameTable names;
+  for (int id = 1; id <= count; id++) {
+    sensor->storeTemplate(id, 1000 + id);
+    names.set(id, (String("Finger #") + id).c_str());
+  }
+  TEST_ASSERT_EQUAL_INT(count, fingerManager->renameFingers(names));
+  sensor->clearCommands();
+  NativeNvs::resetCounters();
+}
+
+static void startCost(BatchCost &cost, std::chrono::steady_clock::time_point &start) {
+  sensor->clearCommands();
+  NativeNvs::resetCounters();
+  cost.simulatedMs = millis();
+  idleMs = 0;
+  start = std::chrono::steady_clock::now();
+}
+
+static void endCost(BatchCost &cost, std::chrono::steady_clock::time_point start) {
+  cost.hostNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  cost.simulatedMs = millis() - cost.simulatedMs - idleMs;
+  cost.commands = sensor->getCommands().size();
+  cost.nvsWrites = NativeNvs::getWriteCount();
+  cost.nvsBytes = NativeNvs::getWrittenBytes();
+}
+
+// the sensor task between two requests of the web API
+static void idleUntilWritten() {
+  delay(FINGER_LIST_WRITE_DELAY_MS);
+  idleMs += FINGER_LIST_WRITE_DELAY_MS;
+  fingerManager->process();
+}
+
+static void printCost(const char *operation, const BatchCost &perItem, const BatchCost &batch) {
+  char message[240];
+  snprintf(message, sizeof(message), "%s of %d: per item %d commands, %u NVS writes (%u bytes), %u ms; batch %d commands, "
+           "%u NVS writes (%u bytes), %u ms (simulated); host %u us vs %u us",
+           operation, BATCH_FINGERS, perItem.commands, perItem.nvsWrites, perItem.nvsBytes, perItem.simulatedMs,
+           batch.commands, batch.nvsWrites, batch.nvsBytes, batch.simulatedMs,
+           (uint32_t)(perItem.hostNanos / 1000), (uint32_t)(batch.hostNanos / 1000));
+  TEST_MESSAGE(message);
+}
+
+void test_delete_sends_one_command_per_range() {
+  enroll(30);
+  FingerNameTable selection; // "3,7,10-25"
+  selection.set(3, "");
+  selection.set(7, "");
+  for (int id = 10; id <= 25; id++)
+    selection.set(id, "");
+
+  TEST_ASSERT_EQUAL_INT(18, fingerManager->deleteFingers(selection));
+
+  TEST_ASSERT_EQUAL_INT(3, sensor->countCommands(FINGERPRINT_DELETE));
+  TEST_ASSERT_EQUAL_INT(12, sensor->getTemplateCount());
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  for (int id = 1; id <= 30; id++) {
+    bool selected = selection.isOccupied(id);
+    TEST_ASSERT_EQUAL(!selected, sensor->hasTemplate(id));
+    TEST_ASSERT_EQUAL(!selected, fingerManager->getFingerName(id, name, sizeof(name)));
+  }
+  TEST_ASSERT_EQUAL_INT(12, fingerManager->countFingerRegistred());
+
+  // written to NVS right away, not after the write delay
+  FingerprintManager rebooted;
+  TEST_ASSERT_TRUE(rebooted.connect());
+  TEST_ASSERT_FALSE(rebooted.getFingerName(10, name, sizeof(name)));
+  TEST_ASSERT_TRUE(rebooted.getFingerName(26, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Finger #26", name);
+}
+
+void test_failed_range_keeps_its_names() {
+  enroll(10);
+  FingerNameTable selection;
+  for (int id = 2; id <= 3; id++)
+    selection.set(id, "");
+  for (int id = 6; id <= 8; id++)
+    selection.set(id, "");
+  sensor->injectReply(FINGERPRINT_DELETE, FINGERPRINT_DELETEFAIL);
+
+  TEST_ASSERT_EQUAL_INT(3, fingerManager->deleteFingers(selection));
+
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Delete of finger templates #2-3 from sensor failed"));
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager->getFingerName(2, name, sizeof(name)));
+  TEST_ASSERT_TRUE(sensor->hasTemplate(2));
+  TEST_ASSERT_FALSE(fingerManager->getFingerName(6, name, sizeof(name)));
+  TEST_ASSERT_FALSE(sensor->hasTemplate(8));
+}
+
+void test_rename_is_written_once() {
+  enroll(BATCH_FINGERS);
+  FingerNameTable newNames;
+  for (int id = 1; id <= BATCH_FINGERS; id += 2)
+    newNames.set(id, (String("Renamed #") + id).c_str());
+
+  TEST_ASSERT_EQUAL_INT(100, fingerManager->renameFingers(newNames));
+  uint32_t writes = NativeNvs::getWriteCount();
+
+  TEST_ASSERT_EQUAL_INT(0, sensor->getCommands().size()); // names live on the ESP32 only
+  TEST_ASSERT_GREATER_THAN_UINT32(0, writes);
+  fingerManager->process(); // nothing left to write
+  delay(FINGER_LIST_WRITE_DELAY_MS);
+  fingerManager->process();
+  TEST_ASSERT_EQUAL_UINT32(writes, NativeNvs::getWriteCount());
+
+  FingerprintManager rebooted;
+  TEST_ASSERT_TRUE(rebooted.connect());
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(rebooted.getFingerName(199, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Renamed #199", name);
+  TEST_ASSERT_TRUE(rebooted.getFingerName(198, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Finger #198", name);
+}
+
+void test_benchmark_batch_against_per_item_calls() {
+  BatchCost perItemDelete, batchDelete, perItemRename, batchRename;
+  std::chrono::steady_clock::time_point start;
+
+  enroll(BATCH_FINGERS);
+  startCost(perItemRename, start);
+  for (int id = 1; id <= BATCH_FINGERS; id++) {
+    fingerManager->renameFinger(id, String("Renamed #") + id);
+    idleUntilWritten();
+  }
+  endCost(perItemRename, start);
+  startCost(perItemDelete, start);
+  for (int id = 1; id <= BATCH_FINGERS; id++) {
+    fingerManager->deleteFinger(id);
+    idleUntilWritten();
+  }
+  endCost(perItemDelete, start);
+  TEST_ASSERT_EQUAL_INT(0, sensor->getTemplateCount());
+
+  setUp();
+  enroll(BATCH_FINGERS);
+  FingerNameTable selection;
+  for (int id = 1; id <= BATCH_FINGERS; id++)
+    selection.set(id, (String("Renamed #") + id).c_str());
+  startCost(batchRename, start);
+  TEST_ASSERT_EQUAL_INT(BATCH_FINGERS, fingerManager->renameFingers(selection));
+  endCost(batchRename, start);
+  startCost(batchDelete, start);
+  TEST_ASSERT_EQUAL_INT(BATCH_FINGERS, fingerManager->deleteFingers(selection));
+  endCost(batchDelete, start);
+  TEST_ASSERT_EQUAL_INT(0, sensor->getTemplateCount());
+
+  printCost("delete", perItemDelete, batchDelete);
+  printCost("rename", perItemRename, batchRename);
+  TEST_ASSERT_EQUAL_INT(BATCH_FINGERS, perItemDelete.commands);
+  TEST_ASSERT_EQUAL_INT(1, batchDelete.commands);
+  TEST_ASSERT_EQUAL_INT(0, batchRename.commands);
+  TEST_ASSERT_LESS_THAN_UINT32(perItemDelete.nvsWrites / 10, batchDelete.nvsWrites);
+  TEST_ASSERT_LESS_THAN_UINT32(perItemRename.nvsWrites / 10, batchRename.nvsWrites);
+  TEST_ASSERT_LESS_THAN_UINT32(perItemDelete.simulatedMs / 10, batchDelete.simulatedMs);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_delete_sends_one_command_per_range);
+  RUN_TEST(test_failed_range_keeps_its_names);
+  RUN_TEST(test_rename_is_written_once);
+  RUN_TEST(test_benchmark_batch_against_per_item_calls);
+  return UNITY_END();
+}
@@ -0,0 +1,275 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "Simulation.h"
+
+/*
+  Persistence of the finger list in NVS. A reboot is a new FingerprintManager on the same simulated NVS and sensor, the
+  NVS operations are counted by NativeNvs.
+*/
+
+#define FINGERS 200
+
+static R503Simulator *sensor = nullptr;
+static FingerprintManager *fingerManager = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete fingerManager;
+  delete sensor;
+  sensor = new R503Simulator();
+  sensor->attach(Serial2);
+  fingerManager = new FingerprintManager();
+}
+
+void tearDown() {
+}
+
+static String makeName(int id) {
+  return String("Firstname Lastname #") + id;
+}
+
+static void reboot() {
+  delete fingerManager;
+  NativeClock::reset();
+  fingerManager = new FingerprintManager();
+  TEST_ASSERT_TRUE(fingerManager->connect());
+}
+
+// waits for the write-back delay like the sensor task does
+static void writeBack() {
+  NativeClock::advanceMillis(FINGER_LIST_WRITE_DELAY_MS);
+  fingerManager->process();
+}
+
+static void enrollAll(int count) {
+  for (int id = 1; id <= count; id++) {
+    sensor->storeTemplate(id, 1000 + id);
+    fingerManager->renameFinger(id, makeName(id));
+  }
+}
+
+static void assertNames(int count) {
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  for (int id = 1; id <= count; id++) {
+    TEST_ASSERT_TRUE(fingerManager->getFingerName(id, name, sizeof(name)));
+    TEST_ASSERT_EQUAL_STRING(makeName(id).c_str(), name);
+  }
+  TEST_ASSERT_FALSE(fingerManager->getFingerName(count + 1, name, sizeof(name)));
+}
+
+static uint32_t countSlotKeys(char slot) {
+  uint32_t count = 0;
+  char key[8];
+  for (int chunk = 0; chunk < 10; chunk++) {
+    snprintf(key, sizeof(key), "%c%d", slot, chunk);
+    if (NativeNvs::hasKey("fingerList", key))
+      count++;
+  }
+  return count;
+}
+
+void test_finger_list_round_trips_through_nvs() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  enrollAll(FINGERS);
+  fingerManager->deleteFinger(150);
+  writeBack();
+
+  reboot();
+
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_FALSE(fingerManager->getFingerName(150, name, sizeof(name)));
+  fingerManager->renameFinger(150, makeName(150));
+  assertNames(FINGERS);
+  TEST_ASSERT_EQUAL_INT(FINGERS - 1, fingerManager->countFingerRegistred());
+}
+
+void test_boot_reads_one_blob_instead_of_one_key_per_finger() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  enrollAll(FINGERS);
+  writeBack();
+  uint32_t chunks = countSlotKeys('a') + countSlotKeys('b');
+
+  NativeNvs::resetCounters();
+  reboot();
+
+  char message[80];
+  snprintf(message, sizeof(message), "boot with %d fingers: %u NVS reads in %u chunks", FINGERS, NativeNvs::getReadCount(), chunks);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(2 * chunks + 2, NativeNvs::getReadCount()); // both slots are checked
+  TEST_ASSERT_EQUAL_UINT32(0, NativeNvs::getWriteCount());
+  assertNames(FINGERS);
+}
+
+void test_changes_are_coalesced_into_one_write() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  NativeNvs::resetCounters();
+
+  for (int id = 1; id <= 50; id++) {
+    sensor->storeTemplate(id, 1000 + id);
+    fingerManager->renameFinger(id, makeName(id));
+    NativeClock::advanceMillis(10);
+    fingerManager->process();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, NativeNvs::getWriteCount());
+
+  writeBack();
+  writeBack();
+
+  TEST_ASSERT_EQUAL_UINT32(countSlotKeys('a'), NativeNvs::getWriteCount()); // 50 short names fit in one chunk
+  TEST_ASSERT_EQUAL_UINT32(1, NativeNvs::getWriteCount());
+}
+
+void test_flush_writes_right_away() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  fingerManager->renameFinger(1, "Alice");
+  NativeNvs::resetCounters();
+
+  fingerManager->flushFingerList();
+
+  TEST_ASSERT_EQUAL_UINT32(1, NativeNvs::getWriteCount());
+  fingerManager->flushFingerList(); // nothing changed since
+  TEST_ASSERT_EQUAL_UINT32(1, NativeNvs::getWriteCount());
+}
+
+void test_writes_alternate_between_the_slots() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  fingerManager->renameFinger(1, "first");
+  fingerManager->flushFingerList();
+  fingerManager->renameFinger(1, "second");
+  fingerManager->flushFingerList();
+
+  TEST_ASSERT_TRUE(NativeNvs::hasKey("fingerList", "a0"));
+  TEST_ASSERT_TRUE(NativeNvs::hasKey("fingerList", "b0"));
+  reboot();
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager->getFingerName(1, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("second", name); // the newer generation wins
+}
+
+void test_torn_write_keeps_the_previous_list() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  enrollAll(FINGERS);
+  writeBack();
+
+  // reset after the first chunk of the new list was written, the header chunk is missing
+  fingerManager->renameFinger(1, "renamed");
+  NativeNvs::failWritesAfter(1);
+  fingerManager->flushFingerList();
+  NativeNvs::failWritesAfter(-1);
+  reboot();
+
+  assertNames(FINGERS);
+}
+
+// flips a bit in the last data byte of a slot
+static void corruptSlot(const char *key) {
+  Preferences preferences;
+  preferences.begin("fingerList", false);
+  uint8_t chunk[FINGER_LIST_BLOB_CHUNK_SIZE];
+  size_t length = preferences.getBytes(key, chunk, sizeof(chunk));
+  chunk[length - 1] ^= 0x20;
+  preferences.putBytes(key, chunk, length);
+  preferences.end();
+}
+
+static void assertName(int id, const char *expected) {
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager->getFingerName(id, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING(expected, name);
+}
+
+void test_corrupted_slot_is_ignored() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  const char *names[] = { "first", "second", "third" }; // slots a, b, a
+  for (const char *name : names) {
+    fingerManager->renameFinger(1, name);
+    fingerManager->flushFingerList();
+  }
+
+  corruptSlot("a0");
+  reboot();
+  assertName(1, "second");
+
+  // the list was written to slot a again on the first change, now slot b is the damaged newer one
+  fingerManager->renameFinger(1, "fourth");
+  fingerManager->flushFingerList();
+  fingerManager->renameFinger(1, "fifth");
+  fingerManager->flushFingerList();
+  corruptSlot("b0");
+  reboot();
+  assertName(1, "fourth");
+}
+
+void test_per_finger_keys_are_migrated() {
+  Preferences preferences;
+  preferences.begin("fingerList", false);
+  for (int id = 1; id <= FINGERS; id++) {
+    sensor->storeTemplate(id, 1000 + id);
+    preferences.putString(String(id).c_str(), makeName(id));
+  }
+  preferences.end();
+  NativeNvs::resetCounters();
+
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  assertNames(FINGERS);
+  uint32_t migrationReads = NativeNvs::getReadCount();
+  TEST_ASSERT_FALSE(NativeNvs::hasKey("fingerList", "1"));
+  TEST_ASSERT_FALSE(NativeNvs::hasKey("fingerList", "200"));
+  TEST_ASSERT_TRUE(NativeNvs::hasKey("fingerList", "a0"));
+
+  NativeNvs::resetCounters();
+  reboot();
+  assertNames(FINGERS);
+  char message[80];
+  snprintf(message, sizeof(message), "NVS reads: %u with one key per finger, %u with the blob", migrationReads, NativeNvs::getReadCount());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT32(migrationReads / 10, NativeNvs::getReadCount());
+}
+
+void test_version_1_blob_is_migrated() {
+  FingerNameTable table;
+  for (int id = 1; id <= 3; id++) {
+    sensor->storeTemplate(id, 1000 + id);
+    table.set(id, makeName(id).c_str());
+  }
+  // version 1: magic, version, length and crc in front of the data, single slot "blob0"
+  uint8_t blob[12 + 200];
+  uint32_t magic = FINGER_LIST_BLOB_MAGIC;
+  uint16_t version = 1;
+  uint16_t length = table.serialize(&blob[12], sizeof(blob) - 12);
+  uint32_t crc = crc32_le(0, &blob[12], length);
+  memcpy(&blob[0], &magic, 4);
+  memcpy(&blob[4], &version, 2);
+  memcpy(&blob[6], &length, 2);
+  memcpy(&blob[8], &crc, 4);
+  Preferences preferences;
+  preferences.begin("fingerList", false);
+  preferences.putBytes("blob0", blob, 12 + length);
+  preferences.end();
+
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  assertNames(3);
+  TEST_ASSERT_FALSE(NativeNvs::hasKey("fingerList", "blob0"));
+  reboot();
+  assertNames(3);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_finger_list_round_trips_through_nvs);
+  RUN_TEST(test_boot_reads_one_blob_instead_of_one_key_per_finger);
+  RUN_TEST(test_changes_are_coalesced_into_one_write);
+  RUN_TEST(test_flush_writes_right_away);
+  RUN_TEST(test_writes_alternate_between_the_slots);
+  RUN_TEST(test_torn_write_keeps_the_previous_list);
+  RUN_TEST(test_corrupted_slot_is_ignored);
+  RUN_TEST(test_per_finger_keys_are_migrated);
+  RUN_TEST(test_version_1_blob_is_migrated);
+  return UNITY_END();
+}
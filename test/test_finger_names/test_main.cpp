@@ -0,0 +1,221 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <Preferences.h>
+#include "FingerNameTable.h"
+#include "Simulation.h"
+
+#define BENCHMARK_FINGERS 200
+#define BENCHMARK_LOADS 50
+
+// counts the heap allocations while enabled
+static bool countAllocations = false;
+static uint32_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+  if (countAllocations) {
+    allocations++;
+    allocatedBytes += size;
+  }
+  void *pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t size) noexcept {
+  free(pointer);
+}
+
+static void startCounting() {
+  allocations = 0;
+  allocatedBytes = 0;
+  countAllocations = true;
+}
+
+static void stopCounting() {
+  countAllocations = false;
+}
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+  stopCounting();
+}
+
+// realistic names are longer than the small string buffer, so every one of them is allocated
+static String makeName(int id) {
+  return String("Firstname Lastname #") + id;
+}
+
+void test_unused_slots_read_as_empty() {
+  FingerNameTable table;
+
+  TEST_ASSERT_EQUAL_STRING(FINGER_NAME_EMPTY, table.get(1));
+  TEST_ASSERT_FALSE(table.isOccupied(1));
+  TEST_ASSERT_EQUAL_INT(0, table.count());
+  TEST_ASSERT_EQUAL_INT(FINGER_LIST_SIZE, table.size());
+}
+
+void test_set_remove_and_count() {
+  FingerNameTable table;
+
+  TEST_ASSERT_TRUE(table.set(1, "Alice"));
+  TEST_ASSERT_TRUE(table.set(200, "Bob"));
+  TEST_ASSERT_TRUE(table.set(32, ""));
+  TEST_ASSERT_EQUAL_STRING("Alice", table.get(1));
+  TEST_ASSERT_EQUAL_STRING("Bob", table.get(200));
+  TEST_ASSERT_EQUAL_STRING("", table.get(32)); // occupied with an empty name is not unused
+  TEST_ASSERT_EQUAL_INT(3, table.count());
+
+  table.remove(1);
+  TEST_ASSERT_EQUAL_STRING(FINGER_NAME_EMPTY, table.get(1));
+  TEST_ASSERT_EQUAL_INT(2, table.count());
+}
+
+void test_ids_out_of_range_are_refused() {
+  FingerNameTable table;
+
+  TEST_ASSERT_FALSE(table.set(0, "zero"));
+  TEST_ASSERT_FALSE(table.set(FINGER_LIST_SIZE, "too big"));
+  table.remove(FINGER_LIST_SIZE);
+  TEST_ASSERT_FALSE(table.isOccupied(FINGER_LIST_SIZE));
+  TEST_ASSERT_EQUAL_INT(0, table.count());
+}
+
+void test_long_names_are_truncated() {
+  FingerNameTable table;
+  char longName[FINGER_NAME_MAX_LENGTH + 10];
+  memset(longName, 'x', sizeof(longName) - 1);
+  longName[sizeof(longName) - 1] = 0;
+
+  table.set(5, longName);
+
+  TEST_ASSERT_EQUAL_UINT32(FINGER_NAME_MAX_LENGTH, strlen(table.get(5)));
+}
+
+void test_serialized_table_round_trips() {
+  FingerNameTable table, copy;
+  for (int id = 1; id < FINGER_LIST_SIZE; id += 3)
+    table.set(id, makeName(id).c_str());
+  static uint8_t buffer[FINGER_LIST_SERIALIZED_MAX_SIZE];
+
+  size_t length = table.serialize(buffer, sizeof(buffer));
+
+  TEST_ASSERT_TRUE(copy.deserialize(buffer, length));
+  TEST_ASSERT_EQUAL_INT(table.count(), copy.count());
+  for (int id = 0; id < FINGER_LIST_SIZE; id++)
+    TEST_ASSERT_EQUAL_STRING(table.get(id), copy.get(id));
+}
+
+void test_broken_serialized_data_is_refused() {
+  FingerNameTable table;
+  uint8_t invalidId[] = { 0, 1, 'a' };
+  uint8_t tooLong[] = { 5, 10, 'a', 'b' };
+
+  TEST_ASSERT_FALSE(table.deserialize(invalidId, sizeof(invalidId)));
+  TEST_ASSERT_FALSE(table.deserialize(tooLong, sizeof(tooLong)));
+  TEST_ASSERT_EQUAL_INT(0, table.count());
+}
+
+// the finger list before the name table: 201 Strings and one NVS key per finger
+static String legacyList[FINGER_LIST_SIZE];
+
+static void loadLegacy() {
+  for (int i = 0; i < FINGER_LIST_SIZE; i++)
+    legacyList[i] = "@empty";
+  Preferences preferences;
+  preferences.begin("fingerList", true);
+  for (int i = 1; i < FINGER_LIST_SIZE; i++) {
+    String key = String(i);
+    if (preferences.isKey(key.c_str()))
+      legacyList[i] = preferences.getString(key.c_str(), "@empty");
+  }
+  preferences.end();
+}
+
+static FingerNameTable table;
+static uint8_t blob[FINGER_LIST_SERIALIZED_MAX_SIZE];
+
+static void loadTable() {
+  Preferences preferences;
+  preferences.begin("fingerList", true);
+  size_t length = preferences.getBytes("names", blob, sizeof(blob));
+  preferences.end();
+  table.deserialize(blob, length);
+}
+
+void test_benchmark_heap_and_load_time_for_200_fingers() {
+  Preferences preferences;
+  preferences.begin("fingerList", false);
+  for (int id = 1; id <= BENCHMARK_FINGERS; id++) {
+    preferences.putString(String(id).c_str(), makeName(id));
+    table.set(id, makeName(id).c_str());
+  }
+  preferences.putBytes("names", blob, table.serialize(blob, sizeof(blob)));
+  preferences.end();
+  table.clear();
+
+  NativeNvs::resetCounters();
+  startCounting();
+  loadLegacy();
+  stopCounting();
+  uint32_t legacyAllocations = allocations;
+  size_t legacyHeap = sizeof(legacyList) + allocatedBytes;
+  uint32_t legacyReads = NativeNvs::getReadCount();
+
+  NativeNvs::resetCounters();
+  startCounting();
+  loadTable();
+  stopCounting();
+  uint32_t tableAllocations = allocations;
+  uint32_t tableReads = NativeNvs::getReadCount();
+
+  TEST_ASSERT_EQUAL_INT(BENCHMARK_FINGERS, table.count());
+  for (int id = 1; id < FINGER_LIST_SIZE; id++)
+    TEST_ASSERT_EQUAL_STRING(legacyList[id].c_str(), table.get(id));
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_LOADS; i++)
+    loadLegacy();
+  uint64_t legacyNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / BENCHMARK_LOADS;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_LOADS; i++)
+    loadTable();
+  uint64_t tableNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / BENCHMARK_LOADS;
+
+  char message[200];
+  snprintf(message, sizeof(message), "String[201]: %u bytes in %u allocations, %u NVS reads, %u us to load",
+           (uint32_t)legacyHeap, legacyAllocations, legacyReads, (uint32_t)(legacyNanos / 1000));
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message), "name table: %u bytes in %u allocations, %u NVS reads, %u us to load",
+           (uint32_t)sizeof(FingerNameTable), tableAllocations, tableReads, (uint32_t)(tableNanos / 1000));
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL_UINT32(0, tableAllocations);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(BENCHMARK_FINGERS, legacyAllocations);
+  TEST_ASSERT_LESS_THAN_UINT32(legacyHeap, sizeof(FingerNameTable));
+  TEST_ASSERT_LESS_THAN_UINT32(legacyReads, tableReads);
+  TEST_ASSERT_LESS_THAN_UINT32(legacyNanos, tableNanos);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unused_slots_read_as_empty);
+  RUN_TEST(test_set_remove_and_count);
+  RUN_TEST(test_ids_out_of_range_are_refused);
+  RUN_TEST(test_long_names_are_truncated);
+  RUN_TEST(test_serialized_table_round_trips);
+  RUN_TEST(test_broken_serialized_data_is_refused);
+  RUN_TEST(test_benchmark_heap_and_load_time_for_200_fingers);
+  return UNITY_END();
+}
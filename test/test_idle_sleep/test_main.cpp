@@ -0,0 +1,184 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <esp_sleep.h>
+#include "FingerprintManager.h"
+#include "LatencyMetrics.h"
+#include "R503Simulator.h"
+#include "SensorTask.h"
+#include "Simulation.h"
+
+/*
+  Idle/wake state machine of the sensor task on the simulated clock. The task runs in its own thread and can't be
+  stopped, so the tests build on each other. Light sleep jumps to the wakeup source (NativeSleep), the test thread waits
+  in real time only.
+*/
+
+#define WAKE_TO_IMAGE_BUDGET_MS 250 // getImage with a finger on the sensor plus its packets at 115200 baud
+#define WAIT_REAL_MS 30000
+
+static R503Simulator sensor;
+static FingerprintManager fingerManager;
+static SensorTask sensorTask;
+static std::vector<SensorEvent> events;
+
+static std::atomic<bool> sleepAllowed{true};
+static std::atomic<uint32_t> sleepsEntered{0};
+static std::atomic<uint32_t> wakeups{0};
+static std::atomic<uint32_t> lastSleepMillis{0};
+static std::atomic<uint32_t> lastWakeMillis{0};
+
+static bool canSleep() {
+  return sleepAllowed;
+}
+
+static void beforeSleep() {
+  sleepsEntered++;
+  lastSleepMillis = millis();
+}
+
+static void afterWake() {
+  wakeups++;
+  lastWakeMillis = millis();
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void drainEvents() {
+  SensorEvent event;
+  while (sensorTask.pollEvent(event))
+    events.push_back(event);
+}
+
+template<typename Condition>
+static bool waitFor(Condition condition) {
+  for (int i = 0; i < WAIT_REAL_MS * 10; i++) {
+    drainEvents();
+    if (condition())
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+static bool hasEvent(SensorEventType type) {
+  for (const SensorEvent &event : events)
+    if (event.type == type)
+      return true;
+  return false;
+}
+
+void test_no_sleep_while_disabled() {
+  TEST_ASSERT_TRUE(waitFor([]() { return hasEvent(SensorEventType::ready); }));
+  uint32_t start = millis();
+
+  TEST_ASSERT_TRUE(waitFor([start]() { return millis() - start >= 2 * IDLE_SLEEP_AFTER_MS; }));
+
+  TEST_ASSERT_EQUAL_UINT32(0, NativeSleep::getSleepCount());
+}
+
+void test_sleeps_after_the_idle_time_and_wakes_by_timer() {
+  uint32_t enabledMillis = millis();
+  sensorTask.setIdleSleep(true, canSleep, beforeSleep, afterWake);
+
+  TEST_ASSERT_TRUE(waitFor([]() { return wakeups >= 2; }));
+
+  // 30 s awake, 5 min asleep, 30 s awake...
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(2, NativeSleep::getSleepCount());
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(IDLE_SLEEP_AFTER_MS, lastSleepMillis - enabledMillis - (wakeups - 1) * (IDLE_SLEEP_TIMER_WAKEUP_US / 1000));
+  TEST_ASSERT_EQUAL_UINT32(NativeSleep::getSleepCount(), sleepsEntered);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(2 * IDLE_SLEEP_TIMER_WAKEUP_US, NativeSleep::getSleptMicros());
+  TEST_ASSERT_UINT32_WITHIN(1000, IDLE_SLEEP_TIMER_WAKEUP_US / 1000, lastWakeMillis - lastSleepMillis);
+  TEST_ASSERT_TRUE(NativeSleep::wasInterruptDisabledDuringSleep(touchRingPin));
+  TEST_ASSERT_TRUE(NativeGpio::isInterruptAttached(touchRingPin));
+  TEST_ASSERT_FALSE(hasEvent(SensorEventType::scan)); // a timer wakeup starts no scan
+}
+
+void test_no_sleep_while_the_application_is_busy() {
+  sleepAllowed = false;
+  uint32_t sleeps = NativeSleep::getSleepCount();
+  uint32_t start = millis();
+
+  TEST_ASSERT_TRUE(waitFor([start]() { return millis() - start >= IDLE_SLEEP_TIMER_WAKEUP_US / 1000 + IDLE_SLEEP_AFTER_MS; }));
+
+  // the sleep that may have started before the flag was seen is the last one
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(sleeps + 1, NativeSleep::getSleepCount());
+  uint32_t settled = NativeSleep::getSleepCount();
+  uint32_t now = millis();
+  TEST_ASSERT_TRUE(waitFor([now]() { return millis() - now >= 2 * IDLE_SLEEP_AFTER_MS; }));
+  TEST_ASSERT_EQUAL_UINT32(settled, NativeSleep::getSleepCount());
+}
+
+void test_no_sleep_while_commands_arrive() {
+  uint32_t sleeps = NativeSleep::getSleepCount();
+  sleepAllowed = true;
+
+  // a rename every 20 s keeps the task awake
+  for (int i = 0; i < 5; i++) {
+    uint32_t start = millis();
+    TEST_ASSERT_TRUE(sensorTask.postRename(1, String("name") + i));
+    TEST_ASSERT_TRUE(waitFor([start]() { return millis() - start >= IDLE_SLEEP_AFTER_MS * 2 / 3; }));
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(sleeps, NativeSleep::getSleepCount());
+}
+
+void test_touch_wakes_and_scans_within_the_budget() {
+  sensor.storeTemplate(7, 42);
+  events.clear();
+  latencyMetrics.reset();
+  uint32_t sleeps = NativeSleep::getSleepCount();
+
+  // the finger arrives a minute from now, the task is asleep by then
+  uint64_t touchMicros = NativeClock::getMicros() + 60000000ull;
+  sensor.placeFinger(42, touchMicros, touchMicros + 2000000ull);
+  NativeSleep::scheduleTouch(touchRingPin, touchMicros);
+  sensor.clearCommands();
+
+  TEST_ASSERT_TRUE(waitFor([]() { return hasEvent(SensorEventType::scan); }));
+
+  TEST_ASSERT_GREATER_THAN_UINT32(sleeps, NativeSleep::getSleepCount());
+  SensorEvent scan;
+  for (const SensorEvent &event : events)
+    if (event.type == SensorEventType::scan)
+      scan = event;
+  TEST_ASSERT_TRUE(scan.match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, scan.match.matchId);
+
+  LatencySummary wakeToImage = latencyMetrics.getSummary(LatencyStage::wakeToImage);
+  std::vector<R503Command> commands = sensor.getCommands();
+  uint64_t firstImageCommand = 0;
+  for (const R503Command &command : commands)
+    if (command.code == FINGERPRINT_GETIMAGE && firstImageCommand == 0)
+      firstImageCommand = command.micros;
+  char message[100];
+  snprintf(message, sizeof(message), "wake to first image: %u us, touch to getImage sent: %u us",
+           wakeToImage.max, (uint32_t)(firstImageCommand - touchMicros));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(1, wakeToImage.count);
+  TEST_ASSERT_LESS_THAN_UINT32(WAKE_TO_IMAGE_BUDGET_MS * 1000, wakeToImage.max);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(touchMicros, firstImageCommand);
+}
+
+int main(int argc, char **argv) {
+  Simulation::reset();
+  sensor.attach(Serial2);
+  sensorTask.begin(&fingerManager);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_no_sleep_while_disabled);
+  RUN_TEST(test_sleeps_after_the_idle_time_and_wakes_by_timer);
+  RUN_TEST(test_no_sleep_while_the_application_is_busy);
+  RUN_TEST(test_no_sleep_while_commands_arrive);
+  RUN_TEST(test_touch_wakes_and_scans_within_the_budget);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the sensor task never returns
+}
@@ -0,0 +1,219 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FingerprintManager.h"
+#include "LatencyMetrics.h"
+#include "R503Simulator.h"
+#include "Simulation.h"
+
+#define BENCHMARK_RECORDS 100000
+#define THREADS 4
+#define RECORDS_PER_THREAD 20000
+
+// counts the heap allocations while enabled
+static bool countAllocations = false;
+static uint32_t allocations = 0;
+
+void* operator new(size_t size) {
+  if (countAllocations)
+    allocations++;
+  void *pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t size) noexcept {
+  free(pointer);
+}
+
+class TextOutput : public Print {
+  public:
+    std::string text;
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+};
+
+void setUp() {
+  Simulation::reset();
+  latencyMetrics.reset();
+}
+
+void tearDown() {
+  countAllocations = false;
+}
+
+void test_values_go_to_log2_buckets() {
+  uint32_t values[] = { 0, 1, 2, 3, 4, 1000, 1023, 1024 };
+  for (uint32_t value : values)
+    latencyMetrics.record(LatencyStage::getImage, value);
+
+  uint32_t buckets[LATENCY_BUCKET_COUNT];
+  int used = latencyMetrics.getBuckets(LatencyStage::getImage, buckets);
+
+  TEST_ASSERT_EQUAL_INT(12, used); // 1024 is in [2^10, 2^11)
+  TEST_ASSERT_EQUAL_UINT32(1, buckets[0]);
+  TEST_ASSERT_EQUAL_UINT32(1, buckets[1]);
+  TEST_ASSERT_EQUAL_UINT32(2, buckets[2]);
+  TEST_ASSERT_EQUAL_UINT32(1, buckets[3]);
+  TEST_ASSERT_EQUAL_UINT32(2, buckets[10]);
+  TEST_ASSERT_EQUAL_UINT32(1, buckets[11]);
+}
+
+void test_huge_values_go_to_the_last_bucket() {
+  latencyMetrics.record(LatencyStage::scan, 0xFFFFFFFF);
+
+  uint32_t buckets[LATENCY_BUCKET_COUNT];
+  TEST_ASSERT_EQUAL_INT(LATENCY_BUCKET_COUNT, latencyMetrics.getBuckets(LatencyStage::scan, buckets));
+  TEST_ASSERT_EQUAL_UINT32(1, buckets[LATENCY_BUCKET_COUNT - 1]);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, latencyMetrics.getSummary(LatencyStage::scan).max);
+}
+
+void test_summary_of_an_empty_stage() {
+  LatencySummary summary = latencyMetrics.getSummary(LatencyStage::apiLookup);
+
+  TEST_ASSERT_EQUAL_UINT32(0, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.min);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.max);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.p50);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.p99);
+}
+
+void test_percentiles_are_bucket_upper_bounds() {
+  // 98 fast values around 100 ms, two slow ones at 900 ms
+  for (int i = 0; i < 98; i++)
+    latencyMetrics.record(LatencyStage::apiLookup, 90000 + i * 200);
+  latencyMetrics.record(LatencyStage::apiLookup, 900000);
+  latencyMetrics.record(LatencyStage::apiLookup, 900000);
+
+  LatencySummary summary = latencyMetrics.getSummary(LatencyStage::apiLookup);
+
+  TEST_ASSERT_EQUAL_UINT32(100, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(90000, summary.min);
+  TEST_ASSERT_EQUAL_UINT32(900000, summary.max);
+  TEST_ASSERT_EQUAL_UINT32(131071, summary.p50); // [65536, 131072)
+  TEST_ASSERT_EQUAL_UINT32(900000, summary.p99); // the bucket bound 1048575 is capped by max
+}
+
+void test_percentile_estimate_is_within_a_factor_of_two() {
+  std::vector<uint32_t> values;
+  srand(1);
+  for (int i = 0; i < 1000; i++) {
+    uint32_t value = 1000 + rand() % 400000;
+    values.push_back(value);
+    latencyMetrics.record(LatencyStage::scan, value);
+  }
+  std::sort(values.begin(), values.end());
+
+  LatencySummary summary = latencyMetrics.getSummary(LatencyStage::scan);
+
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(values[499], summary.p50);
+  TEST_ASSERT_LESS_THAN_UINT32(2 * values[499], summary.p50);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(values[989], summary.p99);
+  TEST_ASSERT_LESS_THAN_UINT32(2 * values[989], summary.p99);
+}
+
+void test_reset_clears_all_stages() {
+  latencyMetrics.record(LatencyStage::getImage, 5);
+  latencyMetrics.record(LatencyStage::wifiConnect, 5);
+
+  latencyMetrics.reset();
+
+  for (int i = 0; i < (int)LatencyStage::count; i++)
+    TEST_ASSERT_EQUAL_UINT32(0, latencyMetrics.getSummary((LatencyStage)i).count);
+}
+
+void test_print_lists_every_stage() {
+  latencyMetrics.record(LatencyStage::image2Tz, 160000);
+  TextOutput output;
+
+  latencyMetrics.printTo(output);
+
+  for (int i = 0; i < (int)LatencyStage::count; i++)
+    TEST_ASSERT_TRUE(output.text.find(LatencyMetrics::getStageName((LatencyStage)i)) != std::string::npos);
+  TEST_ASSERT_TRUE(output.text.find("image2Tz           1     160000") != std::string::npos);
+}
+
+void test_concurrent_recording_loses_nothing() {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < RECORDS_PER_THREAD; i++)
+        latencyMetrics.record(LatencyStage::buzzerLate, t * 1000 + i % 1000);
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+
+  LatencySummary summary = latencyMetrics.getSummary(LatencyStage::buzzerLate);
+  TEST_ASSERT_EQUAL_UINT32(THREADS * RECORDS_PER_THREAD, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.min);
+  TEST_ASSERT_EQUAL_UINT32((THREADS - 1) * 1000 + 999, summary.max);
+}
+
+void test_scan_records_every_stage() {
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.storeTemplate(7, 42);
+  latencyMetrics.reset();
+
+  sensor.placeFingerNow(42, 2000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  Match match;
+  for (int i = 0; i < 100 && (match = fingerManager.scanFingerprint()).scanResult == ScanResult::scanning; i++);
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::ringToImage).count);
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::image2Tz).count);
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::fingerSearch).count);
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::scan).count);
+  // the commands take the time of the simulated sensor plus their packets
+  LatencySummary getImage = latencyMetrics.getSummary(LatencyStage::getImage);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, getImage.count);
+  TEST_ASSERT_UINT32_WITHIN(10000, 135000, getImage.max);
+  TEST_ASSERT_UINT32_WITHIN(10000, 165000, latencyMetrics.getSummary(LatencyStage::image2Tz).max);
+}
+
+void test_benchmark_recording_without_heap() {
+  allocations = 0;
+  countAllocations = true;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCHMARK_RECORDS; i++)
+    latencyMetrics.record(LatencyStage::getImage, i * 37);
+  uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  latencyMetrics.getSummary(LatencyStage::getImage);
+  countAllocations = false;
+
+  char message[64];
+  snprintf(message, sizeof(message), "record: %u ns host time", (uint32_t)(nanos / BENCHMARK_RECORDS));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+  TEST_ASSERT_EQUAL_UINT32(BENCHMARK_RECORDS, latencyMetrics.getSummary(LatencyStage::getImage).count);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_values_go_to_log2_buckets);
+  RUN_TEST(test_huge_values_go_to_the_last_bucket);
+  RUN_TEST(test_summary_of_an_empty_stage);
+  RUN_TEST(test_percentiles_are_bucket_upper_bounds);
+  RUN_TEST(test_percentile_estimate_is_within_a_factor_of_two);
+  RUN_TEST(test_reset_clears_all_stages);
+  RUN_TEST(test_print_lists_every_stage);
+  RUN_TEST(test_concurrent_recording_loses_nothing);
+  RUN_TEST(test_scan_records_every_stage);
+  RUN_TEST(test_benchmark_recording_without_heap);
+  return UNITY_END();
+}
@@ -0,0 +1,269 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <SPIFFS.h>
+#include "Buzzer.h"
+#include "embedded_melodies.h"
+#include "player.h"
+#include "Simulation.h"
+
+/*
+  Melodies by name: the tunes of data/ come from the flash tables, custom tunes are parsed once from SPIFFS and then
+  played from RAM. A cached melody must play exactly like the same RTTTL parsed right before playing, as getTrackPath()
+  did on every scan.
+*/
+
+#define BUZZER_PIN 2
+#define BENCHMARK_GETS 2000
+
+static MelodyCache *cache = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete cache;
+  cache = new MelodyCache();
+}
+
+void tearDown() {
+}
+
+static void writeTune(const char *name, const char *rtttl) {
+  NativeFs::writeFile((String("/") + name + ".rtttl").c_str(), rtttl);
+}
+
+static void removeTune(const char *name) {
+  SPIFFS.remove(String("/") + name + ".rtttl");
+}
+
+// a custom tune of count notes, the pitch walks up so every note differs from its neighbour
+static std::string makeTune(int count) {
+  std::string rtttl = "tune:d=8,o=5,b=180:";
+  const char *pitches[] = { "c", "d", "e", "f", "g", "a", "b" };
+  for (int i = 0; i < count; i++) {
+    if (i > 0)
+      rtttl += ",";
+    rtttl += pitches[i % 7];
+  }
+  return rtttl;
+}
+
+static std::vector<RtttlNote> parseFresh(const char *rtttl, uint16_t &bpm) {
+  std::vector<RtttlNote> notes;
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{rtttl});
+  TEST_ASSERT_TRUE(parser.parseHeader());
+  bpm = parser.getBpm();
+  RtttlNote note = {};
+  while (parser.next(note))
+    notes.push_back(note);
+  TEST_ASSERT_FALSE(parser.hasError());
+  return notes;
+}
+
+// the tone changes while the melody plays to the end, relative to its start
+static std::vector<NativeTone> play(Buzzer &buzzer, const RtttlMelody &melody) {
+  size_t first = NativeLedc::getTones(BUZZER_LEDC_CHANNEL).size();
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_TRUE(buzzer.play(melody, BuzzerPriority::access));
+  while (buzzer.isPlaying())
+    NativeClock::advanceMillis(10);
+
+  const std::vector<NativeTone> &tones = NativeLedc::getTones(BUZZER_LEDC_CHANNEL);
+  std::vector<NativeTone> played(tones.begin() + first, tones.end());
+  for (NativeTone &tone : played)
+    tone.micros -= start;
+  return played;
+}
+
+static void assertSameTones(const std::vector<NativeTone> &expected, const std::vector<NativeTone> &actual) {
+  TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT64(expected[i].micros, actual[i].micros);
+    TEST_ASSERT_EQUAL_UINT32(expected[i].frequency, actual[i].frequency);
+  }
+}
+
+void test_built_in_tunes_need_no_filesystem() {
+  for (const RtttlMelody &embedded : embeddedMelodies) {
+    RtttlMelody melody = cache->get(embedded.name);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, melody.count);
+    TEST_ASSERT_EQUAL_UINT16(embedded.count, melody.count);
+    TEST_ASSERT_EQUAL_MEMORY(embedded.notes, melody.notes, melody.count * sizeof(RtttlNote));
+  }
+
+  TEST_ASSERT_FALSE(NativeFs::isMounted());
+  TEST_ASSERT_EQUAL_UINT32(0, cache->getUsedBytes());
+}
+
+void test_custom_tune_is_parsed_once() {
+  writeTune("custom", "custom:d=4,o=5,b=120:c,e,g,2c6");
+
+  RtttlMelody first = cache->get("custom");
+  removeTune("custom"); // a second read of the file would fail now
+  RtttlMelody second = cache->get("custom");
+
+  TEST_ASSERT_EQUAL_UINT16(4, first.count);
+  TEST_ASSERT_EQUAL_UINT16(120, first.bpm);
+  TEST_ASSERT_EQUAL_PTR(first.notes, second.notes);
+  TEST_ASSERT_EQUAL_UINT16(4, second.count);
+  TEST_ASSERT_EQUAL_UINT32(4 * sizeof(RtttlNote), cache->getUsedBytes());
+}
+
+void test_cached_tunes_play_like_freshly_parsed_ones() {
+  Buzzer buzzer(BUZZER_PIN);
+  TEST_ASSERT_TRUE(buzzer.begin());
+  const char *texts[] = { embedded::alarmText, embedded::entertainerText, embedded::fureliseText, embedded::goodbadText,
+                          embedded::indianaText, embedded::reussiText, embedded::simpsonsText, embedded::starwarsText,
+                          embedded::takeOnMeText };
+
+  for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+    MelodyCache melodies; // a fresh cache per tune, the budget doesn't hold all of them
+    String name = String("custom") + (int)i;
+    writeTune(name.c_str(), texts[i]);
+    uint16_t bpm = 0;
+    std::vector<RtttlNote> notes = parseFresh(texts[i], bpm);
+    RtttlMelody fresh = { "fresh", notes.data(), (uint16_t)notes.size(), bpm };
+
+    melodies.get(name.c_str());
+    RtttlMelody cached = melodies.get(name.c_str());
+
+    TEST_ASSERT_EQUAL_UINT16(fresh.count, cached.count);
+    TEST_ASSERT_EQUAL_UINT16(fresh.bpm, cached.bpm);
+    TEST_ASSERT_EQUAL_MEMORY(fresh.notes, cached.notes, fresh.count * sizeof(RtttlNote));
+    std::vector<NativeTone> freshTones = play(buzzer, fresh);
+    TEST_ASSERT_GREATER_THAN_UINT32(fresh.count, freshTones.size()); // every note plus the gaps
+    assertSameTones(freshTones, play(buzzer, cached));
+    assertSameTones(freshTones, play(buzzer, embeddedMelodies[i])); // the flash table of the same file
+  }
+}
+
+void test_least_recently_used_tune_is_evicted() {
+  // 200 notes are 400 bytes, two fit into the budget
+  std::string tune = makeTune(200);
+  const char *names[] = { "first", "second", "third" };
+  for (const char *name : names)
+    writeTune(name, tune.c_str());
+
+  TEST_ASSERT_TRUE(cache->preload("first"));
+  TEST_ASSERT_TRUE(cache->preload("second"));
+  cache->get("first");
+  TEST_ASSERT_TRUE(cache->preload("third"));
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(MELODY_CACHE_RAM_BUDGET, cache->getUsedBytes());
+  TEST_ASSERT_EQUAL_UINT32(2 * 200 * sizeof(RtttlNote), cache->getUsedBytes());
+  // the resident tunes play without their file, the evicted one is read again
+  for (const char *name : names)
+    removeTune(name);
+  TEST_ASSERT_EQUAL_UINT16(200, cache->get("first").count);
+  TEST_ASSERT_EQUAL_UINT16(200, cache->get("third").count);
+  TEST_ASSERT_EQUAL_STRING(MELODY_FALLBACK, cache->get("second").name);
+}
+
+void test_evicted_tune_is_parsed_again() {
+  std::string tune = makeTune(300);
+  writeTune("first", tune.c_str());
+  writeTune("second", tune.c_str());
+
+  cache->get("first");
+  cache->get("second"); // evicts the first
+  RtttlMelody first = cache->get("first");
+
+  TEST_ASSERT_EQUAL_UINT16(300, first.count);
+  TEST_ASSERT_EQUAL_STRING("first", first.name);
+  TEST_ASSERT_EQUAL_UINT32(300 * sizeof(RtttlNote), cache->getUsedBytes());
+}
+
+void test_tune_larger_than_the_budget_is_kept_alone() {
+  std::string tune = makeTune(MELODY_CACHE_RAM_BUDGET / sizeof(RtttlNote) + 100);
+  writeTune("small", "small:d=4,o=5,b=120:c,e,g");
+  writeTune("large", tune.c_str());
+
+  cache->get("small");
+  RtttlMelody large = cache->get("large");
+
+  TEST_ASSERT_EQUAL_UINT16(MELODY_CACHE_RAM_BUDGET / sizeof(RtttlNote) + 100, large.count);
+  TEST_ASSERT_EQUAL_UINT32(large.count * sizeof(RtttlNote), cache->getUsedBytes());
+}
+
+void test_inline_tune_needs_no_file() {
+  TEST_ASSERT_TRUE(cache->preload("inline", "inline:d=4,o=5,b=100:c,d"));
+
+  RtttlMelody melody = cache->get("inline");
+
+  TEST_ASSERT_EQUAL_UINT16(2, melody.count);
+  TEST_ASSERT_EQUAL_UINT16(100, melody.bpm);
+}
+
+void test_broken_or_missing_tune_falls_back() {
+  writeTune("broken", "broken:d=4,o=5,b=120:c,x,g");
+
+  TEST_ASSERT_EQUAL_STRING(MELODY_FALLBACK, cache->get("broken").name);
+  TEST_ASSERT_EQUAL_STRING(MELODY_FALLBACK, cache->get("missing").name);
+  TEST_ASSERT_EQUAL_UINT32(0, cache->getUsedBytes());
+}
+
+void test_slots_are_limited() {
+  for (int i = 0; i < MELODY_CACHE_SLOTS; i++)
+    TEST_ASSERT_TRUE(cache->preload((String("tune") + i).c_str(), "tune:d=4,o=5,b=120:c"));
+
+  TEST_ASSERT_FALSE(cache->preload("oneTooMany", "tune:d=4,o=5,b=120:c"));
+  TEST_ASSERT_TRUE(cache->preload("tune0", "tune:d=4,o=5,b=120:c,d")); // registered names can be replaced
+  TEST_ASSERT_EQUAL_UINT16(2, cache->get("tune0").count);
+}
+
+template<typename Function>
+static uint32_t measureNanos(int repeat, Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; i++)
+    function(i);
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / repeat;
+}
+
+void test_benchmark_parse_and_get() {
+  const char *names[] = { "myFurelise", "mySimpsons", "myStarwars" };
+  const char *texts[] = { embedded::fureliseText, embedded::simpsonsText, embedded::starwarsText };
+  for (int i = 0; i < 3; i++)
+    writeTune(names[i], texts[i]);
+  volatile uint32_t notes = 0;
+
+  // before: open the file and parse it on every scan
+  uint32_t uncached = measureNanos(BENCHMARK_GETS, [&](int i) {
+    MelodyCache melodies;
+    notes += melodies.get(names[i % 3]).count;
+  });
+  // the parser alone on the text in memory
+  uint32_t parse = measureNanos(BENCHMARK_GETS, [&](int i) {
+    notes += rtttlCountNotes(texts[i % 3]);
+  });
+  for (const char *name : names)
+    cache->preload(name);
+  uint32_t cached = measureNanos(BENCHMARK_GETS, [&](int i) {
+    notes += cache->get(names[i % 3]).count;
+  });
+  uint32_t embedded = measureNanos(BENCHMARK_GETS, [&](int i) {
+    notes += cache->get(embeddedMelodies[i % EMBEDDED_MELODY_COUNT].name).count;
+  });
+
+  char message[160];
+  snprintf(message, sizeof(message), "get: %u ns uncached from SPIFFS, %u ns parse only, %u ns cached, %u ns built in (host time)",
+           uncached, parse, cached, embedded);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT32(uncached / 10, cached);
+  TEST_ASSERT_LESS_THAN_UINT32(uncached / 10, embedded);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_built_in_tunes_need_no_filesystem);
+  RUN_TEST(test_custom_tune_is_parsed_once);
+  RUN_TEST(test_cached_tunes_play_like_freshly_parsed_ones);
+  RUN_TEST(test_least_recently_used_tune_is_evicted);
+  RUN_TEST(test_evicted_tune_is_parsed_again);
+  RUN_TEST(test_tune_larger_than_the_budget_is_kept_alone);
+  RUN_TEST(test_inline_tune_needs_no_file);
+  RUN_TEST(test_broken_or_missing_tune_falls_back);
+  RUN_TEST(test_slots_are_limited);
+  RUN_TEST(test_benchmark_parse_and_get);
+  return UNITY_END();
+}
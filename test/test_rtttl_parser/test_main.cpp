@@ -0,0 +1,378 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <SPIFFS.h>
+#include "rtttl.h"
+#include "Simulation.h"
+
+/*
+  The RTTTL parser over every tune in data/, checked against a reference parser written the way the Melody Player
+  library parses (String operations, frequency from the equal temperament formula), plus the syntax corner cases and
+  a throughput benchmark of both.
+*/
+
+#define BENCHMARK_ROUNDS 2000
+
+// counts the heap allocations while enabled
+static bool countAllocations = false;
+static uint32_t allocations = 0;
+
+void* operator new(size_t size) {
+  if (countAllocations)
+    allocations++;
+  void *pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t size) noexcept {
+  free(pointer);
+}
+
+// a note as it sounds: frequency and length at the tempo of the tune
+struct PlayedNote {
+  uint32_t frequency;
+  uint32_t micros;
+};
+
+struct DataFile {
+  std::string name;
+  std::string text;
+};
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+  countAllocations = false;
+}
+
+// the tests run in the project directory, the path of this file is the fallback
+static std::vector<DataFile> readDataFiles() {
+  std::string file = __FILE__;
+  std::string directories[] = { "data", file.substr(0, file.rfind("test/")) + "data" };
+  std::vector<DataFile> files;
+  for (const std::string &directory : directories) {
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+      continue;
+    while (dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() <= 6 || name.compare(name.size() - 6, 6, ".rtttl") != 0)
+        continue;
+      std::ifstream stream(directory + "/" + name);
+      std::stringstream text;
+      text << stream.rdbuf();
+      files.push_back({ name, text.str() });
+    }
+    closedir(dir);
+    break;
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(0, files.size());
+  return files;
+}
+
+// reference: the tune split at the commas, every field cut into pieces with String operations
+static bool parseReference(const String &rtttl, std::vector<PlayedNote> &notes) {
+  int colon = rtttl.indexOf(':');
+  int secondColon = rtttl.indexOf(':', colon + 1);
+  if (colon < 0 || secondColon < 0)
+    return false;
+  long duration = 4, octave = 6, bpm = 63;
+  String defaults = rtttl.substring(colon + 1, secondColon);
+  defaults.replace(" ", "");
+  for (int start = 0; start < (int)defaults.length();) {
+    int end = defaults.indexOf(',', start);
+    if (end < 0)
+      end = defaults.length();
+    String field = defaults.substring(start, end);
+    long value = field.substring(2).toInt();
+    if (field.startsWith("d="))
+      duration = value;
+    else if (field.startsWith("o="))
+      octave = value;
+    else if (field.startsWith("b="))
+      bpm = value;
+    else
+      return false;
+    start = end + 1;
+  }
+
+  uint32_t wholeNoteMicros = 240000000ul / bpm;
+  String body = rtttl.substring(secondColon + 1);
+  body.replace(" ", "");
+  body.replace("\n", "");
+  body.replace("\r", "");
+  for (int start = 0; start < (int)body.length();) {
+    int end = body.indexOf(',', start);
+    if (end < 0)
+      end = body.length();
+    String field = body.substring(start, end);
+    field.toLowerCase();
+    start = end + 1;
+
+    int pos = 0;
+    while (isdigit(field.charAt(pos)))
+      pos++;
+    long noteDuration = pos > 0 ? field.substring(0, pos).toInt() : duration;
+    const String names = "c d ef g a b";
+    char name = field.charAt(pos++);
+    int semitone = name == 'h' ? 11 : names.indexOf(name);
+    if (name != 'p' && semitone < 0)
+      return false;
+    if (field.charAt(pos) == '#' || field.charAt(pos) == '_') {
+      semitone++;
+      pos++;
+    }
+    bool dotted = field.indexOf('.') >= 0;
+    String rest = field.substring(pos);
+    rest.replace(".", "");
+    long noteOctave = rest.length() > 0 ? rest.toInt() : octave;
+
+    uint32_t frequency = 0;
+    if (name != 'p')
+      frequency = lround(440.0 * pow(2.0, (noteOctave * 12 + semitone - 57) / 12.0)); // A4 is 57 semitones above C0
+    uint32_t micros = wholeNoteMicros / noteDuration;
+    notes.push_back({ frequency, dotted ? micros * 3 / 2 : micros });
+  }
+  return true;
+}
+
+template<typename Source>
+static bool parse(Source source, std::vector<PlayedNote> &notes) {
+  RtttlParser<Source> parser(source);
+  if (!parser.parseHeader())
+    return false;
+  uint32_t wholeNoteMicros = 240000000ul / parser.getBpm();
+  RtttlNote note = {};
+  while (parser.next(note))
+    notes.push_back({ note.frequency(), note.durationMicros(wholeNoteMicros) });
+  return !parser.hasError();
+}
+
+static bool parse(const char *rtttl, std::vector<PlayedNote> &notes) {
+  return parse(RtttlStringSource(rtttl), notes);
+}
+
+// parses a tune that must be valid and returns its only note
+static RtttlNote parseNote(const char *rtttl) {
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{rtttl});
+  TEST_ASSERT_TRUE(parser.parseHeader());
+  RtttlNote note = {};
+  TEST_ASSERT_TRUE(parser.next(note));
+  TEST_ASSERT_FALSE(parser.next(note));
+  TEST_ASSERT_FALSE(parser.hasError());
+  return note;
+}
+
+static bool isValid(const char *rtttl) {
+  std::vector<PlayedNote> notes;
+  return parse(rtttl, notes);
+}
+
+void test_every_data_file_matches_the_reference_parser() {
+  for (const DataFile &file : readDataFiles()) {
+    std::vector<PlayedNote> expected, actual;
+    TEST_ASSERT_TRUE_MESSAGE(parseReference(file.text.c_str(), expected), file.name.c_str());
+    TEST_ASSERT_TRUE_MESSAGE(parse(file.text.c_str(), actual), file.name.c_str());
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected.size(), actual.size(), file.name.c_str());
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), rtttlCountNotes(file.text.c_str()));
+    for (size_t i = 0; i < expected.size(); i++) {
+      TEST_ASSERT_UINT32_WITHIN_MESSAGE(1, expected[i].frequency, actual[i].frequency, file.name.c_str()); // pitches.h is rounded
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected[i].micros, actual[i].micros, file.name.c_str());
+    }
+  }
+}
+
+// source for a file on the simulated SPIFFS, like the one of the melody cache
+struct FileSource {
+  File *file;
+
+  int peek() const { return file->peek(); }
+  int read() { return file->read(); }
+};
+
+void test_parsing_allocates_nothing() {
+  NativeFs::setMounted(true);
+  std::vector<DataFile> files = readDataFiles();
+  std::vector<PlayedNote> notes;
+  notes.reserve(1000);
+
+  for (const DataFile &file : files) {
+    NativeFs::writeFile("/tune.rtttl", file.text);
+    File stream = SPIFFS.open("/tune.rtttl", FILE_READ);
+    allocations = 0;
+    countAllocations = true;
+    notes.clear();
+    TEST_ASSERT_TRUE(parse(RtttlStringSource(file.text.c_str()), notes));
+    notes.clear();
+    TEST_ASSERT_TRUE(parse(FileSource{&stream}, notes));
+    countAllocations = false;
+    stream.close();
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, allocations, file.name.c_str());
+  }
+}
+
+void test_defaults_apply_to_notes_without_them() {
+  RtttlNote note = parseNote("x:d=8,o=4,b=100:a");
+
+  TEST_ASSERT_EQUAL_UINT16(NOTE_A4, note.frequency());
+  TEST_ASSERT_EQUAL_UINT8(8, note.duration());
+  TEST_ASSERT_FALSE(note.dotted());
+  TEST_ASSERT_EQUAL_UINT32(300, note.durationMs(100)); // a beat (quarter) is 600 ms
+
+  // no defaults section: quarter notes in octave 6 at 63 bpm
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{"x::c"});
+  TEST_ASSERT_TRUE(parser.parseHeader());
+  TEST_ASSERT_EQUAL_UINT16(63, parser.getBpm());
+  TEST_ASSERT_TRUE(parser.next(note));
+  TEST_ASSERT_EQUAL_UINT16(NOTE_C6, note.frequency());
+  TEST_ASSERT_EQUAL_UINT8(4, note.duration());
+}
+
+void test_note_fields() {
+  TEST_ASSERT_EQUAL_UINT16(NOTE_CS5, parseNote("x:d=4,o=5,b=100:c#").frequency());
+  TEST_ASSERT_EQUAL_UINT16(NOTE_CS5, parseNote("x:d=4,o=5,b=100:c_").frequency());
+  TEST_ASSERT_EQUAL_UINT16(NOTE_B5, parseNote("x:d=4,o=5,b=100:h").frequency());
+  TEST_ASSERT_EQUAL_UINT16(NOTE_G7, parseNote("x:d=4,o=5,b=100:G7").frequency());
+  TEST_ASSERT_TRUE(parseNote("x:d=4,o=5,b=100:16p").isPause());
+  TEST_ASSERT_EQUAL_UINT8(16, parseNote("x:d=4,o=5,b=100:16p").duration());
+  TEST_ASSERT_EQUAL_UINT8(3, parseNote("x:d=4,o=5,b=100:3c6").duration());
+
+  // the dot before or after the octave
+  RtttlNote before = parseNote("x:d=4,o=5,b=100:2c.6");
+  RtttlNote after = parseNote("x:d=4,o=5,b=100:2c6.");
+  TEST_ASSERT_TRUE(before.dotted());
+  TEST_ASSERT_EQUAL_UINT16(before.bits, after.bits);
+  TEST_ASSERT_EQUAL_UINT32(1800, before.durationMs(100)); // 1200 ms of a half note and half of it again
+}
+
+void test_extreme_pitches_and_durations() {
+  TEST_ASSERT_EQUAL_UINT16(NOTE_B0, parseNote("x:d=4,o=5,b=100:b0").frequency());
+  TEST_ASSERT_EQUAL_UINT16(NOTE_DS8, parseNote("x:d=4,o=5,b=100:d#8").frequency());
+  TEST_ASSERT_EQUAL_UINT8(1, parseNote("x:d=4,o=5,b=100:1c").duration());
+  TEST_ASSERT_EQUAL_UINT8(RTTTL_MAX_DURATION, parseNote("x:d=4,o=5,b=100:64c").duration());
+
+  TEST_ASSERT_FALSE(isValid("x:d=4,o=5,b=100:a0")); // below NOTE_B0
+  TEST_ASSERT_FALSE(isValid("x:d=4,o=5,b=100:e8")); // above NOTE_DS8
+  TEST_ASSERT_FALSE(isValid("x:d=4,o=5,b=100:0c"));
+  TEST_ASSERT_FALSE(isValid("x:d=4,o=5,b=100:65c"));
+}
+
+void test_whitespace_and_header() {
+  char name[8];
+  RtttlParser<RtttlStringSource> parser(RtttlStringSource{"Long tune name: d = 8 , o = 5 , b = 90 :\r\n c , d,\te "});
+
+  TEST_ASSERT_TRUE(parser.parseHeader(name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Long tu", name); // cut to the buffer
+  TEST_ASSERT_EQUAL_UINT16(90, parser.getBpm());
+  RtttlNote note = {};
+  int count = 0;
+  while (parser.next(note))
+    count++;
+  TEST_ASSERT_EQUAL_INT(3, count);
+  TEST_ASSERT_FALSE(parser.hasError());
+}
+
+void test_syntax_errors() {
+  const char *invalid[] = {
+    "no colon at all",
+    "x:d=4,o=5,b=100",      // no notes section
+    "x:d=0,o=5,b=100:c",
+    "x:d=4,o=9,b=100:c",
+    "x:d=4,o=5,b=0:c",
+    "x:d=4,o=5,q=1:c",      // unknown key
+    "x:d4,o=5,b=100:c",
+    "x:d=4,o=5,b=100:c,x",  // unknown note
+    "x:d=4,o=5,b=100:c;d",  // wrong separator
+  };
+
+  for (const char *rtttl : invalid) {
+    TEST_ASSERT_FALSE_MESSAGE(isValid(rtttl), rtttl);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, rtttlCountNotes(rtttl), rtttl);
+  }
+  TEST_ASSERT_TRUE(isValid("x:d=4,o=5,b=100:c,"));
+}
+
+void test_tables_are_built_at_compile_time() {
+  constexpr const char *text = "x:d=4,o=5,b=120:c,8e.,p";
+  constexpr auto table = rtttlParseTable<rtttlCountNotes(text)>(text);
+  static_assert(table.ok && table.count == 3 && table.bpm == 120, "parsed at compile time");
+  static_assert(table.notes[1].frequency() == NOTE_E5 && table.notes[1].dotted() && table.notes[2].isPause(), "notes");
+  static_assert(sizeof(RtttlNote) == 2, "packed notes");
+
+  TEST_ASSERT_EQUAL_UINT16(parseNote("x:d=4,o=5,b=120:8e.").bits, table.notes[1].bits);
+  constexpr auto tooShort = rtttlParseTable<2>(text);
+  TEST_ASSERT_FALSE(tooShort.ok);
+}
+
+template<typename Function>
+static uint64_t measureNanos(Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < BENCHMARK_ROUNDS; round++)
+    function();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void test_benchmark_parse_throughput() {
+  std::vector<DataFile> files = readDataFiles();
+  std::vector<String> texts;
+  size_t bytes = 0, notes = 0;
+  for (const DataFile &file : files) {
+    texts.push_back(file.text.c_str());
+    bytes += file.text.size();
+    notes += rtttlCountNotes(file.text.c_str());
+  }
+  std::vector<PlayedNote> played;
+  played.reserve(1000);
+
+  uint64_t own = measureNanos([&]() {
+    for (const DataFile &file : files) {
+      played.clear();
+      parse(file.text.c_str(), played);
+    }
+  });
+  uint64_t reference = measureNanos([&]() {
+    for (const String &text : texts) {
+      played.clear();
+      parseReference(text, played);
+    }
+  });
+
+  char message[160];
+  snprintf(message, sizeof(message), "%u files, %u bytes, %u notes: %.1f MB/s, %u ns per note, String parser %.1f MB/s",
+           (uint32_t)files.size(), (uint32_t)bytes, (uint32_t)notes, bytes * 1000.0 * BENCHMARK_ROUNDS / own,
+           (uint32_t)(own / BENCHMARK_ROUNDS / notes), bytes * 1000.0 * BENCHMARK_ROUNDS / reference);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT64(reference, own);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_data_file_matches_the_reference_parser);
+  RUN_TEST(test_parsing_allocates_nothing);
+  RUN_TEST(test_defaults_apply_to_notes_without_them);
+  RUN_TEST(test_note_fields);
+  RUN_TEST(test_extreme_pitches_and_durations);
+  RUN_TEST(test_whitespace_and_header);
+  RUN_TEST(test_syntax_errors);
+  RUN_TEST(test_tables_are_built_at_compile_time);
+  RUN_TEST(test_benchmark_parse_throughput);
+  return UNITY_END();
+}
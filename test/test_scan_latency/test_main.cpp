@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "AuthCache.h"
+#include "FingerprintManager.h"
+#include "LatencyMetrics.h"
+#include "R503Simulator.h"
+#include "Simulation.h"
+
+#define SCAN_MAX_CALLS 100
+
+// getImage + image2Tz + search of the simulated sensor plus the packets at 115200 baud and the 1 ms ack polling
+#define MATCH_LATENCY_BUDGET_MS 400
+// the longest single command (image2Tz) plus its packets, one call of scanFingerprint() never takes longer
+#define SCAN_CALL_BUDGET_MS 200
+
+static R503Simulator *sensor = nullptr;
+static FingerprintManager *fingerManager = nullptr;
+static uint32_t maxCallMicros = 0;
+
+void setUp() {
+  Simulation::reset();
+  latencyMetrics.reset();
+  delete fingerManager;
+  delete sensor;
+  sensor = new R503Simulator();
+  sensor->attach(Serial2);
+  fingerManager = new FingerprintManager();
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  maxCallMicros = 0;
+}
+
+void tearDown() {
+}
+
+// ticks the scan like the sensor task does until the scan is finished
+static Match scan() {
+  Match match;
+  for (int i = 0; i < SCAN_MAX_CALLS; i++) {
+    uint64_t start = NativeClock::getMicros();
+    match = fingerManager->scanFingerprint();
+    maxCallMicros = max(maxCallMicros, (uint32_t)(NativeClock::getMicros() - start));
+    if (match.scanResult != ScanResult::scanning)
+      return match;
+  }
+  TEST_FAIL_MESSAGE("scan did not finish");
+  return match;
+}
+
+// finger down: the finger is on the sensor and the touch ring edge is captured at the same time
+static uint64_t fingerDown(int fingerNumber, uint32_t durationMillis) {
+  sensor->placeFingerNow(fingerNumber, durationMillis);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  return NativeClock::getMicros();
+}
+
+void test_match_latency_from_finger_down_to_decision() {
+  sensor->storeTemplate(7, 42);
+  AuthCache authCache;
+  authCache.store(7, UserLookupResult::authorized);
+
+  uint64_t down = fingerDown(42, 2000);
+  Match match = scan();
+  AuthState state;
+  AuthLookup lookup = authCache.lookup(match.matchId, state);
+  uint32_t latencyMs = (NativeClock::getMicros() - down) / 1000;
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_TRUE(lookup == AuthLookup::fresh);
+  TEST_ASSERT_TRUE(state == AuthState::authorized);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)down, match.scanStartMicros);
+  char message[64];
+  snprintf(message, sizeof(message), "finger down to door decision: %u ms", latencyMs);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN_UINT32(MATCH_LATENCY_BUDGET_MS, latencyMs);
+}
+
+void test_scan_latency_is_recorded_from_the_ring_edge() {
+  sensor->storeTemplate(7, 42);
+
+  uint64_t down = fingerDown(42, 2000);
+  NativeClock::advanceMillis(20); // the scan loop notices the edge later
+  Match match = scan();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  LatencySummary summary = latencyMetrics.getSummary(LatencyStage::scan);
+  TEST_ASSERT_EQUAL_UINT32(1, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(NativeClock::getMicros() - down, summary.max);
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::ringToImage).count);
+}
+
+void test_no_call_blocks_longer_than_one_sensor_command() {
+  sensor->storeTemplate(7, 42);
+
+  fingerDown(13, 10000); // unknown finger, all five passes
+  Match match = scan();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noMatchFound);
+  TEST_ASSERT_LESS_THAN_UINT32(SCAN_CALL_BUDGET_MS * 1000, maxCallMicros);
+}
+
+void test_no_match_is_decided_after_five_passes() {
+  sensor->storeTemplate(7, 42);
+
+  uint64_t down = fingerDown(13, 10000);
+  Match match = scan();
+  uint32_t latencyMs = (NativeClock::getMicros() - down) / 1000;
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noMatchFound);
+  TEST_ASSERT_EQUAL_INT(5, sensor->countCommands(FINGERPRINT_SEARCH));
+  TEST_ASSERT_LESS_THAN_UINT32(5 * MATCH_LATENCY_BUDGET_MS, latencyMs);
+}
+
+void test_ring_touch_without_finger_ends_as_no_match() {
+  sensor->clearCommands();
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+
+  Match match = scan();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noMatchFound);
+  TEST_ASSERT_EQUAL_INT(15, sensor->countCommands(FINGERPRINT_GETIMAGE));
+  TEST_ASSERT_EQUAL_INT(0, sensor->countCommands(FINGERPRINT_IMAGE2TZ));
+  TEST_ASSERT_LESS_THAN_UINT32(SCAN_CALL_BUDGET_MS * 1000, maxCallMicros);
+}
+
+void test_back_to_back_users_are_not_delayed() {
+  sensor->storeTemplate(7, 42);
+  sensor->storeTemplate(8, 43);
+
+  fingerDown(42, 1000);
+  TEST_ASSERT_TRUE(scan().scanResult == ScanResult::matchFound);
+  sensor->removeFingers();
+
+  // the next user puts the finger down right after the first one lifted it
+  uint64_t down = fingerDown(43, 1000);
+  Match match = scan();
+  uint32_t latencyMs = (NativeClock::getMicros() - down) / 1000;
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(8, match.matchId);
+  TEST_ASSERT_LESS_THAN_UINT32(MATCH_LATENCY_BUDGET_MS, latencyMs);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_match_latency_from_finger_down_to_decision);
+  RUN_TEST(test_scan_latency_is_recorded_from_the_ring_edge);
+  RUN_TEST(test_no_call_blocks_longer_than_one_sensor_command);
+  RUN_TEST(test_no_match_is_decided_after_five_passes);
+  RUN_TEST(test_ring_touch_without_finger_ends_as_no_match);
+  RUN_TEST(test_back_to_back_users_are_not_delayed);
+  return UNITY_END();
+}
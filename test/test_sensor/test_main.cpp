@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "Simulation.h"
+
+#define SCAN_MAX_CALLS 100
+
+static R503Simulator *sensor = nullptr;
+static FingerprintManager *fingerManager = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete fingerManager;
+  delete sensor;
+  sensor = new R503Simulator();
+  sensor->attach(Serial2);
+  fingerManager = new FingerprintManager();
+}
+
+void tearDown() {
+}
+
+// scans like loop() does until the scan is finished
+static Match scan() {
+  Match match;
+  for (int i = 0; i < SCAN_MAX_CALLS; i++) {
+    match = fingerManager->scanFingerprint();
+    if (match.scanResult != ScanResult::scanning)
+      return match;
+  }
+  TEST_FAIL_MESSAGE("scan did not finish");
+  return match;
+}
+
+static void touchRing() {
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+}
+
+void test_connect_switches_new_sensor_to_115200() {
+  TEST_ASSERT_EQUAL_UINT32(57600, sensor->getBaudRate());
+
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  TEST_ASSERT_EQUAL_UINT32(115200, sensor->getBaudRate());
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_WRITE_REG));
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_READSYSPARAM));
+}
+
+void test_connect_keeps_baud_rate_of_known_sensor() {
+  sensor->setBaudRate(115200);
+
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  TEST_ASSERT_EQUAL_INT(0, sensor->countCommands(FINGERPRINT_WRITE_REG));
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_VERIFYPASSWORD));
+}
+
+void test_connect_fails_without_sensor() {
+  sensor->setPresent(false);
+
+  TEST_ASSERT_FALSE(fingerManager->connect());
+  TEST_ASSERT_FALSE(fingerManager->connected);
+}
+
+void test_scan_without_touch_reports_no_finger() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  sensor->clearCommands();
+
+  Match match = fingerManager->scanFingerprint();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noFinger);
+  TEST_ASSERT_EQUAL_INT(0, sensor->countCommands(FINGERPRINT_GETIMAGE));
+}
+
+void test_scan_finds_enrolled_finger() {
+  sensor->storeTemplate(7, 42);
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  fingerManager->renameFinger(7, "Alice");
+
+  sensor->placeFingerNow(42, 2000);
+  touchRing();
+  Match match = scan();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, match.matchId);
+  TEST_ASSERT_EQUAL_STRING("Alice", match.matchName);
+  TEST_ASSERT_EQUAL_UINT16(R503_MATCH_SCORE, match.matchConfidence);
+}
+
+void test_scan_of_unknown_finger_gives_up_after_five_passes() {
+  sensor->storeTemplate(7, 42);
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  sensor->clearCommands();
+
+  sensor->placeFingerNow(13, 10000);
+  touchRing();
+  Match match = scan();
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noMatchFound);
+  TEST_ASSERT_EQUAL_INT(5, sensor->countCommands(FINGERPRINT_SEARCH));
+}
+
+void test_enroll_stores_template_and_name() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  // five takes: the finger is placed for a second and lifted for a second
+  uint64_t start = NativeClock::getMicros();
+  for (int take = 0; take < 5; take++)
+    sensor->placeFinger(42, start + take * 2000000ull, start + take * 2000000ull + 1000000ull);
+  NewFinger newFinger = fingerManager->enrollFinger(3, "Bob");
+
+  TEST_ASSERT_TRUE(newFinger.enrollResult == EnrollResult::ok);
+  TEST_ASSERT_EQUAL_INT(42, sensor->getTemplateFinger(3));
+  TEST_ASSERT_EQUAL_INT(5, sensor->countCommands(FINGERPRINT_IMAGE2TZ));
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager->getFingerName(3, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Bob", name);
+
+  // the enrolled finger is found by the next scan
+  sensor->placeFingerNow(42, 2000);
+  touchRing();
+  Match match = scan();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(3, match.matchId);
+}
+
+void test_enroll_name_survives_reboot() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  uint64_t start = NativeClock::getMicros();
+  for (int take = 0; take < 5; take++)
+    sensor->placeFinger(42, start + take * 2000000ull, start + take * 2000000ull + 1000000ull);
+  TEST_ASSERT_TRUE(fingerManager->enrollFinger(3, "Bob").enrollResult == EnrollResult::ok);
+  NativeClock::advanceMillis(FINGER_LIST_WRITE_DELAY_MS);
+  fingerManager->process();
+
+  delete fingerManager;
+  fingerManager = new FingerprintManager();
+  sensor->powerCycle();
+  TEST_ASSERT_TRUE(fingerManager->connect());
+
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager->getFingerName(3, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Bob", name);
+}
+
+void test_enroll_with_different_fingers_fails() {
+  TEST_ASSERT_TRUE(fingerManager->connect());
+  uint64_t start = NativeClock::getMicros();
+  for (int take = 0; take < 5; take++)
+    sensor->placeFinger(take == 2 ? 43 : 42, start + take * 2000000ull, start + take * 2000000ull + 1000000ull);
+
+  NewFinger newFinger = fingerManager->enrollFinger(3, "Bob");
+
+  TEST_ASSERT_TRUE(newFinger.enrollResult == EnrollResult::error);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_ENROLLMISMATCH, newFinger.returnCode);
+  TEST_ASSERT_FALSE(sensor->hasTemplate(3));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_switches_new_sensor_to_115200);
+  RUN_TEST(test_connect_keeps_baud_rate_of_known_sensor);
+  RUN_TEST(test_connect_fails_without_sensor);
+  RUN_TEST(test_scan_without_touch_reports_no_finger);
+  RUN_TEST(test_scan_finds_enrolled_finger);
+  RUN_TEST(test_scan_of_unknown_finger_gives_up_after_five_passes);
+  RUN_TEST(test_enroll_stores_template_and_name);
+  RUN_TEST(test_enroll_name_survives_reboot);
+  RUN_TEST(test_enroll_with_different_fingers_fails);
+  return UNITY_END();
+}
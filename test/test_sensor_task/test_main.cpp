@@ -0,0 +1,167 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "SensorTask.h"
+#include "Simulation.h"
+
+/*
+  The sensor task runs in its own thread like on the ESP32, other threads post commands concurrently. The task can't be
+  stopped, so all tests share it. Assertions are made in the test thread only, it waits in real time.
+*/
+
+#define POSTING_THREADS 4
+#define POSTS_PER_THREAD 40
+#define POST_MAX_REAL_MICROS 2000 // a post never waits for the sensor, only for the queue lock
+#define WAIT_REAL_MS 20000
+
+static R503Simulator sensor;
+static FingerprintManager fingerManager;
+static SensorTask sensorTask;
+static std::vector<SensorEvent> events;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void drainEvents() {
+  SensorEvent event;
+  while (sensorTask.pollEvent(event))
+    events.push_back(event);
+}
+
+static int countEvents(SensorEventType type) {
+  return std::count_if(events.begin(), events.end(), [type](const SensorEvent &event) { return event.type == type; });
+}
+
+// waits in real time until count events of the type arrived
+static bool waitForEvents(SensorEventType type, int count) {
+  for (int i = 0; i < WAIT_REAL_MS * 10; i++) {
+    drainEvents();
+    if (countEvents(type) >= count)
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+void test_boot_reports_ready() {
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::ready, 1));
+  TEST_ASSERT_TRUE(events[0].ok);
+  TEST_ASSERT_TRUE(fingerManager.connected);
+}
+
+void test_posts_never_block_under_contention() {
+  events.clear();
+  std::atomic<int> accepted{0};
+  std::atomic<uint32_t> maxPostMicros{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < POSTING_THREADS; t++) {
+    threads.emplace_back([t, &accepted, &maxPostMicros]() {
+      for (int i = 0; i < POSTS_PER_THREAD; i++) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = sensorTask.postRename(1 + t * POSTS_PER_THREAD + i, "user");
+        uint32_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        uint32_t current = maxPostMicros;
+        while (micros > current && !maxPostMicros.compare_exchange_weak(current, micros));
+        if (ok)
+          accepted++;
+      }
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+
+  // every accepted command is executed exactly once, the others were refused right away
+  TEST_ASSERT_GREATER_OR_EQUAL_INT(SENSOR_COMMAND_QUEUE_LENGTH, accepted.load());
+  TEST_ASSERT_LESS_THAN_UINT32(POST_MAX_REAL_MICROS, maxPostMicros.load());
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameDone, accepted));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  drainEvents();
+  TEST_ASSERT_EQUAL_INT(accepted, countEvents(SensorEventType::renameDone));
+}
+
+void test_scans_continue_while_commands_are_queued() {
+  events.clear();
+  sensor.storeTemplate(7, 42);
+  sensor.storeTemplate(150, 43);
+  sensor.clearCommands();
+
+  sensor.placeFingerNow(42, 5000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  std::thread poster([]() {
+    while (!sensorTask.postDelete(150))
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  });
+  poster.join();
+
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::scan, 1));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::deleteDone, 1));
+  auto scanEvent = std::find_if(events.begin(), events.end(), [](const SensorEvent &event) { return event.type == SensorEventType::scan; });
+  TEST_ASSERT_TRUE(scanEvent->match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, scanEvent->match.matchId);
+  TEST_ASSERT_FALSE(sensor.hasTemplate(150));
+
+  // the delete was not executed in the middle of the scan, the scan owns the char buffers until it is finished
+  std::vector<R503Command> commands = sensor.getCommands();
+  auto convert = std::find_if(commands.begin(), commands.end(), [](const R503Command &command) { return command.code == FINGERPRINT_IMAGE2TZ; });
+  auto search = std::find_if(convert, commands.end(), [](const R503Command &command) { return command.code == FINGERPRINT_SEARCH; });
+  TEST_ASSERT_TRUE(convert != commands.end() && search != commands.end());
+  TEST_ASSERT_TRUE(std::none_of(convert, search, [](const R503Command &command) { return command.code == FINGERPRINT_DELETE; }));
+}
+
+void test_results_come_back_in_order() {
+  events.clear();
+
+  for (int i = 0; i < 5; i++)
+    TEST_ASSERT_TRUE(sensorTask.postRename(20 + i, String("name") + i));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameDone, 5));
+
+  for (int i = 0; i < 5; i++)
+    TEST_ASSERT_EQUAL_UINT16(20 + i, events[i].id);
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_TRUE(fingerManager.getFingerName(24, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("name4", name);
+}
+
+void test_failed_delete_is_reported() {
+  events.clear();
+  sensor.storeTemplate(30, 44);
+  sensor.injectReply(FINGERPRINT_DELETE, FINGERPRINT_DELETEFAIL);
+
+  TEST_ASSERT_TRUE(sensorTask.postDelete(30));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::deleteDone, 1));
+  TEST_ASSERT_FALSE(events.back().ok);
+  TEST_ASSERT_EQUAL_UINT16(30, events.back().id);
+  TEST_ASSERT_TRUE(sensor.hasTemplate(30));
+
+  TEST_ASSERT_TRUE(sensorTask.postDelete(30));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::deleteDone, 2));
+  TEST_ASSERT_TRUE(events.back().ok);
+  TEST_ASSERT_FALSE(sensor.hasTemplate(30));
+}
+
+int main(int argc, char **argv) {
+  Simulation::reset();
+  sensor.attach(Serial2);
+  sensorTask.begin(&fingerManager);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_boot_reports_ready);
+  RUN_TEST(test_posts_never_block_under_contention);
+  RUN_TEST(test_scans_continue_while_commands_are_queued);
+  RUN_TEST(test_results_come_back_in_order);
+  RUN_TEST(test_failed_delete_is_reported);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the sensor task never returns
+}
@@ -0,0 +1,199 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "SensorTransport.h"
+#include "Simulation.h"
+
+/*
+  UART traffic of the sensor transport against the simulated R503. All durations are simulated time: the bytes on the
+  line at the baud rate, the command latencies of the sensor and the ack polling of the Adafruit library.
+*/
+
+#define BENCHMARK_COMMANDS 200
+#define SCAN_MAX_CALLS 100
+
+static R503Simulator *sensor = nullptr;
+static SensorTransport *transport = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete transport;
+  delete sensor;
+  sensor = new R503Simulator();
+  sensor->attach(Serial2);
+  transport = new SensorTransport(&Serial2);
+}
+
+void tearDown() {
+}
+
+// a transport talking to the sensor at the baud rate, without switching it
+static void beginAt(uint32_t baudRate) {
+  sensor->setBaudRate(baudRate);
+  transport->begin(baudRate);
+  TEST_ASSERT_TRUE(transport->verifyPassword());
+  sensor->clearCommands();
+}
+
+void test_connect_switches_to_the_fast_baud_rate() {
+  TEST_ASSERT_TRUE(transport->connect());
+
+  TEST_ASSERT_EQUAL_UINT32(SENSOR_BAUD_RATE, transport->getBaudRate());
+  TEST_ASSERT_EQUAL_UINT32(SENSOR_BAUD_RATE, sensor->getBaudRate());
+
+  // next boot: found at the fast rate right away
+  sensor->powerCycle();
+  sensor->clearCommands();
+  TEST_ASSERT_TRUE(transport->connect());
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_VERIFYPASSWORD));
+}
+
+void test_connect_stays_at_default_if_the_switch_fails() {
+  sensor->injectReply(FINGERPRINT_WRITE_REG, FINGERPRINT_PACKETRECIEVEERR);
+
+  TEST_ASSERT_TRUE(transport->connect());
+
+  TEST_ASSERT_EQUAL_UINT32(SENSOR_DEFAULT_BAUD_RATE, transport->getBaudRate());
+  TEST_ASSERT_TRUE(transport->verifyPassword());
+}
+
+void test_unchanged_led_is_not_sent_again() {
+  beginAt(SENSOR_BAUD_RATE);
+
+  transport->setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE);
+  TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->flushLed());
+  transport->setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE);
+  TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->flushLed());
+
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_AURALEDCONFIG));
+}
+
+void test_only_the_last_pending_led_is_sent() {
+  beginAt(SENSOR_BAUD_RATE);
+
+  transport->setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_RED);
+  transport->setLed(FINGERPRINT_LED_BREATHING, 100, FINGERPRINT_LED_PURPLE);
+  transport->flushLed();
+
+  std::vector<R503Led> leds = sensor->getLeds();
+  TEST_ASSERT_EQUAL_UINT32(1, leds.size());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_LED_PURPLE, leds[0].color);
+}
+
+void test_led_goes_out_with_get_image() {
+  beginAt(SENSOR_BAUD_RATE);
+  sensor->placeFingerNow(42, 1000);
+
+  transport->setLed(FINGERPRINT_LED_FLASHING, 25, FINGERPRINT_LED_BLUE, 10);
+  TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->getImagePipelined());
+
+  std::vector<R503Command> commands = sensor->getCommands();
+  TEST_ASSERT_EQUAL_UINT32(2, commands.size());
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_AURALEDCONFIG, commands[0].code);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_GETIMAGE, commands[1].code);
+  // the getImage packet followed right away, not after the LED ack: 12 bytes at 115200 baud
+  TEST_ASSERT_LESS_THAN_UINT32(1500, (uint32_t)(commands[1].micros - commands[0].micros));
+  TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->flushLed()); // nothing pending
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_AURALEDCONFIG));
+}
+
+void test_failed_led_does_not_fail_get_image() {
+  beginAt(SENSOR_BAUD_RATE);
+  sensor->placeFingerNow(42, 1000);
+  sensor->injectReply(FINGERPRINT_AURALEDCONFIG, FINGERPRINT_PACKETRECIEVEERR);
+
+  transport->setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_RED);
+  TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->getImagePipelined());
+
+  // the LED is not known as shown, so the same state is sent again
+  transport->setLed(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_RED);
+  transport->flushLed();
+  TEST_ASSERT_EQUAL_INT(2, sensor->countCommands(FINGERPRINT_AURALEDCONFIG));
+}
+
+void test_scan_takes_one_get_image_per_pass() {
+  sensor->storeTemplate(7, 42);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor->clearCommands();
+
+  sensor->placeFingerNow(42, 2000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  Match match;
+  for (int i = 0; i < SCAN_MAX_CALLS && (match = fingerManager.scanFingerprint()).scanResult == ScanResult::scanning; i++);
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_GETIMAGE));
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_IMAGE2TZ));
+  TEST_ASSERT_EQUAL_INT(1, sensor->countCommands(FINGERPRINT_SEARCH));
+}
+
+// LED commands only: the sensor answers them right away, so the line speed and the turnarounds dominate
+static uint32_t measureLedCommandsPerSecond(uint32_t baudRate) {
+  beginAt(baudRate);
+  uint64_t start = NativeClock::getMicros();
+  for (int i = 0; i < BENCHMARK_COMMANDS; i++) {
+    transport->setLed(FINGERPRINT_LED_ON, 0, (i % 2) ? FINGERPRINT_LED_RED : FINGERPRINT_LED_BLUE);
+    TEST_ASSERT_EQUAL_INT(FINGERPRINT_OK, transport->flushLed());
+  }
+  return (uint64_t)BENCHMARK_COMMANDS * 1000000 / (NativeClock::getMicros() - start);
+}
+
+// the imaging step of the old scan loop: LED update, getImage for the log line, getImage again
+static uint32_t measureImagingBefore(uint32_t baudRate) {
+  beginAt(baudRate);
+  uint64_t start = NativeClock::getMicros();
+  for (int i = 0; i < BENCHMARK_COMMANDS; i++) {
+    transport->setLed(FINGERPRINT_LED_ON, 0, (i % 2) ? FINGERPRINT_LED_RED : FINGERPRINT_LED_BLUE);
+    transport->flushLed();
+    transport->getImage();
+    transport->getImage();
+  }
+  return (NativeClock::getMicros() - start) / BENCHMARK_COMMANDS;
+}
+
+static uint32_t measureImagingAfter(uint32_t baudRate) {
+  beginAt(baudRate);
+  uint64_t start = NativeClock::getMicros();
+  for (int i = 0; i < BENCHMARK_COMMANDS; i++) {
+    transport->setLed(FINGERPRINT_LED_ON, 0, (i % 2) ? FINGERPRINT_LED_RED : FINGERPRINT_LED_BLUE);
+    transport->getImagePipelined();
+  }
+  return (NativeClock::getMicros() - start) / BENCHMARK_COMMANDS;
+}
+
+void test_benchmark_commands_per_second() {
+  uint32_t slowRate = measureLedCommandsPerSecond(SENSOR_DEFAULT_BAUD_RATE);
+  uint32_t fastRate = measureLedCommandsPerSecond(SENSOR_BAUD_RATE);
+
+  // no finger on the sensor: every getImage takes the short "no finger" time of the sensor, like while waiting for one
+  uint32_t before = measureImagingBefore(SENSOR_DEFAULT_BAUD_RATE);
+  uint32_t after = measureImagingAfter(SENSOR_BAUD_RATE);
+  uint32_t pipelinedSlow = measureImagingAfter(SENSOR_DEFAULT_BAUD_RATE);
+
+  char message[120];
+  snprintf(message, sizeof(message), "LED commands/s: %u at %u baud, %u at %u baud", slowRate, SENSOR_DEFAULT_BAUD_RATE, fastRate, SENSOR_BAUD_RATE);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message), "imaging step: %u us before, %u us pipelined at %u baud, %u us pipelined at %u baud",
+           before, pipelinedSlow, SENSOR_DEFAULT_BAUD_RATE, after, SENSOR_BAUD_RATE);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_GREATER_THAN_UINT32(slowRate * 13 / 10, fastRate);
+  TEST_ASSERT_LESS_THAN_UINT32(before * 6 / 10, after); // one getImage and one turnaround less
+  TEST_ASSERT_LESS_THAN_UINT32(pipelinedSlow, after);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_switches_to_the_fast_baud_rate);
+  RUN_TEST(test_connect_stays_at_default_if_the_switch_fails);
+  RUN_TEST(test_unchanged_led_is_not_sent_again);
+  RUN_TEST(test_only_the_last_pending_led_is_sent);
+  RUN_TEST(test_led_goes_out_with_get_image);
+  RUN_TEST(test_failed_led_does_not_fail_get_image);
+  RUN_TEST(test_scan_takes_one_get_image_per_pass);
+  RUN_TEST(test_benchmark_commands_per_second);
+  return UNITY_END();
+}
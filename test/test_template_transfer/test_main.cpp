@@ -0,0 +1,224 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <string>
+#include <SPIFFS.h>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "TemplateArchive.h"
+#include "Simulation.h"
+
+/*
+  Sensor replacement on the simulated R503: the templates are exported from the old sensor into the archive on SPIFFS
+  and imported into a new one on a board fresh from the factory, so the names come from the archive only.
+*/
+
+#define SCAN_MAX_CALLS 100
+#define NEW_SENSOR_PACKET_SETTING 0 // 32 byte data packets, the old sensor sends 128
+#define CONFIRM_FINGER 99           // any finger on the sensor confirms the import
+#define FLASH_STALL_MICROS 30000    // per write, the RX buffer of Serial2 is full after 22 ms at 115200 baud
+#define LOST_WRITE_AFTER_BYTES 1000 // within the data packets of the first template, after the confirmation
+
+static const struct { uint16_t id; int finger; const char *name; } fingers[] = {
+  { 1, 11, "Alice" }, { 7, 42, "Bob" }, { 150, 23, "" }
+};
+static const int fingerCount = sizeof(fingers) / sizeof(fingers[0]);
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+}
+
+// the old sensor with its fingers, returns the exported archive
+static std::string exportFingers(uint32_t *exportMs = nullptr) {
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  for (int i = 0; i < fingerCount; i++)
+    sensor.storeTemplate(fingers[i].id, fingers[i].finger);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  for (int i = 0; i < fingerCount; i++)
+    fingerManager.renameFinger(fingers[i].id, fingers[i].name);
+
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_EQUAL_INT(fingerCount, fingerManager.exportSensorDB());
+  if (exportMs != nullptr)
+    *exportMs = (uint32_t)((NativeClock::getMicros() - start) / 1000);
+  TEST_ASSERT_EQUAL_UINT32(0, Serial2.getOverflowCount());
+  TEST_ASSERT_TRUE(SPIFFS.exists(TEMPLATE_ARCHIVE_PATH));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TEMPLATE_ARCHIVE_TEMP_PATH));
+  return NativeFs::readFile(TEMPLATE_ARCHIVE_PATH);
+}
+
+// a new board and a new sensor with the archive on SPIFFS
+static void replaceBoard(R503Simulator &sensor, const std::string &archive) {
+  Simulation::reset();
+  NativeFs::setMounted(true);
+  NativeFs::writeFile(TEMPLATE_ARCHIVE_PATH, archive);
+  sensor.setPacketSizeSetting(NEW_SENSOR_PACKET_SETTING);
+  sensor.attach(Serial2);
+}
+
+static Match scan(FingerprintManager &fingerManager, R503Simulator &sensor, int finger) {
+  sensor.placeFingerNow(finger, 2000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  Match match;
+  for (int i = 0; i < SCAN_MAX_CALLS; i++) {
+    match = fingerManager.scanFingerprint();
+    if (match.scanResult != ScanResult::scanning)
+      break;
+  }
+  NativeGpio::setLevel(touchRingPin, HIGH);
+  sensor.removeFingers();
+  return match;
+}
+
+void test_export_import_round_trip() {
+  uint32_t exportMs;
+  std::string archive = exportFingers(&exportMs);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Export of 3 templates finished"));
+  TEST_ASSERT_GREATER_THAN_UINT32(fingerCount * R503_TEMPLATE_SIZE, archive.size());
+
+  R503Simulator sensor;
+  replaceBoard(sensor, archive);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.placeFingerNow(CONFIRM_FINGER, 500);
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_EQUAL_INT(fingerCount, fingerManager.importSensorDB());
+  uint32_t importMs = (uint32_t)((NativeClock::getMicros() - start) / 1000);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Import of 3 templates finished"));
+
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  for (int i = 0; i < fingerCount; i++) {
+    TEST_ASSERT_EQUAL_INT(fingers[i].finger, sensor.getTemplateFinger(fingers[i].id));
+    TEST_ASSERT_TRUE(sensor.getTemplate(fingers[i].id) == R503Simulator::makeTemplate(fingers[i].finger));
+    if (fingers[i].name[0] == 0) {
+      TEST_ASSERT_FALSE(fingerManager.getFingerName(fingers[i].id, name, sizeof(name))); // a template without a name
+      continue;
+    }
+    TEST_ASSERT_TRUE(fingerManager.getFingerName(fingers[i].id, name, sizeof(name)));
+    TEST_ASSERT_EQUAL_STRING(fingers[i].name, name);
+  }
+  TEST_ASSERT_EQUAL_INT(fingerCount, sensor.getTemplateCount());
+
+  // the new sensor finds the fingers, the names survive a reboot
+  Match match = scan(fingerManager, sensor, 42);
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, match.matchId);
+  FingerprintManager rebooted;
+  TEST_ASSERT_TRUE(rebooted.connect());
+  TEST_ASSERT_TRUE(rebooted.getFingerName(1, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Alice", name);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%d templates: export %u ms (%u bytes/s), import %u ms with the confirmation, archive %u bytes (simulated time)",
+           fingerCount, exportMs, (uint32_t)((uint64_t)archive.size() * 1000 / exportMs), importMs, (uint32_t)archive.size());
+  TEST_MESSAGE(message);
+}
+
+void test_import_waits_for_a_finger_at_the_sensor() {
+  std::string archive = exportFingers();
+  R503Simulator sensor;
+  replaceBoard(sensor, archive);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+
+  uint64_t start = NativeClock::getMicros();
+  TEST_ASSERT_EQUAL_INT(-1, fingerManager.importSensorDB());
+
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(TEMPLATE_IMPORT_CONFIRM_TIMEOUT_MS * 1000ull, NativeClock::getMicros() - start);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("it was not confirmed at the sensor"));
+  TEST_ASSERT_EQUAL_INT(0, sensor.countCommands(FINGERPRINT_DOWNCHAR));
+  TEST_ASSERT_EQUAL_INT(0, sensor.getTemplateCount());
+  std::vector<R503Led> leds = sensor.getLeds();
+  TEST_ASSERT_TRUE(std::any_of(leds.begin(), leds.end(), [](const R503Led &led) {
+    return led.control == FINGERPRINT_LED_FLASHING && led.color == FINGERPRINT_LED_BLUE;
+  }));
+}
+
+void test_corrupted_archive_is_not_imported() {
+  std::string archive = exportFingers();
+  archive[archive.size() / 2] ^= 0x01;
+  R503Simulator sensor;
+  replaceBoard(sensor, archive);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.placeFingerNow(CONFIRM_FINGER, 500);
+
+  TEST_ASSERT_EQUAL_INT(-1, fingerManager.importSensorDB());
+
+  TEST_ASSERT_TRUE(Simulation::wasNotified("the archive is missing or corrupted"));
+  TEST_ASSERT_EQUAL_INT(0, sensor.countCommands(FINGERPRINT_DOWNCHAR));
+  TEST_ASSERT_EQUAL_INT(0, sensor.getTemplateCount());
+}
+
+// the upload of a template is received completely before the slow flash write, no byte is lost on Serial2
+void test_slow_flash_does_not_overflow_the_rx_buffer() {
+  NativeFs::setWriteLatency(FLASH_STALL_MICROS, 0);
+  std::string archive = exportFingers(); // checks the overflow count
+
+  NativeFs::setWriteLatency(0, 0);
+  R503Simulator sensor;
+  replaceBoard(sensor, archive);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.placeFingerNow(CONFIRM_FINGER, 500);
+  TEST_ASSERT_EQUAL_INT(fingerCount, fingerManager.importSensorDB());
+  for (int i = 0; i < fingerCount; i++)
+    TEST_ASSERT_TRUE(sensor.getTemplate(fingers[i].id) == R503Simulator::makeTemplate(fingers[i].finger));
+}
+
+// a data packet that can't be written to the UART: its template is skipped, the next ones are imported
+void test_failed_packet_write_skips_the_template() {
+  std::string archive = exportFingers();
+  R503Simulator sensor;
+  replaceBoard(sensor, archive);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  sensor.placeFingerNow(CONFIRM_FINGER, 500);
+  Serial2.loseWriteAfter(LOST_WRITE_AFTER_BYTES);
+
+  TEST_ASSERT_EQUAL_INT(fingerCount - 1, fingerManager.importSensorDB());
+
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Import of finger template #1 failed"));
+  TEST_ASSERT_TRUE(Simulation::wasNotified("1 templates of the archive were not imported"));
+  TEST_ASSERT_FALSE(sensor.hasTemplate(fingers[0].id));
+  char name[FINGER_NAME_MAX_LENGTH + 1];
+  TEST_ASSERT_FALSE(fingerManager.getFingerName(fingers[0].id, name, sizeof(name)));
+  for (int i = 1; i < fingerCount; i++)
+    TEST_ASSERT_TRUE(sensor.getTemplate(fingers[i].id) == R503Simulator::makeTemplate(fingers[i].finger));
+  TEST_ASSERT_TRUE(fingerManager.getFingerName(7, name, sizeof(name)));
+  TEST_ASSERT_EQUAL_STRING("Bob", name);
+}
+
+void test_failed_flash_write_keeps_the_old_archive() {
+  std::string archive = exportFingers();
+
+  NativeFs::failWritesAfter(R503_TEMPLATE_SIZE);
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  sensor.storeTemplate(1, 11);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  TEST_ASSERT_EQUAL_INT(-1, fingerManager.exportSensorDB());
+  NativeFs::failWritesAfter(-1);
+
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Template export failed"));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TEMPLATE_ARCHIVE_TEMP_PATH));
+  TEST_ASSERT_TRUE(archive == NativeFs::readFile(TEMPLATE_ARCHIVE_PATH));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_export_import_round_trip);
+  RUN_TEST(test_import_waits_for_a_finger_at_the_sensor);
+  RUN_TEST(test_corrupted_archive_is_not_imported);
+  RUN_TEST(test_slow_flash_does_not_overflow_the_rx_buffer);
+  RUN_TEST(test_failed_packet_write_skips_the_template);
+  RUN_TEST(test_failed_flash_write_keeps_the_old_archive);
+  return UNITY_END();
+}
@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "EventLog.h"
+#include "EventStream.h"
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "TimeService.h"
+#include "Simulation.h"
+
+/*
+  Most tests use their own TimeService, the global one is synced halfway through the scan test and stays synced. SNTP is the
+  simulated wall clock (NativeClock::setWallClock()), the monotonic clock is esp_timer.
+*/
+
+#define SYNC_TIME 1700000000ul      // 2023-11-14 22:13:20 UTC
+#define SCAN_MAX_CALLS 100
+#define SCAN_JITTER_MICROS 10000    // the 1 ms acknowledge polling lines up differently, getLocalTime() waited seconds
+#define BENCHMARK_TIMESTAMPS 100000
+#define CALL_MAX_REAL_MICROS 1000   // now() and formatNow() never wait for the sync
+
+// counts the heap allocations while enabled
+static bool countAllocations = false;
+static uint32_t allocations = 0;
+
+void* operator new(size_t size) {
+  if (countAllocations)
+    allocations++;
+  void *pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t size) noexcept {
+  free(pointer);
+}
+
+void setUp() {
+  Simulation::reset();
+}
+
+void tearDown() {
+  countAllocations = false;
+}
+
+// what getTimestampString() did once getLocalTime() had the time
+static String legacyTimestamp() {
+  time_t now = time(nullptr);
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+  char buffer[25];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S %Z", &timeinfo);
+  String datetime = String(buffer);
+  return datetime;
+}
+
+// ticks the scan like the sensor task does, returns the simulated micros from finger down to the decision
+static uint32_t scanMicros(FingerprintManager &fingerManager, R503Simulator &sensor) {
+  sensor.placeFingerNow(42, 2000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  uint64_t start = NativeClock::getMicros();
+  for (int i = 0; i < SCAN_MAX_CALLS; i++) {
+    Match match = fingerManager.scanFingerprint();
+    if (match.scanResult != ScanResult::scanning) {
+      TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+      NativeGpio::setLevel(touchRingPin, HIGH);
+      sensor.removeFingers();
+      return (uint32_t)(NativeClock::getMicros() - start);
+    }
+  }
+  TEST_FAIL_MESSAGE("scan did not finish");
+  return 0;
+}
+
+void test_unsynced_time_is_zero_without_waiting() {
+  TimeService service;
+  service.begin();
+  NativeClock::advanceMillis(1234);
+
+  uint64_t simulatedStart = NativeClock::getMicros();
+  auto start = std::chrono::steady_clock::now();
+  TEST_ASSERT_FALSE(service.isSynced());
+  TEST_ASSERT_EQUAL_UINT32(0, service.now());
+  char text[TIME_TIMESTAMP_LENGTH];
+  TEST_ASSERT_EQUAL_UINT32(7, service.formatNow(text, sizeof(text)));
+  uint32_t realMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+  TEST_ASSERT_EQUAL_STRING("+1.234s", text);
+  TEST_ASSERT_EQUAL_UINT64(simulatedStart, NativeClock::getMicros()); // nothing waited in simulated time
+  TEST_ASSERT_LESS_THAN_UINT32(CALL_MAX_REAL_MICROS, realMicros);
+}
+
+void test_sync_is_detected_on_the_next_call() {
+  TimeService service;
+  service.begin();
+  TEST_ASSERT_EQUAL_UINT32(0, service.now());
+
+  NativeClock::advanceMillis(5000);
+  NativeClock::setWallClock(SYNC_TIME);
+  TEST_ASSERT_TRUE(service.isSynced());
+  TEST_ASSERT_EQUAL_UINT32(SYNC_TIME, service.now());
+  NativeClock::advanceMillis(90500);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_TIME + 90, service.now());
+}
+
+void test_clock_corrections_never_go_backwards() {
+  TimeService service;
+  NativeClock::setWallClock(SYNC_TIME);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_TIME, service.now());
+
+  // SNTP sets the clock 30 s back, the next resync keeps the offset
+  NativeClock::setWallClock(SYNC_TIME - 30);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_TIME, service.now()); // no resync before the interval
+  NativeClock::advanceMicros(TIME_RESYNC_INTERVAL_US + 1000000);
+  uint32_t expected = SYNC_TIME + TIME_RESYNC_INTERVAL_US / 1000000 + 1;
+  TEST_ASSERT_EQUAL_UINT32(expected, service.now());
+
+  // forward corrections are taken at the next resync
+  NativeClock::setWallClock(expected + 30);
+  NativeClock::advanceMicros(TIME_RESYNC_INTERVAL_US + 1000000);
+  TEST_ASSERT_EQUAL_UINT32(expected + 30 + TIME_RESYNC_INTERVAL_US / 1000000 + 1, service.now());
+}
+
+void test_format_writes_into_the_buffer() {
+  TimeService service;
+  char text[TIME_TIMESTAMP_LENGTH];
+
+  TEST_ASSERT_EQUAL_UINT32(TIME_TIMESTAMP_LENGTH - 1, service.format(SYNC_TIME, text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING("2023-11-14 22:13:20", text);
+  service.format(SYNC_TIME + 39, text, sizeof(text)); // cached minute
+  TEST_ASSERT_EQUAL_STRING("2023-11-14 22:13:59", text);
+  service.format(SYNC_TIME + 40, text, sizeof(text)); // next minute
+  TEST_ASSERT_EQUAL_STRING("2023-11-14 22:14:00", text);
+  service.format(SYNC_TIME - 21, text, sizeof(text)); // back to an older minute
+  TEST_ASSERT_EQUAL_STRING("2023-11-14 22:12:59", text);
+  service.format(SYNC_TIME + 86400 * 48, text, sizeof(text)); // into the next year
+  TEST_ASSERT_EQUAL_STRING("2024-01-01 22:13:20", text);
+
+  TEST_ASSERT_EQUAL_UINT32(0, service.format(SYNC_TIME, text, TIME_TIMESTAMP_LENGTH - 1));
+  TEST_ASSERT_EQUAL_STRING("", text);
+}
+
+void test_format_now_after_the_sync() {
+  TimeService service;
+  NativeClock::setWallClock(SYNC_TIME);
+  NativeClock::advanceMillis(2999);
+  char text[TIME_TIMESTAMP_LENGTH];
+  TEST_ASSERT_EQUAL_UINT32(TIME_TIMESTAMP_LENGTH - 1, service.formatNow(text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING("2023-11-14 22:13:22", text);
+}
+
+void test_unsynced_time_never_delays_the_scan() {
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  sensor.storeTemplate(7, 42);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  uint32_t head = eventLog.getHead();
+
+  uint32_t unsyncedMicros = scanMicros(fingerManager, sensor);
+  TEST_ASSERT_FALSE(timeService.isSynced());
+  eventStream.publish(StreamEventType::match, 7, 90, "Alice");
+
+  LogRecord record;
+  TEST_ASSERT_TRUE(eventLog.read(head, record)); // logged with the uptime only
+  TEST_ASSERT_EQUAL_UINT32(0, record.timestamp);
+  StreamEvent event;
+  TEST_ASSERT_TRUE(eventStream.read(eventStream.getHead() - 1, event) == StreamRead::ok);
+  TEST_ASSERT_EQUAL_UINT32(0, event.timestamp);
+
+  NativeClock::advanceMillis(1000);
+  NativeClock::setWallClock(SYNC_TIME);
+  uint32_t syncedMicros = scanMicros(fingerManager, sensor);
+  TEST_ASSERT_TRUE(timeService.isSynced());
+  TEST_ASSERT_UINT32_WITHIN(SCAN_JITTER_MICROS, syncedMicros, unsyncedMicros);
+  TEST_ASSERT_FALSE(Simulation::wasNotified("Failed to obtain time"));
+
+  char message[64];
+  snprintf(message, sizeof(message), "match: %u us unsynced, %u us synced", unsyncedMicros, syncedMicros);
+  TEST_MESSAGE(message);
+}
+
+void test_benchmark_timestamp_per_event() {
+  TimeService service;
+  NativeClock::setWallClock(SYNC_TIME);
+  char text[TIME_TIMESTAMP_LENGTH];
+  size_t length = 0;
+
+  allocations = 0;
+  countAllocations = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_TIMESTAMPS; i++) {
+    NativeClock::advanceMicros(10000); // an event every 10 ms
+    length += legacyTimestamp().length();
+  }
+  uint64_t legacyNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t legacyAllocations = allocations;
+
+  allocations = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_TIMESTAMPS; i++) {
+    NativeClock::advanceMicros(10000);
+    length += service.formatNow(text, sizeof(text));
+  }
+  uint64_t formatNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t formatAllocations = allocations;
+
+  allocations = 0;
+  start = std::chrono::steady_clock::now();
+  uint32_t sum = 0;
+  for (int i = 0; i < BENCHMARK_TIMESTAMPS; i++) {
+    NativeClock::advanceMicros(10000);
+    sum += service.now();
+  }
+  uint64_t nowNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  countAllocations = false;
+
+  char message[160];
+  snprintf(message, sizeof(message), "per event: strftime String %u ns, %.1f allocations; formatNow() %u ns, %u allocations; now() %u ns (host time)",
+           (uint32_t)(legacyNanos / BENCHMARK_TIMESTAMPS), (double)legacyAllocations / BENCHMARK_TIMESTAMPS,
+           (uint32_t)(formatNanos / BENCHMARK_TIMESTAMPS), formatAllocations, (uint32_t)(nowNanos / BENCHMARK_TIMESTAMPS));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(0, formatAllocations);
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+  TEST_ASSERT_LESS_THAN_UINT64(legacyNanos, formatNanos);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, length + sum);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unsynced_time_is_zero_without_waiting);
+  RUN_TEST(test_sync_is_detected_on_the_next_call);
+  RUN_TEST(test_clock_corrections_never_go_backwards);
+  RUN_TEST(test_format_writes_into_the_buffer);
+  RUN_TEST(test_format_now_after_the_sync);
+  RUN_TEST(test_unsynced_time_never_delays_the_scan);
+  RUN_TEST(test_benchmark_timestamp_per_event);
+  return UNITY_END();
+}
@@ -0,0 +1,253 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "SensorTask.h"
+#include "TouchRing.h"
+#include "Simulation.h"
+
+/*
+  Synthetic edge traces on the touch ring pin: finger taps with contact bounce and rain bursts. The edges are raised as
+  interrupts at their simulated time, the consumer polls like the idle sensor task does.
+*/
+
+#define RING_PIN 21
+#define POLL_MICROS (SENSOR_IDLE_POLL_MS * 1000ull)
+#define SECOND 1000000ull
+
+static TouchRing *ring = nullptr;
+
+void setUp() {
+  Simulation::reset();
+  delete ring;
+  ring = new TouchRing();
+  ring->begin(RING_PIN);
+}
+
+void tearDown() {
+}
+
+struct Detection {
+  uint64_t polledMicros; // relative to the start of the trace
+  uint64_t edgeMicros;
+};
+
+static void advanceTo(uint64_t micros) {
+  if (micros > NativeClock::getMicros())
+    NativeClock::advanceMicros(micros - NativeClock::getMicros());
+}
+
+// raises the edges (relative times, sorted) and polls the ring every SENSOR_IDLE_POLL_MS until endMicros
+static std::vector<Detection> replay(const std::vector<uint64_t> &edges, uint64_t endMicros) {
+  std::vector<Detection> detections;
+  uint64_t base = NativeClock::getMicros();
+  size_t next = 0;
+  for (uint64_t poll = POLL_MICROS; poll <= endMicros; poll += POLL_MICROS) {
+    for (; next < edges.size() && edges[next] <= poll; next++) {
+      advanceTo(base + edges[next]);
+      NativeGpio::setLevel(RING_PIN, LOW);
+      TEST_ASSERT_TRUE(NativeGpio::raiseInterrupt(RING_PIN));
+      NativeGpio::setLevel(RING_PIN, HIGH);
+    }
+    advanceTo(base + poll);
+    uint32_t edge;
+    if (ring->consumeTouch(&edge))
+      detections.push_back({ poll, (uint32_t)(edge - (uint32_t)base) });
+  }
+  return detections;
+}
+
+// a finger tap: the first contact and a few bounces within 15 ms
+static void addTap(std::vector<uint64_t> &edges, uint64_t micros) {
+  edges.push_back(micros);
+  for (int i = 0, bounces = rand() % 4; i < bounces; i++)
+    edges.push_back(micros + 1000 + rand() % 14000);
+}
+
+// drops hitting the ring: random edges 50..600 ms apart
+static void addRain(std::vector<uint64_t> &edges, uint64_t fromMicros, uint64_t toMicros) {
+  for (uint64_t micros = fromMicros; micros < toMicros; micros += 50000 + rand() % 550000)
+    edges.push_back(micros);
+}
+
+static std::vector<uint64_t> sorted(std::vector<uint64_t> edges) {
+  std::sort(edges.begin(), edges.end());
+  return edges;
+}
+
+void test_each_tap_is_detected_once_within_a_poll() {
+  srand(11);
+  std::vector<uint64_t> taps, edges;
+  for (int i = 0; i < 50; i++) {
+    taps.push_back((5 + i * 13) * SECOND + rand() % SECOND);
+    addTap(edges, taps.back());
+  }
+
+  std::vector<Detection> detections = replay(sorted(edges), taps.back() + 5 * SECOND);
+
+  TEST_ASSERT_EQUAL_UINT32(taps.size(), detections.size());
+  uint64_t maxLatency = 0;
+  for (size_t i = 0; i < taps.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)taps[i], (uint32_t)detections[i].edgeMicros); // the first edge, not a bounce
+    maxLatency = max(maxLatency, detections[i].polledMicros - taps[i]);
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "tap detection latency: max %u us", (uint32_t)maxLatency);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(POLL_MICROS, maxLatency);
+  TEST_ASSERT_EQUAL_UINT32(0, ring->getStats().rainRejected);
+  TEST_ASSERT_EQUAL_UINT32(edges.size() - taps.size(), ring->getStats().bounces);
+}
+
+void test_rain_causes_at_most_two_false_touches_per_shower() {
+  srand(12);
+  std::vector<uint64_t> edges;
+  // three showers of two minutes each, 30 s of dry weather between them
+  for (int shower = 0; shower < 3; shower++)
+    addRain(edges, (1 + shower * 150) * SECOND, (121 + shower * 150) * SECOND);
+
+  std::vector<Detection> detections = replay(sorted(edges), 460 * SECOND);
+
+  TouchRingStats stats = ring->getStats();
+  char message[100];
+  snprintf(message, sizeof(message), "rain: %u edges, %u false touches (%.2f %%)", (uint32_t)edges.size(),
+           (uint32_t)detections.size(), 100.0 * detections.size() / edges.size());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * (TouchFilterConfig().burstThreshold - 1), detections.size()); // the first drops of a shower look like a tap
+  TEST_ASSERT_GREATER_THAN_UINT32(edges.size() * 95 / 100, stats.rainRejected + stats.bounces);
+}
+
+void test_tap_is_detected_after_the_rain_stopped() {
+  srand(13);
+  std::vector<uint64_t> edges;
+  addRain(edges, 0, 30 * SECOND);
+  uint64_t lastDrop = edges.back();
+  uint64_t tap = lastDrop + 10500000; // after the holdoff
+  addTap(edges, tap);
+
+  std::vector<Detection> detections = replay(sorted(edges), tap + SECOND);
+
+  TEST_ASSERT_FALSE(ring->isRaining());
+  TEST_ASSERT_TRUE(detections.size() >= 1);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)tap, (uint32_t)detections.back().edgeMicros);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(POLL_MICROS, detections.back().polledMicros - tap);
+}
+
+void test_tap_during_rain_is_rejected() {
+  std::vector<uint64_t> edges;
+  addRain(edges, 0, 20 * SECOND);
+  replay(sorted(edges), 20 * SECOND);
+
+  std::vector<uint64_t> tap;
+  addTap(tap, 2 * SECOND);
+  std::vector<Detection> detections = replay(sorted(tap), 3 * SECOND);
+
+  TEST_ASSERT_TRUE(ring->isRaining());
+  TEST_ASSERT_EQUAL_UINT32(0, detections.size());
+}
+
+void test_edges_before_the_burst_threshold_are_accepted() {
+  // drops 300 ms apart, all within one burst window
+  std::vector<uint64_t> edges = { 100000, 400000, 700000, 1000000 };
+
+  std::vector<Detection> detections = replay(edges, 2 * SECOND);
+
+  TEST_ASSERT_EQUAL_UINT32(TouchFilterConfig().burstThreshold - 1, detections.size());
+  TEST_ASSERT_EQUAL_UINT32(400000, (uint32_t)detections.back().edgeMicros);
+  TEST_ASSERT_EQUAL_UINT32(2, ring->getStats().rainRejected);
+  TEST_ASSERT_TRUE(ring->isRaining());
+}
+
+void test_filter_config_is_applied() {
+  TouchFilterConfig config;
+  config.debounceMs = 0;
+  config.burstThreshold = 255;
+  ring->setFilterConfig(config);
+  std::vector<uint64_t> edges = { 1000, 1500, 2000, 300000, 300100 };
+
+  replay(edges, SECOND);
+
+  TEST_ASSERT_EQUAL_UINT32(5, ring->getStats().accepted);
+}
+
+void test_edges_are_kept_while_the_consumer_is_busy() {
+  // the sensor task is busy with a 2 s command while the finger taps twice
+  std::vector<uint64_t> edges = { 100000, 1500000 };
+  for (uint64_t edge : edges) {
+    advanceTo(edge);
+    NativeGpio::raiseInterrupt(RING_PIN);
+  }
+  advanceTo(2 * SECOND);
+
+  uint32_t edge;
+  TEST_ASSERT_TRUE(ring->consumeTouch(&edge));
+  TEST_ASSERT_EQUAL_UINT32(1500000, edge); // the newest touch
+  TEST_ASSERT_FALSE(ring->consumeTouch(&edge));
+  TEST_ASSERT_EQUAL_UINT32(2, ring->getStats().accepted);
+}
+
+void test_overflow_is_counted() {
+  for (int i = 0; i < TOUCH_EDGE_BUFFER_SIZE + 8; i++) {
+    NativeClock::advanceMillis(100);
+    NativeGpio::raiseInterrupt(RING_PIN);
+  }
+
+  ring->consumeTouch();
+
+  TouchRingStats stats = ring->getStats();
+  TEST_ASSERT_EQUAL_UINT32(8, stats.overflows);
+  TEST_ASSERT_EQUAL_UINT32(TOUCH_EDGE_BUFFER_SIZE, stats.edges);
+}
+
+void test_micros_wrap_around() {
+  advanceTo(0xFFFFFFFFull - 2 * SECOND);
+  std::vector<uint64_t> edges;
+  addTap(edges, SECOND);
+  addTap(edges, 3 * SECOND); // after the wrap of micros()
+
+  std::vector<Detection> detections = replay(sorted(edges), 4 * SECOND);
+
+  TEST_ASSERT_EQUAL_UINT32(2, detections.size());
+  TEST_ASSERT_EQUAL_UINT32(0, ring->getStats().rainRejected);
+}
+
+void test_interrupts_from_another_core_are_not_lost() {
+  TouchFilterConfig config;
+  config.debounceMs = 0;
+  config.burstThreshold = 255;
+  ring->setFilterConfig(config);
+  const uint32_t produced = 200000;
+
+  std::atomic<bool> done{false};
+  std::thread producer([&done, produced]() {
+    for (uint32_t i = 0; i < produced; i++)
+      NativeGpio::raiseInterrupt(RING_PIN);
+    done = true;
+  });
+  while (!done)
+    ring->consumeTouch();
+  producer.join();
+  ring->consumeTouch();
+
+  TouchRingStats stats = ring->getStats();
+  TEST_ASSERT_EQUAL_UINT32(produced, stats.edges + stats.overflows);
+  TEST_ASSERT_EQUAL_UINT32(stats.edges, stats.accepted);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_each_tap_is_detected_once_within_a_poll);
+  RUN_TEST(test_rain_causes_at_most_two_false_touches_per_shower);
+  RUN_TEST(test_tap_is_detected_after_the_rain_stopped);
+  RUN_TEST(test_tap_during_rain_is_rejected);
+  RUN_TEST(test_edges_before_the_burst_threshold_are_accepted);
+  RUN_TEST(test_filter_config_is_applied);
+  RUN_TEST(test_edges_are_kept_while_the_consumer_is_busy);
+  RUN_TEST(test_overflow_is_counted);
+  RUN_TEST(test_micros_wrap_around);
+  RUN_TEST(test_interrupts_from_another_core_are_not_lost);
+  return UNITY_END();
+}
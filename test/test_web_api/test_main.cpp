@@ -0,0 +1,464 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include <SPIFFS.h>
+#include "FingerprintManager.h"
+#include "R503Simulator.h"
+#include "SensorTask.h"
+#include "SettingsManager.h"
+#include "TemplateArchive.h"
+#include "WebApi.h"
+#include "Simulation.h"
+
+/*
+  REST API on the native web server, the browser side sends the requests from the test thread like async_tcp would
+  handle them. The sensor task runs in its own thread and can't be stopped, so the tests after the ones without sensor
+  build on each other. The test thread waits in real time.
+*/
+
+#define TEST_FINGER 42
+#define TEST_FINGER_ID 7
+#define ENROLL_ID 30
+#define BENCHMARK_SCANS 10
+#define REQUEST_GAP_REAL_MICROS 100 // between the requests of the benchmark, the sensor task needs a core too
+#define HANDLER_MAX_REAL_MICROS 20000 // a handler never waits for the sensor, only for the queue lock
+#define WAIT_REAL_MS 30000
+
+typedef std::vector<std::pair<String, String>> Params;
+
+static R503Simulator sensor;
+static FingerprintManager fingerManager;
+static SensorTask sensorTask;
+static SettingsManager settingsManager;
+static WebApi webApi;
+static String password;
+static std::vector<SensorEvent> events;
+
+// the serial console, the sensor task logs to it from its own thread
+class Console : public SerialDevice {
+  private:
+    std::mutex mutex;
+    std::string output;
+
+  public:
+    void onReceive(HardwareSerial &serial, uint8_t value, uint32_t baudRate, uint64_t micros) override {
+      std::lock_guard<std::mutex> lock(mutex);
+      output += (char)value;
+    }
+    bool contains(const String &text) {
+      std::lock_guard<std::mutex> lock(mutex);
+      return output.find(text.c_str()) != std::string::npos;
+    }
+    void clear() {
+      std::lock_guard<std::mutex> lock(mutex);
+      output.clear();
+    }
+};
+static Console console;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static NativeWebResponse get(const char *url) {
+  return webApi.getServer().request(HTTP_GET, url, {}, WEB_API_USER, password.c_str());
+}
+
+static NativeWebResponse post(const char *url, const Params &params = {}) {
+  return webApi.getServer().request(HTTP_POST, url, params, WEB_API_USER, password.c_str());
+}
+
+static bool contains(const NativeWebResponse &response, const char *text) {
+  return response.body.find(text) != std::string::npos;
+}
+
+static void drainEvents() {
+  SensorEvent event;
+  while (sensorTask.pollEvent(event))
+    events.push_back(event);
+}
+
+static int countEvents(SensorEventType type) {
+  return std::count_if(events.begin(), events.end(), [type](const SensorEvent &event) { return event.type == type; });
+}
+
+template<typename Condition>
+static bool waitFor(Condition condition) {
+  for (int i = 0; i < WAIT_REAL_MS * 10; i++) {
+    drainEvents();
+    if (condition())
+      return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+static bool waitForEvents(SensorEventType type, int count) {
+  return waitFor([type, count]() { return countEvents(type) >= count; });
+}
+
+static const SensorEvent& lastEvent(SensorEventType type) {
+  auto event = std::find_if(events.rbegin(), events.rend(), [type](const SensorEvent &candidate) { return candidate.type == type; });
+  TEST_ASSERT_TRUE(event != events.rend());
+  return *event;
+}
+
+void test_password_is_generated_on_first_boot() {
+  TEST_ASSERT_EQUAL_UINT32(16, password.length());
+  for (size_t i = 0; i < password.length(); i++)
+    TEST_ASSERT_TRUE(isxdigit(password[i]));
+  SettingsManager reloaded;
+  TEST_ASSERT_TRUE(reloaded.loadAppSettings());
+  TEST_ASSERT_EQUAL_STRING(password.c_str(), reloaded.getAppSettings().webPassword.c_str());
+}
+
+void test_password_is_printed_on_first_boot_only() {
+  TEST_ASSERT_TRUE(console.contains(password));
+
+  console.clear();
+  WebApi rebooted;
+  rebooted.begin(&sensorTask, &fingerManager, &settingsManager);
+  TEST_ASSERT_FALSE(console.contains(password));
+}
+
+void test_every_route_requires_authentication() {
+  const char *routes[] = { "/api/fingers", "/api/settings", "/api/logs", "/api/status", "/api/templates" };
+  for (const char *route : routes) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(401, webApi.getServer().request(HTTP_GET, route).code, route);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(401, webApi.getServer().request(HTTP_GET, route, {}, WEB_API_USER, "wrong").code, route);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(401, webApi.getServer().request(HTTP_GET, route, {}, "root", password.c_str()).code, route);
+  }
+  NativeWebResponse response = webApi.getServer().request(HTTP_POST, "/api/fingers/delete", { { "id", "5" } });
+  TEST_ASSERT_EQUAL_INT(401, response.code);
+  TEST_ASSERT_EQUAL_INT(401, webApi.getServer().request(HTTP_POST, "/api/reboot").code);
+  TEST_ASSERT_EQUAL_UINT8(0, webApi.takeRequests());
+}
+
+void test_unauthenticated_upload_is_not_stored() {
+  std::string archive(5000, 'x');
+
+  NativeWebResponse response = webApi.getServer().request(HTTP_POST, "/api/templates/import", {}, nullptr, nullptr, &archive);
+
+  TEST_ASSERT_EQUAL_INT(401, response.code);
+  TEST_ASSERT_FALSE(SPIFFS.exists(WEB_API_TEMPLATE_UPLOAD_PATH));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TEMPLATE_ARCHIVE_PATH));
+}
+
+void test_unknown_routes_and_methods_are_not_found() {
+  TEST_ASSERT_EQUAL_INT(404, get("/api/unknown").code);
+  TEST_ASSERT_EQUAL_INT(404, get("/index.html").code);
+  TEST_ASSERT_EQUAL_INT(404, get("/api/reboot").code); // POST only
+  NativeWebResponse response = post("/api/status");
+  TEST_ASSERT_EQUAL_INT(404, response.code);
+  TEST_ASSERT_TRUE(contains(response, "\"ok\":false"));
+}
+
+void test_invalid_parameters_are_rejected() {
+  const Params invalid[] = {
+    {}, { { "id", "0" } }, { { "id", "200" } }, { { "id", "abc" } }, { { "id", "5" } }, { { "id", "5" }, { "name", "   " } },
+    { { "id", "5" }, { "name", String(std::string(FINGER_NAME_MAX_LENGTH + 1, 'n').c_str()) } },
+  };
+  for (const Params &params : invalid) {
+    TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/enroll", params).code);
+    TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/rename", params).code);
+  }
+  TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/delete").code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/delete", { { "id", "-3" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/deleteBatch", { { "ids", "3,x" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/deleteBatch", { { "ids", "25-10" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/fingers/renameBatch", { { "names", "3,Bob\n7" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/settings", { { "apiUrl", "ftp://door" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/settings", { { "webPassword", "short" } }).code);
+  TEST_ASSERT_EQUAL_INT(400, post("/api/settings", { { "mqttRootTopic", "door/#" } }).code);
+  // a rejected batch is given back
+  TEST_ASSERT_NOT_NULL(sensorTask.acquireBatch());
+  sensorTask.releaseBatch();
+  TEST_ASSERT_EQUAL_UINT8(0, webApi.takeRequests());
+}
+
+void test_settings_round_trip() {
+  NativeWebResponse response = post("/api/settings", { { "apiUrl", "https://door.example" }, { "idleSleep", "true" },
+    { "mqttServer", "broker" }, { "mqttPassword", "secret" }, { "webPassword", "changedpassword" } });
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_EQUAL_UINT8(WEB_API_REQUEST_SETTINGS_CHANGED, webApi.takeRequests());
+  TEST_ASSERT_EQUAL_UINT8(0, webApi.takeRequests());
+
+  response = get("/api/settings");
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_EQUAL_STRING("application/json", response.contentType.c_str());
+  TEST_ASSERT_TRUE(contains(response, "\"apiUrl\":\"https://door.example\""));
+  TEST_ASSERT_TRUE(contains(response, "\"idleSleep\":true"));
+  TEST_ASSERT_TRUE(contains(response, "\"mqttServer\":\"broker\""));
+  TEST_ASSERT_FALSE(contains(response, "secret"));
+  TEST_ASSERT_FALSE(contains(response, "changedpassword"));
+  // the new password is stored but used after the next reboot
+  TEST_ASSERT_EQUAL_STRING("changedpassword", settingsManager.getAppSettings().webPassword.c_str());
+  TEST_ASSERT_EQUAL_INT(401, webApi.getServer().request(HTTP_GET, "/api/settings", {}, WEB_API_USER, "changedpassword").code);
+}
+
+void test_loop_requests_are_collected_once() {
+  TEST_ASSERT_EQUAL_INT(202, post("/api/pairing").code);
+  TEST_ASSERT_EQUAL_INT(202, post("/api/reboot").code);
+  TEST_ASSERT_EQUAL_INT(202, post("/api/pairing").code);
+
+  TEST_ASSERT_EQUAL_UINT8(WEB_API_REQUEST_PAIRING | WEB_API_REQUEST_REBOOT, webApi.takeRequests());
+  TEST_ASSERT_EQUAL_UINT8(0, webApi.takeRequests());
+}
+
+void test_logs_status_and_missing_archive() {
+  NativeWebResponse response = get("/api/logs");
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_EQUAL_STRING("{\"logs\":[", response.body.substr(0, 9).c_str());
+
+  response = get("/api/status");
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_TRUE(contains(response, "\"uptime\":"));
+  TEST_ASSERT_TRUE(contains(response, "\"freeHeap\":"));
+  TEST_ASSERT_TRUE(contains(response, "\"latency\":{"));
+  TEST_ASSERT_EQUAL_INT('}', response.body.back());
+
+  TEST_ASSERT_EQUAL_INT(404, get("/api/templates").code);
+}
+
+void test_sensor_becomes_ready() {
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::ready, 1));
+  TEST_ASSERT_TRUE(lastEvent(SensorEventType::ready).ok);
+}
+
+void test_rename_is_queued_and_listed() {
+  events.clear();
+
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/rename", { { "id", String(TEST_FINGER_ID) }, { "name", " Alice " } }).code);
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/renameBatch", { { "names", "20,Bob\n\n21,Carol\n" } }).code);
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameDone, 1));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameBatchDone, 1));
+
+  NativeWebResponse response = get("/api/fingers");
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_EQUAL_STRING("{\"fingers\":[{\"id\":7,\"name\":\"Alice\"},{\"id\":20,\"name\":\"Bob\"},{\"id\":21,\"name\":\"Carol\"}],\"count\":3}",
+    response.body.c_str());
+}
+
+void test_enroll_is_answered_right_away_and_reported_by_event() {
+  events.clear();
+  Simulation::clearNotifications();
+  // five takes, the finger is placed for a second every two seconds
+  uint64_t start = NativeClock::getMicros() + 1000000ull;
+  for (int take = 0; take < 5; take++)
+    sensor.placeFinger(TEST_FINGER + 1, start + take * 2000000ull, start + take * 2000000ull + 1000000ull);
+
+  auto requestStart = std::chrono::steady_clock::now();
+  NativeWebResponse response = post("/api/fingers/enroll", { { "id", String(ENROLL_ID) }, { "name", "Dave" } });
+  uint32_t requestMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - requestStart).count();
+
+  TEST_ASSERT_EQUAL_INT(202, response.code);
+  TEST_ASSERT_LESS_THAN_UINT32(HANDLER_MAX_REAL_MICROS, requestMicros);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Enrollment of finger #30 started"));
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::enrollDone, 1));
+  TEST_ASSERT_TRUE(lastEvent(SensorEventType::enrollDone).ok);
+  TEST_ASSERT_EQUAL_INT(TEST_FINGER + 1, sensor.getTemplateFinger(ENROLL_ID));
+  TEST_ASSERT_TRUE(contains(get("/api/fingers"), "{\"id\":30,\"name\":\"Dave\"}"));
+}
+
+void test_enroll_times_out_without_finger() {
+  events.clear();
+  Simulation::clearNotifications();
+  sensor.clearTouches();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/enroll", { { "id", "31" }, { "name", "Eve" } }).code);
+
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::enrollDone, 1));
+  TEST_ASSERT_FALSE(lastEvent(SensorEventType::enrollDone).ok);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Enrollment timed out"));
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(ENROLL_TAKE_TIMEOUT_MS * 1000ull, NativeClock::getMicros() - start);
+  TEST_ASSERT_FALSE(sensor.hasTemplate(31));
+}
+
+void test_enroll_is_cancelled() {
+  events.clear();
+  Simulation::clearNotifications();
+  uint64_t start = NativeClock::getMicros();
+
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/enroll", { { "id", "31" }, { "name", "Eve" } }).code);
+  TEST_ASSERT_TRUE(waitFor([]() { return Simulation::wasNotified("Take #1"); }));
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/enroll/cancel").code);
+
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::enrollDone, 1));
+  TEST_ASSERT_FALSE(lastEvent(SensorEventType::enrollDone).ok);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("Enrollment cancelled."));
+  TEST_ASSERT_LESS_THAN_UINT64(ENROLL_TAKE_TIMEOUT_MS * 1000ull, NativeClock::getMicros() - start);
+}
+
+void test_busy_sensor_is_answered_with_503() {
+  events.clear();
+  Simulation::clearNotifications();
+
+  // the enrollment keeps the task away from the queue
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/enroll", { { "id", "31" }, { "name", "Eve" } }).code);
+  TEST_ASSERT_TRUE(waitFor([]() { return Simulation::wasNotified("Take #1"); }));
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/deleteBatch", { { "ids", "100-120" } }).code);
+  TEST_ASSERT_EQUAL_INT(503, post("/api/fingers/renameBatch", { { "names", "22,Frank" } }).code); // batch still pending
+  for (int i = 1; i < SENSOR_COMMAND_QUEUE_LENGTH; i++)
+    TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/rename", { { "id", String(40 + i) }, { "name", "Grace" } }).code);
+  NativeWebResponse response = post("/api/fingers/delete", { { "id", String(TEST_FINGER_ID) } });
+  TEST_ASSERT_EQUAL_INT(503, response.code);
+  TEST_ASSERT_TRUE(contains(response, "Sensor is busy"));
+  TEST_ASSERT_EQUAL_INT(503, post("/api/templates/export").code);
+  TEST_ASSERT_EQUAL_INT(503, post("/api/fingers/deleteAll").code);
+
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/enroll/cancel").code);
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameDone, SENSOR_COMMAND_QUEUE_LENGTH - 1));
+  TEST_ASSERT_EQUAL_INT(1, countEvents(SensorEventType::deleteBatchDone));
+  TEST_ASSERT_TRUE(sensor.hasTemplate(TEST_FINGER_ID));
+  TEST_ASSERT_EQUAL_INT(202, post("/api/fingers/renameBatch", { { "names", "22,Frank" } }).code);
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameBatchDone, 1));
+}
+
+// a steady stream of commands, the touch is scanned while the queue never runs empty
+void test_commands_do_not_keep_a_touch_from_being_scanned() {
+  events.clear();
+  std::atomic<bool> running{true};
+  std::atomic<uint32_t> accepted{0};
+  std::thread browser([&]() {
+    for (uint32_t i = 0; running; i++) {
+      if (post("/api/fingers/delete", { { "id", String(100 + i % 100) } }).code == 202)
+        accepted++;
+    }
+  });
+  TEST_ASSERT_TRUE(waitFor([&]() { return accepted >= SENSOR_COMMAND_QUEUE_LENGTH; }));
+
+  sensor.placeFingerNow(TEST_FINGER, 5000); // outlasts the feedback hold of the previous match
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  bool scanned = waitForEvents(SensorEventType::scan, 1);
+  running = false;
+  browser.join();
+  NativeGpio::setLevel(touchRingPin, HIGH);
+
+  TEST_ASSERT_TRUE(scanned);
+  TEST_ASSERT_TRUE(lastEvent(SensorEventType::scan).match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(TEST_FINGER_ID, lastEvent(SensorEventType::scan).match.matchId);
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::deleteDone, accepted));
+}
+
+void test_request_throughput_while_scans_run() {
+  events.clear();
+  std::atomic<bool> running{true};
+  std::atomic<uint32_t> requests{0};
+  std::atomic<uint32_t> renamesAccepted{0};
+  std::atomic<uint32_t> busy{0};
+  std::atomic<uint32_t> failed{0};
+  std::atomic<uint32_t> maxMicros{0};
+
+  std::thread browser([&]() {
+    const char *lists[] = { "/api/fingers", "/api/status", "/api/settings" };
+    for (uint32_t i = 0; running; i++) {
+      auto start = std::chrono::steady_clock::now();
+      NativeWebResponse response = (i % 10 == 9) ? post("/api/fingers/rename", { { "id", String(50 + i % 100) }, { "name", "Henry" } })
+                                                 : get(lists[i % 3]);
+      uint32_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+      maxMicros = std::max(maxMicros.load(), micros);
+      requests++;
+      if (response.code == 202)
+        renamesAccepted++;
+      else if (response.code == 503)
+        busy++;
+      else if (response.code != 200)
+        failed++;
+      std::this_thread::sleep_for(std::chrono::microseconds(REQUEST_GAP_REAL_MICROS));
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  for (int scan = 1; scan <= BENCHMARK_SCANS; scan++) {
+    sensor.placeFingerNow(TEST_FINGER, 5000); // outlasts the feedback hold of the previous match
+    NativeGpio::setLevel(touchRingPin, LOW);
+    NativeGpio::raiseInterrupt(touchRingPin);
+    TEST_ASSERT_TRUE(waitForEvents(SensorEventType::scan, scan));
+    NativeGpio::setLevel(touchRingPin, HIGH);
+  }
+  running = false;
+  browser.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (const SensorEvent &event : events) {
+    if (event.type == SensorEventType::scan) {
+      TEST_ASSERT_TRUE(event.match.scanResult == ScanResult::matchFound);
+      TEST_ASSERT_EQUAL_UINT16(TEST_FINGER_ID, event.match.matchId);
+    }
+  }
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::renameDone, renamesAccepted));
+  char message[140];
+  snprintf(message, sizeof(message), "%u requests in %.2f s (%.0f/s) during %d scans, max %u us per request, %u renames queued, %u refused",
+           requests.load(), seconds, requests / seconds, BENCHMARK_SCANS, maxMicros.load(), renamesAccepted.load(), busy.load());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(0, failed.load());
+  TEST_ASSERT_GREATER_THAN_UINT32(BENCHMARK_SCANS, requests.load());
+  TEST_ASSERT_GREATER_THAN_UINT32(0, renamesAccepted.load());
+  TEST_ASSERT_LESS_THAN_UINT32(HANDLER_MAX_REAL_MICROS, maxMicros.load());
+}
+
+void test_uploaded_archive_is_stored_and_imported() {
+  events.clear();
+  std::string archive;
+  for (int i = 0; i < 4000; i++)
+    archive += (char)(i * 7);
+
+  NativeWebResponse response = webApi.getServer().request(HTTP_POST, "/api/templates/import", {}, WEB_API_USER, password.c_str(), &archive);
+
+  TEST_ASSERT_EQUAL_INT(202, response.code);
+  TEST_ASSERT_TRUE(NativeFs::readFile(TEMPLATE_ARCHIVE_PATH) == archive);
+  TEST_ASSERT_FALSE(SPIFFS.exists(WEB_API_TEMPLATE_UPLOAD_PATH));
+  response = get("/api/templates");
+  TEST_ASSERT_EQUAL_INT(200, response.code);
+  TEST_ASSERT_TRUE(response.download);
+  TEST_ASSERT_TRUE(response.body == archive);
+  TEST_ASSERT_TRUE(waitForEvents(SensorEventType::importDone, 1));
+  TEST_ASSERT_FALSE(lastEvent(SensorEventType::importDone).ok); // not an archive
+}
+
+int main(int argc, char **argv) {
+  Simulation::reset();
+  sensor.attach(Serial2);
+  sensor.storeTemplate(TEST_FINGER_ID, TEST_FINGER);
+  Serial.attach(&console);
+  settingsManager.loadAppSettings();
+  webApi.begin(&sensorTask, &fingerManager, &settingsManager);
+  password = settingsManager.getAppSettings().webPassword;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_password_is_generated_on_first_boot);
+  RUN_TEST(test_password_is_printed_on_first_boot_only);
+  RUN_TEST(test_every_route_requires_authentication);
+  RUN_TEST(test_unauthenticated_upload_is_not_stored);
+  RUN_TEST(test_unknown_routes_and_methods_are_not_found);
+  RUN_TEST(test_invalid_parameters_are_rejected);
+  RUN_TEST(test_settings_round_trip);
+  RUN_TEST(test_loop_requests_are_collected_once);
+  RUN_TEST(test_logs_status_and_missing_archive);
+  sensorTask.begin(&fingerManager);
+  RUN_TEST(test_sensor_becomes_ready);
+  RUN_TEST(test_rename_is_queued_and_listed);
+  RUN_TEST(test_enroll_is_answered_right_away_and_reported_by_event);
+  RUN_TEST(test_enroll_times_out_without_finger);
+  RUN_TEST(test_enroll_is_cancelled);
+  RUN_TEST(test_busy_sensor_is_answered_with_503);
+  RUN_TEST(test_commands_do_not_keep_a_touch_from_being_scanned);
+  RUN_TEST(test_request_throughput_while_scans_run);
+  RUN_TEST(test_uploaded_archive_is_stored_and_imported);
+  int failures = UNITY_END();
+  fflush(stdout);
+  _Exit(failures); // the sensor task never returns
+}
@@ -0,0 +1,310 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <Preferences.h>
+#include <WiFi.h>
+#include "FingerprintManager.h"
+#include "LatencyMetrics.h"
+#include "R503Simulator.h"
+#include "SettingsManager.h"
+#include "WifiManager.h"
+#include "Simulation.h"
+
+/*
+  WifiManager against the scripted access point of the WiFi shim (scan 2200 ms, association 150 ms, DHCP 800 ms, lease
+  of a day). The test thread is loop(): it calls process() every LOOP_STEP_MS of simulated time. A new WifiManager on
+  the same NVS is a reboot, the wall clock decides whether the stored lease is still valid after it.
+*/
+
+#define LOOP_STEP_MS 10
+#define SYNC_TIME 1700000000ul
+#define CONNECT_MS 3150       // scan + association + DHCP of NativeAccessPoint
+#define FAST_CONNECT_MS 150   // association only
+#define FAST_DHCP_CONNECT_MS 950
+#define BACKOFF_ATTEMPTS 11   // 1, 2, 4 ... 256 s and then the cap of 300 s
+#define SCAN_BUDGET_MS 400    // finger down to match, like test_scan_latency
+#define PROCESS_MAX_REAL_MICROS 1000
+
+static SettingsManager *settingsManager = nullptr;
+static WifiManager *wifi = nullptr;
+static uint32_t maxProcessRealMicros = 0;
+
+void setUp() {
+  Simulation::reset();
+  latencyMetrics.reset();
+  delete settingsManager;
+  settingsManager = new SettingsManager();
+  WifiSettings settings;
+  settings.ssid = "door";
+  settings.password = "secret";
+  settingsManager->saveWifiSettings(settings);
+  wifi = nullptr;
+  maxProcessRealMicros = 0;
+}
+
+void tearDown() {
+  delete wifi; // a reboot, the mutex is leaked like on the device
+  wifi = nullptr;
+}
+
+// the settings come from NVS like after a reset
+static void boot() {
+  delete wifi;
+  delete settingsManager;
+  settingsManager = new SettingsManager();
+  TEST_ASSERT_TRUE(settingsManager->loadWifiSettings());
+  wifi = new WifiManager();
+  wifi->begin(settingsManager);
+}
+
+// one pass of loop(): process() must neither wait nor move the clock
+static void loopOnce() {
+  uint64_t before = NativeClock::getMicros();
+  auto start = std::chrono::steady_clock::now();
+  wifi->process();
+  uint32_t realMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  maxProcessRealMicros = max(maxProcessRealMicros, realMicros);
+  TEST_ASSERT_EQUAL_UINT64(before, NativeClock::getMicros());
+  NativeClock::advanceMillis(LOOP_STEP_MS);
+}
+
+// runs loop() until the state is reached, returns the simulated milliseconds it took
+static uint32_t runUntil(WifiState state, uint32_t maxMillis) {
+  uint64_t start = NativeClock::getMicros();
+  while (wifi->getState() != state) {
+    TEST_ASSERT_TRUE_MESSAGE(NativeClock::getMicros() - start <= maxMillis * 1000ull, "state not reached");
+    loopOnce();
+  }
+  return (uint32_t)((NativeClock::getMicros() - start) / 1000);
+}
+
+static void runFor(uint32_t millis) {
+  uint64_t end = NativeClock::getMicros() + millis * 1000ull;
+  while (NativeClock::getMicros() < end)
+    loopOnce();
+}
+
+// first boot with credentials only, connects with scan and DHCP and stores the connection
+static void connectOnce() {
+  boot();
+  runUntil(WifiState::connected, CONNECT_MS + LOOP_STEP_MS);
+}
+
+void test_first_connect_scans_and_stores_the_lease() {
+  NativeClock::setWallClock(SYNC_TIME);
+  boot();
+  TEST_ASSERT_TRUE(wifi->getState() == WifiState::connecting);
+  runUntil(WifiState::connected, CONNECT_MS + LOOP_STEP_MS);
+
+  WifiStats stats = wifi->getStats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.connects);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.fastConnects);
+  TEST_ASSERT_EQUAL_UINT32(CONNECT_MS, stats.lastConnectMs);
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getScanCount());
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getDhcpCount());
+  TEST_ASSERT_EQUAL_UINT32(1, latencyMetrics.getSummary(LatencyStage::wifiConnect).count);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("WiFi connected to door in 3150 ms, IP 192.168.1.50"));
+
+  SettingsManager reloaded;
+  reloaded.loadWifiSettings();
+  WifiSettings stored = reloaded.getWifiSettings();
+  NativeAccessPoint accessPoint;
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(accessPoint.bssid, stored.bssid, 6);
+  TEST_ASSERT_EQUAL_UINT8(accessPoint.channel, stored.channel);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)accessPoint.ip, stored.ip);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)accessPoint.gateway, stored.gateway);
+  TEST_ASSERT_EQUAL_UINT32(accessPoint.leaseSeconds, stored.leaseSeconds);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_TIME + CONNECT_MS / 1000, stored.leaseStart);
+}
+
+void test_reboot_connects_fast_with_the_cached_lease() {
+  NativeClock::setWallClock(SYNC_TIME);
+  connectOnce();
+  NativeClock::advanceMillis(3600000ul);
+  NativeNvs::resetCounters();
+
+  boot();
+  runUntil(WifiState::connected, FAST_CONNECT_MS + LOOP_STEP_MS);
+
+  TEST_ASSERT_EQUAL_UINT32(FAST_CONNECT_MS, wifi->getStats().lastConnectMs);
+  TEST_ASSERT_EQUAL_UINT32(1, wifi->getStats().fastConnects);
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getScanCount());
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getDhcpCount());
+  TEST_ASSERT_EQUAL_UINT32(0, NativeNvs::getWriteCount()); // nothing changed
+}
+
+void test_half_expired_lease_is_renewed_by_dhcp() {
+  NativeClock::setWallClock(SYNC_TIME);
+  connectOnce();
+  NativeAccessPoint accessPoint;
+  NativeClock::advanceMillis((accessPoint.leaseSeconds / 2 + 1) * 1000ull);
+
+  boot();
+  runUntil(WifiState::connected, FAST_DHCP_CONNECT_MS + LOOP_STEP_MS);
+
+  TEST_ASSERT_EQUAL_UINT32(FAST_DHCP_CONNECT_MS, wifi->getStats().lastConnectMs);
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getScanCount()); // the access point is still cached
+  TEST_ASSERT_EQUAL_UINT32(2, NativeWiFi::getDhcpCount());
+  SettingsManager reloaded;
+  reloaded.loadWifiSettings();
+  TEST_ASSERT_GREATER_THAN_UINT32(SYNC_TIME + accessPoint.leaseSeconds / 2, reloaded.getWifiSettings().leaseStart);
+}
+
+void test_unknown_lease_age_after_a_power_cycle_uses_dhcp() {
+  connectOnce(); // the clock was never set, the start of the lease is unknown
+  boot();
+  runUntil(WifiState::connected, FAST_DHCP_CONNECT_MS + LOOP_STEP_MS);
+  TEST_ASSERT_EQUAL_UINT32(2, NativeWiFi::getDhcpCount());
+}
+
+void test_cached_lease_switches_to_dhcp_at_half_time() {
+  NativeClock::setWallClock(SYNC_TIME);
+  connectOnce();
+  NativeAccessPoint accessPoint;
+  NativeClock::advanceMillis((accessPoint.leaseSeconds / 2 - 60) * 1000ull);
+  boot();
+  runUntil(WifiState::connected, FAST_CONNECT_MS + LOOP_STEP_MS);
+  TEST_ASSERT_EQUAL_UINT32(1, NativeWiFi::getDhcpCount());
+
+  runFor(61000);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("cached DHCP lease expires"));
+  runUntil(WifiState::connected, CONNECT_MS + LOOP_STEP_MS);
+  TEST_ASSERT_EQUAL_UINT32(2, NativeWiFi::getDhcpCount());
+}
+
+void test_moved_access_point_falls_back_to_a_scan() {
+  connectOnce();
+  NativeAccessPoint moved;
+  moved.channel = 11;
+  NativeWiFi::setAccessPoint(moved);
+
+  boot();
+  uint32_t millis = runUntil(WifiState::connected, WIFI_FAST_CONNECT_TIMEOUT_MS + CONNECT_MS + 2 * LOOP_STEP_MS);
+
+  TEST_ASSERT_UINT32_WITHIN(2 * LOOP_STEP_MS, WIFI_FAST_CONNECT_TIMEOUT_MS + CONNECT_MS, millis);
+  TEST_ASSERT_EQUAL_UINT32(CONNECT_MS, wifi->getStats().lastConnectMs); // the connect with scan and DHCP
+  TEST_ASSERT_EQUAL_UINT32(1, wifi->getStats().failures);
+  TEST_ASSERT_EQUAL_UINT32(0, wifi->getStats().fastConnects);
+  SettingsManager reloaded;
+  reloaded.loadWifiSettings();
+  TEST_ASSERT_EQUAL_UINT8(11, reloaded.getWifiSettings().channel);
+}
+
+void test_unreachable_access_point_backs_off_without_reboot() {
+  NativeWiFi::setInRange(false);
+  boot();
+
+  std::vector<uint64_t> attempts = { NativeClock::getMicros() };
+  uint32_t begins = NativeWiFi::getBeginCount();
+  while (attempts.size() < BACKOFF_ATTEMPTS) {
+    loopOnce();
+    if (NativeWiFi::getBeginCount() != begins) {
+      begins = NativeWiFi::getBeginCount();
+      attempts.push_back(NativeClock::getMicros());
+    }
+  }
+
+  uint32_t delay = WIFI_RETRY_MIN_MS;
+  for (int i = 1; i < BACKOFF_ATTEMPTS; i++) {
+    uint32_t interval = (uint32_t)((attempts[i] - attempts[i - 1]) / 1000);
+    TEST_ASSERT_UINT32_WITHIN(2 * LOOP_STEP_MS, WIFI_CONNECT_TIMEOUT_MS + delay, interval);
+    delay = min(delay * 2, (uint32_t)WIFI_RETRY_MAX_MS);
+  }
+  TEST_ASSERT_EQUAL_UINT32(BACKOFF_ATTEMPTS - 1, wifi->getStats().failures);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("WiFi connect failed, next try in 300 s"));
+
+  NativeWiFi::setInRange(true);
+  runUntil(WifiState::connected, WIFI_RETRY_MAX_MS + CONNECT_MS + 2 * LOOP_STEP_MS);
+}
+
+void test_lost_link_reconnects_in_the_background() {
+  connectOnce();
+  NativeWiFi::setInRange(false);
+  loopOnce();
+  TEST_ASSERT_TRUE(wifi->getState() == WifiState::connecting);
+  TEST_ASSERT_EQUAL_UINT32(1, wifi->getStats().disconnects);
+  TEST_ASSERT_TRUE(Simulation::wasNotified("WiFi connection lost"));
+
+  runFor(1000);
+  NativeWiFi::setInRange(true);
+  runUntil(WifiState::connected, FAST_CONNECT_MS + LOOP_STEP_MS);
+  TEST_ASSERT_EQUAL_UINT32(2, wifi->getStats().connects);
+  TEST_ASSERT_EQUAL_UINT32(1, wifi->getStats().fastConnects);
+}
+
+void test_suspend_and_resume() {
+  connectOnce();
+  wifi->suspend();
+  TEST_ASSERT_TRUE(wifi->getState() == WifiState::suspended);
+  TEST_ASSERT_EQUAL_INT(WIFI_OFF, WiFi.getMode());
+  runFor(1000);
+  TEST_ASSERT_TRUE(wifi->getState() == WifiState::suspended);
+
+  wifi->resume();
+  runUntil(WifiState::connected, FAST_CONNECT_MS + 2 * LOOP_STEP_MS);
+  TEST_ASSERT_EQUAL_INT(WIFI_STA, WiFi.getMode());
+}
+
+void test_scan_loop_is_never_blocked_while_offline() {
+  R503Simulator sensor;
+  sensor.attach(Serial2);
+  sensor.storeTemplate(7, 42);
+  FingerprintManager fingerManager;
+  TEST_ASSERT_TRUE(fingerManager.connect());
+  NativeWiFi::setInRange(false);
+  boot();
+  runFor(20000); // the first attempt failed, waiting for the retry
+
+  // loop() with the scan, while the WiFi manager keeps retrying
+  sensor.placeFingerNow(42, 2000);
+  NativeGpio::setLevel(touchRingPin, LOW);
+  NativeGpio::raiseInterrupt(touchRingPin);
+  uint64_t down = NativeClock::getMicros();
+  Match match;
+  do {
+    loopOnce();
+    match = fingerManager.scanFingerprint();
+  } while (match.scanResult == ScanResult::scanning && NativeClock::getMicros() - down < SCAN_BUDGET_MS * 1000ull);
+  uint32_t latencyMs = (uint32_t)((NativeClock::getMicros() - down) / 1000);
+
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, match.matchId);
+  TEST_ASSERT_LESS_THAN_UINT32(SCAN_BUDGET_MS, latencyMs);
+  TEST_ASSERT_FALSE(wifi->isConnected());
+  TEST_ASSERT_LESS_THAN_UINT32(PROCESS_MAX_REAL_MICROS, maxProcessRealMicros);
+
+  char message[80];
+  snprintf(message, sizeof(message), "match while offline: %u ms, process() max %u us host time", latencyMs, maxProcessRealMicros);
+  TEST_MESSAGE(message);
+}
+
+class TextOutput : public Print {
+  public:
+    std::string text;
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+};
+
+void test_connect_metrics_are_printed() {
+  connectOnce();
+  TextOutput out;
+  wifi->printTo(out);
+  TEST_ASSERT_EQUAL_STRING("WiFi: 1 connects (0 fast), 0 failures, 0 disconnects, last connect 3150 ms\r\n", out.text.c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_connect_scans_and_stores_the_lease);
+  RUN_TEST(test_reboot_connects_fast_with_the_cached_lease);
+  RUN_TEST(test_half_expired_lease_is_renewed_by_dhcp);
+  RUN_TEST(test_unknown_lease_age_after_a_power_cycle_uses_dhcp);
+  RUN_TEST(test_cached_lease_switches_to_dhcp_at_half_time);
+  RUN_TEST(test_moved_access_point_falls_back_to_a_scan);
+  RUN_TEST(test_unreachable_access_point_backs_off_without_reboot);
+  RUN_TEST(test_lost_link_reconnects_in_the_background);
+  RUN_TEST(test_suspend_and_resume);
+  RUN_TEST(test_scan_loop_is_never_blocked_while_offline);
+  RUN_TEST(test_connect_metrics_are_printed);
+  return UNITY_END();
+}